@@ -0,0 +1,166 @@
+#include "Calibrate.h"
+#include "Storage.h"
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// =========================================================
+// ----------------------- Calibration ---------------------
+// =========================================================
+
+
+static const size_t CALIBRATE_CHUNK = 1024 * 1024; // sequential request size
+static const size_t CALIBRATE_BLOCK = 4 * 1024;    // random request size
+static const int CALIBRATE_RANDOM_IOS = 64;        // random requests per direction
+
+
+static double getSecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+DeviceProfile measureDevice(const std::string &dir) {
+    mkdir(dir.c_str(), 0700);
+    std::string path = dir + "/calibrate.tmp";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) { throw std::runtime_error("ERROR: cannot create calibration file " + path); }
+    auto check = [&](bool okay, const char *what) {
+        if (okay) { return; }
+        close(fd);
+        std::remove(path.c_str());
+        throw std::runtime_error(std::string("ERROR: calibration ") + what + " failed in " + dir);
+    };
+
+    std::vector<char> buffer(CALIBRATE_CHUNK, 'c');
+    size_t nChunks = std::max((size_t)1, (size_t)(Config::get().CALIBRATE_SIZE / CALIBRATE_CHUNK));
+    ByteCount size = nChunks * CALIBRATE_CHUNK;
+
+    // Sequential write, synced so that the data reaches the device
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nChunks; i++) {
+        check(write(fd, buffer.data(), CALIBRATE_CHUNK) == (ssize_t)CALIBRATE_CHUNK, "write");
+    }
+    check(fsync(fd) == 0, "sync");
+    double seqWriteTime = getSecondsSince(start);
+    // Drop the file from the page cache, the reads should hit the device
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    // Sequential read
+    check(lseek(fd, 0, SEEK_SET) == 0, "seek");
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nChunks; i++) {
+        check(read(fd, buffer.data(), CALIBRATE_CHUNK) == (ssize_t)CALIBRATE_CHUNK, "read");
+    }
+    double seqReadTime = getSecondsSince(start);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    // Random reads and synced writes of single blocks
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> block(0, size / CALIBRATE_BLOCK - 1);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALIBRATE_RANDOM_IOS; i++) {
+        off_t offset = block(rng) * CALIBRATE_BLOCK;
+        check(pread(fd, buffer.data(), CALIBRATE_BLOCK, offset) == (ssize_t)CALIBRATE_BLOCK,
+              "random read");
+    }
+    double randReadTime = getSecondsSince(start) / CALIBRATE_RANDOM_IOS;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALIBRATE_RANDOM_IOS; i++) {
+        off_t offset = block(rng) * CALIBRATE_BLOCK;
+        check(pwrite(fd, buffer.data(), CALIBRATE_BLOCK, offset) == (ssize_t)CALIBRATE_BLOCK,
+              "random write");
+        check(fdatasync(fd) == 0, "sync");
+    }
+    double randWriteTime = getSecondsSince(start) / CALIBRATE_RANDOM_IOS;
+    close(fd);
+    std::remove(path.c_str());
+
+    // The model has one latency and one bandwidth per device, average reads and writes.
+    // The latency is what a random request takes beyond transferring its block.
+    double bandwidth = 2.0 * size / (seqReadTime + seqWriteTime);
+    double latency = (randReadTime + randWriteTime) / 2 - CALIBRATE_BLOCK / bandwidth;
+
+    DeviceProfile profile;
+    profile.bandwidth = (int)std::min((double)INT_MAX, std::max(1024.0 * 1024, bandwidth));
+    profile.latency = std::max(1.0 / (1000 * 1000), latency);
+    printvv("\tCalibrated %s: seq write %.3lf s, seq read %.3lf s for %lld MB, "
+            "random read %.3lf ms, random write %.3lf ms\n",
+            dir.c_str(), seqWriteTime, seqReadTime, BYTE_TO_MB(size), SEC_TO_MS(randReadTime),
+            SEC_TO_MS(randWriteTime));
+    printvv("\t\tBandwidth %d MB/s, Latency %.3lf ms\n", BYTE_TO_MB(profile.bandwidth),
+            SEC_TO_MS(profile.latency));
+    flushvv();
+    return profile;
+}
+
+
+/**
+ * @brief Whether the profile file holds a complete measurement of each persistent tier, taken
+ * in the tier's current run directory
+ */
+static bool isProfileCurrent(const std::string &filename, const std::vector<TierSpec> &tiers) {
+    std::ifstream profile(filename);
+    if (!profile) { return false; }
+    std::map<std::string, std::string> values;
+    std::string line;
+    while (getline(profile, line)) {
+        size_t at = line.find('=');
+        if (line.empty() || line[0] == '#' || at == std::string::npos) { continue; }
+        values[line.substr(0, at)] = line.substr(at + 1);
+    }
+    for (size_t i = 1; i < tiers.size(); i++) { // all but the memory tier
+        const std::string &name = tiers[i].name;
+        if (values[name + "_MEASURED_DIR"] != tiers[i].getDir() ||
+            values[name + "_LATENCY"].empty() || values[name + "_BANDWIDTH"].empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void calibrateDevices() {
+    const std::string &filename = Config::get().PROFILE_FILE;
+    std::vector<TierSpec> tiers = getTierSpecs();
+    if (isProfileCurrent(filename, tiers)) {
+        printvv("INFO: Using device profile %s\n", filename.c_str());
+        readConfig(filename);
+        return;
+    }
+
+    printvv("INFO: Calibrating devices, writing profile %s\n", filename.c_str());
+
+    // Measure every tier before writing, a failed measurement leaves no profile behind
+    std::vector<DeviceProfile> measured(tiers.size());
+    for (size_t i = 1; i < tiers.size(); i++) { // all but the memory tier
+        measured[i] = measureDevice(tiers[i].getDir());
+    }
+
+    // Same key=value format as config files, <tier>_LATENCY and <tier>_BANDWIDTH.
+    // <tier>_MEASURED_DIR is ignored by readConfig(), a profile of other tiers is measured anew.
+    std::string tmpFilename = filename + ".tmp";
+    std::ofstream profile(tmpFilename, std::ios::trunc);
+    profile << "# device profile measured by --calibrate, delete it to measure again\n";
+    profile << std::setprecision(9);
+    for (size_t i = 1; i < tiers.size(); i++) {
+        profile << tiers[i].name << "_MEASURED_DIR=" << tiers[i].getDir() << "\n";
+        profile << tiers[i].name << "_LATENCY=" << measured[i].latency << "\n";
+        profile << tiers[i].name << "_BANDWIDTH=" << measured[i].bandwidth << "\n";
+    }
+    profile.close();
+    if (!profile || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        throw std::runtime_error("ERROR: writing the device profile " + filename);
+    }
+
+    // Apply the measurements the same way as a cached profile
+    readConfig(filename);
+    flushvv();
+}
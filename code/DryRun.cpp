@@ -0,0 +1,489 @@
+#include "DryRun.h"
+#include "PackedRun.h"
+#include "SortContext.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+
+// =========================================================
+// ---------------------- SortPrediction -------------------
+// =========================================================
+
+
+/**
+ * @brief How memory holds the records of the current Config, see isPackedPath()
+ */
+static std::string getLayout() { return isPackedPath() ? "flat arrays" : "Record lists"; }
+
+
+void SortPrediction::addRead(const Storage *device, RowCount nRecords,
+                             RowCount requestInRecords) {
+    if (nRecords == 0) { return; }
+    requestInRecords = std::max((RowCount)1, requestInRecords);
+    if (device->getPageSizeInRecords() > 0) {
+        requestInRecords = std::min(requestInRecords, device->getPageSizeInRecords());
+    }
+    DeviceTraffic &t = traffic[device->getName()];
+    t.bytesRead += nRecords * Config::get().RECORD_SIZE;
+    t.nRequests += divide(nRecords, requestInRecords);
+    t.timeInSec += device->getTransferTimeInSec(nRecords, requestInRecords);
+}
+
+
+void SortPrediction::addWrite(const Storage *device, RowCount nRecords,
+                              RowCount requestInRecords) {
+    if (nRecords == 0) { return; }
+    requestInRecords = std::max((RowCount)1, requestInRecords);
+    if (device->getPageSizeInRecords() > 0) {
+        requestInRecords = std::min(requestInRecords, device->getPageSizeInRecords());
+    }
+    DeviceTraffic &t = traffic[device->getName()];
+    t.bytesWritten += nRecords * Config::get().RECORD_SIZE;
+    t.nRequests += divide(nRecords, requestInRecords);
+    t.timeInSec += device->getTransferTimeInSec(nRecords, requestInRecords);
+}
+
+
+void SortPrediction::add(const SortPrediction &other) {
+    for (auto &t : other.traffic) {
+        DeviceTraffic &total = traffic[t.first];
+        total.bytesRead += t.second.bytesRead;
+        total.bytesWritten += t.second.bytesWritten;
+        total.nRequests += t.second.nRequests;
+        total.timeInSec += t.second.timeInSec;
+    }
+    nMemoryLoads += other.nMemoryLoads;
+    nSpilledMiniruns += other.nSpilledMiniruns;
+    nMerges += other.nMerges;
+    nMergePasses = std::max(nMergePasses, other.nMergePasses);
+    nRecordsMerged += other.nRecordsMerged;
+}
+
+
+double SortPrediction::getModeledTimeInSec() const {
+    double total = 0;
+    for (auto &t : traffic) {
+        total += t.second.timeInSec;
+    }
+    return total;
+}
+
+
+void SortPrediction::print() const {
+    printvv("\n=========== PLAN_ONLY PREDICTION ============\n");
+    printvv("\tInitial runs: %d, %d memory loads merged in DRAM and %d miniruns spilled\n",
+            nMemoryLoads + nSpilledMiniruns, nMemoryLoads, nSpilledMiniruns);
+    printvv("\tMerges: %d, merge passes: %d, records merged: %lld\n", nMerges, nMergePasses,
+            nRecordsMerged);
+    // Both layouts use the same buffers, read-aheads and fan-ins, so they do the same I/O
+    printvv("\tRuns sorted and merged as %s, the layout changes the compute time only, which "
+            "is not modeled\n",
+            layout.c_str());
+    if (tagSize > 0) {
+        printvv("\tTag sort: runs and merges of %d-byte tags, %lld reads to gather the records\n",
+                tagSize, nGatherReads);
+    }
+    for (auto &t : traffic) {
+        printvv("\t%s read %s\n", t.first.c_str(), getSizeDetails(t.second.bytesRead).c_str());
+        printvv("\t%s written %s\n", t.first.c_str(),
+                getSizeDetails(t.second.bytesWritten).c_str());
+        printvv("\t%s requests %lld, modeled time %.2lf seconds\n", t.first.c_str(),
+                t.second.nRequests, t.second.timeInSec);
+    }
+    double total = getModeledTimeInSec();
+    printvv("Modeled Total Time %.2lf seconds / %.2lf minutes\n", total, total / 60);
+    printvv("===============================================\n");
+    flushvv();
+}
+
+
+// =========================================================
+// ------------------------- DryRun ------------------------
+// =========================================================
+
+
+void DryRun::checkSupported() {
+    std::vector<std::string> modes;
+    if (!FilterPredicate::fromConfig().isEmpty()) { modes.push_back("FILTER"); }
+    if (Config::get().TOP_K > 0) { modes.push_back("TOP_K"); }
+    if (Config::get().GROUP_BY) { modes.push_back("GROUP_BY"); }
+    if (Config::get().EARLY_DEDUP) { modes.push_back("EARLY_DEDUP"); }
+    if (Config::get().RESUME) { modes.push_back("RESUME"); }
+    // Only the staging and the final tier hold simulated runs
+    if (!TierGraph(getTierSpecs()).getIntermediateSpecs().empty()) {
+        modes.push_back("INTERMEDIATE_TIERS");
+    }
+    if (modes.empty()) { return; }
+
+    std::string names;
+    for (auto &mode : modes) {
+        names += (names.empty() ? "" : ", ") + mode;
+    }
+    throw std::runtime_error("ERROR: PLAN_ONLY does not model " + names);
+}
+
+
+DryRun::DryRun() : _context(SortContext::get()) {
+    _dram = _context->getDRAM();
+    _ssd = _context->getStagingTier();
+    _hdd = _context->getFinalTier();
+}
+
+
+std::vector<PlannedRun> &DryRun::getRuns(const std::string &deviceName) {
+    return deviceName == _ssd->getName() ? _ssdRuns : _hddRuns;
+}
+
+
+RowCount DryRun::getTotalRecords() const {
+    RowCount total = 0;
+    for (auto &run : _ssdRuns) total += run.nRecords;
+    for (auto &run : _hddRuns) total += run.nRecords;
+    return total;
+}
+
+
+void DryRun::sortBySize(std::vector<PlannedRun> &runs) {
+    std::stable_sort(runs.begin(), runs.end(), [](const PlannedRun &a, const PlannedRun &b) {
+        return a.nRecords < b.nRecords;
+    });
+}
+
+
+void DryRun::storeRun(RowCount nRecords, int depth, RowCount requestInRecords) {
+    PlannedRun run = {"r" + std::to_string(_nextRunIndex++), nRecords, _ssd->getName(), depth};
+    _prediction.addWrite(_ssd, nRecords, requestInRecords);
+
+    // Same as Storage::writeNextChunk: once the SSD is full, the writer spills the run to HDD
+    RowCount _ssdEmptySpace = _ssd->getCapacityInRecords() - _ssdFilled;
+    if (nRecords > _ssdEmptySpace) {
+        RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+        _prediction.addRead(_ssd, nRecords, _hddPageSize);
+        _prediction.addWrite(_hdd, nRecords, _hddPageSize);
+        run.deviceName = _hdd->getName();
+        _hddRuns.push_back(run);
+    } else {
+        _ssdFilled += nRecords;
+        _ssdRuns.push_back(run);
+    }
+}
+
+
+std::vector<PlannedRun>::iterator DryRun::findRun(const PlannedRun &run) {
+    std::vector<PlannedRun> &runs = getRuns(run.deviceName);
+    auto it = std::find_if(runs.begin(), runs.end(), [&run](const PlannedRun &r) {
+        return r.filename == run.filename;
+    });
+    if (it == runs.end()) {
+        throw std::runtime_error("ERROR: dry run lost track of run " + run.filename);
+    }
+    return it;
+}
+
+
+void DryRun::removeRun(const PlannedRun &run) {
+    auto it = findRun(run);
+    if (run.deviceName == _ssd->getName()) { _ssdFilled -= it->nRecords; }
+    getRuns(run.deviceName).erase(it);
+}
+
+
+void DryRun::spillLargestSSDRun() {
+    // Same as PersistentTier::freeSpaceBySpillingRunfiles
+    sortBySize(_ssdRuns);
+    PlannedRun run = _ssdRuns.back();
+    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+    _prediction.addRead(_ssd, run.nRecords, _hddPageSize);
+    _prediction.addWrite(_hdd, run.nRecords, _hddPageSize);
+    removeRun(run);
+    run.deviceName = _hdd->getName();
+    _hddRuns.push_back(run);
+}
+
+
+void DryRun::mergeRuns(const std::vector<PlannedRun> &inputs) {
+    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
+    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+    RowCount _dramCapacity = _dram->getCapacityInRecords();
+    RowCount _ssdEmptySpace = _ssd->getCapacityInRecords() - _ssdFilled;
+    int minMergeFanOut = 2; // minimum fan-out for merge
+    int fanIn = inputs.size();
+    std::string hddName = _hdd->getName();
+    int nHDDRuns = std::count_if(inputs.begin(), inputs.end(), [&hddName](const PlannedRun &r) {
+        return r.deviceName == hddName;
+    });
+
+    // Every run is read through an input cluster in DRAM, HDD runs through SSD first
+    RowCount _dramInputSpace = _dramCapacity - _ssdPageSize * minMergeFanOut;
+    RowCount _dramCluster = std::max(_ssdPageSize, (RowCount)RoundDown(_dramInputSpace / fanIn,
+                                                                       _ssdPageSize));
+    RowCount _ssdInputSpace = _ssdEmptySpace > _hddPageSize * minMergeFanOut
+                                  ? _ssdEmptySpace - _hddPageSize * minMergeFanOut
+                                  : 0;
+    RowCount _ssdCluster = _hddPageSize;
+    if (nHDDRuns > 0) {
+        _ssdCluster = std::max(_hddPageSize,
+                               (RowCount)RoundDown(_ssdInputSpace / nHDDRuns, _hddPageSize));
+    }
+
+    RowCount nRecords = 0;
+    int depth = 0;
+    for (auto &run : inputs) {
+        if (run.deviceName == hddName) {
+            _prediction.addRead(_hdd, run.nRecords, _ssdCluster);
+            _prediction.addWrite(_ssd, run.nRecords, _ssdCluster);
+        }
+        _prediction.addRead(_ssd, run.nRecords, _dramCluster);
+        nRecords += run.nRecords;
+        // the planner does not keep the depth of stored runs, take it from the catalog
+        depth = std::max(depth, findRun(run)->depth);
+    }
+    printv("\t\t\tDRY_RUN: merging %d runs (%d from HDD), %lld records\n", fanIn, nHDDRuns,
+           nRecords);
+
+    // The merged run is written from the output clusters in DRAM to SSD,
+    // the input runs are deleted only after the merge
+    RowCount _dramInputClusters = _dramCluster * fanIn;
+    RowCount _dramOutputSpace =
+        _dramCapacity > _dramInputClusters ? _dramCapacity - _dramInputClusters : 0;
+    storeRun(nRecords, depth + 1, std::max(_ssdPageSize, _dramOutputSpace));
+    for (auto &run : inputs) {
+        removeRun(run);
+    }
+    _prediction.nMerges++;
+    _prediction.nRecordsMerged += nRecords;
+}
+
+
+void DryRun::genMiniRuns(RowCount nRecords) {
+    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
+    RowCount _dramCapacity = _dram->getCapacityInRecords();
+    RowCount _cacheSize = std::max(1, Config::get().CACHE_SIZE / Config::get().RECORD_SIZE);
+
+    // Same buffer split as DRAM::setupMergeStateForMiniruns
+    RowCount outSpace = RoundUp(_dram->getClusterSize() * _dram->getPageSizeInRecords(),
+                                _ssdPageSize);
+    RowCount inSpace = RoundDown(_dramCapacity - outSpace, _ssdPageSize);
+    outSpace = RoundDown(_dramCapacity - inSpace, _ssdPageSize);
+
+    // Keep the miniruns that fit in the input clusters, spill the others to SSD
+    RowCount keepNRecordsInDRAM = 0;
+    RowCount i = 0;
+    for (; i < nRecords; i += _cacheSize) {
+        RowCount size = std::min(_cacheSize, nRecords - i);
+        if (keepNRecordsInDRAM + size >= inSpace) { break; }
+        keepNRecordsInDRAM += size;
+    }
+    for (; i < nRecords; i += _cacheSize) {
+        RowCount size = std::min(_cacheSize, nRecords - i);
+        storeRun(size, 0, size);
+        _prediction.nSpilledMiniruns++;
+    }
+    if (keepNRecordsInDRAM > 0) {
+        storeRun(keepNRecordsInDRAM, 0, outSpace);
+        _prediction.nMemoryLoads++;
+    }
+}
+
+
+void DryRun::mergeTierRuns(const Storage *from, const MergeStep *step) {
+    // Same preconditions as mergeTierRuns for the runs below the staging tier
+    if (from != _ssd) {
+        RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+        RowCount _ssdEmptySpace = _ssd->getCapacityInRecords() - _ssdFilled;
+        int minMergeFanIn = 2;  // minimum fan-in for merge
+        int minMergeFanOut = 2; // minimum fan-out for merge
+        if ((_hddPageSize * (minMergeFanIn + minMergeFanOut) > _ssdEmptySpace) ||
+            (_ssdEmptySpace < _ssd->getMergeFanOutRecords()) ||
+            (_ssdFilled > _ssd->getMergeFanInRecords()) ||
+            ((int)_ssdRuns.size() >= _ssd->getMaxBufferedFanIn())) {
+            if (!_ssdRuns.empty()) { spillLargestSSDRun(); }
+            step = nullptr;
+        } else if (!step->getRunsIn(_hdd->getName()).empty()) {
+            mergeRuns(step->inputs);
+            return;
+        }
+    }
+
+    // Same as mergeTierRuns of the staging tier only, see PersistentTier::setupDirectMerge
+    if (_ssdFilled > _ssd->getMergeFanInRecords()) {
+        step = nullptr;
+        while (_ssdFilled > _ssd->getMergeFanInRecords() && !_ssdRuns.empty()) {
+            spillLargestSSDRun();
+        }
+    }
+    if (_ssdRuns.empty()) { return; }
+    if (_ssdRuns.size() == 1) {
+        spillLargestSSDRun();
+        return;
+    }
+
+    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
+    RowCount _dramMaxInputBufSize = _dram->getCapacityInRecords() - _ssdPageSize * 2;
+    std::vector<PlannedRun> inputs;
+    if (step != nullptr) {
+        for (auto &run : step->inputs) {
+            if (run.deviceName == _ssd->getName()) { inputs.push_back(run); }
+        }
+    } else {
+        sortBySize(_ssdRuns);
+        inputs = _ssdRuns;
+    }
+    int fanIn = std::min((int)inputs.size(), (int)(_dramMaxInputBufSize / _ssdPageSize));
+    if (step == nullptr) {
+        fanIn = _dram->getCostOptimalFanIn(_ssd, _ssdFilled, inputs.size(), fanIn,
+                                           _dramMaxInputBufSize);
+    }
+    inputs.resize(fanIn);
+    mergeRuns(inputs);
+}
+
+
+void DryRun::firstPass() {
+    // Same as SortIterator::firstPass
+    RowCount _dramCapacity = _dram->getCapacityInRecords();
+    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+    RowCount _consumed = 0;
+    while (_consumed < Config::get().NUM_RECORDS) {
+        RowCount nRecordsLeft = Config::get().NUM_RECORDS - _consumed;
+        RowCount nRecordsNext = std::min(nRecordsLeft, _dramCapacity);
+        if (_ssdFilled + nRecordsNext > _ssd->getMergeFanInRecords()) { mergeTierRuns(_ssd); }
+
+        PageCount nHDDPages = _dramCapacity / _hddPageSize;
+        RowCount nRecords = nHDDPages == 0 ? _dramCapacity : nHDDPages * _hddPageSize;
+        nRecords = std::min(nRecords, nRecordsLeft);
+        _prediction.addRead(_hdd, nRecords, _hddPageSize);
+        _consumed += nRecords;
+        genMiniRuns(nRecords);
+    }
+    if (_ssdRuns.size() > 1) { mergeTierRuns(_ssd); }
+}
+
+
+void DryRun::mergePhase() {
+    // Same as SortIterator::externalMergeSort, each iteration plans and executes one merge
+    while (_ssdRuns.size() + _hddRuns.size() > 1) {
+        size_t nSSDRuns = _ssdRuns.size(), nHDDRuns = _hddRuns.size();
+        std::vector<PlannedRun> runs = _ssdRuns;
+        runs.insert(runs.end(), _hddRuns.begin(), _hddRuns.end());
+        int fanIn = _ssd->getPlanningFanIn(nSSDRuns, nHDDRuns, getTotalRecords(),
+                                           _ssd->getCapacityInRecords() - _ssdFilled);
+        MergePlan plan = planMerges(runs, fanIn);
+        printv("\t\t\tDRY_RUN: MERGE_PLAN: %s\n", plan.repr().c_str());
+
+        const MergeStep &step = plan.steps.front();
+        mergeTierRuns(_context->getLowestTier(step.inputs), &step);
+        if (_ssdRuns.size() == nSSDRuns && _hddRuns.size() == nHDDRuns) {
+            throw std::runtime_error("ERROR: dry run made no progress while merging");
+        }
+    }
+}
+
+
+int DryRun::getFinalRunDepth() const {
+    if (!_ssdRuns.empty()) { return _ssdRuns.front().depth; }
+    if (!_hddRuns.empty()) { return _hddRuns.front().depth; }
+    return 0;
+}
+
+
+void DryRun::simulateTagSort() {
+    const int tagSize = Config::get().RECORD_KEY_SIZE + (int)sizeof(uint64_t);
+    const int recordSize = Config::get().RECORD_SIZE;
+    const RowCount nRecords = Config::get().NUM_RECORDS;
+    if (!Config::get().APPEND_FILE.empty()) {
+        throw std::runtime_error("ERROR: TAG_SORT does not support APPEND_FILE");
+    }
+    if (tagSize >= recordSize) {
+        throw std::runtime_error("ERROR: TAG_SORT needs records larger than " +
+                                 std::to_string(tagSize) + " bytes");
+    }
+    _prediction.tagSize = tagSize;
+    // Tags are charged in records worth of bytes, like TagSortIterator does
+    auto getTagsInRecords = [&](RowCount nTags) {
+        return divide(nTags * tagSize, (RowCount)recordSize);
+    };
+
+    // Same as TagSortIterator::writeTags, the input is read once and the tags written a page
+    // worth of bytes at a time
+    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+    _prediction.addRead(_hdd, nRecords, _hddPageSize);
+    _prediction.addWrite(_hdd, getTagsInRecords(nRecords), _hddPageSize);
+
+    // Same as TagSortIterator::sortTags, on tiers set up for tag-sized records
+    Config::get().RECORD_SIZE = tagSize;
+    _prediction.layout = getLayout();
+    _context->deleteTiers();
+    checkTierCapacities(_context);
+    std::exception_ptr error;
+    try {
+        DryRun tags;
+        if (nRecords > 1) {
+            tags.firstPass();
+            tags.mergePhase();
+        }
+        tags._prediction.nMergePasses = tags.getFinalRunDepth();
+        _prediction.add(tags._prediction);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    _context->deleteTiers();
+    Config::get().RECORD_SIZE = recordSize;
+    checkTierCapacities(_context);
+    _dram = _context->getDRAM();
+    _ssd = _context->getStagingTier();
+    _hdd = _context->getFinalTier();
+    if (error) { std::rethrow_exception(error); }
+
+    // Same as TagSortIterator::gather: a batch of a memory load of records at a time, whose
+    // records are fetched in input order. Nearby positions share a read, which the gaps
+    // between the random positions of a batch decide.
+    _hddPageSize = _hdd->getPageSizeInRecords();
+    const RowCount batchSize = std::max((RowCount)1, _dram->getCapacityInRecords());
+    const double latency = _hdd->getAccessTimeInSec(0);
+    const double perRecord = _hdd->getAccessTimeInSec(1) - latency;
+    const RowCount maxGap = perRecord > 0 ? (RowCount)(latency / perRecord) : 0;
+    for (RowCount nGathered = 0; nGathered < nRecords;) {
+        RowCount n = std::min(batchSize, nRecords - nGathered);
+        _prediction.addRead(_hdd, getTagsInRecords(n), _hddPageSize);
+        RowCount gap = nRecords / n;
+        if (gap > maxGap + 1 || gap >= _hddPageSize) {
+            // Every record is a read of its own
+            _prediction.addRead(_hdd, n, 1);
+            _prediction.nGatherReads += n;
+        } else {
+            // Reads of up to a page cover the whole input
+            _prediction.addRead(_hdd, nRecords, _hddPageSize);
+            _prediction.nGatherReads += divide(nRecords, _hddPageSize);
+        }
+        nGathered += n;
+    }
+    _prediction.addWrite(_hdd, nRecords, _hddPageSize);
+}
+
+
+SortPrediction DryRun::run() {
+    checkSupported();
+    printvv("\n========= PLAN_ONLY: simulating the sort without data =========\n");
+    flushvv();
+    if (Config::get().TAG_SORT) {
+        simulateTagSort();
+        return _prediction;
+    }
+    _prediction.layout = getLayout();
+    const std::string &appendFile = Config::get().APPEND_FILE;
+    ByteCount appendSize = appendFile.empty() ? 0 : getFileSize(appendFile);
+    if (appendSize != 0 && appendSize != (ByteCount)-1) {
+        // Same as Storage::addSortedFile, the sorted file is a run in HDD from the start
+        PlannedRun run = {"r" + std::to_string(_nextRunIndex++),
+                          (RowCount)(appendSize / Config::get().RECORD_SIZE), _hdd->getName(), 0};
+        _hddRuns.push_back(run);
+    }
+    if (Config::get().NUM_RECORDS > 1 || !_hddRuns.empty()) {
+        firstPass();
+        mergePhase();
+    }
+    _prediction.nMergePasses = getFinalRunDepth();
+    return _prediction;
+}
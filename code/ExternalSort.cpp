@@ -1,7 +1,11 @@
+#include "Calibrate.h"
+#include "DryRun.h"
 #include "Filter.h"
 #include "Iterator.h"
 #include "Scan.h"
 #include "Sort.h"
+#include "SortContext.h"
+#include "TagSort.h"
 #include "Verify.h"
 #include "config.h"
 #include "defs.h"
@@ -9,6 +13,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <ctime>
 #include <string>
 
@@ -24,6 +29,21 @@
  *  `-o` output file
  *  `-v` verify the output file
  *  `-vo` verify the output file only`
+ *  `--plan-only` predict the I/O and modeled time without generating or sorting data
+ *  `--emulate-io` throttle SSD and HDD I/O to their configured latency and bandwidth
+ *  `--calibrate` take the persistent tiers' latency and bandwidth from the device profile
+ *  `--config` read configuration keys, including `TIER` lines, from a file
+ *  `--resume` continue an interrupted sort from its checkpoint instead of starting over
+ *  `--append` merge the sorted input into an existing sorted output, sorting only the input
+ *  `--filter` keep only the input records with a key in [min_key, max_key], `-` for no bound
+ *  `--filter-pattern` keep only the input records holding the given bytes at the given offset
+ *  `--top-k` output only the k smallest records
+ *  `--group-by` output one record per key, aggregating the 8-byte integer at the given offset
+ *  `--dedup` drop no duplicates, equal records, or records with an equal key
+ *  `--early-dedup` drop the duplicates within each memory load before sorting it
+ *  `--tag-sort` sort (key, input position) tags and gather the records at the end
+ *  `--packed-record-size` largest record size sorted and merged as flat arrays, 0 for none
+ *  `--no-key-encoding` compare the keys of packed records with strncmp, not as integers
  *
  * ./ExternalSort.exe -c 20 -s 1024 -o trace0.txt
  * @param argc
@@ -32,7 +52,11 @@
 void readCmdlineArgs(int argc, char *argv[]) {
     std::string usage = "Usage: " + std::string(argv[0]) +
                         " -c <num_records> -s <record_size> -o <trace_file> -v <verify_output> -vo "
-                        "<verify_only> \n";
+                        "<verify_only> --plan-only --emulate-io --calibrate "
+                        "--config <config_file> --resume --append <sorted_file> "
+                        "--filter <min_key|-> <max_key|-> --filter-pattern <offset> <bytes> "
+                        "--top-k <k> --group-by <field_offset> --dedup <none|exact|key> "
+                        "--early-dedup --tag-sort --packed-record-size <bytes> --no-key-encoding \n";
     if (argc < 2) {
         fprintf(stderr, "Usage: %s -c <num_records> -s <record_size> -o <trace_file>\n", argv[0]);
         exit(1);
@@ -45,7 +69,7 @@ void readCmdlineArgs(int argc, char *argv[]) {
         if (strcmp(argv[i], "-c") == 0) {
             if (i + 1 < argc) {
                 num_records = std::atoi(argv[++i]);
-                Config::NUM_RECORDS = num_records;
+                Config::get().NUM_RECORDS = num_records;
             } else {
                 fprintf(stderr, "Option -c requires an argument.\n");
                 exit(1);
@@ -53,7 +77,7 @@ void readCmdlineArgs(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-s") == 0) {
             if (i + 1 < argc) {
                 record_size = std::atoi(argv[++i]);
-                Config::RECORD_SIZE = record_size;
+                Config::get().RECORD_SIZE = record_size;
             } else {
                 fprintf(stderr, "Option -s requires an argument.\n");
                 exit(1);
@@ -61,15 +85,95 @@ void readCmdlineArgs(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-o") == 0) {
             if (i + 1 < argc) {
                 trace_file = argv[++i];
-                Config::TRACE_FILE = trace_file;
+                Config::get().TRACE_FILE = trace_file;
             } else {
                 fprintf(stderr, "Option -o requires an argument.\n");
                 exit(1);
             }
         } else if (strcmp(argv[i], "-vo") == 0) {
-            Config::VERIFY_ONLY = true;
+            Config::get().VERIFY_ONLY = true;
         } else if (strcmp(argv[i], "-v") == 0) {
-            Config::VERIFY = true;
+            Config::get().VERIFY = true;
+        } else if (strcmp(argv[i], "--plan-only") == 0) {
+            Config::get().PLAN_ONLY = true;
+        } else if (strcmp(argv[i], "--emulate-io") == 0) {
+            Config::get().EMULATE_IO = true;
+        } else if (strcmp(argv[i], "--calibrate") == 0) {
+            Config::get().CALIBRATE = true;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            Config::get().RESUME = true;
+        } else if (strcmp(argv[i], "--append") == 0) {
+            if (i + 1 < argc) {
+                Config::get().APPEND_FILE = argv[++i];
+            } else {
+                fprintf(stderr, "Option --append requires an argument.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            if (i + 2 < argc) {
+                // "-" leaves the bound open
+                Config::get().FILTER_MIN_KEY = strcmp(argv[i + 1], "-") == 0 ? "" : argv[i + 1];
+                Config::get().FILTER_MAX_KEY = strcmp(argv[i + 2], "-") == 0 ? "" : argv[i + 2];
+                i += 2;
+            } else {
+                fprintf(stderr, "Option --filter requires two arguments.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--filter-pattern") == 0) {
+            if (i + 2 < argc) {
+                Config::get().FILTER_PATTERN_OFFSET = std::atoi(argv[++i]);
+                Config::get().FILTER_PATTERN = argv[++i];
+            } else {
+                fprintf(stderr, "Option --filter-pattern requires two arguments.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--top-k") == 0) {
+            if (i + 1 < argc) {
+                Config::get().TOP_K = std::atoll(argv[++i]);
+            } else {
+                fprintf(stderr, "Option --top-k requires an argument.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--group-by") == 0) {
+            if (i + 1 < argc) {
+                Config::get().GROUP_BY = true;
+                Config::get().GROUP_BY_FIELD_OFFSET = std::atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Option --group-by requires an argument.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--early-dedup") == 0) {
+            Config::get().EARLY_DEDUP = true;
+        } else if (strcmp(argv[i], "--tag-sort") == 0) {
+            Config::get().TAG_SORT = true;
+        } else if (strcmp(argv[i], "--no-key-encoding") == 0) {
+            Config::get().KEY_ENCODING = false;
+        } else if (strcmp(argv[i], "--packed-record-size") == 0) {
+            if (i + 1 < argc) {
+                Config::get().PACKED_RECORD_SIZE = std::atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Option --packed-record-size requires an argument.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--dedup") == 0) {
+            if (i + 1 < argc) {
+                Config::get().DEDUP = parseDedupPolicy(argv[++i]);
+            } else {
+                fprintf(stderr, "Option --dedup requires an argument.\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--config") == 0) {
+            if (i + 1 < argc) {
+                // Applied in place, later options override the file
+                if (!std::ifstream(argv[i + 1])) {
+                    fprintf(stderr, "Config file %s does not exist.\n", argv[i + 1]);
+                    exit(1);
+                }
+                readConfig(argv[++i]);
+            } else {
+                fprintf(stderr, "Option --config requires an argument.\n");
+                exit(1);
+            }
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             fprintf(stderr, "Usage: %s -c <num_records> -s <record_size> -o <trace_file>\n",
@@ -77,10 +181,10 @@ void readCmdlineArgs(int argc, char *argv[]) {
             exit(1);
         }
     }
-    Config::INPUT_FILE = "input-c" + std::to_string(Config::NUM_RECORDS) + "-s" +
-                         std::to_string(Config::RECORD_SIZE) + ".txt";
-    Config::OUTPUT_FILE = "output-c" + std::to_string(Config::NUM_RECORDS) + "-s" +
-                          std::to_string(Config::RECORD_SIZE) + ".txt";
+    Config::get().INPUT_FILE = "input-c" + std::to_string(Config::get().NUM_RECORDS) + "-s" +
+                         std::to_string(Config::get().RECORD_SIZE) + ".txt";
+    Config::get().OUTPUT_FILE = "output-c" + std::to_string(Config::get().NUM_RECORDS) + "-s" +
+                          std::to_string(Config::get().RECORD_SIZE) + ".txt";
 } // readCmdlineArgs
 
 
@@ -89,43 +193,45 @@ void readCmdlineArgs(int argc, char *argv[]) {
  */
 void init() {
 #if defined(_SMALL)
-    Config::DRAM_CAPACITY = 1LL * 3 * 1024 * 1024;   // 5 MB
-    Config::SSD_CAPACITY = 1LL * 1024 * 1024 * 1024; // 1 GB
-    Config::RECORD_SIZE = 1024;                      // 1024 bytes
-    Config::NUM_RECORDS = 800 * 1024;                // 10000 records
-    Config::INPUT_FILE = "input-c" + std::to_string(Config::NUM_RECORDS) + "-s" +
-                         std::to_string(Config::RECORD_SIZE) + ".txt";
+    Config::get().DRAM_CAPACITY = 1LL * 3 * 1024 * 1024;   // 5 MB
+    Config::get().SSD_CAPACITY = 1LL * 1024 * 1024 * 1024; // 1 GB
+    Config::get().RECORD_SIZE = 1024;                      // 1024 bytes
+    Config::get().NUM_RECORDS = 800 * 1024;                // 10000 records
+    Config::get().INPUT_FILE = "input-c" + std::to_string(Config::get().NUM_RECORDS) + "-s" +
+                         std::to_string(Config::get().RECORD_SIZE) + ".txt";
     // Config::VERIFY = true;
     printvv("WARNING: Running in SMALL mode\n");
     flushvv();
 #elif defined(_BIG)
-    Config::SSD_CAPACITY = 20LL * 1024 * 1024 * 1024; // 25 MB
-    Config::RECORD_SIZE = 1024;                       // 1024 bytes
-    Config::NUM_RECORDS = 11000000;                   // 10000 records
-    Config::INPUT_FILE = "input-c" + std::to_string(Config::NUM_RECORDS) + "-s" +
-                         std::to_string(Config::RECORD_SIZE) + ".txt";
-    Config::VERIFY = false;
+    Config::get().SSD_CAPACITY = 20LL * 1024 * 1024 * 1024; // 25 MB
+    Config::get().RECORD_SIZE = 1024;                       // 1024 bytes
+    Config::get().NUM_RECORDS = 11000000;                   // 10000 records
+    Config::get().INPUT_FILE = "input-c" + std::to_string(Config::get().NUM_RECORDS) + "-s" +
+                         std::to_string(Config::get().RECORD_SIZE) + ".txt";
+    Config::get().VERIFY = false;
     printvv("WARNING: Running in BIG mode\n");
     flushvv();
 #endif
+    // Measure the devices before they are created, configure() derives the page sizes
+    if (Config::get().CALIBRATE && !Config::get().VERIFY_ONLY) { calibrateDevices(); }
     printConfig();
 
 
-    if (Config::RECORD_SIZE < Config::RECORD_KEY_SIZE) {
+    if (Config::get().RECORD_SIZE < Config::get().RECORD_KEY_SIZE) {
         std::string msg = "Error: Record size is less than key size";
         throw std::runtime_error(msg);
     }
 
     // Check if input and output file exists
-    if (Config::VERIFY_ONLY) {
-        if (!std::ifstream(Config::INPUT_FILE.c_str())) {
-            std::string msg =
-                "Error: Verify-only selected. Input file " + Config::INPUT_FILE + " does not exist";
+    if (Config::get().VERIFY_ONLY) {
+        if (!std::ifstream(Config::get().INPUT_FILE.c_str())) {
+            std::string msg = "Error: Verify-only selected. Input file " +
+                              Config::get().INPUT_FILE + " does not exist";
             throw std::runtime_error(msg);
         }
-        if (!std::ifstream(Config::OUTPUT_FILE.c_str())) {
-            std::string msg = "Error: Verify-only selected. Output file " + Config::OUTPUT_FILE +
-                              " does not exist";
+        if (!std::ifstream(Config::get().OUTPUT_FILE.c_str())) {
+            std::string msg = "Error: Verify-only selected. Output file " +
+                              Config::get().OUTPUT_FILE + " does not exist";
             throw std::runtime_error(msg);
         }
         printvv("INFO: Verify-only selected\n");
@@ -133,51 +239,7 @@ void init() {
         return;
     }
 
-    HDD *_hdd = HDD::getInstance();
-    HDD *_ssd = SSD::getInstance();
-    DRAM *_dram = DRAM::getInstance();
-    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
-    RowCount _dramCapacity = _dram->getCapacityInRecords();
-    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
-    RowCount _ssdCapacity = _ssd->getCapacityInRecords();
-
-    /*
-    Assuming, minMergeFanIn = 4, minMergeFanOut = 2;
-    DRAM capacity should be able to hold at least 4 ssd pages;
-    SSD capacity should be able to hold at least 4 hdd pages
-    */
-    int minMergeFanIn = 2;
-    int minMergeFanOut = 2;
-    if ((minMergeFanIn + minMergeFanOut) * _ssdPageSize > _dramCapacity) {
-        std::string msg = "DRAM capacity is less than " +
-                          std::to_string(minMergeFanIn + minMergeFanOut) + " SSD pages";
-        throw std::runtime_error(msg);
-    }
-    if (minMergeFanOut * _ssdPageSize > _dram->getMergeFanOutRecords()) {
-        std::string msg =
-            "DRAM merge fan-in is less than " + std::to_string(minMergeFanIn) + " SSD pages";
-        throw std::runtime_error(msg);
-    }
-    if (minMergeFanIn * _ssdPageSize > _dram->getMergeFanInRecords()) {
-        std::string msg =
-            "DRAM merge fan-in is less than " + std::to_string(minMergeFanIn) + " SSD pages";
-        throw std::runtime_error(msg);
-    }
-    if ((minMergeFanIn + minMergeFanOut) * _hddPageSize > _ssdCapacity) {
-        std::string msg = "SSD capacity is less than " +
-                          std::to_string(minMergeFanIn + minMergeFanOut) + " HDD pages";
-        throw std::runtime_error(msg);
-    }
-    if (minMergeFanOut * _hddPageSize > _ssd->getMergeFanOutRecords()) {
-        std::string msg =
-            "SSD merge fan-in is less than " + std::to_string(minMergeFanOut) + " HDD pages";
-        throw std::runtime_error(msg);
-    }
-    if (minMergeFanIn * _hddPageSize > _ssd->getMergeFanInRecords()) {
-        std::string msg =
-            "SSD merge fan-in is less than " + std::to_string(minMergeFanIn) + " HDD pages";
-        throw std::runtime_error(msg);
-    }
+    checkTierCapacities(SortContext::get());
     printvv("Init done\n");
 }
 
@@ -186,16 +248,7 @@ void init() {
  * @brief cleanup at the very end, what was initialized in init()
  */
 void cleanup() {
-    delete getMaxRecord();
-    DRAM::deleteInstance();
-    printv("deleted DRAM\n");
-    flushv();
-    SSD::deleteInstance();
-    printv("deleted SSD\n");
-    flushv();
-    HDD::deleteInstance();
-    printv("deleted HDD\n");
-    flushv();
+    SortContext::get()->deleteTiers();
     printvv("Cleanup done\n");
     flushvv();
 }
@@ -205,14 +258,35 @@ int main(int argc, char *argv[]) {
 
     // Read command line arguments
     readCmdlineArgs(argc, argv);
+    if (Config::get().PLAN_ONLY) {
+        // Refuse the modes the dry run does not model, before anything is set up
+        try {
+            DryRun::checkSupported();
+        } catch (const std::exception &e) {
+            fprintf(stderr, "%s\n", e.what());
+            exit(1);
+        }
+    }
 
     // Validate the input and initialize the system
     init();
 
 
-    if (!Config::VERIFY_ONLY) {
-        Plan *scanPlan = new ScanPlan(Config::NUM_RECORDS, Config::INPUT_FILE);
-        Plan *const plan = new SortPlan(scanPlan);
+    if (Config::get().PLAN_ONLY) {
+        // Run the planner and the tier accounting only, no input is generated
+        DryRun dryRun;
+        SortPrediction prediction = dryRun.run();
+        prediction.print();
+        cleanup();
+        return 0;
+    }
+
+    if (!Config::get().VERIFY_ONLY) {
+        Plan *scanPlan = new ScanPlan(Config::get().NUM_RECORDS, Config::get().INPUT_FILE);
+        FilterPredicate filter = FilterPredicate::fromConfig();
+        if (!filter.isEmpty()) { scanPlan = new FilterPlan(scanPlan, filter); }
+        Plan *const plan =
+            Config::get().TAG_SORT ? (Plan *)new TagSortPlan(scanPlan) : new SortPlan(scanPlan);
 
         Iterator *const it = plan->init();
         it->run();
@@ -224,12 +298,12 @@ int main(int argc, char *argv[]) {
         cleanup();
     }
 
-    if (Config::VERIFY_ONLY || Config::VERIFY) {
+    if (Config::get().VERIFY_ONLY || Config::get().VERIFY) {
         uint64_t capacityMB = 1024; // 1 GB or 1024 memory used for verification
 
         // Verify the order
         auto start = std::chrono::steady_clock::now();
-        verifyOrder(Config::OUTPUT_FILE, capacityMB);
+        verifyOrder(Config::get().OUTPUT_FILE, capacityMB);
         auto end = std::chrono::steady_clock::now();
         auto dur = std::chrono::duration_cast<std::chrono::seconds>(end - start);
         printvv("Order Verification Duration %lld seconds / %lld minutes\n", dur.count(),
@@ -237,7 +311,25 @@ int main(int argc, char *argv[]) {
 
         // Verify the integrity
         auto startIntegrity = std::chrono::steady_clock::now();
-        verifyIntegrity(Config::INPUT_FILE, Config::OUTPUT_FILE, capacityMB);
+        if (Config::get().APPEND_FILE == Config::get().OUTPUT_FILE) {
+            // The sorted file was replaced by the output
+            printvv("WARNING: appended in place, skipping the integrity check\n");
+        } else if (Config::get().TOP_K > 0) {
+            // The output holds only part of the input
+            printvv("WARNING: top-k output, skipping the integrity check\n");
+        } else if (Config::get().GROUP_BY) {
+            // The output holds one aggregate record per key
+            printvv("WARNING: group-by output, skipping the integrity check\n");
+        } else {
+            verifyIntegrity(Config::get().INPUT_FILE, Config::get().OUTPUT_FILE, capacityMB,
+                            Config::get().APPEND_FILE);
+        }
+        FilterPredicate filter = FilterPredicate::fromConfig();
+        if (!filter.isEmpty() && Config::get().TOP_K == 0 && !Config::get().VERIFY_ONLY) {
+            // The count of dropped records is known only in the run that sorted
+            verifyFilter(Config::get().INPUT_FILE, Config::get().OUTPUT_FILE, filter,
+                         SortContext::get()->counters.nRecordsFiltered, capacityMB);
+        }
         auto endIntegrity = std::chrono::steady_clock::now();
         dur = std::chrono::duration_cast<std::chrono::seconds>(endIntegrity - startIntegrity);
         printvv("Integrity Verification Duration %lld seconds / %lld minutes\n", dur.count(),
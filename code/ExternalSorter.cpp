@@ -0,0 +1,147 @@
+#include "ExternalSorter.h"
+#include "Filter.h"
+#include "Scan.h"
+#include "Sort.h"
+#include "SortContext.h"
+#include "TagSort.h"
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+
+
+// =========================================================
+// --------------------- ExternalSorter --------------------
+// =========================================================
+
+
+SortConfig::SortConfig()
+    : tiers(getTierSpecs()), recordSize(Config::get().RECORD_SIZE),
+      recordKeySize(Config::get().RECORD_KEY_SIZE), cacheSize(Config::get().CACHE_SIZE),
+      mergeFanIn(Config::get().MERGE_FAN_IN), mergeGroupSize(Config::get().MERGE_GROUP_SIZE),
+      emulateIO(Config::get().EMULATE_IO), resume(Config::get().RESUME),
+      runDir(Config::get().RUN_DIR), traceFile(Config::get().TRACE_FILE),
+      filter(FilterPredicate::fromConfig()), topK(Config::get().TOP_K),
+      groupBy(Config::get().GROUP_BY), groupByFieldOffset(Config::get().GROUP_BY_FIELD_OFFSET),
+      dedup(Config::get().DEDUP), earlyDedup(Config::get().EARLY_DEDUP),
+      tagSort(Config::get().TAG_SORT), packedRecordSize(Config::get().PACKED_RECORD_SIZE),
+      keyEncoding(Config::get().KEY_ENCODING) {}
+
+
+ExternalSorter::ExternalSorter(const SortConfig &config, const SortFiles &files)
+    : config(config), files(files) {}
+
+
+ExternalSorter::~ExternalSorter() {
+    if (worker.joinable()) { worker.join(); }
+}
+
+
+void ExternalSorter::start() {
+    if (worker.joinable()) { throw std::runtime_error("ERROR: the sorter is already running"); }
+    error = nullptr;
+    stats = SortStats();
+    worker = std::thread(&ExternalSorter::sort, this);
+}
+
+
+SortStats ExternalSorter::wait() {
+    if (worker.joinable()) { worker.join(); }
+    if (error) { std::rethrow_exception(error); }
+    return stats;
+}
+
+
+SortStats ExternalSorter::run() {
+    if (worker.joinable()) { throw std::runtime_error("ERROR: the sorter is already running"); }
+    error = nullptr;
+    stats = SortStats();
+    sort();
+    if (error) { std::rethrow_exception(error); }
+    return stats;
+}
+
+
+void ExternalSorter::applyConfig(Config &settings) {
+    // A new context starts out with the defaults
+    settings.TIERS = config.tiers;
+    settings.RECORD_SIZE = config.recordSize;
+    settings.RECORD_KEY_SIZE = config.recordKeySize;
+    settings.CACHE_SIZE = config.cacheSize;
+    settings.MERGE_FAN_IN = config.mergeFanIn;
+    settings.MERGE_GROUP_SIZE = config.mergeGroupSize;
+    settings.EMULATE_IO = config.emulateIO;
+    settings.RESUME = config.resume;
+    settings.RUN_DIR = config.runDir;
+    settings.TRACE_FILE = config.traceFile;
+    settings.INPUT_FILE = files.input;
+    settings.OUTPUT_FILE = files.output;
+    settings.APPEND_FILE = files.append;
+    settings.FILTER_MIN_KEY = config.filter.minKey;
+    settings.FILTER_MAX_KEY = config.filter.maxKey;
+    settings.FILTER_PATTERN = config.filter.pattern;
+    settings.FILTER_PATTERN_OFFSET = config.filter.patternOffset;
+    settings.TOP_K = config.topK;
+    settings.GROUP_BY = config.groupBy;
+    settings.GROUP_BY_FIELD_OFFSET = config.groupByFieldOffset;
+    settings.DEDUP = config.dedup;
+    settings.EARLY_DEDUP = config.earlyDedup;
+    settings.TAG_SORT = config.tagSort;
+    settings.PACKED_RECORD_SIZE = config.packedRecordSize;
+    settings.KEY_ENCODING = config.keyEncoding;
+
+    if (settings.RECORD_SIZE < settings.RECORD_KEY_SIZE) {
+        throw std::runtime_error("ERROR: record size is less than key size");
+    }
+    ByteCount inputSize = getFileSize(files.input);
+    if (inputSize == (ByteCount)-1) {
+        throw std::runtime_error("ERROR: input file " + files.input + " does not exist");
+    }
+    if (inputSize % settings.RECORD_SIZE != 0) {
+        throw std::runtime_error("ERROR: size of input file " + files.input +
+                                 " is not a multiple of the record size");
+    }
+    settings.NUM_RECORDS = inputSize / settings.RECORD_SIZE;
+    if (!settings.RUN_DIR.empty()) { mkdir(settings.RUN_DIR.c_str(), 0700); }
+    printConfig();
+}
+
+
+void ExternalSorter::sort() {
+    auto start = std::chrono::steady_clock::now();
+    {
+        // The context of this sort only, on whatever thread runs it
+        SortContext context;
+        SortContext::Scope scope(&context);
+        try {
+            applyConfig(context.config);
+            checkTierCapacities(&context);
+
+            // The input exists, so the scan does not generate it
+            Plan *input = new ScanPlan(context.config.NUM_RECORDS, files.input);
+            if (!config.filter.isEmpty()) { input = new FilterPlan(input, config.filter); }
+            std::unique_ptr<Plan> plan(config.tagSort
+                                           ? (Plan *)new TagSortPlan(input, config.onStep)
+                                           : new SortPlan(input, config.onStep));
+            std::unique_ptr<Iterator> it(plan->init());
+            it->run();
+
+            TimeLedger *ledger = context.getLedger();
+            stats.nRecords = context.config.NUM_RECORDS;
+            stats.nDuplicatesRemoved = context.counters.nDuplicatesRemoved;
+            stats.nRecordsFiltered = context.counters.nRecordsFiltered;
+            stats.nStagingAccesses = context.counters.nStagingAccesses;
+            stats.nFinalAccesses = context.counters.nFinalAccesses;
+            stats.modeledTimeInSec =
+                ledger->getModeledTimeInSec("FIRST_PASS") + ledger->getModeledTimeInSec("MERGE") +
+                ledger->getModeledTimeInSec("TAGS") + ledger->getModeledTimeInSec("GATHER");
+        } catch (...) {
+            error = std::current_exception();
+        }
+        context.deleteTiers();
+        stats.durationInSec =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        flushvv();
+    }
+    if (config.onDone) { config.onDone(); }
+}
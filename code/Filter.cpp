@@ -1,7 +1,10 @@
 #include "Filter.h"
 
 
-FilterPlan::FilterPlan(Plan *const input) : _input(input) { TRACE(true); } // FilterPlan::FilterPlan
+FilterPlan::FilterPlan(Plan *const input, const FilterPredicate &predicate)
+    : _input(input), _predicate(predicate) {
+    TRACE(true);
+} // FilterPlan::FilterPlan
 
 FilterPlan::~FilterPlan() {
     TRACE(true);
@@ -15,7 +18,8 @@ Iterator *FilterPlan::init() const {
 
 
 FilterIterator::FilterIterator(FilterPlan const *const plan)
-    : _plan(plan), _input(plan->_input->init()), _consumed(0), _produced(0) {
+    : _plan(plan), _input(plan->_input->init()), _consumed(0), _produced(0),
+      _kernel(plan->_predicate) {
     TRACE(true);
 } // FilterIterator::FilterIterator
 
@@ -29,27 +33,35 @@ FilterIterator::~FilterIterator() {
 } // FilterIterator::~FilterIterator
 
 bool FilterIterator::next() {
-    TRACE(true);
+    // TRACE(true);
 
     do {
         if (!_input->next())
             return false;
         ++_consumed;
-    } while (_consumed % 2 == 0);
+        _input->getRecord(&_record);
+    } while (!_kernel.matches(_record.data));
 
     ++_produced;
     return true;
 } // FilterIterator::next
 
 void FilterIterator::getRecord(Record *r) {
-    TRACE(true);
+    // TRACE(true);
 
-    _input->getRecord(r);
+    std::memcpy(r->data, _record.data, Config::get().RECORD_SIZE);
 } // FilterIterator::getRecord
 
 
-void FilterIterator::getPage(Page *p) {
-    TRACE(true);
+bool FilterIterator::getPage(Page *p) {
+    // TRACE(true);
 
-    _input->getPage(p);
+    // Drop the records from the selection vector only, the page keeps its bytes
+    while (_input->getPage(p)) {
+        _consumed += p->getSelectedCount();
+        _kernel.select(p);
+        _produced += p->getSelectedCount();
+        if (!p->isEmpty()) { return true; }
+    }
+    return false;
 } // FilterIterator::getPage
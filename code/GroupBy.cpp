@@ -0,0 +1,52 @@
+#include "GroupBy.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+// =========================================================
+// ---------------------- GroupAggregate -------------------
+// =========================================================
+
+
+void checkGroupBy() {
+    if (Config::get().RECORD_KEY_SIZE + (int)sizeof(GroupAggregate) > Config::get().RECORD_SIZE) {
+        throw std::runtime_error("ERROR: GROUP_BY needs records of at least " +
+                                 std::to_string(Config::get().RECORD_KEY_SIZE +
+                                                sizeof(GroupAggregate)) +
+                                 " bytes");
+    }
+    if (Config::get().GROUP_BY_FIELD_OFFSET < 0 ||
+        Config::get().GROUP_BY_FIELD_OFFSET + (int)sizeof(int64_t) > Config::get().RECORD_SIZE) {
+        throw std::runtime_error("ERROR: the GROUP_BY field does not fit in a record");
+    }
+}
+
+
+std::string getGroupByRepr() {
+    if (!Config::get().GROUP_BY) { return "none"; }
+    return "field@" + std::to_string(Config::get().GROUP_BY_FIELD_OFFSET);
+}
+
+
+void initGroups(char *data, RowCount nRecords) {
+    const ByteCount recordSize = Config::get().RECORD_SIZE;
+    for (char *record = data; record < data + nRecords * recordSize; record += recordSize) {
+        // Read before the aggregates overwrite it, the field may follow the key
+        int64_t value;
+        std::memcpy(&value, record + Config::get().GROUP_BY_FIELD_OFFSET, sizeof(value));
+        GroupAggregate aggregate = {1, value, value, value};
+        aggregate.write(record);
+    }
+}
+
+
+void combineGroups(char *into, const char *record) {
+    GroupAggregate total = GroupAggregate::read(into);
+    GroupAggregate other = GroupAggregate::read(record);
+    total.count += other.count;
+    total.sum = (int64_t)((uint64_t)total.sum + (uint64_t)other.sum);
+    total.min = std::min(total.min, other.min);
+    total.max = std::max(total.max, other.max);
+    total.write(into);
+}
@@ -13,11 +13,17 @@ Iterator::~Iterator() { TRACE(true); } // Iterator::~Iterator
 void Iterator::run() {
     TRACE(true);
 
-    while (next()) {
-        ++_count;
+    Page page(getPageSizeInRecords());
+    while (getPage(&page)) {
+        _count += page.getSelectedCount();
     }
     traceprintf("entire plan produced %lu rows\n", (unsigned long)_count);
 } // Iterator::run
 
 
-void Iterator::get(char *data, ByteCount nBytes) { TRACE(true); }
\ No newline at end of file
+void Iterator::get(char *data, ByteCount nBytes) { TRACE(true); }
+
+
+RowCount Iterator::getPageSizeInRecords() {
+    return std::max((RowCount)1, (RowCount)(Config::get().CACHE_SIZE / Config::get().RECORD_SIZE));
+} // Iterator::getPageSizeInRecords
\ No newline at end of file
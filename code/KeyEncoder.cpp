@@ -0,0 +1,29 @@
+#include "KeyEncoder.h"
+
+
+// =========================================================
+// ----------------------- KeyEncoder ----------------------
+// =========================================================
+
+
+const char KEY_ALPHABET[] = "\n"
+                            "0123456789"
+                            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz";
+
+
+/**
+ * @brief Number the symbols of KEY_ALPHABET from 1, see ALPHABET_CODES
+ */
+static const uint8_t *buildAlphabetCodes() {
+    static uint8_t codes[256];
+    static_assert(sizeof(KEY_ALPHABET) - 1 <= 63, "6-bit codes hold 63 symbols");
+    std::memset(codes, INVALID_CODE, sizeof(codes));
+    codes[0] = 0;
+    for (size_t i = 0; i + 1 < sizeof(KEY_ALPHABET); i++) {
+        codes[(unsigned char)KEY_ALPHABET[i]] = i + 1;
+    }
+    return codes;
+}
+
+const uint8_t *const ALPHABET_CODES = buildAlphabetCodes();
@@ -0,0 +1,116 @@
+#include "MergePlanner.h"
+#include <algorithm>
+#include <queue>
+
+
+// =========================================================
+// ----------------------- MergePlanner --------------------
+// =========================================================
+
+
+std::vector<std::pair<std::string, RowCount>>
+MergeStep::getRunsIn(const std::string &deviceName) const {
+    std::vector<std::pair<std::string, RowCount>> runs;
+    for (auto &run : inputs) {
+        if (run.deviceName == deviceName) { runs.push_back({run.filename, run.nRecords}); }
+    }
+    return runs;
+}
+
+
+std::string MergePlan::repr() const {
+    std::string repr = std::to_string(steps.size()) + " merges, " + std::to_string(nPasses) +
+                       " passes, " + std::to_string(nRecordsWritten) + " records to write";
+    if (nConcatenated > 0) { repr += ", " + std::to_string(nConcatenated) + " runs concatenated"; }
+    if (!steps.empty()) {
+        repr += ", first merge: " + std::to_string(steps.front().inputs.size()) + " runs / " +
+                std::to_string(steps.front().nRecords) + " records";
+    }
+    return repr;
+}
+
+
+std::vector<std::vector<PlannedRun>> groupByKeyRange(const std::vector<PlannedRun> &runs) {
+    std::vector<std::vector<PlannedRun>> groups;
+    if (runs.empty()) { return groups; }
+    for (auto &run : runs) {
+        if (run.minKey.empty() || run.maxKey.empty()) { return {runs}; }
+    }
+
+    // Sweep the runs by their first key, a run starting past the group's last key starts a
+    // new group. Hex keys of equal length compare like the keys.
+    std::vector<PlannedRun> sorted = runs;
+    std::sort(sorted.begin(), sorted.end(), [](const PlannedRun &a, const PlannedRun &b) {
+        if (a.minKey != b.minKey) return a.minKey < b.minKey;
+        return a.filename < b.filename;
+    });
+    std::string groupMax;
+    for (auto &run : sorted) {
+        if (groups.empty() || run.minKey > groupMax) {
+            groups.push_back({});
+            groupMax = run.maxKey;
+        }
+        groups.back().push_back(run);
+        groupMax = std::max(groupMax, run.maxKey);
+    }
+    return groups;
+}
+
+
+/**
+ * @brief Append the Huffman merge tree of one group of runs to the plan
+ */
+static void planGroup(const std::vector<PlannedRun> &runs, int fanIn, MergePlan &plan) {
+    // min-heap on the run size, ties broken by name to keep the plan deterministic
+    auto larger = [](const PlannedRun &a, const PlannedRun &b) {
+        if (a.nRecords != b.nRecords) return a.nRecords > b.nRecords;
+        return a.filename > b.filename;
+    };
+    std::priority_queue<PlannedRun, std::vector<PlannedRun>, decltype(larger)> heap(larger);
+    std::string minKey = runs.front().minKey, maxKey = runs.front().maxKey;
+    for (auto &run : runs) {
+        PlannedRun r = run;
+        r.depth = 0;
+        heap.push(r);
+        minKey = std::min(minKey, run.minKey);
+        maxKey = std::max(maxKey, run.maxKey);
+    }
+
+    // Size the first merge so that every later merge is full
+    size_t nMerge = (runs.size() - 2) % (fanIn - 1) + 2;
+    while (heap.size() > 1) {
+        MergeStep step;
+        int depth = 0;
+        for (size_t i = 0; i < nMerge && !heap.empty(); i++) {
+            step.inputs.push_back(heap.top());
+            step.nRecords += heap.top().nRecords;
+            depth = std::max(depth, heap.top().depth);
+            heap.pop();
+        }
+        plan.nRecordsWritten += step.nRecords;
+        plan.steps.push_back(step);
+
+        // The output of this merge is a new run for the next merges
+        PlannedRun merged = {"merge" + std::to_string(plan.steps.size() - 1), step.nRecords, "",
+                             depth + 1, minKey, maxKey};
+        plan.nPasses = std::max(plan.nPasses, merged.depth);
+        heap.push(merged);
+        nMerge = std::min((size_t)fanIn, heap.size());
+    }
+}
+
+
+MergePlan planMerges(const std::vector<PlannedRun> &runs, int fanIn) {
+    MergePlan plan;
+    if (runs.size() < 2) { return plan; }
+    fanIn = std::max(2, fanIn);
+
+    for (auto &group : groupByKeyRange(runs)) {
+        if (group.size() < 2) {
+            plan.nConcatenated++;
+            continue;
+        }
+        planGroup(group, fanIn, plan);
+    }
+    return plan;
+}
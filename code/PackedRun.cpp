@@ -0,0 +1,280 @@
+#include "PackedRun.h"
+#include "GroupBy.h"
+#include "SortContext.h"
+#include <algorithm>
+
+
+int getPackedOrder(const char *data, RowCount nRecords) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+    const int orderSize = getOrderSize();
+    bool ascending = true, descending = true;
+    for (RowCount i = 1; i < nRecords; i++) {
+        int cmp = std::strncmp(data + (i - 1) * size, data + i * size, orderSize);
+        ascending = ascending && cmp <= 0;
+        descending = descending && cmp >= 0;
+        if (!ascending && !descending) { return 0; }
+    }
+    return ascending ? 1 : -1;
+}
+
+
+void reversePacked(char *data, RowCount nRecords) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+    std::vector<char> temp(size);
+    for (RowCount i = 0, j = nRecords - 1; i < j; i++, j--) {
+        std::memcpy(temp.data(), data + i * size, size);
+        std::memcpy(data + i * size, data + j * size, size);
+        std::memcpy(data + j * size, temp.data(), size);
+    }
+}
+
+
+// =========================================================
+// ---------------------- PackedStream ---------------------
+// =========================================================
+
+
+PackedStream::PackedStream(const char *data, RowCount nRecords)
+    : type(StreamerType::INMEMORY_RUN) {
+    if (nRecords > 0) {
+        current = data;
+        end = data + nRecords * Config::get().RECORD_SIZE;
+    }
+}
+
+
+PackedStream::PackedStream(RunReader *reader, Storage *fromDevice, PageCount readAhead,
+                           bool inputCluster)
+    : type(StreamerType::READER), reader(reader), fromDevice(fromDevice), readAhead(readAhead),
+      inputCluster(inputCluster) {
+    if (readAhead < 1) { // validate
+        throw std::runtime_error("Error: ReadAhead should be at least 1");
+    }
+    if (readAheadPages() == 0) { // validate
+        throw std::runtime_error("ERROR: PackedStream initialized with empty run");
+    }
+    printv("\t\t\tPackedStream initialized with reader %s\n", reader->getFilename().c_str());
+}
+
+
+PackedStream::PackedStream(PackedStream *streamer, Storage *fromDevice, PageCount readAhead)
+    : type(StreamerType::STREAMER), fromDevice(fromDevice), readAhead(readAhead),
+      inputCluster(true), readStreamer(streamer) {
+    if (readAhead < 1) { // validate
+        throw std::runtime_error("Error: ReadAhead should be at least 1");
+    }
+    std::string fname = streamer->getFilename();
+    fname = fname.substr(fname.find_last_of("/") + 1);
+    // runs of different tiers share file names, the buffer files are told apart by the tier
+    writerFilename = fromDevice->getBaseDir() + "/buf_" + streamer->fromDevice->getName() + "_" +
+                     fname;
+    if (readStream() == 0 || readAheadPages() == 0) { // validate
+        throw std::runtime_error("ERROR: PackedStream initialized with empty run");
+    }
+    printv("\t\t\tPackedStream initialized with streamer %s\n", fname.c_str());
+}
+
+
+PackedStream::~PackedStream() {
+    if (type == StreamerType::STREAMER && reader != nullptr) {
+        reader->deleteFile(); // left over if the merge stopped early
+    }
+    delete reader;
+    delete readStreamer;
+}
+
+
+RowCount PackedStream::readAheadPages() {
+    current = end = nullptr;
+    if (reader == nullptr || reader->isConsumed()) { return 0; }
+
+    RowCount nRecordsToRead = readAhead * fromDevice->getPageSizeInRecords();
+    cluster.resize(nRecordsToRead * Config::get().RECORD_SIZE);
+    RowCount nRecordsRead = reader->readRecords(&cluster[0], nRecordsToRead);
+    if (nRecordsRead < nRecordsToRead) {
+        // the end of the file, free its space and close it, its RunManager deletes a run file
+        if (fromDevice->getRole() != TierRole::FINAL) {
+            if (inputCluster) {
+                fromDevice->freeInputCluster(reader->getFilesize());
+            } else {
+                fromDevice->freeSpace(reader->getFilesize());
+            }
+        }
+        if (type == StreamerType::STREAMER) {
+            reader->deleteFile(); // a buffer file, not a run of the RunManager
+        } else {
+            reader->consume();
+        }
+    }
+    if (nRecordsRead > 0) {
+        current = cluster.data();
+        end = current + nRecordsRead * Config::get().RECORD_SIZE;
+    }
+
+    // the read-ahead runs in the background of the merge
+    double accessTime = nRecordsRead > 0 ? fromDevice->chargeAccess(nRecordsRead, true) : 0;
+    printss("\t\tSTATE -> BG: Read %lld records in RAP\n", nRecordsRead);
+    printss("\t\tACCESS -> BG: A read from %s was made with size %llu bytes and latency %.2lf us\n",
+            fromDevice->getName().c_str(), nRecordsRead * Config::get().RECORD_SIZE, accessTime);
+    return nRecordsRead;
+}
+
+
+RowCount PackedStream::readStream() {
+    RowCount nRecords = readStreamer->getReadAheadInRecords();
+    std::vector<char> buffer(nRecords * Config::get().RECORD_SIZE);
+    RowCount count = readStreamer->read(&buffer[0], nRecords);
+    if (count == 0) { return 0; }
+
+    // write the records to the buffer file in `fromDevice`, and read it from the start
+    RunWriter writer(writerFilename); // this opens the file in truncate mode
+    writer.writeRecords(buffer.data(), count);
+    writer.close();
+    delete reader;
+    reader = new RunReader(writerFilename, count, fromDevice->getPageSizeInRecords());
+    if (fromDevice->getRole() != TierRole::FINAL) { fromDevice->fillInputCluster(count); }
+    double accessTime = fromDevice->chargeAccess(count, true);
+    printss("\t\tSTATE -> BG: Wrote %lld records to %s using RS\n", count,
+            writerFilename.c_str());
+    printss("\t\tACCESS -> BG: A write to %s was made with size %llu bytes and latency %.2lf us\n",
+            fromDevice->getName().c_str(), count * Config::get().RECORD_SIZE, accessTime);
+    return count;
+}
+
+
+void PackedStream::refill() {
+    if (type == StreamerType::INMEMORY_RUN) {
+        current = end = nullptr;
+    } else if (readAheadPages() == 0 && type == StreamerType::STREAMER && readStream() > 0) {
+        if (readAheadPages() == 0) { // validate
+            throw std::runtime_error("ERROR: Buffered records but failed to readAhead");
+        }
+    }
+}
+
+
+RowCount PackedStream::read(char *data, RowCount nRecords) {
+    RowCount nRead = 0;
+    while (nRead < nRecords && current != nullptr) {
+        RowCount nInMemory = (end - current) / Config::get().RECORD_SIZE;
+        RowCount n = std::min(nRecords - nRead, nInMemory);
+        int recordSize = Config::get().RECORD_SIZE;
+        std::memcpy(data + nRead * recordSize, current, n * recordSize);
+        nRead += n;
+        current += n * Config::get().RECORD_SIZE;
+        if (current == end) { refill(); }
+    }
+    return nRead;
+}
+
+
+// =========================================================
+// -------------------- PackedLoserTree --------------------
+// =========================================================
+
+
+PackedLoserTree::PackedLoserTree(const std::vector<PackedStream *> &leaves)
+    : leaves(leaves), keys(leaves.size()) {
+    // Leaf i sits at node k + i, the winner of each subtree moves up, its loser stays
+    int k = leaves.size();
+    for (int i = 0; i < k; i++) {
+        encodeLeaf(i);
+    }
+    nodes.assign(std::max(k, 1), 0);
+    std::vector<int> winners(2 * k);
+    for (int i = 0; i < k; i++) {
+        winners[k + i] = i;
+    }
+    for (int n = k - 1; n >= 1; n--) {
+        int a = winners[2 * n], b = winners[2 * n + 1];
+        if (isLess(b, a)) { std::swap(a, b); }
+        winners[n] = a;
+        nodes[n] = b;
+    }
+    if (k > 1) { nodes[0] = winners[1]; }
+}
+
+
+void PackedLoserTree::encodeLeaf(int i) {
+    const char *record = leaves[i]->get();
+    if (record == nullptr || encoder.encode(record, &keys[i])) { return; }
+    encoder.setMode(KeyEncoder::Mode::BINARY);
+    for (size_t j = 0; j < leaves.size(); j++) {
+        if (leaves[j]->get() != nullptr) { encoder.encode(leaves[j]->get(), &keys[j]); }
+    }
+}
+
+
+void PackedLoserTree::pop() {
+    int k = leaves.size();
+    int winner = nodes[0];
+    leaves[winner]->moveNext();
+    encodeLeaf(winner);
+    for (int n = (winner + k) / 2; n >= 1; n /= 2) {
+        if (isLess(nodes[n], winner)) { std::swap(nodes[n], winner); }
+    }
+    nodes[0] = winner;
+}
+
+
+// =========================================================
+// ------------------------- Merge -------------------------
+// =========================================================
+
+
+/**
+ * @brief Write the records of the output buffer to the writer's run in storage
+ */
+static void flushPacked(Storage *storage, RunWriter *writer, const char *data, RowCount nRecords) {
+#if defined(_VALIDATE)
+    if (getPackedOrder(data, nRecords) < 0) {
+        printvv("ERROR: Run is not sorted\n");
+        throw std::runtime_error("Run is not sorted");
+    }
+#endif
+    RowCount nRecord = storage->writeNextChunk(writer, data, nRecords);
+    assert(nRecord == nRecords && "ERROR: Writing packed run");
+    double accessTime = storage->chargeAccess(nRecords);
+    printss("\t\tSTATE -> Merging runs, Spill to %s, %lld records\n",
+            writer->getFilename().c_str(), nRecords);
+    printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+            storage->getName().c_str(), nRecords * Config::get().RECORD_SIZE, accessTime);
+}
+
+
+RowCount mergePackedStreams(const std::vector<PackedStream *> &streams, Storage *storage,
+                            RunWriter *writer, RowCount outBufSize, RowCount maxRecords,
+                            RowCount *nDups) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+    PackedLoserTree loserTree(streams);
+    std::vector<char> buffer(outBufSize * size);
+    char *last = nullptr; // the last record in the buffer
+    RowCount nSorted = 0, nBuffered = 0;
+    *nDups = 0;
+    for (const char *winner = loserTree.peek(); winner != nullptr; winner = loserTree.peek()) {
+        nSorted++;
+        if (nSorted > maxRecords) { // verify the merged run size
+            printvv("ERROR: Merged run size exceeds %lld\n", maxRecords);
+            throw std::runtime_error("Merged run size exceeds");
+        }
+        // Duplicate check
+        if (last != nullptr && absorbRecord(last, winner)) {
+            (*nDups)++;
+            storage->getContext()->counters.nDuplicatesRemoved++;
+            loserTree.pop();
+            continue;
+        }
+        // The last record is final once another one follows, only then is a full buffer written
+        if (nBuffered >= outBufSize) {
+            flushPacked(storage, writer, buffer.data(), nBuffered);
+            nBuffered = 0;
+        }
+        last = &buffer[nBuffered * size];
+        std::memcpy(last, winner, size);
+        nBuffered++;
+        loserTree.pop();
+    }
+    if (nBuffered > 0) { flushPacked(storage, writer, buffer.data(), nBuffered); }
+    flushv();
+    return nSorted;
+}
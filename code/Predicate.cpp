@@ -0,0 +1,134 @@
+#include "Predicate.h"
+#include <cstring>
+#include <stdexcept>
+
+
+// =========================================================
+// --------------------- FilterPredicate -------------------
+// =========================================================
+
+
+static std::string toHex(const std::string &bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c : bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
+
+
+FilterPredicate FilterPredicate::fromConfig() {
+    FilterPredicate predicate;
+    predicate.minKey = Config::get().FILTER_MIN_KEY;
+    predicate.maxKey = Config::get().FILTER_MAX_KEY;
+    predicate.pattern = Config::get().FILTER_PATTERN;
+    predicate.patternOffset = Config::get().FILTER_PATTERN_OFFSET;
+    return predicate;
+}
+
+
+std::string FilterPredicate::repr() const {
+    if (isEmpty()) { return "none"; }
+    std::string repr = "key " + (minKey.empty() ? "-" : toHex(minKey)) + ".." +
+                       (maxKey.empty() ? "-" : toHex(maxKey));
+    if (!pattern.empty()) {
+        repr += " pattern " + toHex(pattern) + "@" + std::to_string(patternOffset);
+    }
+    return repr;
+}
+
+
+// =========================================================
+// ---------------------- FilterKernel ---------------------
+// =========================================================
+
+
+FilterKernel::FilterKernel(const FilterPredicate &predicate) : predicate(predicate) {
+    if (!predicate.pattern.empty() &&
+        (predicate.patternOffset < 0 ||
+         predicate.patternOffset + (ByteCount)predicate.pattern.size() >
+             (ByteCount)Config::get().RECORD_SIZE)) {
+        throw std::runtime_error("ERROR: the filter pattern does not fit in a record");
+    }
+    if (!predicate.minKey.empty() && !predicate.maxKey.empty() &&
+        std::strncmp(predicate.minKey.c_str(), predicate.maxKey.c_str(),
+                     Config::get().RECORD_KEY_SIZE) > 0) {
+        throw std::runtime_error("ERROR: the filter key range is empty");
+    }
+    // Point into the copy owned by the kernel
+    minKey = this->predicate.minKey.c_str();
+    maxKey = this->predicate.maxKey.c_str();
+    pattern = this->predicate.pattern.data();
+    patternOffset = predicate.patternOffset;
+    patternSize = predicate.pattern.size();
+
+    bool hasMin = !predicate.minKey.empty(), hasMax = !predicate.maxKey.empty();
+    if (predicate.pattern.empty()) {
+        if (hasMin && hasMax) {
+            compile<true, true, false>();
+        } else if (hasMin) {
+            compile<true, false, false>();
+        } else if (hasMax) {
+            compile<false, true, false>();
+        } else {
+            compile<false, false, false>();
+        }
+    } else {
+        if (hasMin && hasMax) {
+            compile<true, true, true>();
+        } else if (hasMin) {
+            compile<true, false, true>();
+        } else if (hasMax) {
+            compile<false, true, true>();
+        } else {
+            compile<false, false, true>();
+        }
+    }
+}
+
+
+template <bool MIN, bool MAX, bool PATTERN> void FilterKernel::compile() {
+    testFn = &testRecord<MIN, MAX, PATTERN>;
+    compactFn = &compactRecords<MIN, MAX, PATTERN>;
+    selectFn = &selectRecords<MIN, MAX, PATTERN>;
+}
+
+
+template <bool MIN, bool MAX, bool PATTERN>
+bool FilterKernel::testRecord(const FilterKernel &kernel, const char *record) {
+    return (!MIN || std::strncmp(record, kernel.minKey, Config::get().RECORD_KEY_SIZE) >= 0) &&
+           (!MAX || std::strncmp(record, kernel.maxKey, Config::get().RECORD_KEY_SIZE) <= 0) &&
+           (!PATTERN ||
+            std::memcmp(record + kernel.patternOffset, kernel.pattern, kernel.patternSize) == 0);
+}
+
+
+template <bool MIN, bool MAX, bool PATTERN>
+RowCount FilterKernel::compactRecords(const FilterKernel &kernel, char *data, RowCount nRecords) {
+    const ByteCount recordSize = Config::get().RECORD_SIZE;
+    char *out = data;
+    const char *end = data + nRecords * recordSize;
+    for (const char *record = data; record < end; record += recordSize) {
+        if (!testRecord<MIN, MAX, PATTERN>(kernel, record)) { continue; }
+        if (out != record) { std::memmove(out, record, recordSize); }
+        out += recordSize;
+    }
+    return (out - data) / recordSize;
+}
+
+
+template <bool MIN, bool MAX, bool PATTERN>
+void FilterKernel::selectRecords(const FilterKernel &kernel, Page *page) {
+    const ByteCount recordSize = Config::get().RECORD_SIZE;
+    const char *data = page->getData();
+    std::vector<RowCount> &selection = page->getSelection();
+    size_t nSelected = 0;
+    for (size_t i = 0; i < selection.size(); i++) {
+        if (testRecord<MIN, MAX, PATTERN>(kernel, data + selection[i] * recordSize)) {
+            selection[nSelected++] = selection[i];
+        }
+    }
+    selection.resize(nSelected);
+}
@@ -1,4 +1,5 @@
 #include "Record.h"
+#include "SortContext.h"
 
 
 // =========================================================
@@ -8,38 +9,29 @@
 
 // to string
 char *Record::reprKey() {
-    char *key = new char[Config::RECORD_KEY_SIZE + 1];
-    std::strncpy(key, data, Config::RECORD_KEY_SIZE);
-    key[Config::RECORD_KEY_SIZE] = '\0';
+    char *key = new char[Config::get().RECORD_KEY_SIZE + 1];
+    std::strncpy(key, data, Config::get().RECORD_KEY_SIZE);
+    key[Config::get().RECORD_KEY_SIZE] = '\0';
     return key;
 }
 
 char *Record::repr() {
-    char *key = new char[Config::RECORD_SIZE + 1];
-    std::strncpy(key, data, Config::RECORD_SIZE);
-    key[Config::RECORD_SIZE] = '\0';
+    char *key = new char[Config::get().RECORD_SIZE + 1];
+    std::strncpy(key, data, Config::get().RECORD_SIZE);
+    key[Config::get().RECORD_SIZE] = '\0';
     return key;
 }
 
 bool Record::isValid() {
     if (data == nullptr) return false;
     if (this == getMaxRecord()) return true;
-    for (int i = 0; i < Config::RECORD_SIZE; i++) {
+    for (int i = 0; i < Config::get().RECORD_SIZE; i++) {
         if (!isalnum(data[i])) return false;
     }
     return true;
 }
 
-Record *MAX_RECORD = nullptr;
-Record *getMaxRecord() {
-    if (MAX_RECORD == nullptr) {
-        MAX_RECORD = new Record();
-        for (int i = 0; i < Config::RECORD_SIZE; i++) {
-            MAX_RECORD->data[i] = '~';
-        }
-    }
-    return MAX_RECORD;
-}
+Record *getMaxRecord() { return SortContext::get()->getMaxRecord(); }
 bool isRecordMax(Record *r) {
     char a = getMaxRecord()->data[0];
     char b = r->data[0];
@@ -63,7 +55,7 @@ Record *RunReader::readNextRecords(RowCount *nRecords) {
     Record *curr = head;
 
     // Read records page by page
-    ByteCount nBytesToRead = this->PAGE_SIZE_IN_RECORDS * Config::RECORD_SIZE;
+    ByteCount nBytesToRead = this->PAGE_SIZE_IN_RECORDS * Config::get().RECORD_SIZE;
     char *recData = new char[nBytesToRead];
     while (nRecordsReadSoFar < nRecordsToRead) {
 
@@ -74,7 +66,7 @@ Record *RunReader::readNextRecords(RowCount *nRecords) {
 
         if (nBytesRead == 0) { break; }
 
-        if (nBytesRead % Config::RECORD_SIZE != 0) {
+        if (nBytesRead % Config::get().RECORD_SIZE != 0) {
             delete[] recData;
             std::string msg = "Error: Read " + std::to_string(nBytesRead) +
                               " bytes, not aligned with record size";
@@ -83,8 +75,8 @@ Record *RunReader::readNextRecords(RowCount *nRecords) {
         }
 
         // Create a linked list of records
-        for (RowCount i = 0; i < nBytesRead / Config::RECORD_SIZE; i++) {
-            Record *rec = new Record(recData + i * Config::RECORD_SIZE);
+        for (RowCount i = 0; i < nBytesRead / Config::get().RECORD_SIZE; i++) {
+            Record *rec = new Record(recData + i * Config::get().RECORD_SIZE);
             curr->next = rec;
             curr = rec;
             nRecordsReadSoFar++;
@@ -104,11 +96,97 @@ Record *RunReader::readNextRecords(RowCount *nRecords) {
 }
 
 
+RowCount RunReader::readRecords(char *data, RowCount nRecords) {
+    if (_is.eof()) { return 0; }
+    _is.read(data, nRecords * Config::get().RECORD_SIZE);
+    ByteCount nBytesRead = _is.gcount();
+    if (nBytesRead % Config::get().RECORD_SIZE != 0) {
+        std::string msg = "Error: Read " + std::to_string(nBytesRead) +
+                          " bytes, not aligned with record size";
+        printv("%s\n", msg.c_str());
+        throw std::runtime_error(msg);
+    }
+    _nRecordsRead += nBytesRead / Config::get().RECORD_SIZE;
+    return nBytesRead / Config::get().RECORD_SIZE;
+}
+
+
 // =========================================================
 // ----------------------- RunWriter -----------------------
 // =========================================================
 
 
+uint64_t checksumRecords(uint64_t checksum, const char *data, RowCount nRecords) {
+    // FNV-1a over 8-byte words, the last word of a record is padded with zeros
+    for (RowCount r = 0; r < nRecords; r++) {
+        const char *record = data + r * Config::get().RECORD_SIZE;
+        for (int i = 0; i < Config::get().RECORD_SIZE; i += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            int n = std::min<int>(sizeof(uint64_t), Config::get().RECORD_SIZE - i);
+            std::memcpy(&word, record + i, n);
+            checksum = (checksum ^ word) * 0x100000001b3ULL;
+        }
+    }
+    return checksum;
+}
+
+
+static std::string hexKey(const char *record) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (int i = 0; i < Config::get().RECORD_KEY_SIZE; i++) {
+        unsigned char c = record[i];
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
+
+
+RunInfo describeSortedFile(const std::string &filename) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is) { throw std::runtime_error("ERROR: sorted file " + filename + " does not exist"); }
+    is.seekg(0, std::ios::end);
+    ByteCount size = is.tellg();
+    if (size % Config::get().RECORD_SIZE != 0) {
+        throw std::runtime_error("ERROR: size of " + filename +
+                                 " is not a multiple of the record size");
+    }
+
+    RunInfo info;
+    info.filename = filename;
+    info.nRecords = size / Config::get().RECORD_SIZE;
+    info.checksum = NO_CHECKSUM;
+    if (info.nRecords == 0) { return info; }
+
+    std::vector<char> record(Config::get().RECORD_SIZE);
+    auto readKey = [&](RowCount i) {
+        is.seekg(i * Config::get().RECORD_SIZE);
+        is.read(record.data(), Config::get().RECORD_SIZE);
+        if (!is) { throw std::runtime_error("ERROR: reading " + filename); }
+        return hexKey(record.data());
+    };
+    for (RowCount i = 0; i < info.nRecords; i += FENCE_INTERVAL) {
+        info.fences.push_back(readKey(i));
+    }
+    info.minKey = info.fences.front();
+    info.maxKey = readKey(info.nRecords - 1);
+    return info;
+}
+
+
+void RunWriter::track(const char *data, RowCount nRecords) {
+    if (nRecords == 0) { return; }
+    if (currSize == 0) { _minKey = hexKey(data); }
+    _maxKey = hexKey(data + (nRecords - 1) * Config::get().RECORD_SIZE);
+    RowCount first = (FENCE_INTERVAL - currSize % FENCE_INTERVAL) % FENCE_INTERVAL;
+    for (RowCount i = first; i < nRecords; i += FENCE_INTERVAL) {
+        _fences.push_back(hexKey(data + i * Config::get().RECORD_SIZE));
+    }
+    _checksum = checksumRecords(_checksum, data, nRecords);
+}
+
+
 RowCount RunWriter::writeFromFile(std::string writeFromFilename, RowCount toCopyNRecords) {
 
     // Open the given file
@@ -116,21 +194,21 @@ RowCount RunWriter::writeFromFile(std::string writeFromFilename, RowCount toCopy
     if (!is) { throw std::runtime_error("Error: Opening file " + writeFromFilename); }
 
     // Copy the records from the given file to this writer's file
-    ByteCount bufSize = RoundUp(1024 * 1024, Config::RECORD_SIZE);
+    ByteCount bufSize = RoundUp(1024 * 1024, Config::get().RECORD_SIZE);
     char *buffer = new char[bufSize];
     ByteCount total = 0;
     while (is) {
         is.read(buffer, bufSize);
         ByteCount n = is.gcount();
         _os.write(buffer, n);
+        track(buffer, n / Config::get().RECORD_SIZE);
+        currSize += n / Config::get().RECORD_SIZE;
         total += n;
     }
     delete[] buffer;
     if (!_os) { throw std::runtime_error("Error: Writing to file"); }
 
-    // Update the writer's size
-    RowCount nRecords = total / Config::RECORD_SIZE;
-    currSize += nRecords;
+    RowCount nRecords = total / Config::get().RECORD_SIZE;
 
     printv("\t\t\t\tRunWriter copied %llu out of %llu records from %s to %s\n", nRecords,
            toCopyNRecords, writeFromFilename.c_str(), _filename.c_str());
@@ -147,11 +225,17 @@ RowCount RunWriter::writeFromFile(std::string writeFromFilename, RowCount toCopy
 RowCount RunWriter::writeNextRun(Run *run) {
 
     char *data = run->getAllData();
-    RowCount nRecords = run->getSize();
-    _os.write(data, nRecords * Config::RECORD_SIZE);
-    if (!_os) { throw std::runtime_error("Error: Writing to file"); }
-    currSize += nRecords;
+    RowCount nRecords = writeRecords(data, run->getSize());
     delete[] data;
     return nRecords;
 
-} // writeNextRun
\ No newline at end of file
+} // writeNextRun
+
+
+RowCount RunWriter::writeRecords(const char *data, RowCount nRecords) {
+    _os.write(data, nRecords * Config::get().RECORD_SIZE);
+    if (!_os) { throw std::runtime_error("Error: Writing to file"); }
+    track(data, nRecords);
+    currSize += nRecords;
+    return nRecords;
+} // writeRecords
\ No newline at end of file
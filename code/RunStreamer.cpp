@@ -22,6 +22,7 @@ RunStreamer::~RunStreamer() {
         printv("\t\t\t\tRunStreamer %s destroyed\n", repr().c_str());
     } else if (type == StreamerType::STREAMER) {
         if (reader != nullptr) {
+            reader->deleteFile(); // left over if the merge stopped early
             delete reader;
             reader = nullptr;
         }
@@ -30,6 +31,12 @@ RunStreamer::~RunStreamer() {
             readStreamer = nullptr;
         }
         printv("\t\t\t\tRunStreamer %s destroyed\n", repr().c_str());
+    } else if (type == StreamerType::LOSERTREE) {
+        // the leaves of the tree are owned by the caller that created them
+        if (tree != nullptr) {
+            delete tree;
+            tree = nullptr;
+        }
     }
 }
 
@@ -112,7 +119,7 @@ RowCount RunStreamer::readAheadPages(PageCount nPages) {
         // flushv();
         return 0;
     }
-    if (reader->isDeletedFile()) {
+    if (reader->isConsumed()) {
         // printv("\t\t\t\tRunStreamer Reader is deleted\n");
         // flushv();
         return 0;
@@ -128,21 +135,24 @@ RowCount RunStreamer::readAheadPages(PageCount nPages) {
     if (nRecordsRead < nRecordsToRead) {
         /**
          * 1.1 if less than `nRecordsToRead` records are read, that means the reader has reached the
-         * end of the file. So, close the reader and delete the file
+         * end of the file. So, close the reader, its RunManager deletes the file
          */
-        if (!reader->isDeletedFile()) {
-            printv("\t\t\t\tFreeingSpace for %lld records and deleting %s from %s\n",
+        if (!reader->isConsumed()) {
+            printv("\t\t\t\tFreeingSpace for %lld records and consuming %s from %s\n",
                    reader->getFilesize(), reader->getFilename().c_str(),
                    fromDevice->getName().c_str());
-            if (fromDevice->getName() != DISK_NAME) {
+            if (fromDevice->getRole() != TierRole::FINAL) {
                 if (inputCluster) { // free space in input cluster
                     fromDevice->freeInputCluster(reader->getFilesize());
                 } else { // free general space
                     fromDevice->freeSpace(reader->getFilesize());
                 }
             }
-            reader->close();
-            reader->deleteFile();
+            if (type == StreamerType::STREAMER) {
+                reader->deleteFile(); // a buffer file, not a run of the RunManager
+            } else {
+                reader->consume();
+            }
         }
     }
     /**
@@ -160,10 +170,11 @@ RowCount RunStreamer::readAheadPages(PageCount nPages) {
     printv("\t\t\t\tRunStreamer Read %lld records from reader %s, expected %lld records, readSoFar "
            "%lld\n",
            nRecordsRead, reader->getFilename().c_str(), nRecordsToRead, readSoFar);
+    // the read-ahead runs in the background of the merge
+    double accessTime = nRecordsRead > 0 ? fromDevice->chargeAccess(nRecordsRead, true) : 0;
     printss("\t\tSTATE -> BG: Read %lld records in RAP\n", nRecordsRead);
     printss("\t\tACCESS -> BG: A read from %s was made with size %llu bytes and latency %.2lf us\n",
-            fromDevice->getName().c_str(), nRecordsRead * Config::RECORD_SIZE,
-            fromDevice->getAccessTimeInMicro(nRecordsRead));
+            fromDevice->getName().c_str(), nRecordsRead * Config::get().RECORD_SIZE, accessTime);
     flushv();
     return nRecordsRead;
 }
@@ -190,6 +201,7 @@ Record *RunStreamer::moveNextForReader() {
          * 2. set the current record to the head of the run
          */
         currentRecord = run->getHead();
+        PREFETCH(currentRecord->data);
         nextRecord = currentRecord->next;
     } else {
         /**
@@ -224,7 +236,9 @@ RunStreamer::RunStreamer(StreamerType type, RunStreamer *streamer, Storage *from
      */
     std::string fname = streamer->getFilename();
     fname = fname.substr(fname.find_last_of("/") + 1);
-    writerFilename = fromDevice->getBaseDir() + "/buf_" + fname;
+    // runs of different tiers share file names, the buffer files are told apart by the tier
+    writerFilename = fromDevice->getBaseDir() + "/buf_" + streamer->fromDevice->getName() + "_" +
+                     fname;
     /**
      * 2. store `nInBufRecords` Records in a buffer file in `fromDevice`
      */
@@ -304,18 +318,18 @@ RowCount RunStreamer::readStream(RowCount nRecords, bool firstTime) {
         /**
          * 3. update the input cluster space of the `fromDevice`
          */
-        if (fromDevice->getName() != DISK_NAME) {
+        if (fromDevice->getRole() != TierRole::FINAL) {
             fromDevice->fillInputCluster(count);
         }
         printv("\t\t\t\tFillingSpace for %lld records in %s\n", count,
                fromDevice->getName().c_str());
         // print access time
+        double accessTime = fromDevice->chargeAccess(count, true);
         printss("\t\tSTATE -> BG: Wrote %lld records to %s using RS\n", count,
                 writerFilename.c_str());
         printss(
             "\t\tACCESS -> BG: A write to %s was made with size %llu bytes and latency %.2lf us\n",
-            fromDevice->getName().c_str(), count * Config::RECORD_SIZE,
-            fromDevice->getAccessTimeInMicro(count));
+            fromDevice->getName().c_str(), count * Config::get().RECORD_SIZE, accessTime);
         flushv();
     }
     // free memory
@@ -377,17 +391,50 @@ Record *RunStreamer::moveNextForStreamer() {
 }
 
 
+// -------------------- Stream from LoserTree --------------------
+
+
+/**
+ * Runstreamer for the output of a loser tree, used as a leaf of a higher-level tree
+ */
+RunStreamer::RunStreamer(StreamerType type, LoserTree *tree) : type(type), tree(tree) {
+    assert(type == StreamerType::LOSERTREE); // validate
+    /**
+     * set the current record to the first winner of the tree
+     */
+    nextRecord = nullptr;
+    currentRecord = tree->getNext();
+    if (currentRecord == nullptr) { // validate
+        throw std::runtime_error("ERROR: RunStreamer initialized with empty loser tree");
+    }
+}
+
+Record *RunStreamer::moveNextForTree() {
+    /**
+     * the winner is handed to the caller, the tree has already advanced its leaf
+     */
+    currentRecord = tree->getNext();
+    return currentRecord;
+}
+
+
 // -------------------- Move Next --------------------
 
 
 Record *RunStreamer::moveNext() {
+    Record *rec = nullptr;
     if (type == StreamerType::INMEMORY_RUN) {
-        return moveNextForRun();
+        rec = moveNextForRun();
     } else if (type == StreamerType::READER) {
-        return moveNextForReader();
+        rec = moveNextForReader();
     } else if (type == StreamerType::STREAMER) {
-        return moveNextForStreamer();
+        rec = moveNextForStreamer();
+    } else if (type == StreamerType::LOSERTREE) {
+        rec = moveNextForTree();
     } else {
         throw std::runtime_error("Error: Invalid StreamerType");
     }
+    // keep one record ahead in cache for the next comparison in the loser tree
+    prefetchNext();
+    return rec;
 }
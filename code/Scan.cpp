@@ -44,11 +44,11 @@ RowCount genInput(const std::string &filename, const RowCount count) {
     traceprintf("generating input file '%s'\n", filename.c_str());
     std::string tmpfilename = filename + ".tmp";
     std::ofstream input_file(tmpfilename, std::ios::binary);
-    char *record = new char[Config::RECORD_SIZE];
+    char *record = new char[Config::get().RECORD_SIZE];
     for (RowCount i = 0; i < count; i++) {
-        gen_a_record(record, Config::RECORD_SIZE);
-        record[Config::RECORD_SIZE - 1] = '\n'; // TODO: remove later
-        input_file.write(record, Config::RECORD_SIZE);
+        gen_a_record(record, Config::get().RECORD_SIZE);
+        record[Config::get().RECORD_SIZE - 1] = '\n'; // TODO: remove later
+        input_file.write(record, Config::get().RECORD_SIZE);
     }
     input_file.close();
     // rename the file
@@ -74,60 +74,60 @@ RowCount genInputBatch(const std::string &filename, const RowCount count) {
 
     // Calculate batch size and number of batches
     RowCount batchSize = 4096;
-    if (batchSize * Config::RECORD_SIZE > 1024*1024*1024) {
-        batchSize = 1024*1024*1024 / Config::RECORD_SIZE;
+    if (batchSize * Config::get().RECORD_SIZE > 1024*1024*1024) {
+        batchSize = 1024*1024*1024 / Config::get().RECORD_SIZE;
         batchSize = std::min(batchSize, (RowCount) 2);
     }
     batchSize = std::min(batchSize, count);
     if (batchSize % 2 != 0) { batchSize--; }
     RowCount nBatches = batchSize == 0 ? 0 : (count / batchSize);
     // Allocate buffer for batch records
-    char *buffer = new char[Config::RECORD_SIZE * batchSize];
+    char *buffer = new char[Config::get().RECORD_SIZE * batchSize];
     RowCount n = 0;
     RowCount dup = 0;
     for (RowCount i = 0; i < nBatches; i++) {
         char *record = buffer;
 #if defined(_DUP_GEN)
         for (RowCount j = 0; j < batchSize / 2; j++) {
-            gen_a_record(record, Config::RECORD_SIZE);
-            record[Config::RECORD_SIZE - 1] = '\n'; // TODO: remove later
+            gen_a_record(record, Config::get().RECORD_SIZE);
+            record[Config::get().RECORD_SIZE - 1] = '\n'; // TODO: remove later
             n++;
-            record += Config::RECORD_SIZE;
+            record += Config::get().RECORD_SIZE;
             // Duplicate the record
-            memcpy(record, record - Config::RECORD_SIZE, Config::RECORD_SIZE);
+            memcpy(record, record - Config::get().RECORD_SIZE, Config::get().RECORD_SIZE);
             dup++;
             n++;
-            record += Config::RECORD_SIZE;
+            record += Config::get().RECORD_SIZE;
         }
 #else
         for (RowCount j = 0; j < batchSize; j++) {
-            gen_a_record(record, Config::RECORD_SIZE);
-            record[Config::RECORD_SIZE - 1] = '\n'; // TODO: remove later
+            gen_a_record(record, Config::get().RECORD_SIZE);
+            record[Config::get().RECORD_SIZE - 1] = '\n'; // TODO: remove later
             n++;
-            record += Config::RECORD_SIZE;
+            record += Config::get().RECORD_SIZE;
         }
 #endif
-        input_file.write(buffer, Config::RECORD_SIZE * batchSize);
+        input_file.write(buffer, Config::get().RECORD_SIZE * batchSize);
     }
     // free memory
     delete[] buffer;
     batchSize = count - n;
-    buffer = new char[Config::RECORD_SIZE * batchSize];
+    buffer = new char[Config::get().RECORD_SIZE * batchSize];
     if (batchSize > 0) {
         char *record = buffer;
         for (RowCount j = 0; j < batchSize; j++) {
-            gen_a_record(record, Config::RECORD_SIZE);
-            record[Config::RECORD_SIZE - 1] = '\n'; // TODO: remove later
+            gen_a_record(record, Config::get().RECORD_SIZE);
+            record[Config::get().RECORD_SIZE - 1] = '\n'; // TODO: remove later
             n++;
-            record += Config::RECORD_SIZE;
+            record += Config::get().RECORD_SIZE;
         }
-        input_file.write(buffer, Config::RECORD_SIZE * batchSize);
+        input_file.write(buffer, Config::get().RECORD_SIZE * batchSize);
         // printv("%lld\n", n);
     }
     input_file.close();
     // rename the file
     rename(tmpfilename.c_str(), filename.c_str());
-    Config::NUM_DUPLICATES = dup;
+    Config::get().NUM_DUPLICATES = dup;
     printvv("Generated %lu records (%lu of them are duplicate) in %s\n", n, dup, filename.c_str());
 
     // free memory
@@ -149,6 +149,12 @@ ScanIterator::ScanIterator(ScanPlan const *const plan) : _plan(plan), _count(0)
 
 
     if (!std::ifstream(plan->_filename.c_str())) {
+        // The runs to resume from were sorted from the missing input
+        if (Config::get().RESUME) {
+            throw std::runtime_error("ERROR: cannot resume, input file " + plan->_filename +
+                                     " does not exist");
+        }
+
         // Generate input file
         printvv("========== INPUT_GEN START ========\n");
         flushvv();
@@ -173,7 +179,7 @@ ScanIterator::ScanIterator(ScanPlan const *const plan) : _plan(plan), _count(0)
 
     // NOTE: did not update HDD usage value since its capacity is infinite
     printv("\tinput file %s, size %s\n", _plan->_filename.c_str(),
-           getSizeDetails(_plan->_count * Config::RECORD_SIZE).c_str());
+           getSizeDetails(_plan->_count * Config::get().RECORD_SIZE).c_str());
     printv("\tinput file has %llu records\n", _plan->_count);
 
 } // ScanIterator::ScanIterator
@@ -181,17 +187,51 @@ ScanIterator::ScanIterator(ScanPlan const *const plan) : _plan(plan), _count(0)
 
 ScanIterator::~ScanIterator() {
     // TRACE(true);
+    delete _page;
 } // ScanIterator::~ScanIterator
 
 bool ScanIterator::next() {
     // TRACE(true);
-    return false;
+    if (_page != nullptr && ++_position < _page->getSelectedCount()) { return true; }
+    if (_page == nullptr) { _page = new Page(getPageSizeInRecords()); }
+    _position = 0;
+    return readPage(_page);
 } // ScanIterator::next
 
 void ScanIterator::getRecord(Record *r) {
     // TRACE(true);
+    std::memcpy(r->data, _page->getSelected(_position), Config::get().RECORD_SIZE);
 }
 
-void ScanIterator::getPage(Page *p) {
+bool ScanIterator::getPage(Page *p) {
     // TRACE(true);
+    // Hand over what is left of the page of next() first
+    if (_page != nullptr && _position + 1 < _page->getSelectedCount()) {
+        p->clear();
+        while (++_position < _page->getSelectedCount()) {
+            p->append(_page->getSelected(_position));
+        }
+        _page->clear();
+        _position = 0;
+        return true;
+    }
+    return readPage(p);
 } // ScanIterator::getPage
+
+bool ScanIterator::readPage(Page *p) {
+    p->clear();
+    RowCount n = std::min(p->getCapacityInRecords(), _plan->_count - _count);
+    if (n == 0) { return false; }
+    if (!_file.is_open()) {
+        _file.open(_plan->_filename, std::ios::binary);
+        _file.seekg(_count * Config::get().RECORD_SIZE, std::ios::beg);
+    }
+    _file.read(p->getData(), n * Config::get().RECORD_SIZE);
+    if (_file.gcount() != (std::streamsize)(n * Config::get().RECORD_SIZE)) {
+        throw std::runtime_error("ERROR: input file " + _plan->_filename + " has less than " +
+                                 std::to_string(_plan->_count) + " records");
+    }
+    p->setSize(n);
+    _count += n;
+    return true;
+} // ScanIterator::readPage
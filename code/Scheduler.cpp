@@ -0,0 +1,303 @@
+#include "Scheduler.h"
+#include "SortContext.h"
+#include <stdexcept>
+
+
+// =========================================================
+// --------------------- SortScheduler ---------------------
+// =========================================================
+
+
+/**
+ * @brief Split the budget by weight, each share between the minimum and its demand.
+ * What the capped shares leave is split again among the others.
+ */
+static std::vector<ByteCount> shareBudget(ByteCount budget, const std::vector<double> &weights,
+                                          const std::vector<ByteCount> &demands,
+                                          ByteCount minimum) {
+    size_t n = weights.size();
+    std::vector<ByteCount> shares(n, minimum);
+    std::vector<bool> capped(n, false);
+    ByteCount left = budget > n * minimum ? budget - n * minimum : 0;
+    while (left > 0) {
+        double totalWeight = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!capped[i]) { totalWeight += weights[i]; }
+        }
+        if (totalWeight == 0) { break; }
+
+        ByteCount given = 0;
+        bool newlyCapped = false;
+        for (size_t i = 0; i < n; i++) {
+            if (capped[i]) { continue; }
+            ByteCount extra = (ByteCount)(left * (weights[i] / totalWeight));
+            if (shares[i] + extra >= demands[i]) {
+                extra = demands[i] > shares[i] ? demands[i] - shares[i] : 0;
+                capped[i] = newlyCapped = true;
+            }
+            shares[i] += extra;
+            given += extra;
+        }
+        left -= std::min(left, given);
+        if (!newlyCapped) { break; }
+    }
+    return shares;
+}
+
+
+SortScheduler::SortScheduler(const SchedulerConfig &config) : config(config) {
+    if (config.maxJobs < 1 || config.memoryBudget == 0 || config.stagingBudget == 0) {
+        throw std::runtime_error("ERROR: the scheduler needs a job slot and a budget per tier");
+    }
+    if (this->config.minMemory == 0) {
+        this->config.minMemory = config.memoryBudget / (2 * config.maxJobs);
+    }
+    if (this->config.minStaging == 0) {
+        this->config.minStaging = config.stagingBudget / (2 * config.maxJobs);
+    }
+    // The staging tier receives whole memory loads, see onStep()
+    if (this->config.minStaging < 2 * this->config.minMemory) {
+        throw std::runtime_error("ERROR: the minimum staging quota is less than twice the "
+                                 "minimum memory quota");
+    }
+}
+
+
+int SortScheduler::submit(const SortConfig &sortConfig, const SortFiles &files) {
+    std::unique_ptr<Job> job(new Job());
+    job->id = jobs.size();
+    job->config = sortConfig;
+    job->files = files;
+    ByteCount inputSize = getFileSize(files.input);
+    job->inputSize = inputSize == (ByteCount)-1 ? 0 : inputSize; // fails when it starts
+    if (job->config.tiers.size() < 2) {
+        throw std::runtime_error("ERROR: a job needs a memory and a staging tier");
+    }
+    // Jobs must not share run directories and traces
+    if (job->config.runDir.empty()) {
+        job->config.runDir = "job" + std::to_string(job->id);
+        job->config.traceFile = job->config.runDir + "/" + job->config.traceFile;
+    }
+    Job *const self = job.get();
+    job->config.onStep = [this, self](SortContext &context, const std::string &phase) {
+        onStep(self, context, phase);
+    };
+    job->config.onDone = [this, self]() { onDone(self); };
+    jobs.push_back(std::move(job));
+    return jobs.back()->id;
+}
+
+
+ByteCount SortScheduler::getUsedMemory() const {
+    ByteCount used = 0;
+    for (auto &job : jobs) {
+        used += job->memory;
+    }
+    return used;
+}
+
+
+ByteCount SortScheduler::getUsedStaging() const {
+    ByteCount used = 0;
+    for (auto &job : jobs) {
+        used += job->staging;
+    }
+    return used;
+}
+
+
+ByteCount SortScheduler::getFreeMemory() const {
+    ByteCount used = getUsedMemory();
+    return used < config.memoryBudget ? config.memoryBudget - used : 0;
+}
+
+
+ByteCount SortScheduler::getFreeStaging() const {
+    ByteCount used = getUsedStaging();
+    return used < config.stagingBudget ? config.stagingBudget - used : 0;
+}
+
+
+void SortScheduler::updatePeaks() {
+    peakMemory = std::max(peakMemory, getUsedMemory());
+    peakStaging = std::max(peakStaging, getUsedStaging());
+}
+
+
+void SortScheduler::getTargets(std::vector<Job *> &candidates, std::vector<ByteCount> &memory,
+                               std::vector<ByteCount> &staging) const {
+    // The running jobs, and the waiting jobs that fill the free slots next
+    int nRunning = 0;
+    for (auto &job : jobs) {
+        if (job->state == JobState::RUN_GENERATION || job->state == JobState::MERGING) {
+            candidates.push_back(job.get());
+            nRunning++;
+        }
+    }
+    for (auto &job : jobs) {
+        if (nRunning >= config.maxJobs) { break; }
+        if (job->state == JobState::WAITING) {
+            candidates.push_back(job.get());
+            nRunning++;
+        }
+    }
+
+    std::vector<double> memoryWeights, stagingWeights;
+    std::vector<ByteCount> memoryDemands, stagingDemands;
+    for (Job *job : candidates) {
+        bool merging = job->state == JobState::MERGING;
+        memoryWeights.push_back(merging ? 1 : 2);
+        stagingWeights.push_back(merging ? 2 : 1);
+        memoryDemands.push_back(std::max(config.minMemory, job->inputSize));
+        stagingDemands.push_back(std::max(config.minStaging, 2 * job->inputSize));
+    }
+    memory = shareBudget(config.memoryBudget, memoryWeights, memoryDemands, config.minMemory);
+    staging = shareBudget(config.stagingBudget, stagingWeights, stagingDemands, config.minStaging);
+}
+
+
+void SortScheduler::admitJobs() {
+    std::vector<Job *> candidates;
+    std::vector<ByteCount> memoryTargets, stagingTargets;
+    getTargets(candidates, memoryTargets, stagingTargets);
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        Job *job = candidates[i];
+        if (job->state != JobState::WAITING) { continue; }
+
+        // Start within the free capacity, the running jobs release theirs at their next step
+        ByteCount memory = std::min(memoryTargets[i], getFreeMemory());
+        ByteCount staging = std::min(stagingTargets[i], getFreeStaging());
+        memory = std::min(memory, staging / 2);
+        if (memory < config.minMemory || staging < config.minStaging) { break; }
+
+        job->memory = memory;
+        job->staging = staging;
+        job->config.tiers[0].capacity = memory;
+        job->config.tiers[1].capacity = staging;
+        job->state = JobState::RUN_GENERATION;
+        updatePeaks();
+        printvv("\tSCHEDULER: started job %d (%s, %lld MB), memory %lld MB, staging %lld MB\n",
+                job->id, job->files.input.c_str(), BYTE_TO_MB(job->inputSize),
+                BYTE_TO_MB(memory), BYTE_TO_MB(staging));
+        flushvv();
+        job->sorter.reset(new ExternalSorter(job->config, job->files));
+        job->sorter->start();
+    }
+}
+
+
+void SortScheduler::onStep(Job *job, SortContext &context, const std::string &phase) {
+    DRAM *_dram = context.getDRAM();
+    PersistentTier *_ssd = context.getStagingTier();
+    const int recordSize = Config::get().RECORD_SIZE;
+    ByteCount storedInMemory = (ByteCount)_dram->getTotalFilledSpaceInRecords() * recordSize;
+    ByteCount stored = (ByteCount)_ssd->getTotalFilledSpaceInRecords() * recordSize;
+    std::unique_lock<std::mutex> lock(mutex);
+    job->state = phase == "MERGE" ? JobState::MERGING : JobState::RUN_GENERATION;
+
+    // The quotas never exceed the budgets: a job whose stored records need more than it holds
+    // and what is free waits for other jobs to release capacity
+    auto isAvailable = [&]() {
+        return storedInMemory <= job->memory + getFreeMemory() &&
+               stored <= job->staging + getFreeStaging();
+    };
+    if (!isAvailable()) {
+        printvv("\tSCHEDULER: job %d in %s waits for %lld MB of memory, %lld MB of staging\n",
+                job->id, phase.c_str(), BYTE_TO_MB(storedInMemory), BYTE_TO_MB(stored));
+        flushvv();
+        changed.wait(lock, isAvailable);
+    }
+
+    std::vector<Job *> candidates;
+    std::vector<ByteCount> memoryTargets, stagingTargets;
+    getTargets(candidates, memoryTargets, stagingTargets);
+    size_t i = std::find(candidates.begin(), candidates.end(), job) - candidates.begin();
+
+    // Shrink right away, grow only into what the other jobs have released
+    ByteCount availableMemory = job->memory + getFreeMemory();
+    ByteCount availableStaging = job->staging + getFreeStaging();
+    ByteCount staging = std::min(stagingTargets[i], availableStaging);
+    staging = std::max(staging, stored);
+    ByteCount memory = std::min(memoryTargets[i], staging / 2);
+    memory = std::min(std::max(memory, std::max(config.minMemory, storedInMemory)),
+                      availableMemory);
+    if (memory == job->memory && staging == job->staging) { return; }
+
+    printvv("\tSCHEDULER: job %d in %s, memory %lld MB, staging %lld MB\n", job->id,
+            phase.c_str(), BYTE_TO_MB(memory), BYTE_TO_MB(staging));
+    // Record what the tiers applied, they do not shrink below their stored records
+    job->memory = _dram->resize(memory);
+    job->staging = _ssd->resize(staging);
+    updatePeaks();
+    changed.notify_all();
+}
+
+
+void SortScheduler::onDone(Job *job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    job->state = JobState::FINISHED;
+    job->memory = 0;
+    job->staging = 0;
+    changed.notify_all();
+}
+
+
+std::vector<SortStats> SortScheduler::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // Collect the finished jobs first, so the trace shows their slots freed before reuse
+        bool pending = false;
+        bool collected = false;
+        for (auto &job : jobs) {
+            if (job->state == JobState::FINISHED) {
+                // The sorter has left onDone(), joining it does not need the lock
+                lock.unlock();
+                try {
+                    job->stats = job->sorter->wait();
+                } catch (const std::exception &e) {
+                    job->error = e.what();
+                }
+                lock.lock();
+                job->sorter.reset();
+                job->state = JobState::COLLECTED;
+                printvv("\tSCHEDULER: finished job %d%s%s\n", job->id,
+                        job->error.empty() ? "" : ", ", job->error.c_str());
+                flushvv();
+                collected = true;
+            }
+            pending = pending || job->state != JobState::COLLECTED;
+        }
+        if (!pending) { break; }
+        // Other jobs may have finished while the lock was released
+        if (collected) { continue; }
+        admitJobs();
+        changed.wait(lock);
+    }
+
+    std::vector<SortStats> stats;
+    for (auto &job : jobs) {
+        stats.push_back(job->stats);
+    }
+    return stats;
+}
+
+
+void SortScheduler::print() const {
+    printvv("SCHEDULER: %d jobs, memory budget %lld MB, staging budget %lld MB, %d slots\n",
+            (int)jobs.size(), BYTE_TO_MB(config.memoryBudget), BYTE_TO_MB(config.stagingBudget),
+            config.maxJobs);
+    printvv("\tpeak quotas: memory %lld MB, staging %lld MB\n", BYTE_TO_MB(peakMemory),
+            BYTE_TO_MB(peakStaging));
+    for (auto &job : jobs) {
+        if (!job->error.empty()) {
+            printvv("\tjob %d: %s failed, %s\n", job->id, job->files.input.c_str(),
+                    job->error.c_str());
+            continue;
+        }
+        printvv("\tjob %d: %s, %lld records in %.2lf seconds, modeled %.2lf seconds\n", job->id,
+                job->files.input.c_str(), job->stats.nRecords, job->stats.durationInSec,
+                job->stats.modeledTimeInSec);
+    }
+    flushvv();
+}
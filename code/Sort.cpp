@@ -1,11 +1,17 @@
 #include "Sort.h"
+#include "Filter.h"
+#include "SortContext.h"
 #include <chrono>
+#include <map>
 
 // ============================================================================
 // ---------------------------------- SortPlan --------------------------------
 // ============================================================================
 
-SortPlan::SortPlan(Plan *const input) : _input(input) { TRACE(true); } // SortPlan::SortPlan
+SortPlan::SortPlan(Plan *const input, StepHook onStep, bool stream)
+    : _input(input), _onStep(onStep), _stream(stream) {
+    TRACE(true);
+} // SortPlan::SortPlan
 
 SortPlan::~SortPlan() {
     TRACE(true);
@@ -24,125 +30,307 @@ Iterator *SortPlan::init() const {
 
 
 SortIterator::SortIterator(SortPlan const *const plan)
-    : _plan(plan), _input(plan->_input->init()), _consumed(0), _produced(0) {
+    : _plan(plan), _input(plan->_input->init()), _consumed(0), _produced(0),
+      _context(SortContext::get()) {
+
+    this->_hdd = _context->getFinalTier();
+    this->_ssd = _context->getStagingTier();
+    this->_tiers = _context->getSpillChain();
+    this->_dram = _context->getDRAM();
 
-    this->_hdd = HDD::getInstance();
-    this->_ssd = SSD::getInstance();
-    this->_dram = DRAM::getInstance();
+    // A filter right below the sort drops its records while the input is loaded
+    FilterPlan const *filter = dynamic_cast<FilterPlan const *>(plan->_input);
+    _dram->setFilter(filter != nullptr ? filter->getPredicate() : FilterPredicate());
+    if (Config::get().GROUP_BY) { checkGroupBy(); }
 
     externalMergeSort();
 } // SortIterator::SortIterator
 
 SortIterator::~SortIterator() {
     TRACE(true);
+    delete _stream; // a consumer that stops early drops the runs left
+    delete _input;
     traceprintf("produced %lu of %lu rows\n", (unsigned long)(_produced),
                 (unsigned long)(_consumed));
 } // SortIterator::~SortIterator
 
 bool SortIterator::next() {
-    TRACE(true);
-    return false; // TODO: remove
-
-    if (_produced >= _consumed) return false;
-
+    // TRACE(true);
+    if (_stream == nullptr) { return false; }
+
+    // Past the top k, the runs left are dropped unread
+    RowCount topK = Config::get().TOP_K;
+    _current = topK > 0 && _produced >= topK ? nullptr : _stream->next();
+    if (_current == nullptr) {
+        delete _stream;
+        _stream = nullptr;
+        return false;
+    }
     ++_produced;
     return true;
 } // SortIterator::next
 
-void SortIterator::getRecord(Record *r) { TRACE(true); } // SortIterator::getRecord
-
-void SortIterator::getPage(Page *p) { TRACE(true); } // SortIterator::getPage
+void SortIterator::getRecord(Record *r) {
+    // TRACE(true);
+    if (_current == nullptr) { return; }
+    std::memcpy(r->data, _current->data, Config::get().RECORD_SIZE);
+} // SortIterator::getRecord
+
+bool SortIterator::getPage(Page *p) {
+    // TRACE(true);
+    p->clear();
+    while (!p->isFull() && SortIterator::next()) {
+        p->append(_current->data);
+    }
+    return !p->isEmpty();
+} // SortIterator::getPage
 
 
 void SortIterator::firstPass() {
     TRACE(true);
 
     // Skip sorting if there are no records
-    if (Config::NUM_RECORDS == 0) {
+    if (Config::get().NUM_RECORDS == 0) {
         printvv("No records to sort\n");
         return;
     }
 
-    // Skip sorting if there is only one record
-    if (Config::NUM_RECORDS == 1) {
+    // Skip sorting if there is only one record, and nothing to merge it into
+    if (isSingleRecordCopy()) {
         printvv("Only one record to sort\n");
         return;
     }
 
     // Verify input file exists
-    bool okay = _hdd->readFrom(Config::INPUT_FILE);
+    bool okay = _hdd->readFrom(Config::get().INPUT_FILE, _consumed * Config::get().RECORD_SIZE);
     if (!okay) {
         printvv("ERROR: unable to read from input file\n");
-        exit(EXIT_FAILURE);
+        throw std::runtime_error("unable to read from input file " + Config::get().INPUT_FILE);
     }
 
     int printStatus = 1;
-    _consumed = 0;
     while (true) {
         // Check if all input records are read
-        if (_consumed >= Config::NUM_RECORDS) {
+        if (_consumed >= Config::get().NUM_RECORDS) {
             printvv("All input records read\n");
             break;
         }
 
+        atStep("FIRST_PASS");
+
         // Print status
-        double consumedPerc = ((double)_consumed) * 100.0 / Config::NUM_RECORDS;
+        double consumedPerc = ((double)_consumed) * 100.0 / Config::get().NUM_RECORDS;
         if (consumedPerc > printStatus * 1.0) {
             printvv("\tConsumed %.1lf%% input. %llu out of %lld records.\n\t", consumedPerc,
-                    _consumed, Config::NUM_RECORDS);
+                    _consumed, Config::get().NUM_RECORDS);
             prettyPrintPercentage(consumedPerc);
             printStatus++;
         }
 
 
-        // If the next DRAM load will exceed SSD capacity, merge runs in SSD
-        // This will spill the merged run to HDD and free up space in SSD
-        RowCount nRecordsLeft = Config::NUM_RECORDS - _consumed;
+        // If the next DRAM load will exceed the staging tier, merge its runs
+        // This will spill the merged run down the chain and free up space in it
+        RowCount nRecordsLeft = Config::get().NUM_RECORDS - _consumed;
         RowCount _ssdCurrSize = _ssd->getTotalFilledSpaceInRecords();
         RowCount nRecordsNext = std::min(nRecordsLeft, _dramCapacity);
         if (_ssdCurrSize + nRecordsNext > _ssd->getMergeFanInRecords()) {
-            // spill some runs to HDD
-            _ssd->mergeSSDRuns(_hdd);
+            // spill some runs down the chain
+            mergeTierRuns(_ssd, _ssd);
         }
 
-        // Read records from input file to DRAM
-        PageCount nHDDPages = _dramCapacity / _hddPageSize;
-        RowCount nRecordsToRead = nHDDPages == 0 ? _dramCapacity : nHDDPages * _hddPageSize;
+        // Read records from input file to DRAM, next to the carried top-k records
+        RowCount loadCapacity = _dramCapacity - (_dram->isTopKCarried() ? Config::get().TOP_K : 0);
+        PageCount nHDDPages = loadCapacity / _hddPageSize;
+        RowCount nRecordsToRead = nHDDPages == 0 ? loadCapacity : nHDDPages * _hddPageSize;
         nRecordsToRead = std::min(nRecordsToRead, nRecordsLeft);
-        RowCount nRecords = _dram->loadInput(nRecordsToRead);
+        RowCount nRecordsKept = 0;
+        RowCount nRecords = _dram->loadInput(nRecordsToRead, &nRecordsKept);
         if (nRecords == 0) {
             printv("WARNING: no records read\n");
             break;
         }
         _consumed += nRecords;
         printv("\tconsumed %llu records, left %llu records in input\n", _consumed,
-               Config::NUM_RECORDS - _consumed);
+               Config::get().NUM_RECORDS - _consumed);
+        if (nRecordsKept == 0) { continue; } // the filter dropped the whole load
 
         // Sort records in DRAM
         // - Create mini-runs using quicksort,
         // - Spill some mini-runs to SSD to free up space for output buffer in DRAM
         // - Merge mini-runs, store the merged run in SSD and reset DRAM
-        _dram->genMiniRuns(nRecords, _ssd);
+        // - Or append records already in order to the natural run in HDD
+        _dram->genMiniRuns(nRecordsKept, _ssd);
     }
 
-    // Close the input file
+    // Close the input file, the last natural run and the top-k records
     _hdd->closeRead();
+    _dram->closeNaturalRun();
+    _dram->flushTopK();
 
 
     if (_ssd->getRunfilesCount() > 1) {
-        // Merge all runs in SSD, expecting the merged run to spill to HDD
-        _ssd->mergeSSDRuns(_hdd);
+        // Merge all runs of the staging tier, expecting the merged run to spill down the chain
+        mergeTierRuns(_ssd, _ssd);
     }
 
 #if defined(_VALIDATE)
     // verify the input size and consumed records is same
-    printv("VALIDATE: input size %llu == consumed %llu\n", Config::NUM_RECORDS, _consumed);
+    printv("VALIDATE: input size %llu == consumed %llu\n", Config::get().NUM_RECORDS, _consumed);
     flushv();
-    assert(_consumed == Config::NUM_RECORDS && "consumed records mismatch");
+    assert(_consumed == Config::get().NUM_RECORDS && "consumed records mismatch");
 #endif
 } // SortIterator::firstPass
 
 
+void SortIterator::atStep(const std::string &phase) {
+    // The previous step is complete, checkpoint it before the runs it consumed are deleted
+    ++_step;
+    saveCheckpoint(phase);
+    for (PersistentTier *tier : _tiers) {
+        tier->beginStep(_step);
+    }
+
+    if (!_plan->_onStep) { return; }
+    _plan->_onStep(*_context, phase);
+    _ssdCapacity = _ssd->getCapacityInRecords();
+    _dramCapacity = _dram->getCapacityInRecords();
+} // SortIterator::atStep
+
+
+std::string SortIterator::getCheckpointFile() { return _ssd->getBaseDir() + "/CHECKPOINT"; }
+
+
+void SortIterator::saveCheckpoint(const std::string &phase) {
+    std::string filename = getCheckpointFile();
+    std::string tmpFilename = filename + ".tmp";
+    std::ofstream os(tmpFilename, std::ios::trunc);
+    os << "INPUT_FILE=" << Config::get().INPUT_FILE << "\n";
+    os << "NUM_RECORDS=" << Config::get().NUM_RECORDS << "\n";
+    os << "RECORD_SIZE=" << Config::get().RECORD_SIZE << "\n";
+    os << "APPEND_FILE=" << Config::get().APPEND_FILE << "\n";
+    os << "TOP_K=" << Config::get().TOP_K << "\n";
+    os << "GROUP_BY=" << getGroupByRepr() << "\n";
+    os << "DEDUP=" << getDedupPolicyName(Config::get().DEDUP) << "\n";
+    os << "FILTER=" << _dram->getFilterRepr() << "\n";
+    os << "STEP=" << _step << "\n";
+    os << "PHASE=" << phase << "\n";
+    // The open natural run and the top-k records are not in the MANIFEST, their input is read
+    // again on resume
+    os << "CONSUMED=" << _consumed - _dram->getUnsavedInput() << "\n";
+    os << "NUM_DUPLICATES_REMOVED="
+       << _context->counters.nDuplicatesRemoved - _dram->getUnsavedDuplicates() << "\n";
+    os << "NUM_RECORDS_FILTERED="
+       << _context->counters.nRecordsFiltered - _dram->getUnsavedFiltered() << "\n";
+    os.close();
+    // Replaced in one go, a crash leaves the previous checkpoint
+    if (!os || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error("ERROR: writing the checkpoint " + filename);
+    }
+} // SortIterator::saveCheckpoint
+
+
+std::string SortIterator::restoreCheckpoint() {
+    std::map<std::string, std::string> values;
+    std::ifstream is(getCheckpointFile());
+    std::string line;
+    while (getline(is, line)) {
+        size_t eq = line.find('=');
+        if (eq != std::string::npos) { values[line.substr(0, eq)] = line.substr(eq + 1); }
+    }
+
+    std::string phase;
+    if (values.empty()) {
+        printvv("RESUME: no checkpoint in %s, starting over\n", _ssd->getBaseDir().c_str());
+    } else {
+        if (values["INPUT_FILE"] != Config::get().INPUT_FILE ||
+            values["APPEND_FILE"] != Config::get().APPEND_FILE ||
+            values["FILTER"] != _dram->getFilterRepr() ||
+            values["TOP_K"] != std::to_string(Config::get().TOP_K) ||
+            values["GROUP_BY"] != getGroupByRepr() ||
+            values["DEDUP"] != getDedupPolicyName(Config::get().DEDUP) ||
+            std::stoull(values["NUM_RECORDS"]) != Config::get().NUM_RECORDS ||
+            std::stoi(values["RECORD_SIZE"]) != Config::get().RECORD_SIZE) {
+            throw std::runtime_error("ERROR: the checkpoint " + getCheckpointFile() +
+                                     " belongs to the sort of " + values["INPUT_FILE"]);
+        }
+        _step = std::stoi(values["STEP"]);
+        phase = values["PHASE"];
+        _consumed = std::stoull(values["CONSUMED"]);
+        _context->counters.nDuplicatesRemoved = std::stoull(values["NUM_DUPLICATES_REMOVED"]);
+        _context->counters.nRecordsFiltered = std::stoull(values["NUM_RECORDS_FILTERED"]);
+        printvv("RESUME: step %d in %s, %llu of %lld input records consumed\n", _step,
+                phase.c_str(), _consumed, Config::get().NUM_RECORDS);
+    }
+
+    // Without a checkpoint, step 0 drops every run
+    for (PersistentTier *tier : _tiers) {
+        tier->restoreRuns(_step);
+    }
+    flushvv();
+    return phase;
+} // SortIterator::restoreCheckpoint
+
+
+std::vector<PlannedRun> SortIterator::getStoredRuns() {
+    std::vector<PlannedRun> runs;
+    for (PersistentTier *tier : _tiers) {
+        std::vector<PlannedRun> tierRuns = tier->getPlannedRuns();
+        runs.insert(runs.end(), tierRuns.begin(), tierRuns.end());
+    }
+    return runs;
+} // SortIterator::getStoredRuns
+
+
+MergePlan SortIterator::planRemainingMerges() {
+    std::vector<PlannedRun> runs = getStoredRuns();
+    MergePlan plan = planMerges(runs, _ssd->getPlanningFanIn());
+    printvv("\tMERGE_PLAN: %s\n", plan.repr().c_str());
+    flushvv();
+    return plan;
+} // SortIterator::planRemainingMerges
+
+
+void SortIterator::concatenateRuns() {
+    std::vector<PlannedRun> runs = getStoredRuns();
+
+    if (runs.size() == 1) {
+        // This is the final run, rename it to output file
+        PersistentTier *device = _context->getTier(runs[0].deviceName);
+        rename(runs[0].filename.c_str(), Config::get().OUTPUT_FILE.c_str());
+        device->removeRunFile(runs[0].filename);
+        return;
+    }
+
+    // Copy the runs in key order, a single sequential pass instead of a merge
+    printvv("\tCONCATENATE: %d runs with disjoint key ranges\n", (int)runs.size());
+    flushvv();
+    RunWriter writer(Config::get().OUTPUT_FILE);
+    for (auto &group : groupByKeyRange(runs)) {
+        assert(group.size() == 1 && "ERROR: concatenating runs with overlapping key ranges");
+        const PlannedRun &run = group.front();
+        PersistentTier *device = _context->getTier(run.deviceName);
+        writer.writeFromFile(run.filename, run.nRecords);
+        device->chargeAccess(run.nRecords);
+        _hdd->chargeAccess(run.nRecords);
+        device->removeRunFile(run.filename);
+    }
+    writer.close();
+} // SortIterator::concatenateRuns
+
+
+void SortIterator::writeStream() {
+    RunWriter writer(Config::get().OUTPUT_FILE);
+    Page page(_hdd->getPageSizeInRecords());
+    while (getPage(&page)) {
+        writer.writeRecords(page.getData(), page.getSizeInRecords());
+        _hdd->chargeAccess(page.getSizeInRecords());
+    }
+    writer.close();
+    printvv("\tWRITE_STREAM: %lld records to %s\n", _produced, Config::get().OUTPUT_FILE.c_str());
+    flushvv();
+} // SortIterator::writeStream
+
+
 void SortIterator::externalMergeSort() {
     TRACE(true);
 
@@ -160,8 +348,16 @@ void SortIterator::externalMergeSort() {
     // - When SSD is full, merge runs in SSD and spill the merged run to HDD
     // - Repeat until all input records are read
     printvv("\n========= EXTERNAL_MERGE_SORT START =========\n");
+    TimeLedger *ledger = _context->getLedger();
     auto start = std::chrono::steady_clock::now();
-    this->firstPass();
+    std::string resumePhase = Config::get().RESUME ? restoreCheckpoint() : "";
+    ledger->startPhase("FIRST_PASS");
+    if (resumePhase.empty() && !Config::get().APPEND_FILE.empty() &&
+        getFileSize(Config::get().APPEND_FILE) != 0) {
+        // Only the input is sorted, the sorted file joins the runs as it is
+        _hdd->addSortedFile(Config::get().APPEND_FILE);
+    }
+    if (resumePhase != "MERGE") { this->firstPass(); }
     auto endFirstPass = std::chrono::steady_clock::now();
     auto durFirstPass = std::chrono::duration_cast<std::chrono::seconds>(endFirstPass - start);
     printvv("============= FIRST_PASS COMPLETE ===========\n");
@@ -174,17 +370,18 @@ void SortIterator::externalMergeSort() {
     // - At this point, all runs are in SSD and HDD
     // - Merge runs in SSD and HDD until only one run is left
     int mergeIteration = 0;
+    ledger->startPhase("MERGE");
     while (true) {
         // Check if all records are merged
-        if (Config::NUM_RECORDS == 0) {
+        if (Config::get().NUM_RECORDS == 0 && _hdd->getRunfilesCount() == 0) {
             printvv("SUCCESS: No records to merge\n");
             break;
         }
-        if (Config::NUM_RECORDS == 1) {
+        if (isSingleRecordCopy()) {
             printvv("SUCCESS: Only one record to merge\n");
             // copy the input file to output file
-            std::string src = Config::INPUT_FILE;
-            std::string dest = Config::OUTPUT_FILE;
+            std::string src = Config::get().INPUT_FILE;
+            std::string dest = Config::get().OUTPUT_FILE;
             std::ifstream srcFile(src, std::ios::binary);
             std::ofstream destFile(dest, std::ios::binary);
             destFile << srcFile.rdbuf();
@@ -192,51 +389,55 @@ void SortIterator::externalMergeSort() {
             destFile.close();
             break;
         }
+        if (getStoredRuns().empty()) {
+            printvv("SUCCESS: the filter dropped every record\n");
+            if (!_plan->_stream) { std::ofstream(Config::get().OUTPUT_FILE, std::ios::trunc); }
+            break;
+        }
 
-        int nRFilesInSSD = _ssd->getRunfilesCount();
-        int nRFilesInHDD = _hdd->getRunfilesCount();
-        printvv("\tMERGE_ITR %d: %d runfiles in SSD, %d runfiles in HDD\n", mergeIteration,
-                nRFilesInSSD, nRFilesInHDD);
+        atStep("MERGE");
+        // The runs below the staging tier, wherever on the chain they are
+        int nRunsInStaging = _ssd->getRunfilesCount();
+        int nRunsBelow = 0;
+        std::string layout;
+        for (PersistentTier *tier : _tiers) {
+            if (tier != _ssd) { nRunsBelow += tier->getRunfilesCount(); }
+            layout += (layout.empty() ? "" : ", ") + std::to_string(tier->getRunfilesCount()) +
+                      " runfiles in " + tier->getName();
+        }
+        printvv("\tMERGE_ITR %d: %s\n", mergeIteration, layout.c_str());
         flushvv();
         auto startMerge = std::chrono::steady_clock::now();
-        if (nRFilesInSSD < 0 || nRFilesInHDD < 0) {
-            printvv("ERROR: invalid runs in SSD or HDD\n");
-            throw std::runtime_error("invalid runs in SSD or HDD");
+
+        if (nRunsInStaging + nRunsBelow < 1) {
+            printvv("ERROR: no runs to merge\n");
             break;
         }
 
-        if (nRFilesInHDD == 0) {
-            // No runfiles in HDD
-            if (nRFilesInSSD < 1) {
-                printvv("ERROR: no runs to merge\n");
-                break;
-            } else if (nRFilesInSSD == 1) {
-                // Only one runfile in SSD, this is the final run, Rename it to output file
-                printvv("SUCCESS: all runs merged\n");
-                std::string src = _ssd->getRunfile(0);
-                std::string dest = Config::OUTPUT_FILE;
-                rename(src.c_str(), dest.c_str());
-                break;
-            }
-
-            // More than one runfile in SSD, merge them
-            _ssd->mergeSSDRuns(_hdd);
-
-        } else {
-            // There are runfiles in HDD
-            if (nRFilesInHDD == 1 && nRFilesInSSD == 0) {
-                // Only one runfile in HDD, this is the final run, Rename it to output file
-                printvv("SUCCESS: all runs merged\n");
-                std::string src = _hdd->getRunfile(0);
-                std::string dest = Config::OUTPUT_FILE;
-                rename(src.c_str(), dest.c_str());
-                break;
-            }
-
-            // Merge runs in SSD and HDD
-            // - this will merge runs from SSD and HDD together with the help of RunStreamer
-            _hdd->mergeHDDRuns();
+        // Only runs with overlapping key ranges are merged
+        MergePlan plan = planRemainingMerges();
+
+        // The last merge is left to next(), unless the runs below the staging tier cannot be
+        // read through it.
+        // A top-k sort pulls its k records from it as well, and drops the rest unread.
+        if ((_plan->_stream || Config::get().TOP_K > 0) && plan.steps.size() <= 1 &&
+            (nRunsBelow == 0 || !_ssd->isTooFullToMerge())) {
+            printvv("SUCCESS: streaming the last merge\n");
+            _stream = new MergeStream(_context, getStoredRuns());
+            if (!_plan->_stream) { writeStream(); }
+            break;
+        }
+        if (plan.isEmpty()) {
+            // A single run is left, or every run covers a key range of its own
+            printvv("SUCCESS: all runs merged\n");
+            concatenateRuns();
+            break;
         }
+
+        // Merge the first planned step, down to the lowest tier holding one of its runs; the
+        // runs below the staging tier are read through it
+        const MergeStep &step = plan.steps.front();
+        mergeTierRuns(_context->getLowestTier(step.inputs), _ssd, &step);
         auto endMerge = std::chrono::steady_clock::now();
         auto durMerge = std::chrono::duration_cast<std::chrono::seconds>(endMerge - startMerge);
         printvv("\tMERGE_ITR %d COMPLETE: Duration %lld seconds / %lld minutes\n", mergeIteration,
@@ -246,6 +447,8 @@ void SortIterator::externalMergeSort() {
         // Increment merge iteration
         ++mergeIteration;
     }
+    ledger->endPhase();
+    std::remove(getCheckpointFile().c_str()); // the sort is complete
     auto endMerge = std::chrono::steady_clock::now();
     auto durMerge = std::chrono::duration_cast<std::chrono::seconds>(endMerge - endFirstPass);
     auto durTotal = std::chrono::duration_cast<std::chrono::seconds>(endMerge - start);
@@ -254,10 +457,22 @@ void SortIterator::externalMergeSort() {
     printvv("======== EXTERNAL_MERGE_SORT COMPLETE =========\n");
     printvv("External_Merge_Sort Total Duration %lld seconds / %lld minutes\n", durTotal.count(),
             durTotal.count() / 60);
-    printvv("Removed %lld duplicate records out of %lld duplicates\n",
-            Config::NUM_DUPLICATES_REMOVED, Config::NUM_DUPLICATES);
-    printvv("SSD Access Count: %lld\n", Config::SSD_COUNT);
-    printvv("HDD Access Count: %lld\n", Config::HDD_COUNT);
+    if (Config::get().GROUP_BY) {
+        printvv("Combined %lld records into their groups, GROUP_BY %s\n",
+                _context->counters.nDuplicatesRemoved, getGroupByRepr().c_str());
+    } else {
+        printvv("Removed %lld duplicate records out of %lld duplicates, DEDUP %s\n",
+                _context->counters.nDuplicatesRemoved, Config::get().NUM_DUPLICATES,
+                getDedupPolicyName(Config::get().DEDUP).c_str());
+    }
+    if (_context->counters.nRecordsFiltered > 0) {
+        printvv("Dropped %lld input records on load, filter %s, TOP_K %lld\n",
+                _context->counters.nRecordsFiltered, _dram->getFilterRepr().c_str(),
+                Config::get().TOP_K);
+    }
+    printvv("SSD Access Count: %lld\n", _context->counters.nStagingAccesses);
+    printvv("HDD Access Count: %lld\n", _context->counters.nFinalAccesses);
+    ledger->print();
     printvv("===============================================\n");
     flushvv();
 } // SortIterator::externalMergeSort
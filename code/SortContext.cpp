@@ -0,0 +1,187 @@
+#include "SortContext.h"
+#include "StorageTypes.h"
+#include <stdexcept>
+
+
+// =========================================================
+// ---------------------- SortContext ----------------------
+// =========================================================
+
+
+thread_local SortContext *SortContext::bound = nullptr;
+
+
+SortContext *SortContext::get() {
+    if (bound != nullptr) { return bound; }
+    // The command line and the embedding program configure it outside of any sort
+    static SortContext defaults;
+    return &defaults;
+}
+
+
+Config &Config::getDefaults() { return SortContext::get()->config; }
+
+
+SortContext::Scope::Scope(SortContext *context) : previous(bound) {
+    bound = context;
+    Config::bind(&context->config);
+}
+
+
+SortContext::Scope::~Scope() {
+    bound = previous;
+    Config::bind(previous == nullptr ? nullptr : &previous->config);
+}
+
+
+SortContext::~SortContext() {
+    // The tiers trace their cleanup to this context
+    Scope scope(this);
+    deleteTiers();
+    delete tierGraph;
+    flushTrace();
+}
+
+
+TierGraph *SortContext::getTierGraph() {
+    if (tierGraph == nullptr) {
+        Scope scope(this);
+        tierGraph = new TierGraph(getTierSpecs());
+        tierGraph->print();
+    }
+    return tierGraph;
+}
+
+
+DRAM *SortContext::getDRAM() {
+    if (dram == nullptr) {
+        Scope scope(this);
+        dram = new DRAM(this);
+    }
+    return dram;
+}
+
+
+PersistentTier *SortContext::getStagingTier() {
+    if (staging == nullptr) {
+        const std::vector<PersistentTier *> &below = getIntermediateTiers();
+        Scope scope(this);
+        staging = new PersistentTier(this, getTierGraph()->getSpec(TierRole::STAGING),
+                                     TierRole::STAGING,
+                                     below.empty() ? getFinalTier() : below.front());
+    }
+    return staging;
+}
+
+
+const std::vector<PersistentTier *> &SortContext::getIntermediateTiers() {
+    const std::vector<TierSpec> &specs = getTierGraph()->getIntermediateSpecs();
+    if (intermediates.empty() && !specs.empty()) {
+        // Created from the final tier up, so each one spills to the tier created before it
+        Scope scope(this);
+        Storage *below = getFinalTier();
+        intermediates.resize(specs.size());
+        for (size_t i = specs.size(); i-- > 0;) {
+            intermediates[i] =
+                new PersistentTier(this, specs[i], TierRole::INTERMEDIATE, below);
+            below = intermediates[i];
+        }
+    }
+    return intermediates;
+}
+
+
+PersistentTier *SortContext::getFinalTier() {
+    if (finalTier == nullptr) {
+        Scope scope(this);
+        finalTier = new PersistentTier(this, getTierGraph()->getSpec(TierRole::FINAL),
+                                       TierRole::FINAL);
+    }
+    return finalTier;
+}
+
+
+std::vector<PersistentTier *> SortContext::getSpillChain() {
+    std::vector<PersistentTier *> chain = {getStagingTier()};
+    const std::vector<PersistentTier *> &middle = getIntermediateTiers();
+    chain.insert(chain.end(), middle.begin(), middle.end());
+    chain.push_back(getFinalTier());
+    return chain;
+}
+
+
+PersistentTier *SortContext::getTier(const std::string &name) {
+    for (PersistentTier *tier : getSpillChain()) {
+        if (tier->getName() == name) { return tier; }
+    }
+    throw std::runtime_error("ERROR: no tier " + name + " on the spill chain");
+}
+
+
+PersistentTier *SortContext::getLowestTier(const std::vector<PlannedRun> &runs) {
+    std::vector<PersistentTier *> chain = getSpillChain();
+    size_t lowest = 0;
+    for (auto &run : runs) {
+        for (size_t i = lowest + 1; i < chain.size(); i++) {
+            if (chain[i]->getName() == run.deviceName) { lowest = i; }
+        }
+    }
+    return chain[lowest];
+}
+
+
+PersistentTier *SortContext::getLargestPageTier() {
+    std::vector<PersistentTier *> chain = getSpillChain();
+    PersistentTier *largest = chain.back();
+    for (size_t i = 1; i < chain.size(); i++) {
+        if (chain[i]->getPageSizeInRecords() > largest->getPageSizeInRecords()) {
+            largest = chain[i];
+        }
+    }
+    return largest;
+}
+
+
+void SortContext::deleteTiers() {
+    Scope scope(this);
+    delete maxRecord;
+    maxRecord = nullptr;
+    delete dram;
+    dram = nullptr;
+    printv("deleted DRAM\n");
+    flushv();
+    delete staging;
+    staging = nullptr;
+    printv("deleted the staging tier\n");
+    flushv();
+    for (PersistentTier *tier : intermediates) {
+        delete tier;
+    }
+    intermediates.clear();
+    delete finalTier;
+    finalTier = nullptr;
+    printv("deleted the intermediate and final tiers\n");
+    flushv();
+}
+
+
+Record *SortContext::getMaxRecord() {
+    if (maxRecord == nullptr) {
+        maxRecord = new Record();
+        for (int i = 0; i < config.RECORD_SIZE; i++) {
+            maxRecord->data[i] = '~';
+        }
+    }
+    return maxRecord;
+}
+
+
+std::ofstream &SortContext::getTrace() {
+    if (!trace.is_open()) { trace.open(config.TRACE_FILE); }
+    return trace;
+}
+
+
+void SortContext::flushTrace() {
+    if (trace.is_open()) { trace.flush(); }
+}
@@ -1,7 +1,13 @@
 #include "Storage.h"
 #include "Losertree.h"
+#include "SortContext.h"
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
 #include <vector>
 
 
@@ -10,9 +16,51 @@
 // =========================================================
 
 
-RunManager::RunManager(std::string deviceName) {
+/**
+ * @brief Index of a run file named r<index>.txt
+ * @return false for other files, e.g. the buffer files of RunStreamers
+ */
+static bool getRunIndex(const std::string &name, int *index) {
+    int n = 0;
+    return sscanf(name.c_str(), "r%d.txt%n", index, &n) == 1 && n == (int)name.size();
+}
+
+
+/**
+ * @brief Check a run file against its manifest entry
+ */
+static void verifyRun(const RunInfo &run) {
+    std::ifstream is(run.filename, std::ios::binary);
+    if (!is) { throw std::runtime_error("ERROR: run " + run.filename + " is missing"); }
+    if (run.checksum == NO_CHECKSUM) {
+        // A sorted file added as it is, only its size is known
+        if (getFileSize(run.filename) != run.nRecords * Config::get().RECORD_SIZE) {
+            throw std::runtime_error("ERROR: run " + run.filename + " does not match the manifest");
+        }
+        return;
+    }
+
+    ByteCount bufSize = RoundUp(1024 * 1024, Config::get().RECORD_SIZE);
+    char *buffer = new char[bufSize];
+    uint64_t checksum = EMPTY_CHECKSUM;
+    RowCount nRecords = 0;
+    while (is) {
+        is.read(buffer, bufSize);
+        RowCount n = is.gcount() / Config::get().RECORD_SIZE;
+        checksum = checksumRecords(checksum, buffer, n);
+        nRecords += n;
+    }
+    delete[] buffer;
+    if (nRecords != run.nRecords || checksum != run.checksum) {
+        throw std::runtime_error("ERROR: run " + run.filename + " does not match the manifest");
+    }
+}
+
+
+RunManager::RunManager(std::string deviceName, std::string runDir) {
     // Create a directory for the device runs
-    baseDir = deviceName + "_runs";
+    tierName = deviceName;
+    baseDir = runDir;
     nextRunIndex = 0;
     runFiles.clear();
 
@@ -22,7 +70,7 @@ RunManager::RunManager(std::string deviceName) {
         // If the directory does not exist, create it
         mkdir(baseDir.c_str(), 0700);
 
-    } else {
+    } else if (!Config::get().RESUME) {
 
         // If the dir exits, delete all run files in the directory
         int counter = 0;
@@ -48,6 +96,11 @@ RunManager::RunManager(std::string deviceName) {
 }
 
 RunManager::~RunManager() {
+    // A complete sort consumed every run, the runs of an interrupted one are kept to resume it
+    if (runFiles.empty()) {
+        beginStep(step + 1);
+        std::remove(getManifestFile().c_str());
+    }
     // Give a warning if there are any run files left
     if (getRunInfoFromDir().size() > 0) {
         printvv("WARNING: %d run files left in %s\n", runFiles.size(), baseDir.c_str());
@@ -56,6 +109,147 @@ RunManager::~RunManager() {
 }
 
 
+bool RunManager::removeRunFile(std::string filename) {
+    // Find the run file
+    auto it = std::find_if(
+        runFiles.begin(), runFiles.end(),
+        [filename](const std::pair<std::string, RowCount> &p) { return p.first == filename; });
+    if (it == runFiles.end()) { return false; }
+
+    // Remove the run file and update the total records count
+    totalRecords -= it->second;
+    runFiles.erase(it);
+
+    // The last checkpoint may still need a run stored in an earlier step
+    auto run = std::find_if(manifest.begin(), manifest.end(), [&](const CatalogedRun &r) {
+        return r.info.filename == filename && r.consumedAt < 0;
+    });
+    if (run != manifest.end()) {
+        if (run->storedAt == step) {
+            std::remove(filename.c_str()); // unless deleted already
+            manifest.erase(run);
+        } else {
+            run->consumedAt = step;
+        }
+        writeManifest();
+    }
+    return true;
+}
+
+
+const RunInfo &RunManager::getRunInfo(const std::string &filename) {
+    for (auto &run : manifest) {
+        if (run.info.filename == filename && run.consumedAt < 0) { return run.info; }
+    }
+    throw std::runtime_error("ERROR: run " + filename + " is not in the manifest of " + baseDir);
+}
+
+
+void RunManager::beginStep(int step) {
+    size_t nRuns = manifest.size();
+    for (auto &run : manifest) {
+        if (run.consumedAt >= 0) { std::remove(run.info.filename.c_str()); }
+    }
+    manifest.erase(std::remove_if(manifest.begin(), manifest.end(),
+                                  [](const CatalogedRun &r) { return r.consumedAt >= 0; }),
+                   manifest.end());
+    if (manifest.size() != nRuns) { writeManifest(); }
+    this->step = step;
+}
+
+
+void RunManager::writeManifest() {
+    std::string filename = getManifestFile();
+    std::string tmpFilename = filename + ".tmp";
+    std::ofstream os(tmpFilename, std::ios::trunc);
+    os << "# file records tier stored_at consumed_at min_key max_key checksum fences\n";
+    for (auto &run : manifest) {
+        std::string fences;
+        for (auto &fence : run.info.fences) {
+            fences += (fences.empty() ? "" : ",") + fence;
+        }
+        os << run.info.filename << " " << run.info.nRecords << " " << tierName << " "
+           << run.storedAt << " " << run.consumedAt << " "
+           << (run.info.minKey.empty() ? "-" : run.info.minKey) << " "
+           << (run.info.maxKey.empty() ? "-" : run.info.maxKey) << " " << run.info.checksum
+           << " " << (fences.empty() ? "-" : fences) << "\n";
+    }
+    os.close();
+    if (!os || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error("ERROR: writing the manifest " + filename);
+    }
+}
+
+
+std::vector<CatalogedRun> RunManager::readManifest() {
+    std::vector<CatalogedRun> runs;
+    std::ifstream is(getManifestFile());
+    std::string line;
+    while (getline(is, line)) {
+        if (line.empty() || line[0] == '#') { continue; }
+        std::istringstream fields(line);
+        CatalogedRun run;
+        std::string tier, fences;
+        fields >> run.info.filename >> run.info.nRecords >> tier >> run.storedAt >>
+            run.consumedAt >> run.info.minKey >> run.info.maxKey >> run.info.checksum >> fences;
+        if (!fields) {
+            throw std::runtime_error("ERROR: malformed line in " + getManifestFile() + ": " +
+                                     line);
+        }
+        if (run.info.minKey == "-") { run.info.minKey.clear(); }
+        if (run.info.maxKey == "-") { run.info.maxKey.clear(); }
+        std::istringstream fenceList(fences == "-" ? "" : fences);
+        std::string fence;
+        while (getline(fenceList, fence, ',')) {
+            run.info.fences.push_back(fence);
+        }
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+
+void RunManager::restore(int step) {
+    this->step = step;
+    runFiles.clear();
+    manifest.clear();
+    totalRecords = 0;
+
+    // Keep the runs that existed when the step began
+    for (auto &run : readManifest()) {
+        bool stored = run.storedAt < step;
+        bool consumed = run.consumedAt >= 0 && run.consumedAt < step;
+        if (!stored || consumed) { continue; }
+        verifyRun(run.info);
+        run.consumedAt = -1;
+        manifest.push_back(run);
+        runFiles.push_back({run.info.filename, run.info.nRecords});
+        totalRecords += run.info.nRecords;
+    }
+
+    // Delete what the interrupted step wrote, and number the new runs after the kept ones
+    int nDeleted = 0;
+    nextRunIndex = 0;
+    for (auto &name : getRunInfoFromDir()) {
+        std::string filename = baseDir + "/" + name;
+        auto it = std::find_if(
+            runFiles.begin(), runFiles.end(),
+            [&](const std::pair<std::string, RowCount> &p) { return p.first == filename; });
+        int index = 0;
+        if (it == runFiles.end()) {
+            std::remove(filename.c_str());
+            nDeleted++;
+        } else if (getRunIndex(name, &index)) {
+            nextRunIndex = std::max(nextRunIndex, index + 1);
+        }
+    }
+    writeManifest();
+    printvv("\tRESUME: %s restored %d runs (%lld records), deleted %d files of the interrupted "
+            "step\n",
+            tierName.c_str(), (int)runFiles.size(), totalRecords, nDeleted);
+}
+
+
 std::string RunManager::getNextRunFileName() {
     struct stat st = {0};
     if (stat(baseDir.c_str(), &st) == -1) {
@@ -75,8 +269,11 @@ std::vector<std::string> RunManager::getRunInfoFromDir() {
             struct stat path_stat;
             std::string filePath = baseDir + "/" + entry->d_name;
             stat(filePath.c_str(), &path_stat);
-            if (S_ISREG(path_stat.st_mode)) {
-                runFiles.push_back(entry->d_name);
+            // Runs and the buffer files of RunStreamers, not the MANIFEST or CHECKPOINT
+            std::string name = entry->d_name;
+            bool isTxt = name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0;
+            if (S_ISREG(path_stat.st_mode) && isTxt) {
+                runFiles.push_back(name);
             }
         }
         closedir(dir);
@@ -94,13 +291,99 @@ std::vector<std::pair<std::string, RowCount>> &RunManager::getStoredRunsSortedBy
 }
 
 
+// =========================================================
+// ------------------------ TimeLedger ---------------------
+// =========================================================
+
+
+/**
+ * @brief CPU time of the calling thread, other sorts in the process are not included
+ */
+static double getThreadCPUTimeInSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void TimeLedger::startPhase(const std::string &phase) {
+    endPhase();
+    currentPhase = phase;
+    if (std::find(phases.begin(), phases.end(), phase) == phases.end()) {
+        phases.push_back(phase);
+    }
+    phaseStart = getThreadCPUTimeInSec();
+}
+
+
+void TimeLedger::endPhase() {
+    if (phaseStart < 0) { return; }
+    computeInSec[currentPhase] += getThreadCPUTimeInSec() - phaseStart;
+    phaseStart = -1;
+}
+
+
+void TimeLedger::charge(const std::string &deviceName, RowCount nRecords, RowCount nRequests,
+                        double latencyInSec, double transferInSec, bool background) {
+    if (std::find(phases.begin(), phases.end(), currentPhase) == phases.end()) {
+        phases.push_back(currentPhase);
+    }
+    DeviceTime &t = times[currentPhase][deviceName];
+    t.nAccesses += nRequests;
+    t.nBytes += nRecords * Config::get().RECORD_SIZE;
+    t.latencyInSec += latencyInSec;
+    t.transferInSec += transferInSec;
+    if (background) { t.backgroundInSec += latencyInSec + transferInSec; }
+}
+
+
+double TimeLedger::getModeledTimeInSec(const std::string &phase) const {
+    double foreground = 0, background = 0, compute = 0;
+    auto it = times.find(phase);
+    if (it != times.end()) {
+        for (auto &device : it->second) {
+            foreground += device.second.getTotalInSec() - device.second.backgroundInSec;
+            background += device.second.backgroundInSec;
+        }
+    }
+    auto c = computeInSec.find(phase);
+    if (c != computeInSec.end()) { compute = c->second; }
+    return foreground + std::max(background, compute);
+}
+
+
+void TimeLedger::print() const {
+    printvv("=========== MODELED DEVICE TIME =============\n");
+    double total = 0;
+    for (auto &phase : phases) {
+        auto c = computeInSec.find(phase);
+        double compute = c != computeInSec.end() ? c->second : 0;
+        double modeled = getModeledTimeInSec(phase);
+        total += modeled;
+        printvv("%s: modeled %.2lf seconds, cpu %.2lf seconds\n", phase.c_str(), modeled, compute);
+        auto it = times.find(phase);
+        if (it == times.end()) { continue; }
+        for (auto &device : it->second) {
+            const DeviceTime &t = device.second;
+            printvv("\t%s: %lld accesses, %lld MB, latency %.2lf s, transfer %.2lf s, "
+                    "background %.2lf s\n",
+                    device.first.c_str(), t.nAccesses, BYTE_TO_MB(t.nBytes), t.latencyInSec,
+                    t.transferInSec, t.backgroundInSec);
+        }
+    }
+    printvv("Modeled Total Time %.2lf seconds / %.2lf minutes\n", total, total / 60);
+    flushvv();
+}
+
+
 // =========================================================
 // -------------------------- Storage ----------------------
 // =========================================================
 
 
-Storage::Storage(std::string name, ByteCount capacity, int bandwidth, double latency)
-    : name(name), CAPACITY_IN_BYTES(capacity), BANDWIDTH(bandwidth), LATENCY(latency) {
+Storage::Storage(SortContext *context, const TierSpec &tier, TierRole role)
+    : context(context), name(tier.name), role(role), CAPACITY_IN_BYTES(tier.capacity),
+      BANDWIDTH(tier.bandwidth), LATENCY(tier.latency) {
 
     printvv("Storage %s\n", name.c_str());
     if (CAPACITY_IN_BYTES == INFINITE_CAPACITY) {
@@ -111,8 +394,10 @@ Storage::Storage(std::string name, ByteCount capacity, int bandwidth, double lat
     printvv("\tBandwidth %d MB/s, Latency %3.1lf ms\n", BYTE_TO_MB(BANDWIDTH), SEC_TO_MS(LATENCY));
 
     this->configure();
-    if (this->name != DRAM_NAME) {
-        this->runManager = new RunManager(this->name);
+    _ioTokens = PAGE_SIZE_IN_RECORDS * Config::get().RECORD_SIZE;
+    _ioRefilledAt = std::chrono::steady_clock::now();
+    if (this->role != TierRole::MEMORY) {
+        this->runManager = new RunManager(this->name, tier.getDir());
     }
     flushvv();
 }
@@ -122,29 +407,165 @@ void Storage::configure() {
     // Calculate the page size in records
     ByteCount nBytes = this->BANDWIDTH * this->LATENCY;
     nBytes = RoundUp(nBytes, 4 * 1024); // round up to 4KB
-    PAGE_SIZE_IN_RECORDS = nBytes / Config::RECORD_SIZE;
+    PAGE_SIZE_IN_RECORDS = nBytes / Config::get().RECORD_SIZE;
     PAGE_SIZE_IN_RECORDS = std::max((RowCount)1, PAGE_SIZE_IN_RECORDS);
     printvv("\tConfigured %s\n", this->name.c_str());
     printvv("\tPage %s\n",
-            getSizeDetails(this->PAGE_SIZE_IN_RECORDS * Config::RECORD_SIZE).c_str());
+            getSizeDetails(this->PAGE_SIZE_IN_RECORDS * Config::get().RECORD_SIZE).c_str());
+
+    // Only the memory and the staging tier buffer merges
+    if (this->role == TierRole::MEMORY || this->role == TierRole::STAGING) { configureBuffers(); }
+}
+
+
+RowCount Storage::getExpectedRunSizeInRecords() const {
+    ByteCount runSize = this->role == TierRole::MEMORY
+                            ? Config::get().CACHE_SIZE
+                            : context->getTierGraph()->getSpec(TierRole::MEMORY).capacity;
+    return std::max((RowCount)1, (RowCount)(runSize / Config::get().RECORD_SIZE));
+}
+
+
+void Storage::configureBuffers() {
+    // Size the clusters (buffer size per run) for the fan-in the cost model picks when the
+    // tier is full of runs, the output clusters take at least a page each
+    RowCount nRecords = getCapacityInRecords();
+    PageCount nPages = nRecords / PAGE_SIZE_IN_RECORDS;
+    RowCount nRuns = std::min(divide(nRecords, getExpectedRunSizeInRecords()),
+                              (RowCount)Config::get().MERGE_FAN_IN);
+    PageCount inputPages = nPages > (PageCount)MAX_MERGE_FAN_OUT ? nPages - MAX_MERGE_FAN_OUT : 0;
+    RowCount inputSpace = inputPages * PAGE_SIZE_IN_RECORDS;
+    CLUSTER_FAN_IN = std::max(2, getCostOptimalFanIn(this, nRecords, (int)nRuns,
+                                                     Config::get().MERGE_FAN_IN, inputSpace));
+    MAX_MERGE_FAN_IN = CLUSTER_FAN_IN;
+    CLUSTER_SIZE = nPages / (MAX_MERGE_FAN_IN + MAX_MERGE_FAN_OUT);
+
+    // Calculate the merge fan-in and merge fan-out
+    MERGE_FANIN_IN_RECORDS = MAX_MERGE_FAN_IN * CLUSTER_SIZE * PAGE_SIZE_IN_RECORDS;
+    MERGE_FANOUT_IN_RECORDS = getCapacityInRecords() - MERGE_FANIN_IN_RECORDS;
+
+    // The input clusters can be shared by more runs as long as each keeps MIN_CLUSTER_PAGES,
+    // such high fan-ins are merged by a cascade of small loser trees
+    PageCount inPages = MERGE_FANIN_IN_RECORDS / PAGE_SIZE_IN_RECORDS;
+    int memFanIn = (int)std::min(inPages / MIN_CLUSTER_PAGES, (PageCount)INT_MAX);
+    MAX_MERGE_FAN_IN = std::max(2, std::min(Config::get().MERGE_FAN_IN, memFanIn));
+
+    // Print the configurations
+    printvv("\tMerge Fan-in: %d runs, Fan-out: %d clusters, clusters sized for %d runs\n",
+            MAX_MERGE_FAN_IN, MAX_MERGE_FAN_OUT, CLUSTER_FAN_IN);
+    printvv("\tCluster Size: %d pages / %s\n", CLUSTER_SIZE,
+            getSizeDetails(CLUSTER_SIZE * PAGE_SIZE_IN_RECORDS * Config::get().RECORD_SIZE)
+                .c_str());
+    printvv("\tInput Buffer Total Size: %llu records\n", this->MERGE_FANIN_IN_RECORDS);
+    printvv("\tOutput Buffer Total Size: %llu records\n", this->MERGE_FANOUT_IN_RECORDS);
+}
+
+
+ByteCount Storage::resize(ByteCount capacity) {
+    assert((this->role == TierRole::MEMORY || this->role == TierRole::STAGING) &&
+           "ERROR: only the memory and the staging tier are resized");
+    assert(_filledInputClusters == 0 && _filledOutputClusters == 0 && "ERROR: resize in merge");
+    capacity = std::max(capacity, (ByteCount)_filled * Config::get().RECORD_SIZE);
+    if (capacity == CAPACITY_IN_BYTES) { return capacity; }
+    printvv("\tResized %s from %lld MB to %lld MB\n", this->name.c_str(),
+            BYTE_TO_MB(CAPACITY_IN_BYTES), BYTE_TO_MB(capacity));
+    CAPACITY_IN_BYTES = capacity;
+    configureBuffers();
+    return capacity;
+}
+
 
-    if (this->name != DISK_NAME) {
+// --------------------------------- Cost Model --------------------------------
 
-        // Calculate a rough cluster size (buffer size per run) in pages
-        RowCount nRecords = CAPACITY_IN_BYTES / Config::RECORD_SIZE;
-        PageCount nPages = nRecords / PAGE_SIZE_IN_RECORDS;
-        CLUSTER_SIZE = nPages / (MAX_MERGE_FAN_IN + MAX_MERGE_FAN_OUT);
 
-        // Calculate the merge fan-in and merge fan-out
-        MERGE_FANIN_IN_RECORDS = MAX_MERGE_FAN_IN * CLUSTER_SIZE * PAGE_SIZE_IN_RECORDS;
-        MERGE_FANOUT_IN_RECORDS = getCapacityInRecords() - MERGE_FANIN_IN_RECORDS;
+/**
+ * @brief number of merge passes to reduce nRuns runs to one with the given fan-in
+ */
+static int getMergePasses(int nRuns, int fanIn) {
+    int nPasses = 0;
+    for (int n = nRuns; n > 1; n = divide(n, fanIn)) {
+        nPasses++;
+    }
+    return nPasses;
+}
+
 
-        // Print the configurations
-        printvv("\tCluster Size: %d pages / %s\n", CLUSTER_SIZE,
-                getSizeDetails(CLUSTER_SIZE * PAGE_SIZE_IN_RECORDS * Config::RECORD_SIZE).c_str());
-        printvv("\tInput Buffer Total Size: %llu records\n", this->MERGE_FANIN_IN_RECORDS);
-        printvv("\tOutput Buffer Total Size: %llu records\n", this->MERGE_FANOUT_IN_RECORDS);
+double Storage::chargeAccess(RowCount nRecords, bool background) {
+    RowCount nRequests = getRequests(nRecords);
+    if (this->role == TierRole::STAGING) {
+        context->counters.nStagingAccesses += nRequests;
+    } else if (this->role != TierRole::MEMORY) {
+        context->counters.nFinalAccesses += nRequests; // the intermediate and the final tiers
     }
+    double latency = nRequests * this->LATENCY;
+    double transfer = ((double)nRecords * Config::get().RECORD_SIZE) / this->BANDWIDTH;
+    context->getLedger()->charge(this->name, nRecords, nRequests, latency, transfer, background);
+    if (Config::get().EMULATE_IO && this->role != TierRole::MEMORY) {
+        throttle(nRecords, nRequests);
+    }
+    return (latency + transfer) * 1000 * 1000;
+}
+
+
+void Storage::throttle(RowCount nRecords, RowCount nRequests) {
+    // Refill the bucket for the time since the last access
+    double bucketSize = PAGE_SIZE_IN_RECORDS * Config::get().RECORD_SIZE;
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _ioRefilledAt).count();
+    _ioTokens = std::min(bucketSize, _ioTokens + elapsed * this->BANDWIDTH);
+
+    // Take the tokens for this access, a deficit is paid by waiting for the refill
+    _ioTokens -= (double)nRecords * Config::get().RECORD_SIZE;
+    double transferWait = _ioTokens < 0 ? -_ioTokens / this->BANDWIDTH : 0;
+    double wait = nRequests * this->LATENCY + transferWait;
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+
+    // The transfer wait refilled the deficit, the device was busy during the latencies
+    _ioTokens = std::max(0.0, _ioTokens);
+    _ioRefilledAt = std::chrono::steady_clock::now();
+}
+
+
+double Storage::getTransferTimeInSec(RowCount nRecords, RowCount requestInRecords) const {
+    if (nRecords == 0) { return 0; }
+    requestInRecords = std::max((RowCount)1, requestInRecords);
+    double transfer = ((double)nRecords * Config::get().RECORD_SIZE) / this->BANDWIDTH;
+    double latency = std::ceil((double)nRecords / requestInRecords) * this->LATENCY;
+    return transfer + latency;
+}
+
+
+double Storage::getMergeReadTimeInSec(RowCount nRecords, int nRuns, int fanIn,
+                                      RowCount clusterInRecords) const {
+    if (clusterInRecords == 0) { return std::numeric_limits<double>::max(); }
+    int nPasses = getMergePasses(nRuns, fanIn);
+    double transfer = ((double)nRecords * Config::get().RECORD_SIZE) / this->BANDWIDTH;
+    double latency = std::ceil((double)nRecords / clusterInRecords) * this->LATENCY;
+    return nPasses * (transfer + latency);
+}
+
+
+int Storage::getCostOptimalFanIn(const Storage *fromDevice, RowCount nRecords, int nRuns,
+                                 int maxFanIn, RowCount bufferInRecords) const {
+    int limit = std::min(nRuns, maxFanIn);
+    if (limit < 2) { return limit; }
+
+    RowCount fromPageSize = fromDevice->getPageSizeInRecords();
+    int bestFanIn = 2;
+    double bestTime = std::numeric_limits<double>::max();
+    for (int fanIn = 2; fanIn <= limit; fanIn++) {
+        // Each input cluster holds whole pages of the device it reads from
+        RowCount cluster = RoundDown(bufferInRecords / fanIn, fromPageSize);
+        if (cluster == 0) { break; }
+        double time = fromDevice->getMergeReadTimeInSec(nRecords, nRuns, fanIn, cluster);
+        if (time < bestTime) {
+            bestTime = time;
+            bestFanIn = fanIn;
+        }
+    }
+    printv("\t\t\tCost model: merging %d runs (%lld records) from %s, fan-in %d, %.2lf s\n",
+           nRuns, nRecords, fromDevice->getName().c_str(), bestFanIn, bestTime);
+    return bestFanIn;
 }
 
 
@@ -174,27 +595,51 @@ void Storage::spill(RunWriter *writer) {
     // Close the current writer file
     writer->close();
 
-    // Copy the current writer file content to spillWriter
-    RowCount nRecord = spillWriter->writeFromFile(writer->getFilename(), writer->getCurrSize());
-    if (nRecord != writer->getCurrSize()) {
-        printvv("ERROR: Failed to copy %lld records to %s\n", writer->getCurrSize(),
-                spillWriter->getFilename().c_str());
-        assert(nRecord == writer->getCurrSize() && "Failed to copy all records to spillWriter");
-    }
-    spillTo->fillupSpace(nRecord);
+    // Copy the current writer file content to spillWriter, further down the chain if spillTo
+    // is full as well
+    RowCount nRecord = writer->getCurrSize();
+    printss("\t\tSTATE -> %s is full, Spill to %s %lld records\n", this->name.c_str(),
+            spillTo->name.c_str(), nRecord);
+    spillTo->acceptSpill(spillWriter, writer->getFilename(), nRecord);
     // reset the filesize to 0
     writer->reset();
     // update the storage usage (free up the space in this storage)
     this->freeSpace(nRecord);
-    printss("\t\tSTATE -> %s is full, Spill to %s %lld records\n", this->name.c_str(),
-            spillTo->name.c_str(), nRecord);
-    printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
-            spillTo->getName().c_str(), nRecord * Config::RECORD_SIZE,
-            spillTo->getAccessTimeInMicro(nRecord));
+    // the spilled records are read back from this device
+    this->chargeAccess(nRecord);
     flushvv();
 }
 
 
+void Storage::acceptSpill(RunWriter *writer, const std::string &filename, RowCount nRecords) {
+    if (spillTo != nullptr && nRecords > getTotalEmptySpaceInRecords() &&
+        writer->getCurrSize() > 0) {
+        // Make room by moving what the writer holds down the chain, in front of the records
+        spill(writer);
+    }
+    if (spillTo != nullptr && nRecords > getTotalEmptySpaceInRecords()) {
+        // Still full of other runs, the records pass through to the spill session, which
+        // holds everything written before them
+        if (spillWriter == nullptr) { spillWriter = startSpillSession(); }
+        printss("\t\tSTATE -> %s is full, Pass %lld records through to %s\n", this->name.c_str(),
+                nRecords, spillTo->name.c_str());
+        spillTo->acceptSpill(spillWriter, filename, nRecords);
+        return;
+    }
+
+    RowCount nRecord = writer->writeFromFile(filename, nRecords);
+    if (nRecord != nRecords) {
+        printvv("ERROR: Failed to copy %lld records to %s\n", nRecords,
+                writer->getFilename().c_str());
+        assert(nRecord == nRecords && "Failed to copy all records to spillWriter");
+    }
+    this->fillupSpace(nRecord);
+    double accessTime = this->chargeAccess(nRecord);
+    printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+            this->name.c_str(), nRecord * Config::get().RECORD_SIZE, accessTime);
+}
+
+
 RowCount Storage::writeNextChunk(RunWriter *writer, Run *run) {
     RowCount _empty = this->getTotalEmptySpaceInRecords();
     if (run->getSize() > _empty) {
@@ -206,6 +651,14 @@ RowCount Storage::writeNextChunk(RunWriter *writer, Run *run) {
     return nRecord;
 }
 
+
+RowCount Storage::writeNextChunk(RunWriter *writer, const char *data, RowCount nRecords) {
+    if (nRecords > this->getTotalEmptySpaceInRecords()) { spill(writer); }
+    RowCount nRecord = writer->writeRecords(data, nRecords);
+    _filled += nRecord;
+    return nRecord;
+}
+
 void Storage::closeWriter(RunWriter *writer) {
     if (this->runManager == nullptr) {
         printv("ERROR: RunManager is null in %s\n", this->name.c_str());
@@ -215,15 +668,50 @@ void Storage::closeWriter(RunWriter *writer) {
         printv("ERROR: Writer is null in %s\n", this->name.c_str());
         return;
     }
-    RowCount nRecords = writer->getCurrSize();
-    runManager->addRunFile(writer->getFilename(), nRecords);
+    runManager->addRunFile(writer->getRunInfo());
 
     if (spillWriter != nullptr) {
         endSpillSession(writer, true);
     } else {
         writer->close();
-        delete writer;
     }
+    delete writer;
+}
+
+
+void Storage::beginStep(int step) {
+    if (runManager != nullptr) { runManager->beginStep(step); }
+}
+
+
+void Storage::restoreRuns(int step) {
+    if (runManager == nullptr) { return; }
+    runManager->restore(step);
+    resetAllFilledSpace();
+    fillupSpace(runManager->getTotalRecords());
+}
+
+
+void Storage::addSortedFile(const std::string &filename) {
+    RunInfo info = describeSortedFile(filename);
+    std::string runFilename = runManager->getNextRunFileName();
+    if (link(filename.c_str(), runFilename.c_str()) == 0) {
+        info.filename = runFilename;
+        printvv("\tSORTED_FILE: linked %s as run %s, %lld records\n", filename.c_str(),
+                runFilename.c_str(), info.nRecords);
+    } else {
+        // Another file system, copy it once
+        RunWriter writer(runFilename);
+        writer.writeFromFile(filename, info.nRecords);
+        writer.close();
+        info = writer.getRunInfo();
+        this->chargeAccess(info.nRecords);
+        printvv("\tSORTED_FILE: copied %s to run %s, %lld records\n", filename.c_str(),
+                runFilename.c_str(), info.nRecords);
+    }
+    flushvv();
+    addRunFile(info);
+    fillupSpace(info.nRecords);
 }
 
 
@@ -250,12 +738,11 @@ void Storage::endSpillSession(RunWriter *currDeviceWriter, bool deleteCurrFile)
             }
         }
 
-        RowCount nRecords = spillWriter->getCurrSize();
-        spillTo->addRunFile(spillWriter->getFilename(), nRecords);
-        spillWriter->close();
-        delete spillWriter;
+        // The session file is a run of spillTo, or moves further down if spillTo spilled it
+        RunWriter *writer = spillWriter;
         spillWriter = nullptr;
-        printv("\t\t\tINFO: Spill writer wrote %lld records. END\n", nRecords);
+        printv("\t\t\tINFO: Spill writer wrote %lld records. END\n", writer->getCurrSize());
+        spillTo->closeWriter(writer);
     }
 }
 
@@ -265,7 +752,7 @@ void Storage::endSpillSession(RunWriter *currDeviceWriter, bool deleteCurrFile)
 // --------------------------------- File IO -----------------------------------
 
 
-bool Storage::readFrom(const std::string &filePath) {
+bool Storage::readFrom(const std::string &filePath, ByteCount offset) {
     if (readFile.is_open())
         readFile.close();
     readFilePath = filePath;
@@ -274,9 +761,9 @@ bool Storage::readFrom(const std::string &filePath) {
         printvv("ERROR: Failed to open read file '%s'\n", readFilePath.c_str());
         return false;
     }
-    readFile.seekg(0, std::ios::beg);
+    readFile.seekg(offset, std::ios::beg);
     if (!readFile) {
-        printv("ERROR: Failed to seek to the beginning of '%s'\n", readFilePath.c_str());
+        printv("ERROR: Failed to seek to %lld in '%s'\n", offset, readFilePath.c_str());
         return false;
     }
     // printvv("DEBUG: Opened readFile '%s', curr pos %llu\n", readFilePath.c_str(),
@@ -289,9 +776,9 @@ RowCount Storage::readRecords(char *data, RowCount nRecords) {
         printvv("ERROR: Read file '%s' is not open\n", readFilePath.c_str());
         return 0;
     }
-    readFile.read(data, nRecords * Config::RECORD_SIZE);
+    readFile.read(data, nRecords * Config::get().RECORD_SIZE);
     ByteCount nBytes = readFile.gcount();
-    return nBytes / Config::RECORD_SIZE;
+    return nBytes / Config::get().RECORD_SIZE;
 }
 
 void Storage::closeRead() {
@@ -307,7 +794,7 @@ std::string Storage::reprUsageDetails() {
                                            ? "Infinite"
                                            : std::to_string(getCapacityInRecords()) + " records");
     state += "\n\t\t\t\t_filled (with runfiles): " + std::to_string(_filled) + " records";
-    if (this->name != DISK_NAME) {
+    if (this->role == TierRole::MEMORY || this->role == TierRole::STAGING) {
         state += "\n\t\t\t\tinputcluster: " + std::to_string(_filledInputClusters) + " out of " +
                  std::to_string(_totalSpaceInInputClusters) + " records";
         state += ", \n\t\t\t\toutputcluster: " + std::to_string(_filledOutputClusters) +
@@ -335,6 +822,6 @@ void Storage::printStoredRunFiles() {
            runManager->getTotalRecords());
     for (auto &run : runFiles) {
         printv("\t\t\t\t%s: %s\n", run.first.c_str(),
-               getSizeDetails(run.second * Config::RECORD_SIZE).c_str());
+               getSizeDetails(run.second * Config::get().RECORD_SIZE).c_str());
     }
 }
@@ -1,20 +1,21 @@
-
 #include "StorageTypes.h"
+#include "SortContext.h"
+#include <algorithm>
 
 
 // =========================================================
-// -------------------------- Disk -------------------------
+// --------------------- PersistentTier --------------------
 // =========================================================
 
 
-HDD *HDD::instance = nullptr;
-
-
-HDD::HDD(std::string name, ByteCount capacity, int bandwidth, double latency)
-    : Storage(name, capacity, bandwidth, latency) {}
+PersistentTier::PersistentTier(SortContext *context, const TierSpec &tier, TierRole role,
+                               Storage *spillTo)
+    : Storage(context, tier, role) {
+    if (spillTo != nullptr) { setSpillTo(spillTo); }
+}
 
 
-RowCount HDD::storeRun(Run *run) {
+RowCount PersistentTier::storeRun(Run *run) {
     // Create a new run file
     RunWriter *writer = getRunWriter();
 
@@ -32,333 +33,335 @@ RowCount HDD::storeRun(Run *run) {
 }
 
 
-void HDD::printStates(std::string where) {
+RowCount PersistentTier::storeRun(const char *data, RowCount nRecords) {
+    RunWriter *writer = getRunWriter();
+    writer->writeRecords(data, nRecords);
+    _filled += nRecords;
+    closeWriter(writer);
+    return nRecords;
+}
+
+
+void PersistentTier::printStates(std::string where) {
     printv("\t\t------------ STATE_DETAILS: %s", where.c_str());
-    printv("%s\n", DRAM::getInstance()->reprUsageDetails().c_str());
-    printv("%s\n", SSD::getInstance()->reprUsageDetails().c_str());
-    printv("%s\n", HDD::getInstance()->reprUsageDetails().c_str());
+    printv("%s\n", context->getDRAM()->reprUsageDetails().c_str());
+    std::vector<PersistentTier *> chain = context->getSpillChain();
+    for (size_t i = 0; i < chain.size(); i++) {
+        printv("%s\n", chain[i]->reprUsageDetails().c_str());
+    }
 
-    // Print stored runs in ssd and hdd
-    SSD::getInstance()->printStoredRunFiles();
-    HDD::getInstance()->printStoredRunFiles();
+    // Print stored runs in every tier of the chain
+    for (PersistentTier *tier : chain) {
+        tier->printStoredRunFiles();
+    }
     printv("\t\t-------------------------\n");
     flushv();
 }
 
 
-int HDD::setupMergeStateInSSDAndDRAM() {
-    DRAM *_dram = DRAM::getInstance();
-    SSD *_ssd = SSD::getInstance();
-    HDD *_hdd = HDD::getInstance();
-    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
-    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
-    RowCount _ssdEmptySpace = _ssd->getTotalEmptySpaceInRecords();
+int PersistentTier::getMaxBufferedFanIn() {
+    RowCount _pageSize = getPageSizeInRecords();
+    RowCount _dramCapacity = context->getDRAM()->getCapacityInRecords();
     int minMergeFanOut = 2; // minimum fan-out for merge
-    int _ssdRunFilesCount = _ssd->getRunfilesCount();
-    int _hddRunFilesCount = _hdd->getRunfilesCount();
-
-    // Calculate the fanIn based on the available space in SSD and HDD
-    int maxFetchFromHDDFanIn = (_ssdEmptySpace / _hddPageSize) - minMergeFanOut;
-    maxFetchFromHDDFanIn = std::min(maxFetchFromHDDFanIn, _hddRunFilesCount);
-    int fanIn = std::min(maxFetchFromHDDFanIn + _ssdRunFilesCount, _ssd->getMaxMergeFanIn());
-    int fetchFromHDDFanIn = fanIn - _ssdRunFilesCount; // include all SSD runs to reduce disk IO
-    printvv("\t\tFanIn %d, fetchFromHDDFanIn %d\n", fanIn, fetchFromHDDFanIn);
-    flushvv();
-
-    // Setup the input and output buffer sizes in SSD
-    _ssd->setupMergeState(_hddPageSize, fetchFromHDDFanIn);
-    printv("\t\t\tDEBUG: After setupSSD for merge in mergeHDDRuns: \n%s\n",
-           _ssd->reprUsageDetails().c_str());
+    // every run needs an input cluster in this tier and at least one of its pages in DRAM
+    int maxDRAMFanIn = (int)(_dramCapacity / _pageSize) - minMergeFanOut;
+    return std::min(getMaxMergeFanIn(), maxDRAMFanIn);
+}
 
-    if ((fanIn + 1) * _ssdPageSize > _dram->getCapacityInRecords()) {
-        // TODO: avoid this during config
-        printvv("ERROR: fanIn %d exceeds capacity %lld of DRAM\n", fanIn, getCapacityInRecords());
-        throw std::runtime_error("Error: fanIn exceeds capacity in DRAM");
-    }
 
-    // Setup the input and output buffer sizes in DRAM
-    _dram->setupMergeState(_ssdPageSize, fanIn);
-    printv("\t\t\tDEBUG: After setupDRAM for merge in mergeHDDRuns: %s\n",
-           _dram->reprUsageDetails().c_str());
+/**
+ * @brief space in the staging tier left for input clusters of the runs below it after the
+ * minimum output clusters
+ */
+static RowCount getInputSpaceForLowerRuns(SortContext *context, RowCount _stagingEmptySpace) {
+    int minMergeFanOut = 2; // minimum fan-out for merge
+    RowCount _lowerPageSize = context->getLargestPageTier()->getPageSizeInRecords();
+    RowCount _outputSpace = minMergeFanOut * _lowerPageSize;
+    return _stagingEmptySpace > _outputSpace ? _stagingEmptySpace - _outputSpace : 0;
+}
 
-    return fanIn;
+static RowCount getInputSpaceForLowerRuns(SortContext *context) {
+    return getInputSpaceForLowerRuns(
+        context, context->getStagingTier()->getTotalEmptySpaceInRecords());
 }
 
-std::pair<std::vector<RunStreamer *>, RowCount> HDD::loadRunfilesToDRAM(size_t fanIn) {
 
-    DRAM *_dram = DRAM::getInstance();
-    SSD *_ssd = SSD::getInstance();
-    HDD *_hdd = this; // HDD::getInstance();
-    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
-    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
-    std::vector<std::pair<std::string, RowCount>> _ssdRunFiles =
-        _ssd->runManager->getStoredRunsSortedBySize();
-    std::vector<std::pair<std::string, RowCount>> _hddRunFiles =
-        runManager->getStoredRunsSortedBySize();
-    PageCount readAheadSSD = _ssd->getEffectiveClusterSize() / _hddPageSize;
-    PageCount readAheadDRAM = _dram->getEffectiveClusterSize() / _ssdPageSize;
-    printv("\t\t\treadAheadDram %d, readAheadSSD %d\n", readAheadDRAM, readAheadSSD);
+std::vector<PlannedRun> PersistentTier::getPlannedRuns() {
+    std::vector<PlannedRun> runs;
+    if (runManager == nullptr) { return runs; }
+    for (auto &run : runManager->getStoredRunsSortedBySize()) {
+        const RunInfo &info = runManager->getRunInfo(run.first);
+        runs.push_back({run.first, run.second, this->getName(), 0, info.minKey, info.maxKey});
+    }
+    return runs;
+}
 
 
-    // Load the runs to streamers from SSD using RunReaders and RunStreamers
-    std::vector<RunStreamer *> runStreamers;
-    RowCount allRunTotal = 0;
-    size_t ithRunfile = 0;
-    for (; ithRunfile < _ssdRunFiles.size(); ithRunfile++) {
-        std::string runFilename = _ssdRunFiles[ithRunfile].first;
-        RowCount runSize = _ssdRunFiles[ithRunfile].second;
-        allRunTotal += runSize;
-        printv("\t\t\t\tLoading run %d: %s, %lld records in mergeHDDRuns\n", ithRunfile,
-               runFilename.c_str(), runSize);
-        // create a run reader and streamer; the streamer will update the dram input buffer size
-        RunReader *reader = new RunReader(runFilename, runSize, _ssdPageSize);
-        RunStreamer *runStreamer =
-            new RunStreamer(StreamerType::READER, reader, _ssd, _dram, readAheadDRAM);
-        runStreamers.push_back(runStreamer);
+std::vector<PlannedRun> PersistentTier::getRunsBelow(Storage *from, const MergeStep *step) {
+    std::vector<PlannedRun> runs;
+    if (step != nullptr) {
+        for (auto &run : step->inputs) {
+            if (run.deviceName != getName()) { runs.push_back(run); }
+        }
+        return runs;
     }
-    printv("\t\t\tDEBUG: After loading SSDRunfiles in mergeHDDRuns: \n%s\n",
-           _dram->reprUsageDetails().c_str());
-    printv("%s\n", _ssd->reprUsageDetails().c_str());
-    flushv();
+    // Walk the spill chain from the tier below this one down to from
+    std::vector<PersistentTier *> chain = context->getSpillChain();
+    for (size_t i = 1; i < chain.size() && chain[i - 1] != from; i++) {
+        std::vector<PlannedRun> tierRuns = chain[i]->getPlannedRuns();
+        runs.insert(runs.end(), tierRuns.begin(), tierRuns.end());
+    }
+    std::stable_sort(runs.begin(), runs.end(), [](const PlannedRun &a, const PlannedRun &b) {
+        return a.nRecords < b.nRecords;
+    });
+    return runs;
+}
 
 
-    // Load the runs to streamers from HDD using RunStreamer of (RunStreamer of RunReader)
-    if (ithRunfile < fanIn) {
-        int i = 0;
-        for (; ithRunfile < fanIn; ithRunfile++) {
-            std::string runFilename = _hddRunFiles[i].first;
-            RowCount runSize = _hddRunFiles[i++].second;
-            allRunTotal += runSize;
-            printv("\t\t\t\tLoading run %d: %s, %lld records in mergeHDDRuns\n", ithRunfile,
-                   runFilename.c_str(), runSize);
-            // Create a run reader and streamer; the run streamer will update the dram input buffer
-            // size
-            RunReader *reader = new RunReader(runFilename, runSize, _hddPageSize);
-            RunStreamer *rsInner =
-                new RunStreamer(StreamerType::READER, reader, _hdd, _ssd, readAheadSSD, true);
-            RunStreamer *rsOuter =
-                new RunStreamer(StreamerType::STREAMER, rsInner, _ssd, _dram, readAheadDRAM);
-            runStreamers.push_back(rsOuter);
-        }
-        printv("\t\t\tDEBUG: After loading HDDRunfiles in mergeHDDRuns: %s\n",
-               _dram->reprUsageDetails().c_str());
-        printv("%s\n", _ssd->reprUsageDetails().c_str());
-        printv("%s\n", _hdd->reprUsageDetails().c_str());
-        flushv();
+int PersistentTier::getPlanningFanIn() {
+    RowCount nRecords = runManager->getTotalRecords();
+    std::vector<PlannedRun> lowerRuns = getRunsBelow(context->getFinalTier(), nullptr);
+    for (auto &run : lowerRuns) {
+        nRecords += run.nRecords;
     }
-    printv("\t\t\tAllRunTotal: %lld\n", allRunTotal);
-
-    return std::make_pair(runStreamers, allRunTotal);
+    return getPlanningFanIn(getRunfilesCount(), lowerRuns.size(), nRecords,
+                            getTotalEmptySpaceInRecords());
 }
 
-void HDD::mergeHDDRuns() {
 
-    DRAM *_dram = DRAM::getInstance();
-    SSD *_ssd = SSD::getInstance();
-    HDD *_hdd = this; // HDD::getInstance();
+int PersistentTier::getPlanningFanIn(int nRuns, int nLowerRuns, RowCount nRecords,
+                                     RowCount emptySpace) {
+    DRAM *_dram = context->getDRAM();
+    PersistentTier *_lower = context->getLargestPageTier();
+    RowCount _pageSize = getPageSizeInRecords();
+    RowCount _lowerPageSize = _lower->getPageSizeInRecords();
+    int minMergeFanOut = 2; // minimum fan-out for merge
+    int nAllRuns = nRuns + nLowerRuns;
 
-    // Print all device information
-    printStates("DEBUG: before mergeHDDRuns");
+    if (nLowerRuns == 0) {
+        // The runs of this tier are read into input clusters in DRAM
+        RowCount _dramInputSpace = _dram->getCapacityInRecords() - _pageSize * minMergeFanOut;
+        int maxFanIn = _dramInputSpace / _pageSize;
+        return _dram->getCostOptimalFanIn(this, nRecords, nAllRuns, maxFanIn, _dramInputSpace);
+    }
 
-    RowCount _hddPageSize = HDD::getInstance()->getPageSizeInRecords();
-    RowCount _ssdEmptySpace = SSD::getInstance()->getTotalEmptySpaceInRecords();
-    RowCount _ssdFilledSpace = SSD::getInstance()->getTotalFilledSpaceInRecords();
+    // The runs below are read into input clusters in this tier, which are streamed to DRAM
+    RowCount _inputSpace = getInputSpaceForLowerRuns(context, emptySpace);
+    int maxFanIn = nRuns + (int)(_inputSpace / _lowerPageSize);
+    maxFanIn = std::min(maxFanIn, getMaxBufferedFanIn());
+    return getCostOptimalFanIn(_lower, nRecords, nAllRuns, maxFanIn, _inputSpace);
+}
 
 
-    // Verify _ssd is reasonably empty;
-    // At least 2 runs from hdd should fit in ssd and at least 2 output buffers should fit in ssd
-    int minMergeFanIn = 2;  // minimum fan-in for merge
+int PersistentTier::setupBufferedMerge(Storage *from, const MergeStep *step) {
+    DRAM *_dram = context->getDRAM();
+    PersistentTier *_lower = context->getLargestPageTier(); // the clusters here hold its pages
+    RowCount _pageSize = getPageSizeInRecords();
+    RowCount _lowerPageSize = _lower->getPageSizeInRecords();
+    RowCount _emptySpace = getTotalEmptySpaceInRecords();
     int minMergeFanOut = 2; // minimum fan-out for merge
-    if (
-
-        // At least 2 runs from HDD should fit in SSD
-        (_hddPageSize * (minMergeFanIn + minMergeFanOut) > _ssdEmptySpace) ||
-        // Not enough space for output buffers
-        (_ssdEmptySpace < _ssd->getMergeFanOutRecords()) ||
-        // Not enough space for input buffers
-        (_ssdFilledSpace > _ssd->getMergeFanInRecords()) ||
-        // Not any space for run files from HDD
-        (_ssd->getRunfilesCount() >= _ssd->getMaxMergeFanIn())
-
-    ) {
-        // printvv("WARNING: SSD is almost full, merging SSD runs first\n");
-        // flushvv();
-        // _ssd->mergeSSDRuns(_hdd);
-        printvv("WARNING: SSD is almost full, moving a runfile to HDD\n");
-        flushvv();
-        _ssd->freeSpaceBySpillingRunfiles();
-        _ssd->mergeSSDRuns(_hdd);
-        return;
+    int _runFilesCount = getRunfilesCount();
+    std::vector<PlannedRun> lowerRuns = getRunsBelow(from, step);
+    int _lowerRunFilesCount = lowerRuns.size();
+    RowCount _lowerTotalRecords = 0;
+    for (auto &run : lowerRuns) {
+        _lowerTotalRecords += run.nRecords;
     }
 
+    int fanIn, fetchFromBelowFanIn;
+    if (step != nullptr) {
+        // The planner has already chosen the runs to merge
+        fetchFromBelowFanIn = _lowerRunFilesCount;
+        fanIn = step->inputs.size();
+    } else {
+        // Calculate the fanIn based on the available space in this tier and DRAM
+        int maxFetchFromBelowFanIn = (_emptySpace / _lowerPageSize) - minMergeFanOut;
+        maxFetchFromBelowFanIn = std::min(maxFetchFromBelowFanIn, _lowerRunFilesCount);
+        fanIn = std::min(maxFetchFromBelowFanIn + _runFilesCount, getMaxBufferedFanIn());
+        // include all runs of this tier to reduce disk IO
+        fetchFromBelowFanIn = fanIn - _runFilesCount;
+
+        // Pick how many runs to fetch from below using the cost model, the input clusters here
+        // hold pages of the tiers below and share what is left after the output clusters
+        fetchFromBelowFanIn =
+            getCostOptimalFanIn(_lower, _lowerTotalRecords, _lowerRunFilesCount,
+                                fetchFromBelowFanIn, getInputSpaceForLowerRuns(context));
+        fetchFromBelowFanIn = std::max(1, fetchFromBelowFanIn);
+        fanIn = _runFilesCount + fetchFromBelowFanIn;
+    }
+    printvv("\t\tFanIn %d, fetchFromBelowFanIn %d\n", fanIn, fetchFromBelowFanIn);
+    flushvv();
 
-    // Adjust the fanIn based on the available space in SSD
-    // and setup the input and output buffer sizes in SSD and DRAM
-    int fanIn = setupMergeStateInSSDAndDRAM();
+    // Setup the input and output buffer sizes in this tier
+    setupMergeState(_lowerPageSize, fetchFromBelowFanIn);
+    printv("\t\t\tDEBUG: After setup of %s for merge in mergeTierRuns: \n%s\n",
+           getName().c_str(), reprUsageDetails().c_str());
 
+    if ((fanIn + 1) * _pageSize > _dram->getCapacityInRecords()) {
+        // TODO: avoid this during config
+        printvv("ERROR: fanIn %d exceeds capacity %lld of DRAM\n", fanIn,
+                _dram->getCapacityInRecords());
+        throw std::runtime_error("Error: fanIn exceeds capacity in DRAM");
+    }
 
-    printvv("\tMERGE_HDD_RUNS START: Merging %d runs\n", fanIn);
+    // Setup the input and output buffer sizes in DRAM
+    _dram->setupMergeState(_pageSize, fanIn);
+    printv("\t\t\tDEBUG: After setupDRAM for merge in mergeTierRuns: %s\n",
+           _dram->reprUsageDetails().c_str());
 
+    return fanIn;
+}
 
-    // Load the runs to streamers from SSD and HDD using RunReaders and RunStreamers
-    auto pair = loadRunfilesToDRAM(fanIn);
-    std::vector<RunStreamer *> runStreamers = pair.first;
-    RowCount allRunTotal = pair.second;
-    printv("\t\t\t#runStreamers %d, allRunTotal %lld\n", runStreamers.size(), allRunTotal);
-    std::vector<std::string> filesToRemove;
-    for (auto runStreamer : runStreamers) {
-        filesToRemove.push_back(runStreamer->getFilename());
-    }
 
-    // Merge the runs using a loser tree
-    RowCount totalOutBufSizeDram = _dram->getTotalSpaceInOutputClusters();
-    LoserTree loserTree;
-    loserTree.constructTree(runStreamers);
-    RunWriter *writer = _ssd->getRunWriter();
+int PersistentTier::setupDirectMerge(const MergeStep *step,
+                                     std::vector<std::pair<std::string, RowCount>> &runFiles) {
+    DRAM *_dram = context->getDRAM();
+    int minMergeFanOut = 2;
+    RowCount _pageSize = getPageSizeInRecords();
+    RowCount _emptySpace = getTotalEmptySpaceInRecords();
 
-    Record *head = new Record();
-    Record *current = head, *prev = nullptr;
-    RowCount nSorted = 0, runningCount = 0;
-    RowCount nDups = 0, runningCountWithoutDups = 0;
-    bool copied = false;
-    while (true) {
-        Record *winner = loserTree.getNext();
-        if (winner == NULL) {
-            break;
+    // Verify this tier has space for output buffers
+    assert(runManager->getTotalRecords() == _filled);
+    if (_filled > getMergeFanInRecords()) {
+        // the spilled runs might be part of the planned merge, merge the remaining runs instead
+        step = nullptr;
+        freeSpaceBySpillingRunfiles();
+        while (_filled > getMergeFanInRecords()) {
+            freeSpaceBySpillingRunfiles();
         }
-        nSorted++;
-        runningCount++;
-        if (nSorted > allRunTotal) {
-            printvv("ERROR: Merged run size exceeds %lld\n", allRunTotal);
-            throw std::runtime_error("Merged run size exceeds");
-        }
-        /** duplicate check */
-        if (prev != nullptr && *prev == *winner) {
-            nDups++;
-            Config::NUM_DUPLICATES_REMOVED++;
-            // free memory
-            delete winner;
-            // move to next record
-            continue;
-        }
-        runningCountWithoutDups++;
-        if (copied) {
-            delete prev;
-            copied = false;
-        }
-        prev = winner;
-        current->next = winner;
-        current = current->next;
-        if (runningCountWithoutDups >= totalOutBufSizeDram) {
-            prev = new Record(prev->data);
-            copied = true;
-
-            // When the merged run size fills the output buffer size, store the run in SSD
-            Run *merged = new Run(head->next, runningCountWithoutDups);
-#if defined(_VALIDATE)
-            if (merged->isSorted() == false) {
-                printvv("ERROR: Run is not sorted\n");
-                throw std::runtime_error("Run is not sorted");
-            }
-#endif
-            RowCount nRecord = _ssd->writeNextChunk(writer, merged);
-            assert(nRecord == runningCountWithoutDups && "ERROR: Writing run in mergeHDDRuns");
-            printss("\t\tSTATE -> Merging runs, Spill to %s %lld records\n",
-                    writer->getFilename().c_str(), runningCountWithoutDups);
-            printss("\t\tACCESS -> A write to SSD was made with size %llu bytes and "
-                    "latency %.2lf us\n",
-                    runningCount * Config::RECORD_SIZE, getSSDAccessTime(runningCountWithoutDups));
-            flushv();
-            // Free memory
-            delete merged;
-            // Reset the head
-            head->next = nullptr;
-            current = head;
-            runningCount = 0;
-            runningCountWithoutDups = 0;
+        _emptySpace = getTotalEmptySpaceInRecords();
+        if (_pageSize * minMergeFanOut > _emptySpace) {
+            std::string msg = "ERROR: " + getName() + " should have enough space for Output "
+                              "Buffers\n";
+            printvv("%s\n", msg.c_str());
+            throw std::runtime_error(msg);
         }
-        flushv();
     }
-    if (runningCount > 0) {
 
-        // Write the remaining records
-        Run *merged = new Run(head->next, runningCountWithoutDups);
-#if defined(_VALIDATE)
-        if (merged->isSorted() == false) {
-            printvv("ERROR: Run is not sorted\n");
-            throw std::runtime_error("Run is not sorted");
-        }
-#endif
-        RowCount nRecord = _ssd->writeNextChunk(writer, merged);
-        assert(nRecord == runningCountWithoutDups &&
-               "ERROR: Writing remaining run in mergeHDDRuns");
-        printss("\t\tSTATE -> Merged runs, Spill to %s %lld records\n",
-                writer->getFilename().c_str(), runningCountWithoutDups);
-        printss("\t\tACCESS -> A write to SSD was made with size %llu bytes and latency %.2lf us\n",
-                runningCountWithoutDups * Config::RECORD_SIZE,
-                getSSDAccessTime(runningCountWithoutDups));
-        flushv();
-        // Free memory
-        delete merged;
-        // Room for optimization
+    // Verify this tier has runs to merge
+    if (getRunfilesCount() == 0) {
+        printvv("WARNING: No runs to merge in %s\n", getName().c_str());
+        return 0;
+    }
+    if (getRunfilesCount() == 1) {
+        printvv("WARNING: Only one run in %s, No need for merge\n", getName().c_str());
+        freeSpaceBySpillingRunfiles();
+        return 0;
     }
-    flushv();
-
 
-    // Close the RunWriter that was storing the merged run.
-    // The SSD used space should be updated by the writeNextChunk
-    _ssd->closeWriter(writer);
-    // Delete the run file entries from the run manager,
-    // The actual files has already been deleted by the runreader and endspillsession
-    for (auto runFilename : filesToRemove) {
-        bool removed = _ssd->runManager->removeRunFile(runFilename);
-        if (!removed) { // this is a file from HDD
-            _hdd->runManager->removeRunFile(runFilename);
-            printv("\t\t\t\tRemoved run file %s from HDD\n", runFilename.c_str());
-        } else {
-            printv("\t\t\t\tRemoved run file %s from SSD\n", runFilename.c_str());
-        }
+    // Adjust the fanIn based on the available space in DRAM
+    // and setup the input and output buffer sizes in DRAM
+    RowCount _dramCapacity = _dram->getCapacityInRecords();
+    RowCount _dramMaxInputBufSize = _dramCapacity - _pageSize * minMergeFanOut;
+    runFiles = step != nullptr ? step->getRunsIn(getName())
+                               : runManager->getStoredRunsSortedBySize();
+    int _fanIn = runFiles.size();
+    if (_fanIn * _pageSize > _dramMaxInputBufSize) {
+        // if the input buffer size is less than the fanIn, reduce the fanIn
+        _fanIn = _dramMaxInputBufSize / _pageSize;
+        printvv("FOCUS: Reducing fanIn to %d\n", _fanIn);
+        flushvv();
     }
-    // Reset the dram
-    _dram->reset();
-    // Free memory
-    delete head;
-    for (auto streamer : runStreamers) {
-        delete streamer;
+    if (step == nullptr) {
+        // Pick the fan-in using the cost model, the input clusters in DRAM hold pages of this tier
+        _fanIn = _dram->getCostOptimalFanIn(this, runManager->getTotalRecords(), runFiles.size(),
+                                            _fanIn, _dramMaxInputBufSize);
     }
+    runFiles.resize(_fanIn);
+    printv("\t\t\tfanIn %d\n", _fanIn);
+    flushv();
+    _dram->setupMergeState(_pageSize, _fanIn);
+    printv("\t\t\tAfter setting up merging state in mergeTierRuns: %s\n",
+           _dram->reprUsageDetails().c_str());
+    return _fanIn;
+}
 
-    // Verify the merged run size
-    assert(nSorted == allRunTotal && "ERROR: Merged run size mismatch in mergeHDDRuns");
 
-    // Print all device information
-    printStates("DEBUG: after mergeHDDRuns:");
-    printvv("\tMERGE_HDD_RUNS COMPLETE: Merged %lld records\n", nSorted);
-    if (nDups > 0) {
-        printvv("\tRemoved %lld duplicates\n", nDups);
+std::pair<std::vector<RunStreamer *>, RowCount>
+PersistentTier::openRunStreamers(const std::vector<std::pair<std::string, RowCount>> &runFiles,
+                                 const std::vector<PlannedRun> &lowerRuns) {
+    DRAM *_dram = context->getDRAM();
+    RowCount _pageSize = getPageSizeInRecords();
+    PageCount readAheadDRAM = _dram->getEffectiveClusterSize() / _pageSize;
+    printv("\t\t\treadAheadDram %d\n", readAheadDRAM);
+
+    // Load the runs of this tier to streamers using RunReaders and RunStreamers
+    std::vector<RunStreamer *> runStreamers;
+    RowCount allRunTotal = 0;
+    for (size_t i = 0; i < runFiles.size(); i++) {
+        std::string runFilename = runFiles[i].first;
+        RowCount runSize = runFiles[i].second;
+        allRunTotal += runSize;
+        printv("\t\t\t\tLoading run %d: %s, %lld records in mergeTierRuns\n", (int)i,
+               runFilename.c_str(), runSize);
+        // create a run reader and streamer; the streamer will update the dram input buffer size
+        RunReader *reader = new RunReader(runFilename, runSize, _pageSize);
+        RunStreamer *runStreamer =
+            new RunStreamer(StreamerType::READER, reader, this, _dram, readAheadDRAM);
+        runStreamers.push_back(runStreamer);
     }
-    flushvv();
-}
+    printv("\t\t\tDEBUG: After loading the runs of %s in mergeTierRuns: \n%s\n",
+           getName().c_str(), _dram->reprUsageDetails().c_str());
+    printv("%s\n", reprUsageDetails().c_str());
+    flushv();
 
+    // Load the runs below this tier to streamers using RunStreamer of (RunStreamer of RunReader)
+    for (size_t i = 0; i < lowerRuns.size(); i++) {
+        const PlannedRun &run = lowerRuns[i];
+        PersistentTier *tier = context->getTier(run.deviceName);
+        RowCount pageSize = tier->getPageSizeInRecords();
+        PageCount readAhead = getEffectiveClusterSize() / pageSize;
+        allRunTotal += run.nRecords;
+        printv("\t\t\t\tLoading run %d: %s, %lld records from %s in mergeTierRuns\n",
+               (int)(runFiles.size() + i), run.filename.c_str(), run.nRecords,
+               tier->getName().c_str());
+        // Create a run reader and streamer; the run streamer will update the dram input buffer
+        // size, the reader frees the run's space in an intermediate tier once it is read
+        RunReader *reader = new RunReader(run.filename, run.nRecords, pageSize);
+        RunStreamer *rsInner = new RunStreamer(StreamerType::READER, reader, tier, this, readAhead);
+        RunStreamer *rsOuter =
+            new RunStreamer(StreamerType::STREAMER, rsInner, this, _dram, readAheadDRAM);
+        runStreamers.push_back(rsOuter);
+    }
+    if (!lowerRuns.empty()) {
+        printv("\t\t\tDEBUG: After loading the runs below %s in mergeTierRuns: %s\n",
+               getName().c_str(), _dram->reprUsageDetails().c_str());
+        printv("%s\n", reprUsageDetails().c_str());
+        flushv();
+    }
+    printv("\t\t\tAllRunTotal: %lld\n", allRunTotal);
 
-// =========================================================
-// -------------------------- SSD -------------------------
-// =========================================================
+    return std::make_pair(runStreamers, allRunTotal);
+}
 
 
-SSD *SSD::instance = nullptr;
+bool PersistentTier::isTooFullToMerge() {
+    RowCount _lowerPageSize = context->getLargestPageTier()->getPageSizeInRecords();
+    RowCount _emptySpace = getTotalEmptySpaceInRecords();
+    RowCount _filledSpace = getTotalFilledSpaceInRecords();
 
-SSD::SSD() : HDD(SSD_NAME, Config::SSD_CAPACITY, Config::SSD_BANDWIDTH, Config::SSD_LATENCY) {
-    this->setSpillTo(HDD::getInstance());
+    // At least 2 runs from below and at least 2 output buffers should fit in this tier
+    int minMergeFanIn = 2;  // minimum fan-in for merge
+    int minMergeFanOut = 2; // minimum fan-out for merge
+    return
+        // At least 2 runs from below should fit in this tier
+        (_lowerPageSize * (minMergeFanIn + minMergeFanOut) > _emptySpace) ||
+        // Not enough space for output buffers
+        (_emptySpace < getMergeFanOutRecords()) ||
+        // Not enough space for input buffers
+        (_filledSpace > getMergeFanInRecords()) ||
+        // Not any space for run files from below
+        (getRunfilesCount() >= getMaxBufferedFanIn());
 }
 
 
-void SSD::setupMergeState(RowCount outputDevicePageSize, int fanIn) {
+void PersistentTier::setupMergeState(RowCount outputDevicePageSize, int fanIn) {
     RowCount _emptySpace = getTotalEmptySpaceInRecords();
 
-    // Check if the fanIn exceeds the available space in SSD
+    // Check if the fanIn exceeds the available space in this tier
     if ((fanIn + 1) * outputDevicePageSize > _emptySpace) { // should not occur
         std::string msg = "ERROR: fanIn " + std::to_string(fanIn) + "  exceeds available space " +
-                          std::to_string(_emptySpace) + " in SSD";
+                          std::to_string(_emptySpace) + " in " + getName();
         printvv("%s\n", msg.c_str());
         throw std::runtime_error(msg);
     }
@@ -389,241 +392,243 @@ void SSD::setupMergeState(RowCount outputDevicePageSize, int fanIn) {
 }
 
 
-void SSD::freeSpaceBySpillingRunfiles() {
+void PersistentTier::freeSpaceBySpillingRunfiles() {
+    if (spillTo == nullptr) {
+        throw std::runtime_error("ERROR: " + getName() + " has no tier to spill to");
+    }
     // Get the run file with the largest size
     auto runFile = this->runManager->getStoredRunsSortedBySize().back();
     std::string runFilename = runFile.first;
     RowCount runSize = runFile.second;
-    printvv("\tMoving large run %s (%lld records) to HDD\n", runFilename.c_str(), runSize);
+    printvv("\tMoving large run %s (%lld records) to %s\n", runFilename.c_str(), runSize,
+            spillTo->getName().c_str());
 
-    // Move the run file to HDD
+    // Move the run file down the chain, to spillTo unless it is full
     RunWriter *writer = spillTo->getRunWriter();
-    writer->writeFromFile(runFilename, runSize);
-    spillTo->addRunFile(writer->getFilename(), runSize);
-    printss("\t\tSTATE -> Wrote run %s to HDD\n", runFilename.c_str());
-    printss("\t\tACCESS -> A write to HDD was made with size %llu bytes and latency %.2lf us\n",
-            runSize * Config::RECORD_SIZE, getHDDAccessTime(runSize));
-    writer->close();
-    delete writer;
-
-    // Free the space in SSD
+    spillTo->acceptSpill(writer, runFilename, runSize);
+    this->chargeAccess(runSize);
+    printss("\t\tSTATE -> Wrote run %s to %s\n", runFilename.c_str(),
+            writer->getFilename().c_str());
+    spillTo->closeWriter(writer);
+
+    // Free the space in this tier, the run manager deletes the run file
     this->freeSpace(runSize);
     this->runManager->removeRunFile(runFilename);
-
-    // Delete the run file
-    std::remove(runFilename.c_str());
 }
 
 
-void SSD::mergeSSDRuns(HDD *outputDevice) {
-    // Print all device information
-    printStates("DEBUG: before mergeSSDRuns\n");
-
-    DRAM *_dram = DRAM::getInstance();
-    SSD *_ssd = SSD::getInstance();
-    int minMergeFanOut = 2;
-    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
-    RowCount _ssdEmptySpace = _ssd->getTotalEmptySpaceInRecords();
-
-    // Verify the SSD has space for output buffers
-    assert(_ssd->runManager->getTotalRecords() == _ssd->_filled);
-    if (_ssd->_filled > _ssd->getMergeFanInRecords()) {
-        _ssd->freeSpaceBySpillingRunfiles();
-        while (_ssd->_filled > _ssd->getMergeFanInRecords()) {
-            _ssd->freeSpaceBySpillingRunfiles();
-        }
-        if (_ssd->_filled > _ssd->getMergeFanInRecords()) {
-            std ::string msg = "ERROR: SSD should have enough space for Input Buffers\n";
-            printvv("%s\n", msg.c_str());
-            throw std::runtime_error(msg);
-        }
-        _ssdEmptySpace = _ssd->getTotalEmptySpaceInRecords();
-        if (_ssdPageSize * minMergeFanOut > _ssdEmptySpace) {
-            std::string msg = "ERROR: SSD should have enough space for Output Buffers\n";
-            printvv("%s\n", msg.c_str());
-            throw std::runtime_error(msg);
-        }
-    }
-
-    // Verify the SSD has runs to merge
-    if (_ssd->getRunfilesCount() == 0) {
-        printvv("WARNING: No runs to merge in SSD\n");
-        return;
-    }
-    if (_ssd->getRunfilesCount() == 1) {
-        printvv("WARNING: Only one run in SSD, No need for merge\n");
-        _ssd->freeSpaceBySpillingRunfiles();
-        return;
-    }
-
-    // Adjust the fanIn based on the available space in SSD and DRAM
-    // and setup the input and output buffer sizes in DRAM
-    RowCount _dramCapacity = _dram->getCapacityInRecords();
-    RowCount _dramMaxInputBufSize = _dramCapacity - _ssdPageSize * minMergeFanOut;
-    auto _runFiles = _ssd->runManager->getStoredRunsSortedBySize();
-    int _fanIn = _runFiles.size();
-    if (_fanIn * _ssdPageSize > _dramMaxInputBufSize) {
-        // if the input buffer size is less than the fanIn, reduce the fanIn
-        _fanIn = _dramMaxInputBufSize / _ssdPageSize;
-        printvv("FOCUS: Reducing fanIn to %d\n", _fanIn);
-        flushvv();
+/**
+ * @brief Write the merged records of head to the run of writer in the tier to
+ */
+static void writeMerged(Storage *to, RunWriter *writer, Record *head, RowCount nRecords,
+                        const char *state) {
+    Run *merged = new Run(head->next, nRecords);
+#if defined(_VALIDATE)
+    if (merged->isSorted() == false) {
+        printvv("ERROR: Run is not sorted\n");
+        throw std::runtime_error("Run is not sorted");
     }
-    printv("\t\t\tfanIn %d\n", _fanIn);
+#endif
+    RowCount nRecord = to->writeNextChunk(writer, merged);
+    assert(nRecord == nRecords && "ERROR: Writing run during mergeTierRuns");
+    double accessTime = to->chargeAccess(nRecords);
+    printss("\t\tSTATE -> %s runs, Spill to %s %lld records\n", state,
+            writer->getFilename().c_str(), nRecords);
+    printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+            to->getName().c_str(), nRecords * Config::get().RECORD_SIZE, accessTime);
     flushv();
-    _dram->setupMergeState(_ssdPageSize, _fanIn);
-    printv("\t\t\tAfter setting up merging state in mergeSSDRuns: %s\n",
-           _dram->reprUsageDetails().c_str());
+    // Free memory
+    delete merged;
+}
 
 
-    printvv("\tMERGE_SSD_RUNS START: Merging %d runs\n", _fanIn);
+void mergeTierRuns(Storage *from, Storage *to, const MergeStep *step) {
+    SortContext *context = to->getContext();
+    PersistentTier *staging = context->getStagingTier();
+    DRAM *_dram = context->getDRAM();
 
-    // Load the runs from SSD to DRAM
-    RowCount _inBufSizePerRun = _dram->getEffectiveClusterSize();
-    RowCount _totalOutBufSize = _dram->getTotalSpaceInOutputClusters();
-    PageCount _readAheadDRAM = _inBufSizePerRun / _ssdPageSize;
-    printv("\t\t\tinBufSizePerRun %lld, totalOutBufSize %lld, readAhead %d\n", _inBufSizePerRun,
-           _totalOutBufSize, _readAheadDRAM);
+    // Print all device information
+    staging->printStates("DEBUG: before mergeTierRuns");
+
+    if (from != staging) {
+        if (staging->isTooFullToMerge()) {
+            // Verify the staging tier is reasonably empty, or merge its own runs
+            printvv("WARNING: %s is almost full, moving a runfile down the spill chain\n",
+                    staging->getName().c_str());
+            flushvv();
+            staging->freeSpaceBySpillingRunfiles();
+            from = staging;
+            step = nullptr;
+        } else if (step != nullptr && staging->getRunsBelow(from, step).empty()) {
+            // The planned merge only reads runs of the staging tier
+            from = staging;
+        }
+    }
 
-    std::vector<RunStreamer *> runStreamers;
-    RowCount allRunTotal = 0;
-    for (int i = 0; i < _fanIn; i++) {
-        std::string runFilename = _runFiles[i].first;
-        RowCount runSize = _runFiles[i].second;
-        // The run streamer will update the dram input
-        RunReader *reader = new RunReader(runFilename, runSize, _ssdPageSize);
-        RunStreamer *runStreamer =
-            new RunStreamer(StreamerType::READER, reader, _ssd, _dram, _readAheadDRAM);
-        runStreamers.push_back(runStreamer);
-        allRunTotal += runSize;
+    // Select the runs and set up the input clusters: the runs of the staging tier are read
+    // into DRAM, the planned ones or the smallest, and the runs below it through the staging tier
+    std::vector<std::pair<std::string, RowCount>> runFiles;
+    std::vector<PlannedRun> lowerRuns;
+    int fanIn;
+    if (from == staging) {
+        fanIn = staging->setupDirectMerge(step, runFiles);
+        if (fanIn == 0) { return; }
+    } else {
+        fanIn = staging->setupBufferedMerge(from, step);
+        lowerRuns = staging->getRunsBelow(from, step);
+        if (step != nullptr) {
+            runFiles = step->getRunsIn(staging->getName());
+        } else {
+            runFiles = staging->runManager->getStoredRunsSortedBySize();
+            lowerRuns.resize(fanIn - runFiles.size());
+        }
     }
+    printvv("\tMERGE_TIER_RUNS START: Merging %d runs of %s to %s into %s\n", fanIn,
+            staging->getName().c_str(), from->getName().c_str(), to->getName().c_str());
 
-    std::vector<std::string> filesToRemove;
-    for (auto runStreamer : runStreamers) {
-        filesToRemove.push_back(runStreamer->getFilename());
+    if (isPackedPath()) {
+        staging->mergePackedRuns(runFiles, lowerRuns, to);
+        return;
     }
-    printv("\t\t\tDEBUG: After loading runs to streamers in mergeSSDRuns: %s\n",
-           _dram->reprUsageDetails().c_str());
-    printv("%s", _ssd->reprUsageDetails().c_str());
-    flushv();
 
+    // Load the runs to streamers from the staging tier and the tiers below
+    auto pair = staging->openRunStreamers(runFiles, lowerRuns);
+    std::vector<RunStreamer *> runStreamers = pair.first;
+    RowCount allRunTotal = pair.second;
+    printv("\t\t\t#runStreamers %d, allRunTotal %lld\n", runStreamers.size(), allRunTotal);
 
     // Merge the runs using a loser tree
+    RowCount totalOutBufSizeDram = _dram->getTotalSpaceInOutputClusters();
     LoserTree loserTree;
-    loserTree.constructTree(runStreamers);
-    RunWriter *writer = _ssd->getRunWriter();
+    loserTree.constructCascade(runStreamers, Config::get().MERGE_GROUP_SIZE);
+    RunWriter *writer = to->getRunWriter();
+
     Record *head = new Record();
     Record *current = head, *prev = nullptr;
-    RowCount nSorted = 0, runningCount = 0;
+    RowCount nSorted = 0;
     RowCount nDups = 0, runningCountWithoutDups = 0;
-    bool copied = false;
     while (true) {
         Record *winner = loserTree.getNext();
         if (winner == nullptr) {
             break;
         }
         nSorted++;
-        runningCount++;
+        if (nSorted > allRunTotal) { // verify the merged run size
+            printvv("ERROR: Merged run size exceeds %lld\n", allRunTotal);
+            throw std::runtime_error("Merged run size exceeds");
+        }
         // Duplicate check
-        if (prev != nullptr && *prev == *winner) {
+        if (prev != nullptr && absorbRecord(prev->data, winner->data)) {
             nDups++;
-            Config::NUM_DUPLICATES_REMOVED++;
+            context->counters.nDuplicatesRemoved++;
             // free memory
             delete winner;
             // move to next record
             continue;
         }
-        runningCountWithoutDups++;
-        if (copied) {
-            delete prev;
-            copied = false;
-        }
-        prev = winner;
-        current->next = winner;
-        current = current->next;
-        if (nSorted > allRunTotal) { // verify the merged run size
-            printvv("ERROR: Merged run size exceeds %lld\n", allRunTotal);
-            throw std::runtime_error("Merged run size exceeds");
-        }
-        if (runningCountWithoutDups >= _totalOutBufSize) {
-            prev = new Record(prev->data);
-            copied = true;
-
-            // When the merged run size fills the DRAM output buffer size, spill the
-            // run to SSD; when the SSD output buffer size is filled, spill the run to HDD
-            Run *merged = new Run(head->next, runningCountWithoutDups);
-#if defined(_VALIDATE)
-            if (merged->isSorted() == false) {
-                printvv("ERROR: Run is not sorted\n");
-                throw std::runtime_error("Run is not sorted");
-            }
-#endif
-            RowCount nRecord = _ssd->writeNextChunk(writer, merged);
-            assert(nRecord == runningCountWithoutDups && "ERROR: Writing run during mergeSSDRuns");
-            printss("\t\tSTATE -> Merging runs, Spill to %s, %lld records \n",
-                    writer->getFilename().c_str(), runningCountWithoutDups);
-            printss(
-                "\t\tACCESS -> A write to SSD was made with size %llu bytes and latency %.2lf us\n",
-                runningCountWithoutDups * Config::RECORD_SIZE,
-                getSSDAccessTime(runningCountWithoutDups));
-            // free memory
-            delete merged;
+        // The last record is final once another one follows, only then is a full buffer written
+        if (runningCountWithoutDups >= totalOutBufSizeDram) {
+            // When the merged run fills the output clusters in DRAM, write it to the tier,
+            // which spills it down the chain once it is full
+            writeMerged(to, writer, head, runningCountWithoutDups, "Merging");
             // reset the head
             head->next = nullptr;
             current = head;
-            // prev = nullptr;
-            runningCount = 0;
             runningCountWithoutDups = 0;
         }
-        flushv();
+        runningCountWithoutDups++;
+        prev = winner;
+        current->next = winner;
+        current = current->next;
     }
 
     // Write the remaining records
     if (runningCountWithoutDups > 0) {
-        Run *merged = new Run(head->next, runningCountWithoutDups);
-#if defined(_VALIDATE)
-        if (merged->isSorted() == false) {
-            printvv("ERROR: Run is not sorted\n");
-            throw std::runtime_error("Run is not sorted");
-        }
-#endif
-        RowCount nRecord = _ssd->writeNextChunk(writer, merged);
-        assert(nRecord == runningCountWithoutDups && "ERROR: Writing run during mergeSSDRuns");
-        printss("\t\tSTATE -> Merged runs, Spill to %s %lld records\n",
-                writer->getFilename().c_str(), runningCountWithoutDups);
-        printss("\t\tACCESS -> A write to SSD was made with size %llu bytes and latency %.2lf us\n",
-                runningCountWithoutDups * Config::RECORD_SIZE,
-                getSSDAccessTime(runningCountWithoutDups));
-        flushv();
-        // free memory
-        delete merged;
-        // room for optimization
+        writeMerged(to, writer, head, runningCountWithoutDups, "Merged");
     }
 
-    // Close the RunWriter that was storing the merged run. The SSD used space should be updated by
-    // the writeNextChunk,
-    _ssd->closeWriter(writer);
+    // Close the RunWriter that was storing the merged run.
+    // The used space of the tier is updated by writeNextChunk
+    to->closeWriter(writer);
+    // Delete the run file entries from the run managers, which delete the files once the
+    // step is complete
+    for (auto &runFile : runFiles) {
+        staging->removeRunFile(runFile.first);
+        printv("\t\t\t\tRemoved run file %s from %s\n", runFile.first.c_str(),
+               staging->getName().c_str());
+    }
+    for (auto &run : lowerRuns) {
+        context->getTier(run.deviceName)->removeRunFile(run.filename);
+        printv("\t\t\t\tRemoved run file %s from %s\n", run.filename.c_str(),
+               run.deviceName.c_str());
+    }
+    // Reset the dram
+    _dram->reset();
+    // Free memory
+    delete head;
+    for (auto streamer : runStreamers) {
+        delete streamer;
+    }
+
+    // Verify the merged run size
+    assert(nSorted == allRunTotal && "ERROR: Merged run size mismatch in mergeTierRuns");
+
+    // Print all device information
+    staging->printStates("DEBUG: after mergeTierRuns:");
+    printvv("\tMERGE_TIER_RUNS COMPLETE: Merged %d runs, %lld records\n", fanIn, nSorted);
+    if (nDups > 0) {
+        printvv("\tRemoved %lld duplicates\n", nDups);
+    }
+    flushvv();
+}
+
 
-    // Remove the run files from the run manager, the actual files has already been
-    // deleted by the runreader and endspillsession
-    for (auto runFilename : filesToRemove) {
-        _ssd->runManager->removeRunFile(runFilename);
+void PersistentTier::mergePackedRuns(const std::vector<std::pair<std::string, RowCount>> &runFiles,
+                                     const std::vector<PlannedRun> &lowerRuns, Storage *to) {
+    DRAM *_dram = context->getDRAM();
+    RowCount _pageSize = getPageSizeInRecords();
+    PageCount readAheadDRAM = _dram->getEffectiveClusterSize() / _pageSize;
+
+    // Read the runs of this tier directly, and the runs below it through buffer files here
+    std::vector<PackedStream *> streams;
+    RowCount allRunTotal = 0;
+    for (auto &runFile : runFiles) {
+        RunReader *reader = new RunReader(runFile.first, runFile.second, _pageSize);
+        streams.push_back(new PackedStream(reader, this, readAheadDRAM));
+        allRunTotal += runFile.second;
+    }
+    for (auto &run : lowerRuns) {
+        PersistentTier *tier = context->getTier(run.deviceName);
+        RowCount pageSize = tier->getPageSizeInRecords();
+        PageCount readAhead = getEffectiveClusterSize() / pageSize;
+        RunReader *reader = new RunReader(run.filename, run.nRecords, pageSize);
+        PackedStream *inner = new PackedStream(reader, tier, readAhead);
+        streams.push_back(new PackedStream(inner, this, readAheadDRAM));
+        allRunTotal += run.nRecords;
     }
 
-    // Reset the dram
+    // Merge the runs into a new run of the tier to, which spills down the chain once it is full
+    RunWriter *writer = to->getRunWriter();
+    RowCount nDups = 0;
+    RowCount nSorted = mergePackedStreams(streams, to, writer,
+                                          _dram->getTotalSpaceInOutputClusters(), allRunTotal,
+                                          &nDups);
+    to->closeWriter(writer);
+    for (auto &runFile : runFiles) {
+        removeRunFile(runFile.first);
+    }
+    for (auto &run : lowerRuns) {
+        context->getTier(run.deviceName)->removeRunFile(run.filename);
+    }
     _dram->reset();
-
-    // Free memory
-    delete head;
-    for (auto streamer : runStreamers) {
-        delete streamer;
+    for (auto stream : streams) {
+        delete stream;
     }
+    assert(nSorted == allRunTotal && "ERROR: Merged run size mismatch in mergeTierRuns");
 
-    // Print all device information
-    printv("\t\t\tSorted %lld records in SSD\n", nSorted);
-    printStates("DEBUG: after mergeSSDRuns:");
-
-    // Final print
-    printvv("\tMERGE_SSD_RUNS COMPLETE: Merged %d runs\n", _runFiles.size());
+    printStates("DEBUG: after mergeTierRuns:");
+    printvv("\tMERGE_TIER_RUNS COMPLETE: Merged %d runs, %lld packed records\n",
+            (int)streams.size(), nSorted);
     if (nDups > 0) {
         printvv("\tRemoved %lld duplicates\n", nDups);
     }
@@ -676,12 +681,29 @@ void quickSort(std::vector<Record *> &records) {
 // =========================================================
 
 
-DRAM *DRAM::instance = nullptr;
-
-DRAM::DRAM()
-    : Storage(DRAM_NAME, Config::DRAM_CAPACITY, Config::DRAM_BANDWIDTH, Config::DRAM_LATENCY) {
-    this->spillTo = SSD::getInstance();
+DRAM::DRAM(SortContext *context)
+    : Storage(context, context->getTierGraph()->getSpec(TierRole::MEMORY), TierRole::MEMORY) {
+    this->spillTo = context->getStagingTier();
     this->reset();
+    _packed = nullptr;
+    _naturalRun = nullptr;
+    _naturalRunLast = nullptr;
+    _naturalRunInput = 0;
+    _naturalRunDuplicates = 0;
+    _naturalRunFiltered = 0;
+    _filter = nullptr;
+    _loadedInput = 0;
+    _loadedFiltered = 0;
+    _loadedDuplicates = 0;
+    _topKInput = 0;
+    _topKDuplicates = 0;
+    _topKFiltered = 0;
+}
+
+
+void DRAM::setFilter(const FilterPredicate &predicate) {
+    delete _filter;
+    _filter = predicate.isEmpty() ? nullptr : new FilterKernel(predicate);
 }
 
 
@@ -734,63 +756,374 @@ void DRAM::setupMergeState(RowCount outputDevicePageSize, int fanIn) {
 }
 
 
-RowCount DRAM::loadInput(RowCount nRecords) {
+RowCount DRAM::loadInput(RowCount nRecords, RowCount *nRecordsKept) {
     // TRACE(true);
-    HDD *_hdd = HDD::getInstance();
+    PersistentTier *_hdd = context->getFinalTier();
 
     // Read records from HDD to DRAM
-    char *data = new char[nRecords * Config::RECORD_SIZE];
+    char *data = new char[nRecords * Config::get().RECORD_SIZE];
     RowCount nRecordsRead = _hdd->readRecords(data, nRecords);
     if (nRecordsRead == 0) {
         printvv("WARNING: no records read\n");
     }
-    printv("\tinput file ptr: %lld records", _hdd->getReadPosition() / Config::RECORD_SIZE);
+    printv("\tinput file ptr: %lld records", _hdd->getReadPosition() / Config::get().RECORD_SIZE);
+
+    // Drop the filtered records before they become Records
+    *nRecordsKept = _filter == nullptr ? nRecordsRead : _filter->compact(data, nRecordsRead);
+    _loadedInput = nRecordsRead;
+    _loadedFiltered = nRecordsRead - *nRecordsKept;
+    if (Config::get().GROUP_BY) { initGroups(data, *nRecordsKept); }
+    _loadedDuplicates = 0;
+    if (Config::get().EARLY_DEDUP) {
+        RowCount nDistinct = dropDuplicates(data, *nRecordsKept);
+        _loadedDuplicates = *nRecordsKept - nDistinct;
+        context->counters.nDuplicatesRemoved += _loadedDuplicates;
+        *nRecordsKept = nDistinct;
+    }
+    if (Config::get().TOP_K > 0) { *nRecordsKept = keepTopK(data, *nRecordsKept); }
+    context->counters.nRecordsFiltered += _loadedFiltered;
+    if (*nRecordsKept == 0 && _naturalRun != nullptr) {
+        // Nothing to append, the open natural run still covers the input read so far
+        _naturalRunInput += _loadedInput;
+        _naturalRunDuplicates += _loadedDuplicates;
+        _naturalRunFiltered += _loadedFiltered;
+    }
 
-    // Create a linked list of records
-    Record *head = new Record();
-    Record *curr = head;
-    char *recordsData = data;
-    for (RowCount i = 0; i < nRecordsRead; i++) {
-        Record *rec = new Record(recordsData);
-        curr->next = rec;
-        curr = rec;
-        // update
-        recordsData += Config::RECORD_SIZE;
+    // Create a linked list of records, small records stay in the flat buffer instead
+    bool packed = isPackedPath() && *nRecordsKept > 0;
+    if (packed) {
+        _packed = data;
+    } else {
+        linkRecords(data, *nRecordsKept);
     }
-    _head = head->next;
 
     // Update DRAM usage
-    _filled += nRecordsRead;
+    _filled += *nRecordsKept;
 
     // Print debug information
-    printss("\t\tSTATE -> LOAD_INPUT: %llu input records\n", nRecordsRead);
+    double accessTime = _hdd->chargeAccess(nRecordsRead);
+    printss("\t\tSTATE -> LOAD_INPUT: %llu input records, %llu filtered out, %llu duplicates\n",
+            nRecordsRead, _loadedFiltered, _loadedDuplicates);
     printss("\t\tACCESS -> A read from HDD was made with size %llu bytes and latency %.2lf us\n",
-            nRecordsRead * Config::RECORD_SIZE, getHDDAccessTime(nRecordsRead));
+            nRecordsRead * Config::get().RECORD_SIZE, accessTime);
     printv("%s\n", this->reprUsageDetails().c_str());
     flushv();
 
     // Free memory
-    delete[] data;
-    delete head;
+    if (!packed) { delete[] data; }
     return nRecordsRead;
 }
 
 
-void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
+void DRAM::linkRecords(char *data, RowCount nRecords) {
+    Record *head = new Record();
+    Record *curr = head;
+    for (RowCount i = 0; i < nRecords; i++) {
+        Record *rec = new Record(data + i * Config::get().RECORD_SIZE);
+        curr->next = rec;
+        curr = rec;
+    }
+    _head = head->next;
+    delete head;
+}
+
+
+/**
+ * @brief FNV-1a hash of the key of a record, up to a null byte, as strncmp compares it
+ */
+static uint64_t hashKey(const char *record) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < Config::get().RECORD_KEY_SIZE && record[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)record[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+RowCount DRAM::dropDuplicates(char *data, RowCount nRecords) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+    if (getDistinctSize() == 0 || nRecords < 2) { return nRecords; }
+
+    // Slot: hash and 1 + position of a kept record, 0 if empty. A power of two, so a probe
+    // wraps around with a mask.
+    size_t nSlots = 1;
+    while (nSlots < 2 * (size_t)nRecords) {
+        nSlots <<= 1;
+    }
+    std::vector<std::pair<uint64_t, RowCount>> table(nSlots, std::make_pair(0, 0));
+    RowCount nKept = 0;
+    for (RowCount i = 0; i < nRecords; i++) {
+        char *record = data + i * size;
+        uint64_t hash = hashKey(record);
+        size_t slot = hash & (nSlots - 1);
+        bool absorbed = false;
+        for (; table[slot].second != 0; slot = (slot + 1) & (nSlots - 1)) {
+            if (table[slot].first == hash &&
+                absorbRecord(data + (table[slot].second - 1) * size, record)) {
+                absorbed = true;
+                break;
+            }
+        }
+        if (absorbed) { continue; }
+        // Kept records only move forward, to positions no slot points to yet
+        char *kept = data + nKept * size;
+        if (kept != record) { std::memmove(kept, record, size); }
+        table[slot] = std::make_pair(hash, ++nKept);
+    }
+    return nKept;
+}
+
+
+RowCount DRAM::keepTopK(char *data, RowCount nRecords) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+    std::vector<char *> records;
+    records.reserve(nRecords + _topK.size() / size);
+    for (char *record = data; record < data + nRecords * size; record += size) {
+        if (_topKCutoff.empty() ||
+            std::strncmp(record, _topKCutoff.data(), Config::get().RECORD_KEY_SIZE) <= 0) {
+            records.push_back(record);
+        }
+    }
+    bool carry = isTopKCarried();
+    if (!carry && (RowCount)records.size() == nRecords && nRecords <= Config::get().TOP_K) {
+        return nRecords;
+    }
+    RowCount nCarried = _topK.size() / size;
+    for (char *record = _topK.data(); record < _topK.data() + _topK.size(); record += size) {
+        records.push_back(record);
+    }
+
+    RowCount nDups = 0;
+    if (carry || (RowCount)records.size() > Config::get().TOP_K) {
+        // Equal records end up next to each other, as the merges expect them
+        std::sort(records.begin(), records.end(), [size](const char *a, const char *b) {
+            int cmp = std::strncmp(a, b, Config::get().RECORD_KEY_SIZE);
+            return cmp != 0 ? cmp < 0 : std::strncmp(a, b, size) < 0;
+        });
+        // Keep the first TOP_K distinct records, or groups with GROUP_BY. Written runs keep the
+        // duplicates for the merges to count, the carried records are never merged, so they drop
+        // or combine them right away.
+        const int distinctSize = getDistinctSize();
+        RowCount nDistinct = 0;
+        size_t nKept = 0;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (i > 0 && distinctSize > 0 &&
+                std::strncmp(records[i - 1], records[i], distinctSize) == 0) {
+                if (carry) {
+                    if (Config::get().GROUP_BY) { combineGroups(records[nKept - 1], records[i]); }
+                    nDups++;
+                } else {
+                    records[nKept++] = records[i];
+                }
+                continue;
+            }
+            if (nDistinct == Config::get().TOP_K) { break; }
+            nDistinct++;
+            records[nKept++] = records[i];
+        }
+        records.resize(nKept);
+        if (nDistinct == Config::get().TOP_K) {
+            _topKCutoff.assign(records.back(), Config::get().RECORD_KEY_SIZE);
+        }
+    }
+
+    std::vector<char> kept(records.size() * size);
+    for (size_t i = 0; i < records.size(); i++) {
+        std::memcpy(kept.data() + i * size, records[i], size);
+    }
+    _loadedFiltered += nRecords + nCarried - records.size() - nDups;
+    if (!carry) {
+        // The kept records are in order, so the load is written as a natural run
+        std::memcpy(data, kept.data(), kept.size());
+        return records.size();
+    }
+
+    // Nothing is sorted or written until the input ends, see flushTopK()
+    _topK.swap(kept);
+    context->counters.nDuplicatesRemoved += nDups;
+    _topKInput += _loadedInput;
+    _topKDuplicates += nDups + _loadedDuplicates;
+    _topKFiltered += _loadedFiltered;
+    return 0;
+}
+
+
+void DRAM::flushTopK() {
+    RowCount nRecords = _topK.size() / Config::get().RECORD_SIZE;
+    if (nRecords > 0) {
+        PersistentTier *_hdd = context->getFinalTier();
+        RunWriter *writer = _hdd->getRunWriter();
+        std::string filename = writer->getFilename();
+        writer->writeRecords(_topK.data(), nRecords);
+        _hdd->closeWriter(writer);
+        double accessTime = _hdd->chargeAccess(nRecords);
+        printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+                _hdd->getName().c_str(), nRecords * Config::get().RECORD_SIZE, accessTime);
+        printvv("\tTOP_K: the %lld smallest records of %lld input records written to %s\n",
+                nRecords, _topKInput, filename.c_str());
+        flushvv();
+    }
+    std::vector<char>().swap(_topK);
+    _topKInput = 0;
+    _topKDuplicates = 0;
+    _topKFiltered = 0;
+}
+
+
+bool DRAM::isNaturalRun() {
+    bool ascending = true, descending = true;
+    for (Record *curr = _head; curr != nullptr && curr->next != nullptr; curr = curr->next) {
+        ascending = ascending && !(*curr > *curr->next);
+        descending = descending && !(*curr < *curr->next);
+        if (!ascending && !descending) { return false; }
+    }
+    if (ascending) { return true; }
+
+    // Reverse the linked list
+    Record *prev = nullptr, *curr = _head;
+    while (curr != nullptr) {
+        Record *next = curr->next;
+        curr->next = prev;
+        prev = curr;
+        curr = next;
+    }
+    _head = prev;
+    return true;
+}
+
+
+void DRAM::writeNaturalRun(RowCount nRecords) {
+    PersistentTier *_hdd = context->getFinalTier();
+
+    // Continue the open run if the loaded records follow its last record. The group of the last
+    // record is written already, so a load starting with its key starts a new run.
+    bool extends = _naturalRun != nullptr && !(*_head < *_naturalRunLast) &&
+                   !(Config::get().GROUP_BY && !(*_naturalRunLast < *_head));
+    if (!extends) {
+        closeNaturalRun();
+        _naturalRun = _hdd->getRunWriter();
+    }
+
+    // Drop the duplicates, the first record is compared with the last one written
+    Record *head = new Record();
+    Record *current = head, *prev = extends ? _naturalRunLast : nullptr;
+    RowCount nDups = 0, nKept = 0;
+    Record *curr = _head;
+    while (curr != nullptr) {
+        Record *next = curr->next;
+        if (prev != nullptr && absorbRecord(prev->data, curr->data)) {
+            nDups++;
+            context->counters.nDuplicatesRemoved++;
+            delete curr;
+        } else {
+            current->next = curr;
+            current = curr;
+            prev = curr;
+            nKept++;
+        }
+        curr = next;
+    }
+    current->next = nullptr;
+    _naturalRunInput += _loadedInput;
+    _naturalRunDuplicates += nDups + _loadedDuplicates;
+    _naturalRunFiltered += _loadedFiltered;
+
+    if (nKept > 0) {
+        delete _naturalRunLast;
+        _naturalRunLast = new Record(current->data);
+        Run *run = new Run(head->next, nKept);
+#if defined(_VALIDATE)
+        if (run->isSorted() == false) {
+            printvv("ERROR: Run is not sorted\n");
+            throw std::runtime_error("Run is not sorted");
+        }
+#endif
+        RowCount nRecord = _hdd->writeNextChunk(_naturalRun, run);
+        assert(nRecord == nKept && "ERROR: Writing natural run");
+        double accessTime = _hdd->chargeAccess(nKept);
+        printss("\t\tSTATE -> Natural run, append to %s %lld records\n",
+                _naturalRun->getFilename().c_str(), nKept);
+        printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+                _hdd->getName().c_str(), nKept * Config::get().RECORD_SIZE, accessTime);
+        // Free memory
+        delete run;
+    }
+    this->reset();
+    delete head;
+
+    printvv("\tGEN_MINIRUNS COMPLETE: %lld records in order, %s natural run %s\n", nRecords,
+            extends ? "extended" : "started", _naturalRun->getFilename().c_str());
+    if (nDups > 0) {
+        printvv("\tRemoved %lld duplicates\n", nDups);
+    }
+    flushvv();
+}
+
+
+void DRAM::closeNaturalRun() {
+    if (_naturalRun == nullptr) { return; }
+    printv("\t\t\tClosing natural run %s, %lld input records\n",
+           _naturalRun->getFilename().c_str(), _naturalRunInput);
+    context->getFinalTier()->closeWriter(_naturalRun);
+    delete _naturalRunLast;
+    _naturalRun = nullptr;
+    _naturalRunLast = nullptr;
+    _naturalRunInput = 0;
+    _naturalRunDuplicates = 0;
+    _naturalRunFiltered = 0;
+}
+
+
+void DRAM::genMiniRuns(RowCount nRecords, PersistentTier *outputStorage) {
     // TRACE(true);
     printvv("\tGEN_MINIRUNS START\n");
+    if (_packed != nullptr) {
+        genPackedMiniRuns(nRecords, outputStorage);
+        return;
+    }
+
+    // Input already in order needs neither a sort nor a merge
+    if (isNaturalRun()) {
+        writeNaturalRun(nRecords);
+        return;
+    }
+    closeNaturalRun();
 
-    // Sort the records in cache-sized chunks and create miniruns
-    RowCount _cacheSize = Config::CACHE_SIZE / Config::RECORD_SIZE;
+    // Sort the records in cache-sized chunks and create miniruns,
+    // chunks already in order are kept and chunks in reverse order are reversed
+    RowCount _cacheSize = Config::get().CACHE_SIZE / Config::get().RECORD_SIZE;
     std::vector<Run *> _miniruns;
     Record *curr = _head;
+    RowCount nPresorted = 0, nCombined = 0;
     for (RowCount i = 0; i < nRecords; i += _cacheSize) {
         std::vector<Record *> records;
         for (RowCount j = 0; j < _cacheSize && curr != nullptr; j++) {
             records.push_back(curr);
             curr = curr->next;
         }
-        quickSort(records);
+        auto less = [](const Record *a, const Record *b) { return *a < *b; };
+        auto greater = [](const Record *a, const Record *b) { return *a > *b; };
+        if (std::is_sorted(records.begin(), records.end(), less)) {
+            nPresorted += records.size();
+        } else if (std::is_sorted(records.begin(), records.end(), greater)) {
+            std::reverse(records.begin(), records.end());
+            nPresorted += records.size();
+        } else {
+            quickSort(records);
+        }
+        // Combine the groups right away, the merge reads one record per group and mini-run
+        if (Config::get().GROUP_BY) {
+            size_t nKept = 1;
+            for (size_t j = 1; j < records.size(); j++) {
+                if (absorbRecord(records[nKept - 1]->data, records[j]->data)) {
+                    delete records[j];
+                } else {
+                    records[nKept++] = records[j];
+                }
+            }
+            nCombined += records.size() - nKept;
+            records.resize(nKept);
+        }
         // Update the next pointer
         for (size_t j = 0; j < records.size() - 1; j++) {
             records[j]->next = records[j + 1];
@@ -806,7 +1139,13 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
 #endif
         _miniruns.push_back(run);
     }
-    printvv("\tSorted %lld records and generated %d miniruns\n", nRecords, _miniruns.size());
+    printvv("\tSorted %lld records and generated %d miniruns, %lld records already in order\n",
+            nRecords, _miniruns.size(), nPresorted);
+    if (nCombined > 0) {
+        printvv("\tCombined %lld records into their groups\n", nCombined);
+        context->counters.nDuplicatesRemoved += nCombined;
+        _filled -= nCombined;
+    }
     flushv();
 
     // Setup the merge state for miniruns
@@ -845,11 +1184,12 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
         _miniruns.erase(_miniruns.begin() + i, _miniruns.end());
 
         // Print access
+        double accessTime = outputStorage->chargeAccess(spillNRecords);
         printss("\t\tSTATE -> %d cache-sized miniruns Spill to %s\n", j - i,
                 outputStorage->getName().c_str());
         printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
-                outputStorage->getName().c_str(), spillNRecords * Config::RECORD_SIZE,
-                getSSDAccessTime(spillNRecords));
+                outputStorage->getName().c_str(), spillNRecords * Config::get().RECORD_SIZE,
+                accessTime);
 
     } else {
         printv("\t\t\tDEBUG: All miniruns fit in DRAM\n");
@@ -862,7 +1202,7 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
         runStreamers.push_back(new RunStreamer(StreamerType::INMEMORY_RUN, _miniruns[i]));
     }
     LoserTree loserTree;
-    loserTree.constructTree(runStreamers);
+    loserTree.constructCascade(runStreamers, Config::get().MERGE_GROUP_SIZE);
     RunWriter *writer = outputStorage->getRunWriter();
     printss("\t\tSTATE -> Merging %d cache-sized miniruns\n", _miniruns.size());
     // Start merging
@@ -870,7 +1210,6 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
     Record *current = head, *prev = nullptr;
     RowCount nSorted = 0, runningCount = 0;
     RowCount nDups = 0, runningCountWithoutDups = 0;
-    bool copied = false;
     while (true) {
         Record *winner = loserTree.getNext();
         if (winner == NULL) {
@@ -883,25 +1222,16 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
             throw std::runtime_error("Merged run size exceeds");
         }
         /** duplicate check */
-        if (prev != nullptr && *prev == *winner) {
+        if (prev != nullptr && absorbRecord(prev->data, winner->data)) {
             nDups++;
-            Config::NUM_DUPLICATES_REMOVED++;
+            context->counters.nDuplicatesRemoved++;
             // free memory
             delete winner;
             // move to next record
             continue;
         }
-        runningCountWithoutDups++;
-        if (copied) {
-            delete prev;
-            copied = false;
-        }
-        prev = winner;
-        current->next = winner;
-        current = current->next;
+        // The last record is final once another one follows, only then is a full buffer written
         if (runningCountWithoutDups >= _totalSpaceInOutputClusters) {
-            prev = new Record(prev->data);
-            copied = true;
             // When the merged run size fills the output buffer size, store the run in SSD
             printv("\t\t\tWriting %lld (%lld) records to SSD\n", runningCountWithoutDups,
                    runningCount);
@@ -914,18 +1244,23 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
 #endif
             RowCount nRecord = outputStorage->writeNextChunk(writer, merged);
             assert(nRecord == runningCountWithoutDups && "ERROR: Writing run in mergeMini");
+            double accessTime = outputStorage->chargeAccess(runningCountWithoutDups);
             printss(
                 "\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
-                outputStorage->getName().c_str(), runningCountWithoutDups * Config::RECORD_SIZE,
-                outputStorage->getAccessTimeInMicro(runningCountWithoutDups));
+                outputStorage->getName().c_str(),
+                runningCountWithoutDups * Config::get().RECORD_SIZE, accessTime);
             // Free memory
             delete merged;
             // Reset the head
             head->next = nullptr;
             current = head;
-            runningCount = 0;
+            runningCount = 1; // the winner
             runningCountWithoutDups = 0;
         }
+        runningCountWithoutDups++;
+        prev = winner;
+        current->next = winner;
+        current = current->next;
     }
 
     // Write the remaining records
@@ -939,9 +1274,10 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
 #endif
         RowCount nRecord = outputStorage->writeNextChunk(writer, merged);
         assert(nRecord == runningCountWithoutDups && "ERROR: Writing remaining run in mergeMini");
+        double accessTime = outputStorage->chargeAccess(runningCountWithoutDups);
         printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
-                outputStorage->getName().c_str(), runningCountWithoutDups * Config::RECORD_SIZE,
-                outputStorage->getAccessTimeInMicro(runningCountWithoutDups));
+                outputStorage->getName().c_str(),
+                runningCountWithoutDups * Config::get().RECORD_SIZE, accessTime);
         // Free memory
         delete merged;
     }
@@ -969,19 +1305,328 @@ void DRAM::genMiniRuns(RowCount nRecords, HDD *outputStorage) {
 }
 
 
-// =============================================================================
-// ------------------------------ CommonFunctions ------------------------------
-// =============================================================================
+void DRAM::genPackedMiniRuns(RowCount nRecords, PersistentTier *outputStorage) {
+    const ByteCount size = Config::get().RECORD_SIZE;
+
+    // Input already in order needs neither a sort nor a merge, the natural run takes Records
+    int order = getPackedOrder(_packed, nRecords);
+    if (order != 0) {
+        if (order < 0) { reversePacked(_packed, nRecords); }
+        linkRecords(_packed, nRecords);
+        delete[] _packed;
+        _packed = nullptr;
+        writeNaturalRun(nRecords);
+        return;
+    }
+    closeNaturalRun();
+
+    // Sort the records in cache-sized chunks in place: their encoded keys and pointers are
+    // sorted, then the records are gathered in that order and copied back. Chunks already in
+    // order are kept and chunks in reverse order are reversed.
+    struct SortEntry {
+        EncodedKey key;
+        const char *record;
+    };
+    KeyEncoder encoder;
+    auto less = [&encoder](const SortEntry &a, const SortEntry &b) {
+        return encoder.isLess(a.key, a.record, b.key, b.record);
+    };
+    RowCount _cacheSize = Config::get().CACHE_SIZE / size;
+    std::vector<std::pair<char *, RowCount>> _miniruns; // first record and size of each
+    std::vector<SortEntry> entries;
+    std::vector<char> gathered;
+    RowCount nPresorted = 0, nCombined = 0;
+    for (RowCount i = 0; i < nRecords; i += _cacheSize) {
+        char *chunk = _packed + i * size;
+        RowCount n = std::min(_cacheSize, nRecords - i);
+        int chunkOrder = getPackedOrder(chunk, n);
+        if (chunkOrder != 0) {
+            if (chunkOrder < 0) { reversePacked(chunk, n); }
+            nPresorted += n;
+        } else {
+            entries.resize(n);
+            bool encoded = true;
+            for (RowCount j = 0; j < n; j++) {
+                entries[j].record = chunk + j * size;
+                encoded = encoded && encoder.encode(entries[j].record, &entries[j].key);
+            }
+            if (!encoded) {
+                // A key outside the alphabet, the rest of the load takes the binary encoding
+                encoder.setMode(KeyEncoder::Mode::BINARY);
+                for (RowCount j = 0; j < n; j++) {
+                    encoder.encode(entries[j].record, &entries[j].key);
+                }
+            }
+            std::sort(entries.begin(), entries.end(), less);
+            gathered.resize(n * size);
+            for (RowCount j = 0; j < n; j++) {
+                std::memcpy(&gathered[j * size], entries[j].record, size);
+            }
+            std::memcpy(chunk, gathered.data(), n * size);
+        }
+        // Combine the groups right away, the merge reads one record per group and mini-run
+        if (Config::get().GROUP_BY) {
+            RowCount nKept = 1;
+            for (RowCount j = 1; j < n; j++) {
+                if (!absorbRecord(chunk + (nKept - 1) * size, chunk + j * size)) {
+                    if (nKept != j) { std::memcpy(chunk + nKept * size, chunk + j * size, size); }
+                    nKept++;
+                }
+            }
+            nCombined += n - nKept;
+            n = nKept;
+        }
+#if defined(_VALIDATE)
+        if (getPackedOrder(chunk, n) < 0) {
+            printvv("ERROR: Run is not sorted\n");
+            throw std::runtime_error("Run is not sorted");
+        }
+#endif
+        _miniruns.push_back(std::make_pair(chunk, n));
+    }
+    printvv("\tSorted %lld packed records and generated %d miniruns, %lld records already in "
+            "order\n",
+            nRecords, _miniruns.size(), nPresorted);
+    if (nCombined > 0) {
+        printvv("\tCombined %lld records into their groups\n", nCombined);
+        context->counters.nDuplicatesRemoved += nCombined;
+        _filled -= nCombined;
+    }
+    flushv();
+
+    // Setup the merge state for miniruns, and spill the runs that don't fit in InputClusters
+    setupMergeStateForMiniruns(outputStorage->getPageSizeInRecords());
+    RowCount totalInBufSizeDram = this->getTotalSpaceInInputClusters();
+    RowCount keepNRecordsInDRAM = 0;
+    size_t i = 0;
+    for (; i < _miniruns.size(); i++) {
+        RowCount runSize = _miniruns[i].second;
+        if (keepNRecordsInDRAM + runSize < totalInBufSizeDram) {
+            keepNRecordsInDRAM += runSize;
+        } else {
+            break;
+        }
+    }
+    // Emulate transfer of these runs to input buffer
+    _filledInputClusters += keepNRecordsInDRAM;
+    _filled -= keepNRecordsInDRAM;
+    if (i < _miniruns.size()) {
+        RowCount spillNRecords = 0;
+        for (size_t j = i; j < _miniruns.size(); j++) {
+            spillNRecords += _miniruns[j].second;
+            outputStorage->storeRun(_miniruns[j].first, _miniruns[j].second);
+        }
+        double accessTime = outputStorage->chargeAccess(spillNRecords);
+        printss("\t\tSTATE -> %d cache-sized miniruns Spill to %s\n", _miniruns.size() - i,
+                outputStorage->getName().c_str());
+        printss("\t\tACCESS -> A write to %s was made with size %llu bytes and latency %.2lf us\n",
+                outputStorage->getName().c_str(), spillNRecords * Config::get().RECORD_SIZE,
+                accessTime);
+        _miniruns.erase(_miniruns.begin() + i, _miniruns.end());
+    }
+    flushv();
+
+    // Remaining runs fit in DRAM, merge them
+    std::vector<PackedStream *> streams;
+    for (auto &minirun : _miniruns) {
+        streams.push_back(new PackedStream(minirun.first, minirun.second));
+    }
+    RunWriter *writer = outputStorage->getRunWriter();
+    printss("\t\tSTATE -> Merging %d cache-sized miniruns\n", _miniruns.size());
+    RowCount nDups = 0;
+    RowCount nSorted = mergePackedStreams(streams, outputStorage, writer,
+                                          _totalSpaceInOutputClusters, keepNRecordsInDRAM, &nDups);
+    outputStorage->closeWriter(writer);
+
+    // Reset the DRAM and the merge state, the DRAM should be empty now
+    this->reset();
+    this->resetMergeState();
+
+    // Free memory
+    for (auto stream : streams) {
+        delete stream;
+    }
+    delete[] _packed;
+    _packed = nullptr;
+
+    // Final print
+    printvv("\tGEN_MINIRUNS COMPLETE: Merged %lld records and Spill to %s\n", nSorted,
+            outputStorage->getName().c_str());
+    if (nDups > 0) {
+        printvv("\tRemoved %lld duplicates\n", nDups);
+    }
+    flushvv();
+}
+
 
+// =========================================================
+// ---------------------- MergeStream ----------------------
+// =========================================================
+
+
+MergeStream::MergeStream(SortContext *context, const std::vector<PlannedRun> &runs)
+    : context(context), groups(groupByKeyRange(runs)) {
+    printvv("\tMERGE_STREAM START: %d runs in %d groups of overlapping key ranges\n",
+            (int)runs.size(), (int)groups.size());
+    flushvv();
+}
+
+
+MergeStream::~MergeStream() {
+    // Runs not read to the end are dropped as well, the consumer has stopped
+    if (loserTree != nullptr) { closeGroup(); }
+    for (; nextGroup < groups.size(); nextGroup++) {
+        removeRuns(groups[nextGroup]);
+    }
+    delete prev;
+    delete pending;
+    printvv("\tMERGE_STREAM COMPLETE: %lld records\n", nProduced);
+    if (nDups > 0) {
+        printvv("\tRemoved %lld duplicates\n", nDups);
+    }
+    flushvv();
+}
+
+
+bool MergeStream::openNextGroup() {
+    if (nextGroup >= groups.size()) { return false; }
+    DRAM *_dram = context->getDRAM();
+    PersistentTier *staging = context->getStagingTier();
 
-double getDRAMAccessTime(RowCount nRecords) {
-    return (DRAM::getInstance()->getAccessTimeInMicro(nRecords));
+    MergeStep step;
+    step.inputs = groups[nextGroup++];
+    for (auto &run : step.inputs) {
+        step.nRecords += run.nRecords;
+    }
+    auto runFiles = step.getRunsIn(staging->getName());
+    Storage *from = context->getLowestTier(step.inputs);
+    std::vector<PlannedRun> lowerRuns;
+    if (from == staging) {
+        // Same as mergeTierRuns of the staging tier, its runs are read into input clusters in DRAM
+        _dram->setupMergeState(staging->getPageSizeInRecords(), runFiles.size());
+    } else {
+        // Same as mergeTierRuns from below, the runs below are read through the staging tier
+        staging->setupBufferedMerge(from, &step);
+        lowerRuns = staging->getRunsBelow(from, &step);
+    }
+    runStreamers = staging->openRunStreamers(runFiles, lowerRuns).first;
+    loserTree = new LoserTree();
+    loserTree->constructCascade(runStreamers, Config::get().MERGE_GROUP_SIZE);
+    printv("\t\t\tMERGE_STREAM: group %d of %d, %d runs, %lld records\n", (int)nextGroup,
+           (int)groups.size(), (int)runStreamers.size(), step.nRecords);
+    flushv();
+    return true;
+}
+
+
+void MergeStream::closeGroup() {
+    // The leaves are not exhausted if the consumer stopped early
+    loserTree->releaseLeaves();
+    delete loserTree;
+    loserTree = nullptr;
+    for (auto streamer : runStreamers) {
+        delete streamer;
+    }
+    runStreamers.clear();
+    removeRuns(groups[nextGroup - 1]);
+    context->getDRAM()->reset();
+}
+
+
+void MergeStream::removeRuns(const std::vector<PlannedRun> &runs) {
+    for (auto &run : runs) {
+        context->getTier(run.deviceName)->removeRunFile(run.filename);
+    }
 }
 
-double getSSDAccessTime(RowCount nRecords) {
-    return (SSD::getInstance()->getAccessTimeInMicro(nRecords));
+
+Record *MergeStream::next() {
+    delete prev;
+    prev = nullptr;
+    while (loserTree != nullptr || openNextGroup()) {
+        Record *winner = loserTree->getNext();
+        if (winner == nullptr) {
+            closeGroup();
+            continue;
+        }
+        // Duplicate check
+        if (pending != nullptr && absorbRecord(pending->data, winner->data)) {
+            nDups++;
+            context->counters.nDuplicatesRemoved++;
+            delete winner;
+            continue;
+        }
+        prev = pending;
+        pending = winner;
+        if (prev != nullptr) { break; }
+    }
+    if (prev == nullptr) {
+        // All groups were read, the last record is final
+        prev = pending;
+        pending = nullptr;
+    }
+    if (prev != nullptr) { nProduced++; }
+    return prev;
 }
 
-double getHDDAccessTime(RowCount nRecords) {
-    return (HDD::getInstance()->getAccessTimeInMicro(nRecords));
+
+// =============================================================================
+// ------------------------------ CommonFunctions ------------------------------
+// =============================================================================
+
+
+void checkTierCapacities(SortContext *context) {
+    // the staging tier buffers the pages of the tiers below it
+    PersistentTier *_hdd = context->getLargestPageTier();
+    PersistentTier *_ssd = context->getStagingTier();
+    DRAM *_dram = context->getDRAM();
+    RowCount _ssdPageSize = _ssd->getPageSizeInRecords();
+    RowCount _dramCapacity = _dram->getCapacityInRecords();
+    RowCount _hddPageSize = _hdd->getPageSizeInRecords();
+    RowCount _ssdCapacity = _ssd->getCapacityInRecords();
+
+    /*
+    Assuming, minMergeFanIn = 4, minMergeFanOut = 2;
+    DRAM capacity should be able to hold at least 4 ssd pages;
+    SSD capacity should be able to hold at least 4 hdd pages
+    */
+    int minMergeFanIn = 2;
+    int minMergeFanOut = 2;
+    if ((minMergeFanIn + minMergeFanOut) * _ssdPageSize > _dramCapacity) {
+        std::string msg = _dram->getName() + " capacity is less than " +
+                          std::to_string(minMergeFanIn + minMergeFanOut) + " " +
+                          _ssd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
+    if (minMergeFanOut * _ssdPageSize > _dram->getMergeFanOutRecords()) {
+        std::string msg = _dram->getName() + " merge fan-in is less than " +
+                          std::to_string(minMergeFanIn) + " " +
+                          _ssd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
+    if (minMergeFanIn * _ssdPageSize > _dram->getMergeFanInRecords()) {
+        std::string msg = _dram->getName() + " merge fan-in is less than " +
+                          std::to_string(minMergeFanIn) + " " +
+                          _ssd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
+    if ((minMergeFanIn + minMergeFanOut) * _hddPageSize > _ssdCapacity) {
+        std::string msg = _ssd->getName() + " capacity is less than " +
+                          std::to_string(minMergeFanIn + minMergeFanOut) + " " +
+                          _hdd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
+    if (minMergeFanOut * _hddPageSize > _ssd->getMergeFanOutRecords()) {
+        std::string msg = _ssd->getName() + " merge fan-in is less than " +
+                          std::to_string(minMergeFanOut) + " " +
+                          _hdd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
+    if (minMergeFanIn * _hddPageSize > _ssd->getMergeFanInRecords()) {
+        std::string msg = _ssd->getName() + " merge fan-in is less than " +
+                          std::to_string(minMergeFanIn) + " " +
+                          _hdd->getName() + " pages";
+        throw std::runtime_error(msg);
+    }
 }
+
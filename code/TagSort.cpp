@@ -0,0 +1,330 @@
+#include "TagSort.h"
+#include "Filter.h"
+#include "Scan.h"
+#include "SortContext.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+
+// ============================================================================
+// --------------------------------- TagSortPlan ------------------------------
+// ============================================================================
+
+TagSortPlan::TagSortPlan(Plan *const input, StepHook onStep) : _input(input), _onStep(onStep) {
+    TRACE(true);
+} // TagSortPlan::TagSortPlan
+
+TagSortPlan::~TagSortPlan() {
+    TRACE(true);
+    delete _input;
+} // TagSortPlan::~TagSortPlan
+
+Iterator *TagSortPlan::init() const {
+    TRACE(true);
+    return new TagSortIterator(this);
+} // TagSortPlan::init
+
+
+// ============================================================================
+// ------------------------------ TagSortIterator -----------------------------
+// ============================================================================
+
+
+TagSortIterator::TagSortIterator(TagSortPlan const *const plan)
+    : _plan(plan), _input(plan->_input->init()), _context(SortContext::get()),
+      _recordSize(Config::get().RECORD_SIZE) {
+    TRACE(true);
+
+    // The tags carry no payload to aggregate, and the sort of the tags cannot resume
+    if (Config::get().GROUP_BY || Config::get().TOP_K > 0 || !Config::get().APPEND_FILE.empty() ||
+        Config::get().RESUME) {
+        throw std::runtime_error(
+            "ERROR: TAG_SORT does not support GROUP_BY, TOP_K, APPEND_FILE or RESUME");
+    }
+    if (getTagSize() >= _recordSize) {
+        throw std::runtime_error("ERROR: TAG_SORT needs records larger than " +
+                                 std::to_string(getTagSize()) + " bytes");
+    }
+
+    // A filter right below the sort drops its records while the tags are written
+    FilterPlan const *filter = dynamic_cast<FilterPlan const *>(plan->_input);
+    if (filter != nullptr) { _filter.reset(new FilterKernel(filter->getPredicate())); }
+
+    printvv("\n============== TAG_SORT START ===============\n");
+    auto start = std::chrono::steady_clock::now();
+    writeTags();
+    sortTags();
+    gather();
+    std::remove(getTagFile().c_str());
+    std::remove(getSortedTagFile().c_str());
+    auto dur = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() -
+                                                                start);
+
+    printvv("============== TAG_SORT COMPLETE ============\n");
+    printvv("Tag_Sort Total Duration %lld seconds / %lld minutes\n", dur.count(),
+            dur.count() / 60);
+    printvv("Sorted %lld tags of %d bytes for records of %d bytes, gathered in %lld reads\n",
+            _nTags, getTagSize(), _recordSize, _nReads);
+    printvv("Removed %lld duplicate records, DEDUP %s\n", _context->counters.nDuplicatesRemoved,
+            getDedupPolicyName(Config::get().DEDUP).c_str());
+    if (_context->counters.nRecordsFiltered > 0) {
+        printvv("Dropped %lld input records, filter %s\n", _context->counters.nRecordsFiltered,
+                _filter->getPredicate().repr().c_str());
+    }
+    printvv("SSD Access Count: %lld\n", _context->counters.nStagingAccesses);
+    printvv("HDD Access Count: %lld\n", _context->counters.nFinalAccesses);
+    _context->getLedger()->print();
+    printvv("===============================================\n");
+    flushvv();
+} // TagSortIterator::TagSortIterator
+
+TagSortIterator::~TagSortIterator() {
+    TRACE(true);
+    delete _input;
+} // TagSortIterator::~TagSortIterator
+
+bool TagSortIterator::next() { return false; } // TagSortIterator::next
+
+void TagSortIterator::getRecord(Record *r) {} // TagSortIterator::getRecord
+
+bool TagSortIterator::getPage(Page *p) {
+    p->clear();
+    return false;
+} // TagSortIterator::getPage
+
+
+void TagSortIterator::writeTags() {
+    TRACE(true);
+    _context->getLedger()->startPhase("TAGS");
+    PersistentTier *hdd = _context->getFinalTier();
+    RowCount pageSize = hdd->getPageSizeInRecords();
+    if (!hdd->readFrom(Config::get().INPUT_FILE)) {
+        throw std::runtime_error("unable to read from input file " + Config::get().INPUT_FILE);
+    }
+    std::ofstream tags(getTagFile(), std::ios::binary | std::ios::trunc);
+    if (!tags) { throw std::runtime_error("Cannot open file: " + getTagFile()); }
+
+    // A page of input records, and a page worth of bytes of tags
+    const int tagSize = getTagSize();
+    const RowCount tagsPerPage = std::max((RowCount)1, pageSize * _recordSize / tagSize);
+    std::vector<char> page(pageSize * _recordSize);
+    std::vector<char> tagPage(tagsPerPage * tagSize);
+    RowCount nBuffered = 0;
+    uint64_t position = 0;
+    while (position < (uint64_t)Config::get().NUM_RECORDS) {
+        RowCount nRecords = hdd->readRecords(
+            page.data(), std::min(pageSize, (RowCount)(Config::get().NUM_RECORDS - position)));
+        if (nRecords == 0) { break; }
+        hdd->chargeAccess(nRecords);
+        for (RowCount i = 0; i < nRecords; i++, position++) {
+            const char *record = page.data() + i * _recordSize;
+            if (_filter && !_filter->matches(record)) {
+                _context->counters.nRecordsFiltered++;
+                continue;
+            }
+            char *tag = tagPage.data() + nBuffered * tagSize;
+            std::memcpy(tag, record, Config::get().RECORD_KEY_SIZE);
+            std::memcpy(tag + Config::get().RECORD_KEY_SIZE, &position, sizeof(position));
+            if (++nBuffered < tagsPerPage) { continue; }
+            tags.write(tagPage.data(), nBuffered * tagSize);
+            hdd->chargeAccess(pageSize);
+            _nTags += nBuffered;
+            nBuffered = 0;
+        }
+    }
+    hdd->closeRead();
+    if (nBuffered > 0) {
+        tags.write(tagPage.data(), nBuffered * tagSize);
+        hdd->chargeAccess((nBuffered * tagSize + _recordSize - 1) / _recordSize);
+        _nTags += nBuffered;
+    }
+    tags.close();
+    if (!tags) { throw std::runtime_error("ERROR: writing the tags " + getTagFile()); }
+    printvv("\tTAGS: %lld tags of %lld input records in %s\n", _nTags, (RowCount)position,
+            getTagFile().c_str());
+    flushvv();
+} // TagSortIterator::writeTags
+
+
+void TagSortIterator::sortTags() {
+    TRACE(true);
+    if (_nTags == 0) { return; }
+
+    // The tiers size their pages and buffers for the record size, set them up for the tags
+    const int recordSize = Config::get().RECORD_SIZE;
+    const RowCount nRecords = Config::get().NUM_RECORDS;
+    const std::string inputFile = Config::get().INPUT_FILE, outputFile = Config::get().OUTPUT_FILE;
+    const RowCount nFiltered = _context->counters.nRecordsFiltered;
+    const DedupPolicy dedup = Config::get().DEDUP;
+    Config::get().RECORD_SIZE = getTagSize();
+    Config::get().NUM_RECORDS = _nTags;
+    // The tags are all kept, the filter ran on writing them
+    _context->counters.nRecordsFiltered = 0;
+    Config::get().INPUT_FILE = getTagFile();
+    Config::get().OUTPUT_FILE = getSortedTagFile();
+    // Equal records are told apart by their payload, which only the gather pass reads
+    Config::get().DEDUP = dedup == DedupPolicy::KEY ? DedupPolicy::KEY : DedupPolicy::NONE;
+    _context->deleteTiers();
+    checkTierCapacities(_context);
+
+    std::exception_ptr error;
+    try {
+        SortPlan plan(new ScanPlan(_nTags, Config::get().INPUT_FILE), _plan->_onStep);
+        std::unique_ptr<Iterator> it(plan.init());
+        it->run();
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    _context->deleteTiers();
+    Config::get().RECORD_SIZE = recordSize;
+    Config::get().NUM_RECORDS = nRecords;
+    _context->counters.nRecordsFiltered = nFiltered;
+    Config::get().INPUT_FILE = inputFile;
+    Config::get().OUTPUT_FILE = outputFile;
+    Config::get().DEDUP = dedup;
+    checkTierCapacities(_context);
+    if (error) { std::rethrow_exception(error); }
+} // TagSortIterator::sortTags
+
+
+void TagSortIterator::gather() {
+    TRACE(true);
+    _context->getLedger()->startPhase("GATHER");
+    PersistentTier *hdd = _context->getFinalTier();
+    RunWriter writer(Config::get().OUTPUT_FILE);
+    if (_nTags == 0) {
+        writer.close();
+        _context->getLedger()->endPhase();
+        return;
+    }
+
+    // Fewer tags than written with the KEY dedup policy
+    const int tagSize = getTagSize();
+    const RowCount nSorted = getFileSize(getSortedTagFile()) / tagSize;
+
+    // A batch fills the memory tier with records
+    const RowCount batchSize = std::max((RowCount)1, _context->getDRAM()->getCapacityInRecords());
+    std::ifstream tags(getSortedTagFile(), std::ios::binary);
+    std::ifstream input(Config::get().INPUT_FILE, std::ios::binary);
+    if (!tags || !input) { throw std::runtime_error("ERROR: unable to open the gather input"); }
+    std::vector<char> tagData(batchSize * tagSize);
+    std::vector<uint64_t> positions;
+    std::vector<char> records(batchSize * _recordSize);
+    Page out(hdd->getPageSizeInRecords());
+    auto writeRecord = [&](const char *record) {
+        out.append(record);
+        if (!out.isFull()) { return; }
+        writer.writeRecords(out.getData(), out.getSizeInRecords());
+        hdd->chargeAccess(out.getSizeInRecords());
+        out.clear();
+    };
+
+    // With EXACT, the records of the current key, kept until a larger key shows up
+    const bool exact = Config::get().DEDUP == DedupPolicy::EXACT;
+    std::vector<char> group;
+    auto flushGroup = [&]() {
+        RowCount n = group.size() / _recordSize;
+        std::vector<const char *> sorted(n);
+        for (RowCount i = 0; i < n; i++) {
+            sorted[i] = group.data() + i * _recordSize;
+        }
+        std::sort(sorted.begin(), sorted.end(), [&](const char *a, const char *b) {
+            return std::strncmp(a, b, _recordSize) < 0;
+        });
+        for (RowCount i = 0; i < n; i++) {
+            if (i > 0 && std::strncmp(sorted[i - 1], sorted[i], _recordSize) == 0) {
+                _context->counters.nDuplicatesRemoved++;
+                continue;
+            }
+            writeRecord(sorted[i]);
+        }
+        group.clear();
+    };
+
+    RowCount nGathered = 0;
+    while (nGathered < nSorted) {
+        RowCount n = std::min(batchSize, nSorted - nGathered);
+        tags.read(tagData.data(), n * tagSize);
+        if (tags.gcount() != (std::streamsize)(n * tagSize)) {
+            throw std::runtime_error("ERROR: the sorted tags " + getSortedTagFile() +
+                                     " are incomplete");
+        }
+        hdd->chargeAccess((n * tagSize + _recordSize - 1) / _recordSize);
+        positions.resize(n);
+        for (RowCount i = 0; i < n; i++) {
+            std::memcpy(&positions[i], tagData.data() + i * tagSize + Config::get().RECORD_KEY_SIZE,
+                        sizeof(uint64_t));
+        }
+        fetchRecords(input, positions, records.data());
+
+        for (RowCount i = 0; i < n; i++) {
+            const char *record = records.data() + i * _recordSize;
+            if (!exact) {
+                writeRecord(record);
+                continue;
+            }
+            if (!group.empty() &&
+                std::strncmp(group.data(), record, Config::get().RECORD_KEY_SIZE) != 0) {
+                flushGroup();
+            }
+            group.insert(group.end(), record, record + _recordSize);
+        }
+        nGathered += n;
+    }
+    if (!group.empty()) { flushGroup(); }
+    if (!out.isEmpty()) {
+        writer.writeRecords(out.getData(), out.getSizeInRecords());
+        hdd->chargeAccess(out.getSizeInRecords());
+    }
+    writer.close();
+    _context->getLedger()->endPhase();
+    printvv("\tGATHER: %lld records in %lld reads to %s\n", nGathered, _nReads,
+            Config::get().OUTPUT_FILE.c_str());
+    flushvv();
+} // TagSortIterator::gather
+
+
+void TagSortIterator::fetchRecords(std::ifstream &input, const std::vector<uint64_t> &positions,
+                                   char *out) {
+    PersistentTier *hdd = _context->getFinalTier();
+    const RowCount maxSpan = hdd->getPageSizeInRecords();
+    // Records in a gap cost their transfer, another read costs the latency
+    const double latency = hdd->getAccessTimeInSec(0);
+    const double perRecord = hdd->getAccessTimeInSec(1) - latency;
+    const uint64_t maxGap = perRecord > 0 ? (uint64_t)(latency / perRecord) : 0;
+
+    std::vector<RowCount> order(positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](RowCount a, RowCount b) { return positions[a] < positions[b]; });
+
+    std::vector<char> span(maxSpan * _recordSize);
+    size_t begin = 0;
+    while (begin < order.size()) {
+        // Extend the read while the next record is close enough and fits
+        uint64_t first = positions[order[begin]];
+        size_t end = begin + 1;
+        while (end < order.size()) {
+            uint64_t position = positions[order[end]];
+            uint64_t last = positions[order[end - 1]];
+            if (position - last > maxGap + 1 || position - first >= (uint64_t)maxSpan) { break; }
+            end++;
+        }
+        RowCount nRecords = positions[order[end - 1]] - first + 1;
+        input.seekg(first * _recordSize, std::ios::beg);
+        input.read(span.data(), nRecords * _recordSize);
+        if (input.gcount() != (std::streamsize)(nRecords * _recordSize)) {
+            throw std::runtime_error("ERROR: input file " + Config::get().INPUT_FILE +
+                                     " changed during the sort");
+        }
+        hdd->chargeAccess(nRecords);
+        _nReads++;
+        for (size_t k = begin; k < end; k++) {
+            std::memcpy(out + order[k] * _recordSize,
+                        span.data() + (positions[order[k]] - first) * _recordSize, _recordSize);
+        }
+        begin = end;
+    }
+} // TagSortIterator::fetchRecords
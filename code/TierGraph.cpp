@@ -0,0 +1,113 @@
+#include "TierGraph.h"
+#include <cassert>
+#include <stdexcept>
+
+
+// =========================================================
+// ------------------------ TierGraph ----------------------
+// =========================================================
+
+
+TierGraph::TierGraph(const std::vector<TierSpec> &tiers) : tiers(tiers) {
+    validate();
+    resolveSpillChain();
+}
+
+
+int TierGraph::findTier(const std::string &name) const {
+    for (size_t i = 0; i < tiers.size(); i++) {
+        if (tiers[i].name == name) { return i; }
+    }
+    return -1;
+}
+
+
+void TierGraph::validate() {
+    if (tiers.size() < 2) {
+        throw std::runtime_error("ERROR: a memory tier and at least one persistent tier needed");
+    }
+    for (size_t i = 0; i < tiers.size(); i++) {
+        TierSpec &tier = tiers[i];
+        if (tier.name.empty() || findTier(tier.name) != (int)i) {
+            throw std::runtime_error("ERROR: tier names must be unique and non-empty");
+        }
+        if (tier.capacity == 0 || tier.bandwidth <= 0 || tier.latency < 0) {
+            throw std::runtime_error("ERROR: invalid capacity, bandwidth or latency of tier " +
+                                     tier.name);
+        }
+        // A persistent tier spills to the next tier by default
+        if (i > 0 && tier.spillTo.empty() && i + 1 < tiers.size()) {
+            tier.spillTo = tiers[i + 1].name;
+        }
+        // Spilling only goes to later tiers, which keeps the graph acyclic
+        if (!tier.spillTo.empty() && findTier(tier.spillTo) <= (int)i) {
+            throw std::runtime_error("ERROR: tier " + tier.name + " spills to " + tier.spillTo +
+                                     ", which is not a later tier");
+        }
+    }
+}
+
+
+void TierGraph::resolveSpillChain() {
+    const TierSpec &staging = tiers[1];
+    if (staging.spillTo.empty()) {
+        // A single persistent tier: the output goes to a second view of it
+        finalIndex = 1;
+        finalSpec = staging;
+        finalSpec.name = staging.name + "_OUT";
+        finalSpec.dir = staging.getDir() + "_out";
+        return;
+    }
+
+    // Every tier on the chain holds runs, the end of the chain receives the output
+    int curr = findTier(staging.spillTo);
+    while (!tiers[curr].spillTo.empty()) {
+        intermediateSpecs.push_back(tiers[curr]);
+        curr = findTier(tiers[curr].spillTo);
+    }
+    finalIndex = curr;
+    finalSpec = tiers[curr];
+}
+
+
+const TierSpec &TierGraph::getSpec(TierRole role) const {
+    switch (role) {
+    case TierRole::MEMORY:
+        return tiers[0];
+    case TierRole::STAGING:
+        return tiers[1];
+    case TierRole::INTERMEDIATE:
+        assert(!intermediateSpecs.empty() && "ERROR: no intermediate tier");
+        return intermediateSpecs.front();
+    default:
+        return finalSpec;
+    }
+}
+
+
+void TierGraph::print() const {
+    printvv("Tiers\n");
+    for (size_t i = 0; i < tiers.size(); i++) {
+        const TierSpec &tier = tiers[i];
+        bool intermediate = false;
+        for (auto &spec : intermediateSpecs) {
+            intermediate = intermediate || spec.name == tier.name;
+        }
+        std::string role = i == 0                  ? "memory"
+                           : i == 1                ? "staging"
+                           : intermediate          ? "intermediate"
+                           : (int)i == finalIndex ? "final"
+                                                   : "unused";
+        std::string capacity = tier.capacity == INFINITE_CAPACITY
+                                   ? "infinite"
+                                   : std::to_string(BYTE_TO_MB(tier.capacity)) + " MB";
+        printvv("\t%s (%s): capacity %s, bandwidth %d MB/s, latency %.3lf ms, spill to %s\n",
+                tier.name.c_str(), role.c_str(), capacity.c_str(), BYTE_TO_MB(tier.bandwidth),
+                SEC_TO_MS(tier.latency), tier.spillTo.empty() ? "-" : tier.spillTo.c_str());
+    }
+    if (finalIndex == 1) {
+        printvv("\t%s (final): output view of %s in %s\n", finalSpec.name.c_str(),
+                tiers[1].name.c_str(), finalSpec.getDir().c_str());
+    }
+    flushvv();
+}
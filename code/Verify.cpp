@@ -22,9 +22,9 @@
 
 void readRecordsFromFile(std::ifstream &file, RowCount nRecordsPerRead, RowCount *nRecordsLoaded,
                          char *data) {
-    file.read(data, nRecordsPerRead * Config::RECORD_SIZE);
+    file.read(data, nRecordsPerRead * Config::get().RECORD_SIZE);
     ByteCount nBytes = file.gcount();
-    *nRecordsLoaded = nBytes / Config::RECORD_SIZE;
+    *nRecordsLoaded = nBytes / Config::get().RECORD_SIZE;
 }
 
 std::ifstream openReadFile(const std::string &filePath) {
@@ -41,12 +41,13 @@ std::ifstream openReadFile(const std::string &filePath) {
     return file;
 }
 
-std::ofstream openWriteFile(const std::string &filePath) {
-    std::ofstream file(filePath, std::ios::binary);
+std::ofstream openWriteFile(const std::string &filePath, bool append = false) {
+    std::ofstream file(filePath, append ? std::ios::binary | std::ios::app : std::ios::binary);
     if (!file.is_open()) {
         printvv("ERROR: Failed to open write file '%s'\n", filePath.c_str());
         exit(1);
     }
+    if (append) { return file; }
     file.seekp(0, std::ios::beg);
     if (!file) {
         printv("ERROR: Failed to seek to the beginning of '%s'\n", filePath.c_str());
@@ -58,7 +59,7 @@ std::ofstream openWriteFile(const std::string &filePath) {
 
 bool verifyOrder(const std::string &outputFilePath, uint64_t capacityMB) {
     TRACE(true);
-    if (Config::NUM_RECORDS == 0) {
+    if (Config::get().NUM_RECORDS == 0) {
         printvv("SUCCESS: No records to verify order\n");
         return true;
     }
@@ -67,17 +68,23 @@ bool verifyOrder(const std::string &outputFilePath, uint64_t capacityMB) {
     std::ifstream outputFile = openReadFile(outputFilePath);
 
     uint64_t capacityBytes = capacityMB * 1024 * 1024;
-    RowCount nRecordsPerRead = capacityBytes / Config::RECORD_SIZE;
+    RowCount nRecordsPerRead = capacityBytes / Config::get().RECORD_SIZE;
 
     RowCount nRecordsLoaded = 0;
     RowCount i = 1;
 
-    int comparisonLength = Config::RECORD_KEY_SIZE;
-    char *data = new char[nRecordsPerRead * Config::RECORD_SIZE];
+    int comparisonLength = Config::get().RECORD_KEY_SIZE;
+    char *data = new char[nRecordsPerRead * Config::get().RECORD_SIZE];
     char *startData = data;
 
     readRecordsFromFile(outputFile, nRecordsPerRead, &nRecordsLoaded, data);
     RowCount nRecords = nRecordsLoaded;
+    if (nRecords == 0) {
+        // Every input record was filtered out
+        delete[] startData;
+        printvv("SUCCESS: Order verified with 0 records\n");
+        return true;
+    }
 
     // read first record
     char *prevRecord = new char[comparisonLength];
@@ -97,7 +104,7 @@ bool verifyOrder(const std::string &outputFilePath, uint64_t capacityMB) {
             }
             nRecords += nRecordsLoaded;
         } else {
-            data += Config::RECORD_SIZE;
+            data += Config::get().RECORD_SIZE;
         }
 
         Record *record = Record::wrapAsRecord(data);
@@ -137,7 +144,7 @@ u_int64_t simpleHash(Record *record, u_int64_t nPartitions) {
     // hash using key
     char *key = record->data;
     u_int64_t hash = 0;
-    for (int i = 0; i < Config::RECORD_SIZE; i++) {
+    for (int i = 0; i < Config::get().RECORD_SIZE; i++) {
         hash = (hash << 5) + hash + key[i];
     }
     return hash;
@@ -145,18 +152,18 @@ u_int64_t simpleHash(Record *record, u_int64_t nPartitions) {
 
 
 void partitionFile(const std::string &inputFilePath, const std::string &hashFilesDir,
-                   u_int64_t nPartitions, RowCount nRecordsPerRead) {
+                   u_int64_t nPartitions, RowCount nRecordsPerRead, bool append = false) {
     std::ifstream inputFile = openReadFile(inputFilePath);
 
-    // create partitioned files
+    // create partitioned files, or add to them
     std::ofstream *outputFiles = new std::ofstream[nPartitions];
     for (u_int64_t i = 0; i < nPartitions; i++) {
         std::string outputFilePath = hashFilesDir + std::to_string(i) + ".txt";
-        outputFiles[i] = openWriteFile(outputFilePath);
+        outputFiles[i] = openWriteFile(outputFilePath, append);
     }
 
     RowCount nRecordsLoaded = 0;
-    char *data = new char[nRecordsPerRead * Config::RECORD_SIZE];
+    char *data = new char[nRecordsPerRead * Config::get().RECORD_SIZE];
 
     // read input file in batches and hash partition it
     while (1) {
@@ -165,11 +172,11 @@ void partitionFile(const std::string &inputFilePath, const std::string &hashFile
         printvv("Number of records loaded: %ld\n", nRecordsLoaded);
 
         for (RowCount i = 0; i < nRecordsLoaded; i++) {
-            Record *record = new Record(data + i * Config::RECORD_SIZE);
+            Record *record = new Record(data + i * Config::get().RECORD_SIZE);
             u_int64_t hash = simpleHash(record, nPartitions);
             uint64_t partition = hash % nPartitions;
             outputFiles[partition].write(reinterpret_cast<char *>(&hash),
-                                         Config::VERIFY_HASH_BYTES);
+                                         Config::get().VERIFY_HASH_BYTES);
             delete record;
         }
         // free(data);
@@ -190,7 +197,7 @@ bool contains(const std::vector<Record *> &arr, Record *target) {
 
     while (left <= right) {
         size_t mid = left + (right - left) / 2; // Prevent potential overflow
-        int compare = std::strncmp(arr[mid]->data, target->data, Config::RECORD_SIZE);
+        int compare = std::strncmp(arr[mid]->data, target->data, Config::get().RECORD_SIZE);
 
         if (compare == 0) {
             return true;
@@ -305,17 +312,21 @@ bool compareHashFiles(uint64_t i, const std::string &inputDir, const std::string
 }
 
 bool verifyIntegrity(const std::string &inputFilePath, const std::string &outputFilePath,
-                     uint64_t capacityMB) {
+                     uint64_t capacityMB, const std::string &appendFilePath) {
     TRACE(true);
-    if (Config::NUM_RECORDS == 0) {
+    RowCount nAppendRecords = 0;
+    if (!appendFilePath.empty()) {
+        nAppendRecords = getFileSize(appendFilePath) / Config::get().RECORD_SIZE;
+    }
+    if (Config::get().NUM_RECORDS + nAppendRecords == 0) {
         printvv("SUCCESS: No records to verify integrity\n");
         return true;
     }
     printvv("============= Verifying integrity =============\n");
 
     // delete existing hash partitioned files
-    std::string inputDir = Config::VERIFY_INPUTDIR;
-    std::string outputDir = Config::VERIFY_OUTPUTDIR;
+    std::string inputDir = Config::get().VERIFY_INPUTDIR;
+    std::string outputDir = Config::get().VERIFY_OUTPUTDIR;
 
     cleanDirectory(inputDir);
     cleanDirectory(outputDir);
@@ -325,8 +336,9 @@ bool verifyIntegrity(const std::string &inputFilePath, const std::string &output
 
     uint64_t capacityBytes = capacityMB * 1024 * 1024;
     uint64_t expectedPartitionSize = capacityBytes / 2; // expecting to hold two partitions in DRAM
-    uint64_t expectedHashesPerPartition = expectedPartitionSize / Config::VERIFY_HASH_BYTES;
-    uint64_t nPartitions = ceil(Config::NUM_RECORDS * 1.0 / expectedHashesPerPartition);
+    uint64_t expectedHashesPerPartition = expectedPartitionSize / Config::get().VERIFY_HASH_BYTES;
+    uint64_t nPartitions =
+        ceil((Config::get().NUM_RECORDS + nAppendRecords) * 1.0 / expectedHashesPerPartition);
 
     printvv("Expected partition size: %ld\n", expectedPartitionSize);
     printvv("Expected hashes per partition: %ld\n", expectedHashesPerPartition);
@@ -334,9 +346,14 @@ bool verifyIntegrity(const std::string &inputFilePath, const std::string &output
     printvv("Number of partitions: %ld\n", nPartitions);
 
     // read input file in batches and hash partition it
-    uint64_t nRecordsPerRead = capacityBytes / Config::RECORD_SIZE;
+    uint64_t nRecordsPerRead = capacityBytes / Config::get().RECORD_SIZE;
     partitionFile(inputFilePath, inputDir, nPartitions, nRecordsPerRead);
     printvv("Partitioned input file\n");
+    if (nAppendRecords > 0) {
+        // The records of the sorted file are input as well
+        partitionFile(appendFilePath, inputDir, nPartitions, nRecordsPerRead, true);
+        printvv("Partitioned sorted file %s\n", appendFilePath.c_str());
+    }
     partitionFile(outputFilePath, outputDir, nPartitions, nRecordsPerRead);
     printvv("Partitioned output file\n");
 
@@ -354,7 +371,10 @@ bool verifyIntegrity(const std::string &inputFilePath, const std::string &output
     }
 
     if (integrity) {
-        printvv("Total input records generated: %ld\n", Config::NUM_RECORDS);
+        printvv("Total input records generated: %ld\n", Config::get().NUM_RECORDS);
+        if (nAppendRecords > 0) {
+            printvv("Total records of the sorted file: %ld\n", nAppendRecords);
+        }
         printvv("Total input records verified: %ld\n", totalInputRecords);
         printvv("Total output records verified: %ld\n", totalOutputRecords);
         printvv("Duplicates removed: %ld\n", totalInputRecords - totalOutputRecords);
@@ -369,4 +389,59 @@ bool verifyIntegrity(const std::string &inputFilePath, const std::string &output
     cleanDirectory(inputDir);
     cleanDirectory(outputDir);
     return integrity;
-}
\ No newline at end of file
+}
+/**
+ * @brief Count the records of a file that do not match the filter
+ */
+static RowCount countUnmatched(const std::string &filePath, const FilterKernel &kernel,
+                               RowCount nRecordsPerRead, RowCount *nRecords) {
+    std::ifstream file = openReadFile(filePath);
+    char *data = new char[nRecordsPerRead * Config::get().RECORD_SIZE];
+    RowCount nUnmatched = 0, nRecordsLoaded = 0;
+    *nRecords = 0;
+    do {
+        readRecordsFromFile(file, nRecordsPerRead, &nRecordsLoaded, data);
+        for (RowCount i = 0; i < nRecordsLoaded; i++) {
+            if (!kernel.matches(data + i * Config::get().RECORD_SIZE)) { nUnmatched++; }
+        }
+        *nRecords += nRecordsLoaded;
+    } while (nRecordsLoaded > 0);
+    delete[] data;
+    file.close();
+    return nUnmatched;
+}
+
+bool verifyFilter(const std::string &inputFilePath, const std::string &outputFilePath,
+                  const FilterPredicate &predicate, RowCount nFiltered, uint64_t capacityMB) {
+    TRACE(true);
+    printvv("============= Verifying filter =============\n");
+    FilterKernel kernel(predicate);
+    RowCount nRecordsPerRead = capacityMB * 1024 * 1024 / Config::get().RECORD_SIZE;
+
+    RowCount nInputRecords = 0, nOutputRecords = 0;
+    RowCount nInputUnmatched =
+        countUnmatched(inputFilePath, kernel, nRecordsPerRead, &nInputRecords);
+    RowCount nOutputUnmatched =
+        countUnmatched(outputFilePath, kernel, nRecordsPerRead, &nOutputRecords);
+
+    bool filtered = true;
+    if (nOutputUnmatched > 0) {
+        printvv("ERROR: %lld of %lld output records do not match the filter %s\n",
+                nOutputUnmatched, nOutputRecords, predicate.repr().c_str());
+        filtered = false;
+    }
+    if (nInputUnmatched != nFiltered) {
+        printvv("ERROR: %lld input records do not match the filter, but %lld were dropped\n",
+                nInputUnmatched, nFiltered);
+        filtered = false;
+    }
+    if (filtered) {
+        printvv("Input records dropped by the filter: %lld of %lld\n", nFiltered, nInputRecords);
+        printvv("SUCCESS: Filter verified with %lld output records\n", nOutputRecords);
+        printvv("============= Filter verification successful =============\n");
+    } else {
+        printvv("============= Filter verification failed =============\n");
+    }
+    flushvv();
+    return filtered;
+}
@@ -1,79 +1,196 @@
 #include "config.h"
+#include "SortContext.h"
 #include <iomanip>
+#include <stdexcept>
 #include <sys/stat.h>
 
 // =========================================================
 // ------------------------- Config ------------------------
 // =========================================================
 
-// ==== Default Configurations ====
-// ---- Cache ----
-int Config::CACHE_SIZE = 1 * 1024 * 1024; // 1 MB
-// ---- DRAM ----
-ByteCount Config::DRAM_CAPACITY = 1LL * 100 * 1024 * 1024; // 100 MB
-double Config::DRAM_LATENCY = 1.0 / (1000 * 1000);         // 10 microsecond
-int Config::DRAM_BANDWIDTH = 100 * 1024 * 1024;            // 100 GB/s
-// ---- SSD ----
-ByteCount Config::SSD_CAPACITY = 10LL * 1024 * 1024 * 1024; // 10GB
-double Config::SSD_LATENCY = 1.0 / (10 * 1000);             // 0.1 ms
-int Config::SSD_BANDWIDTH = 200 * 1024 * 1024;              // 200 MB/s
-// SSD buffer size = 10 MB
-// ---- HDD ----
-ByteCount Config::HDD_CAPACITY = INFINITE_CAPACITY * 1LL; // Infinite
-double Config::HDD_LATENCY = 1 * 5.0 / 1000;              // 5 ms
-int Config::HDD_BANDWIDTH = 100 * 1024 * 1024;            // 100 MB/s
-// ---- Record ----
-int Config::RECORD_KEY_SIZE = 8;          // 8 bytes
-int Config::RECORD_SIZE = 1024;           // 1024 bytes
-RowCount Config::NUM_RECORDS = 2200000LL; // 20 records
-// ---- Duplicate ----
-RowCount Config::NUM_DUPLICATES = 0;
-RowCount Config::NUM_DUPLICATES_REMOVED = 0;
-// ---- Access Count ----
-RowCount Config::SSD_COUNT = 0;
-RowCount Config::HDD_COUNT = 0;
-// ---- Verify ----
-bool Config::VERIFY_ONLY = false;
-bool Config::VERIFY = false;
-std::string Config::VERIFY_INPUTDIR = "Verify_parts/input/";
-std::string Config::VERIFY_OUTPUTDIR = "Verify_parts/output/";
-int Config::VERIFY_HASH_BYTES = sizeof(uint64_t);
-// ---- File ----
-std::string Config::OUTPUT_FILE = "output.txt";
-std::string Config::INPUT_FILE = "input.txt";
-std::string Config::TRACE_FILE = "trace.log";
-// ================================
+thread_local Config *Config::bound = nullptr;
 
 void printConfig() {
     printvv("\n============== Configurations ===============\n");
     // ---- Cache ----
-    printvv("\tCACHE_SIZE: %d bytes\n", Config::CACHE_SIZE);
+    printvv("\tCACHE_SIZE: %d bytes\n", Config::get().CACHE_SIZE);
     // ---- DRAM ----
-    printvv("\tDRAM_SIZE: %d bytes\n", Config::DRAM_CAPACITY);
-    printvv("\tDRAM_LATENCY: %f\n", Config::DRAM_LATENCY);
-    printvv("\tDRAM_BANDWIDTH: %d\n", Config::DRAM_BANDWIDTH);
+    printvv("\tDRAM_SIZE: %d bytes\n", Config::get().DRAM_CAPACITY);
+    printvv("\tDRAM_LATENCY: %f\n", Config::get().DRAM_LATENCY);
+    printvv("\tDRAM_BANDWIDTH: %d\n", Config::get().DRAM_BANDWIDTH);
     // ---- SSD ----
-    printvv("\tSSD_SIZE: %lld bytes\n", Config::SSD_CAPACITY);
-    printvv("\tSSD_LATENCY: %f\n", Config::SSD_LATENCY);
-    printvv("\tSSD_BANDWIDTH: %d\n", Config::SSD_BANDWIDTH);
+    printvv("\tSSD_SIZE: %lld bytes\n", Config::get().SSD_CAPACITY);
+    printvv("\tSSD_LATENCY: %f\n", Config::get().SSD_LATENCY);
+    printvv("\tSSD_BANDWIDTH: %d\n", Config::get().SSD_BANDWIDTH);
     // ---- HDD ----
-    printvv("\tHDD_SIZE: %d bytes\n", Config::HDD_CAPACITY);
-    printvv("\tHDD_LATENCY: %f\n", Config::HDD_LATENCY);
-    printvv("\tHDD_BANDWIDTH: %d\n", Config::HDD_BANDWIDTH);
+    printvv("\tHDD_SIZE: %d bytes\n", Config::get().HDD_CAPACITY);
+    printvv("\tHDD_LATENCY: %f\n", Config::get().HDD_LATENCY);
+    printvv("\tHDD_BANDWIDTH: %d\n", Config::get().HDD_BANDWIDTH);
+    // ---- Tiers ----
+    for (auto &tier : Config::get().TIERS) {
+        printvv("\tTIER: %s, %lld bytes, %d bytes/s, %f s, dir %s, spill to %s\n",
+                tier.name.c_str(), tier.capacity, tier.bandwidth, tier.latency,
+                tier.getDir().c_str(), tier.spillTo.c_str());
+    }
     // ---- Record ----
-    printvv("\tRECORD_KEY_SIZE: %d bytes\n", Config::RECORD_KEY_SIZE);
-    printvv("\tRECORD_SIZE: %d bytes\n", Config::RECORD_SIZE);
-    printvv("\tNUM_RECORDS: %lld (%s)\n", Config::NUM_RECORDS,
-            formatNum(Config::NUM_RECORDS).c_str());
+    printvv("\tRECORD_KEY_SIZE: %d bytes\n", Config::get().RECORD_KEY_SIZE);
+    printvv("\tRECORD_SIZE: %d bytes\n", Config::get().RECORD_SIZE);
+    printvv("\tNUM_RECORDS: %lld (%s)\n", Config::get().NUM_RECORDS,
+            formatNum(Config::get().NUM_RECORDS).c_str());
     printvv("\tInput Size: %sBytes\n", formatNum(getInputSizeInBytes()).c_str());
+    // ---- Merge ----
+    printvv("\tMERGE_FAN_IN: %d runs\n", Config::get().MERGE_FAN_IN);
+    printvv("\tMERGE_GROUP_SIZE: %d runs\n", Config::get().MERGE_GROUP_SIZE);
+    printvv("\tMERGE_PREFETCH: %s\n", Config::get().MERGE_PREFETCH ? "on" : "off");
+    // ---- Emulation ----
+    printvv("\tEMULATE_IO: %s\n", Config::get().EMULATE_IO ? "on" : "off");
+    // ---- Calibration ----
+    printvv("\tCALIBRATE: %s, PROFILE_FILE: %s\n", Config::get().CALIBRATE ? "on" : "off",
+            Config::get().PROFILE_FILE.c_str());
+    // ---- Duplicate ----
+    printvv("\tDEDUP: %s, EARLY_DEDUP: %s\n", getDedupPolicyName(Config::get().DEDUP).c_str(),
+            Config::get().EARLY_DEDUP ? "on" : "off");
+    // ---- Resume ----
+    printvv("\tRESUME: %s\n", Config::get().RESUME ? "on" : "off");
+    // ---- Append ----
+    if (!Config::get().APPEND_FILE.empty()) {
+        printvv("\tAPPEND_FILE: %s\n", Config::get().APPEND_FILE.c_str());
+    }
+    // ---- Filter ----
+    if (!Config::get().FILTER_MIN_KEY.empty() || !Config::get().FILTER_MAX_KEY.empty()) {
+        printvv("\tFILTER_KEYS: %s..%s\n", Config::get().FILTER_MIN_KEY.c_str(),
+                Config::get().FILTER_MAX_KEY.c_str());
+    }
+    if (!Config::get().FILTER_PATTERN.empty()) {
+        printvv("\tFILTER_PATTERN: %s at offset %d bytes\n", Config::get().FILTER_PATTERN.c_str(),
+                Config::get().FILTER_PATTERN_OFFSET);
+    }
+    // ---- Top-k ----
+    if (Config::get().TOP_K > 0) { printvv("\tTOP_K: %lld records\n", Config::get().TOP_K); }
+    // ---- Group by ----
+    if (Config::get().GROUP_BY) {
+        printvv("\tGROUP_BY: field at offset %d bytes\n", Config::get().GROUP_BY_FIELD_OFFSET);
+    }
+    // ---- Tag sort ----
+    printvv("\tTAG_SORT: %s\n", Config::get().TAG_SORT ? "on" : "off");
+    // ---- Packed records ----
+    printvv("\tPACKED_RECORD_SIZE: %d bytes (%s)\n", Config::get().PACKED_RECORD_SIZE,
+            Config::get().RECORD_SIZE <= Config::get().PACKED_RECORD_SIZE ? "packed"
+                                                                          : "record lists");
+    printvv("\tKEY_ENCODING: %s\n", Config::get().KEY_ENCODING ? "on" : "off");
     // ---- File ----
-    printvv("\tOUTPUT_FILE: %s\n", Config::OUTPUT_FILE.c_str());
-    printvv("\tINPUT_FILE: %s\n", Config::INPUT_FILE.c_str());
-    printvv("\tTRACE_FILE: %s\n", Config::TRACE_FILE.c_str());
+    printvv("\tOUTPUT_FILE: %s\n", Config::get().OUTPUT_FILE.c_str());
+    printvv("\tINPUT_FILE: %s\n", Config::get().INPUT_FILE.c_str());
+    printvv("\tTRACE_FILE: %s\n", Config::get().TRACE_FILE.c_str());
+    if (!Config::get().RUN_DIR.empty()) {
+        printvv("\tRUN_DIR: %s\n", Config::get().RUN_DIR.c_str());
+    }
     printvv("============ End Configurations ===============\n\n");
     flushvv();
 }
 
+std::string TierSpec::getDir() const {
+    if (!dir.empty()) { return dir; }
+    const std::string &runDir = Config::get().RUN_DIR;
+    return runDir.empty() ? name + "_runs" : runDir + "/" + name + "_runs";
+}
+
+
+std::vector<TierSpec> getTierSpecs() {
+    if (!Config::get().TIERS.empty()) { return Config::get().TIERS; }
+
+    // The default hierarchy DRAM -> SSD -> HDD
+    std::vector<TierSpec> tiers(3);
+    tiers[0].name = "DRAM";
+    tiers[0].capacity = Config::get().DRAM_CAPACITY;
+    tiers[0].bandwidth = Config::get().DRAM_BANDWIDTH;
+    tiers[0].latency = Config::get().DRAM_LATENCY;
+    tiers[1].name = "SSD";
+    tiers[1].capacity = Config::get().SSD_CAPACITY;
+    tiers[1].bandwidth = Config::get().SSD_BANDWIDTH;
+    tiers[1].latency = Config::get().SSD_LATENCY;
+    tiers[1].spillTo = "HDD";
+    tiers[2].name = "HDD";
+    tiers[2].capacity = Config::get().HDD_CAPACITY;
+    tiers[2].bandwidth = Config::get().HDD_BANDWIDTH;
+    tiers[2].latency = Config::get().HDD_LATENCY;
+    return tiers;
+}
+
+
+/**
+ * @brief Parse `TIER=name,capacity,bandwidth,latency[,dir[,spillTo]]`
+ */
+static TierSpec parseTierSpec(const std::string &value) {
+    std::vector<std::string> fields;
+    std::istringstream is(value);
+    std::string field;
+    while (getline(is, field, ',')) {
+        field.erase(0, field.find_first_not_of(" \t"));
+        field.erase(field.find_last_not_of(" \t") + 1);
+        fields.push_back(field);
+    }
+    if (fields.size() < 4 || fields.size() > 6) {
+        throw std::runtime_error("ERROR: expected TIER=name,capacity,bandwidth,latency[,dir"
+                                 "[,spillTo]], got " + value);
+    }
+    TierSpec tier;
+    tier.name = fields[0];
+    tier.capacity = fields[1] == "inf" ? INFINITE_CAPACITY : stoll(fields[1]);
+    tier.bandwidth = stoi(fields[2]);
+    tier.latency = stod(fields[3]);
+    if (fields.size() > 4) tier.dir = fields[4];
+    if (fields.size() > 5) tier.spillTo = fields[5];
+    return tier;
+}
+
+
+DedupPolicy parseDedupPolicy(const std::string &name) {
+    if (name == "none") { return DedupPolicy::NONE; }
+    if (name == "exact") { return DedupPolicy::EXACT; }
+    if (name == "key") { return DedupPolicy::KEY; }
+    throw std::runtime_error("ERROR: expected DEDUP=none, exact or key, got " + name);
+}
+
+
+std::string getDedupPolicyName(DedupPolicy policy) {
+    switch (policy) {
+    case DedupPolicy::NONE:
+        return "none";
+    case DedupPolicy::EXACT:
+        return "exact";
+    case DedupPolicy::KEY:
+        return "key";
+    }
+    return "unknown";
+}
+
+
+/**
+ * @brief Set `<tier>_SIZE`, `<tier>_LATENCY`, `<tier>_BANDWIDTH` or `<tier>_DIR` of a tier
+ * in Config::TIERS
+ * @return true if the key names a parameter of a configured tier
+ */
+static bool setTierParameter(const std::string &key, const std::string &value) {
+    for (auto &tier : Config::get().TIERS) {
+        if (key.compare(0, tier.name.size() + 1, tier.name + "_") != 0) continue;
+        std::string param = key.substr(tier.name.size() + 1);
+        if (param == "SIZE")
+            tier.capacity = stoll(value);
+        else if (param == "LATENCY")
+            tier.latency = stod(value);
+        else if (param == "BANDWIDTH")
+            tier.bandwidth = stoi(value);
+        else if (param == "DIR")
+            tier.dir = value;
+        else
+            continue;
+        return true;
+    }
+    return false;
+}
+
+
 void readConfig(const std::string &filename) {
     std::ifstream configFile(filename);
     std::string line;
@@ -87,45 +204,94 @@ void readConfig(const std::string &filename) {
                 value.erase(0, value.find_first_not_of(" \t"));
                 value.erase(value.find_last_not_of(" \t") + 1);
 
+                // Parameters of runtime tiers, the legacy keys below also set the defaults
+                setTierParameter(key, value);
+
                 if (key == "CACHE_SIZE")
-                    Config::CACHE_SIZE = stoi(value);
+                    Config::get().CACHE_SIZE = stoi(value);
                 else if (key == "DRAM_SIZE")
-                    Config::DRAM_CAPACITY = stoll(value);
+                    Config::get().DRAM_CAPACITY = stoll(value);
                 else if (key == "DRAM_LATENCY")
-                    Config::DRAM_LATENCY = stod(value);
+                    Config::get().DRAM_LATENCY = stod(value);
                 else if (key == "DRAM_BANDWIDTH")
-                    Config::DRAM_BANDWIDTH = stoi(value);
+                    Config::get().DRAM_BANDWIDTH = stoi(value);
                 else if (key == "SSD_SIZE")
-                    Config::SSD_CAPACITY = stoll(value);
+                    Config::get().SSD_CAPACITY = stoll(value);
                 else if (key == "SSD_LATENCY")
-                    Config::SSD_LATENCY = stod(value);
+                    Config::get().SSD_LATENCY = stod(value);
                 else if (key == "SSD_BANDWIDTH")
-                    Config::SSD_BANDWIDTH = stoi(value);
+                    Config::get().SSD_BANDWIDTH = stoi(value);
                 else if (key == "HDD_SIZE")
-                    Config::HDD_CAPACITY = stoll(value);
+                    Config::get().HDD_CAPACITY = stoll(value);
                 else if (key == "HDD_LATENCY")
-                    Config::HDD_LATENCY = stod(value);
+                    Config::get().HDD_LATENCY = stod(value);
                 else if (key == "HDD_BANDWIDTH")
-                    Config::HDD_BANDWIDTH = stoi(value);
+                    Config::get().HDD_BANDWIDTH = stoi(value);
+                else if (key == "TIER")
+                    Config::get().TIERS.push_back(parseTierSpec(value));
                 else if (key == "RECORD_KEY_SIZE")
-                    Config::RECORD_KEY_SIZE = stoi(value);
+                    Config::get().RECORD_KEY_SIZE = stoi(value);
                 else if (key == "RECORD_SIZE")
-                    Config::RECORD_SIZE = stoi(value);
+                    Config::get().RECORD_SIZE = stoi(value);
                 else if (key == "NUM_RECORDS")
-                    Config::NUM_RECORDS = stoll(value);
+                    Config::get().NUM_RECORDS = stoll(value);
+                else if (key == "MERGE_FAN_IN")
+                    Config::get().MERGE_FAN_IN = stoi(value);
+                else if (key == "MERGE_GROUP_SIZE")
+                    Config::get().MERGE_GROUP_SIZE = stoi(value);
+                else if (key == "MERGE_PREFETCH")
+                    Config::get().MERGE_PREFETCH = stoi(value) != 0;
+                else if (key == "EMULATE_IO")
+                    Config::get().EMULATE_IO = stoi(value) != 0;
+                else if (key == "CALIBRATE")
+                    Config::get().CALIBRATE = stoi(value) != 0;
+                else if (key == "CALIBRATE_SIZE")
+                    Config::get().CALIBRATE_SIZE = stoll(value);
+                else if (key == "PROFILE_FILE")
+                    Config::get().PROFILE_FILE = value;
+                else if (key == "DEDUP")
+                    Config::get().DEDUP = parseDedupPolicy(value);
+                else if (key == "EARLY_DEDUP")
+                    Config::get().EARLY_DEDUP = stoi(value) != 0;
+                else if (key == "RESUME")
+                    Config::get().RESUME = stoi(value) != 0;
+                else if (key == "APPEND_FILE")
+                    Config::get().APPEND_FILE = value;
+                else if (key == "FILTER_MIN_KEY")
+                    Config::get().FILTER_MIN_KEY = value;
+                else if (key == "FILTER_MAX_KEY")
+                    Config::get().FILTER_MAX_KEY = value;
+                else if (key == "FILTER_PATTERN")
+                    Config::get().FILTER_PATTERN = value;
+                else if (key == "FILTER_PATTERN_OFFSET")
+                    Config::get().FILTER_PATTERN_OFFSET = stoi(value);
+                else if (key == "TOP_K")
+                    Config::get().TOP_K = stoll(value);
+                else if (key == "GROUP_BY")
+                    Config::get().GROUP_BY = stoi(value) != 0;
+                else if (key == "GROUP_BY_FIELD_OFFSET")
+                    Config::get().GROUP_BY_FIELD_OFFSET = stoi(value);
+                else if (key == "TAG_SORT")
+                    Config::get().TAG_SORT = stoi(value) != 0;
+                else if (key == "PACKED_RECORD_SIZE")
+                    Config::get().PACKED_RECORD_SIZE = stoi(value);
+                else if (key == "KEY_ENCODING")
+                    Config::get().KEY_ENCODING = stoi(value) != 0;
                 else if (key == "OUTPUT_FILE")
-                    Config::OUTPUT_FILE = value;
+                    Config::get().OUTPUT_FILE = value;
                 else if (key == "INPUT_FILE")
-                    Config::INPUT_FILE = value;
+                    Config::get().INPUT_FILE = value;
                 else if (key == "TRACE_FILE")
-                    Config::TRACE_FILE = value;
+                    Config::get().TRACE_FILE = value;
+                else if (key == "RUN_DIR")
+                    Config::get().RUN_DIR = value;
             }
         }
     }
     configFile.close();
 }
 
-ByteCount getInputSizeInBytes() { return Config::NUM_RECORDS * Config::RECORD_SIZE; }
+ByteCount getInputSizeInBytes() { return Config::get().NUM_RECORDS * Config::get().RECORD_SIZE; }
 ByteCount getInputSizeInMB() { return getInputSizeInBytes() / (1024 * 1024); }
 ByteCount getInputSizeInGB() { return getInputSizeInBytes() / (1024 * 1024 * 1024); }
 
@@ -164,31 +330,6 @@ std::string formatNum(uint64_t number) {
 }
 
 
-// =========================================================
-// ------------------------- Logger ------------------------
-// =========================================================
-
-void Logger::write(const std::string &message) {
-    if (!traceFile.is_open()) {
-        std::cout << "Error: Trace file not open" << std::endl;
-        return;
-    }
-    traceFile << message;
-}
-
-void Logger::writef(const char *format, ...) {
-    if (!traceFile.is_open()) {
-        std::cout << "Error: Trace file not open" << std::endl;
-        return;
-    }
-    va_list args;
-    va_start(args, format);
-    char buffer[1024];
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    va_end(args);
-    traceFile << buffer;
-}
-
 // =========================================================
 // ------------------------- Assert ------------------------
 // =========================================================
@@ -209,15 +350,13 @@ void Assert(bool const predicate, char const *const file, int const line,
 } // Assert
 
 
-std::ofstream logFile;
-
 void printVerbose(bool vv, char const *const file, int const line, char const *const function,
                   const char *format, ...) {
     va_list args;
     va_start(args, format);
 
 #if defined(_USE_LOGFILE)
-    if (!logFile.is_open()) { logFile.open(Config::TRACE_FILE); }
+    std::ofstream &logFile = SortContext::get()->getTrace();
     if (vv) logFile << file << ":" << line << ":" << function << " ";
     char buffer[1024];
     vsnprintf(buffer, sizeof(buffer), format, args);
@@ -233,7 +372,7 @@ void printVerbose(bool vv, char const *const file, int const line, char const *c
 
 void flushVerbose() {
 #if defined(_USE_LOGFILE)
-    if (logFile.is_open()) logFile.flush();
+    SortContext::get()->flushTrace();
 #else
     std::fflush(stdout);
 #endif
@@ -252,7 +391,7 @@ ByteCount getFileSize(const std::string &filename) {
 
 std::string getSizeDetails(ByteCount bytes) {
     std::ostringstream ss;
-    auto nRecords = bytes / Config::RECORD_SIZE;
+    auto nRecords = bytes / Config::get().RECORD_SIZE;
     auto kilobytes = BYTE_TO_KB(bytes);
     auto megabytes = BYTE_TO_MB(bytes);
     ss << "Size: " << nRecords << " records / " << bytes << " bytes / " << kilobytes << " KB / "
@@ -0,0 +1,40 @@
+#ifndef _CALIBRATE_H_
+#define _CALIBRATE_H_
+
+
+#include "config.h"
+#include <string>
+
+
+// =========================================================
+// ----------------------- Calibration ---------------------
+// =========================================================
+
+
+/**
+ * @brief Latency and bandwidth of a device, in the units of Config
+ */
+struct DeviceProfile {
+    double latency = 0; // in seconds
+    int bandwidth = 0;  // in bytes/s
+};
+
+
+/**
+ * @brief Benchmark the device holding the given directory.
+ * Sequential reads and writes of Config::CALIBRATE_SIZE bytes give the bandwidth,
+ * random 4 KB reads and synced writes give the latency.
+ */
+DeviceProfile measureDevice(const std::string &dir);
+
+
+/**
+ * @brief Set the latency and bandwidth of the persistent tiers in Config from the profile file,
+ * measuring the run directories of the tiers and writing the profile file first if it
+ * does not exist, is incomplete or was measured in other run directories. Must run before the devices are created, since configure() derives the
+ * page and cluster sizes from these values.
+ */
+void calibrateDevices();
+
+
+#endif // _CALIBRATE_H_
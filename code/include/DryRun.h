@@ -0,0 +1,128 @@
+#ifndef _DRY_RUN_H_
+#define _DRY_RUN_H_
+
+
+#include "MergePlanner.h"
+#include "StorageTypes.h"
+#include <map>
+#include <string>
+#include <vector>
+
+
+// =========================================================
+// ---------------------- SortPrediction -------------------
+// =========================================================
+
+
+/**
+ * @brief Predicted reads and writes of one device
+ */
+struct DeviceTraffic {
+    ByteCount bytesRead = 0;
+    ByteCount bytesWritten = 0;
+    RowCount nRequests = 0; // each request pays the device latency once
+    double timeInSec = 0;   // modeled latency and transfer time
+};
+
+
+/**
+ * @brief Predicted cost of a sort, computed without reading or writing any record
+ */
+class SortPrediction {
+  public:
+    std::map<std::string, DeviceTraffic> traffic; // by device name
+    int nMemoryLoads = 0;                         // runs merged from the miniruns of a load
+    int nSpilledMiniruns = 0;                     // miniruns spilled as runs of their own
+    int nMerges = 0;                              // merges in the first pass and merge phase
+    int nMergePasses = 0;                         // merges the final run went through
+    RowCount nRecordsMerged = 0;                  // records written by all merges
+    std::string layout; // how memory holds the records: flat arrays or Record lists
+    // ---- tag sort, see TagSort.h ----
+    int tagSize = 0;           // in bytes, 0 without a tag sort
+    RowCount nGatherReads = 0; // reads of the input by the gather pass
+
+    /**
+     * @brief Add the traffic of an access in requests of requestInRecords, which the device
+     * splits into page-sized requests like Storage::chargeAccess does
+     */
+    void addRead(const Storage *device, RowCount nRecords, RowCount requestInRecords);
+    void addWrite(const Storage *device, RowCount nRecords, RowCount requestInRecords);
+    /**
+     * @brief Add the traffic and the runs of another prediction, e.g. of the sort of the tags
+     */
+    void add(const SortPrediction &other);
+    double getModeledTimeInSec() const;
+    void print() const;
+};
+
+
+// =========================================================
+// ------------------------- DryRun ------------------------
+// =========================================================
+
+
+/**
+ * @brief Simulates firstPass and externalMergeSort on a catalog of run sizes.
+ * It uses the same device configuration, fan-in choices and merge planner as the sort,
+ * but never generates, reads or writes records.
+ * Duplicates are not predicted, every record is assumed to be unique. Modes that change the
+ * runs or the passes of the sort are not simulated, see checkSupported().
+ */
+class DryRun {
+  private:
+    SortContext *_context; // bound when the dry run was created, owns the tiers below
+    DRAM *_dram;
+    PersistentTier *_ssd; // the staging tier
+    PersistentTier *_hdd; // the final tier
+    // ---- simulated run files ----
+    std::vector<PlannedRun> _ssdRuns;
+    std::vector<PlannedRun> _hddRuns;
+    RowCount _ssdFilled = 0;
+    int _nextRunIndex = 0;
+    SortPrediction _prediction;
+
+    std::vector<PlannedRun> &getRuns(const std::string &deviceName);
+    RowCount getTotalRecords() const;
+    void sortBySize(std::vector<PlannedRun> &runs);
+    std::vector<PlannedRun>::iterator findRun(const PlannedRun &run);
+    void storeRun(RowCount nRecords, int depth, RowCount requestInRecords);
+    void removeRun(const PlannedRun &run);
+    void spillLargestSSDRun();
+    void mergeRuns(const std::vector<PlannedRun> &inputs);
+
+    // ---- simulated counterparts of the sort ----
+    void genMiniRuns(RowCount nRecords);
+    /**
+     * @param step required if from is below the staging tier
+     */
+    void mergeTierRuns(const Storage *from, const MergeStep *step = nullptr);
+    void firstPass();
+    void mergePhase();
+    /**
+     * @brief Merges the final run went through, 0 if there is none
+     */
+    int getFinalRunDepth() const;
+    /**
+     * @brief Same as TagSortIterator: write the tags, sort them on tiers set up for tag-sized
+     * records, then gather the records in batches of a memory load
+     */
+    void simulateTagSort();
+
+  public:
+    DryRun();
+
+    /**
+     * @brief Throw if Config asks for a mode the simulation does not model, rather than
+     * predicting the plain sort for it
+     */
+    static void checkSupported();
+
+    /**
+     * @brief Simulate the sort of Config::NUM_RECORDS records of Config::RECORD_SIZE bytes,
+     * a tag sort with Config::TAG_SORT
+     */
+    SortPrediction run();
+};
+
+
+#endif // _DRY_RUN_H_
@@ -0,0 +1,120 @@
+#ifndef _EXTERNAL_SORTER_H_
+#define _EXTERNAL_SORTER_H_
+
+
+#include "Predicate.h"
+#include "Sort.h"
+#include "config.h"
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// =========================================================
+// --------------------- ExternalSorter --------------------
+// =========================================================
+
+
+/**
+ * @brief Settings of one sort, applied to the Config of its SortContext.
+ * A default constructed SortConfig holds the settings of Config::get(), so the defaults, a
+ * readConfig() or the command line options carry over.
+ */
+struct SortConfig {
+    std::vector<TierSpec> tiers;  // memory tier first, see TierGraph
+    int recordSize;               // in bytes
+    int recordKeySize;            // in bytes, the prefix of a record that is compared
+    int cacheSize;                // in bytes
+    int mergeFanIn;               // upper bound of runs per merge
+    int mergeGroupSize;           // runs per cache-resident loser tree
+    bool emulateIO;               // throttle the persistent tiers to their latency and bandwidth
+    bool resume;                  // continue from the checkpoint in the staging run directory
+    std::string runDir;           // parent of the run directories, one per concurrent sorter
+    std::string traceFile;
+    FilterPredicate filter;       // input records kept, pushed down into the input load
+    RowCount topK;                // only the topK smallest records are output, all if 0
+    bool groupBy;                 // one record per key with the aggregates, see GroupBy.h
+    int groupByFieldOffset;       // in bytes, the 8-byte integer aggregated with groupBy
+    DedupPolicy dedup;            // records dropped as duplicates, unless groupBy
+    bool earlyDedup;              // drop them within each memory load already, by hashing
+    bool tagSort;                 // sort tags and gather the records at the end, see TagSort.h
+    int packedRecordSize;         // records up to it are sorted as flat arrays, see PackedRun.h
+    bool keyEncoding;             // packed records compare encoded keys, see KeyEncoder.h
+    StepHook onStep;              // between the steps of the sort, e.g. for SortScheduler quotas
+    std::function<void()> onDone; // on the thread of the sort once it ended, also on errors
+
+    SortConfig();
+};
+
+
+/**
+ * @brief Input and output of one sort: a file of fixed-size records and the file receiving
+ * them in sorted order
+ */
+struct SortFiles {
+    std::string input;
+    std::string output;
+    std::string append; // sorted, deduplicated output of an earlier sort to merge the input into
+};
+
+
+/**
+ * @brief Statistics of one finished sort
+ */
+struct SortStats {
+    RowCount nRecords = 0;
+    RowCount nDuplicatesRemoved = 0; // or combined into their groups with groupBy
+    RowCount nRecordsFiltered = 0;
+    RowCount nStagingAccesses = 0; // staging tier
+    RowCount nFinalAccesses = 0;   // intermediate and final tiers
+    double modeledTimeInSec = 0;   // see TimeLedger
+    double durationInSec = 0;
+};
+
+
+/**
+ * @brief External merge sort that can be embedded in another program.
+ * Every sort runs in a SortContext of its own, which holds its Config, its tiers, its
+ * TimeLedger, its counters and its trace, so several sorters can run at the same time, as
+ * long as their files and run directories differ. A sort runs on the sorter's thread with
+ * start(), or on the caller's with run().
+ */
+class ExternalSorter {
+  private:
+    SortConfig config;
+    SortFiles files;
+    SortStats stats;
+    std::thread worker;
+    std::exception_ptr error;
+
+    void applyConfig(Config &settings);
+    void sort();
+
+  public:
+    ExternalSorter(const SortConfig &config, const SortFiles &files);
+    ExternalSorter(const ExternalSorter &) = delete;
+    ExternalSorter &operator=(const ExternalSorter &) = delete;
+    ~ExternalSorter();
+
+    /**
+     * @brief Start the sort on the sorter's thread and return immediately
+     */
+    void start();
+
+    /**
+     * @brief Wait for the sort started by start()
+     * @return statistics of the sort, rethrows the exception the sort failed with
+     */
+    SortStats wait();
+
+    /**
+     * @brief Sort on the calling thread
+     * @return statistics of the sort, rethrows the exception the sort failed with
+     */
+    SortStats run();
+}; // class ExternalSorter
+
+
+#endif // _EXTERNAL_SORTER_H_
@@ -2,18 +2,25 @@
 #define _FILTER_H_
 
 #include "Iterator.h"
+#include "Predicate.h"
 
 
+/**
+ * @brief Keeps the records of its input that match the predicate.
+ * Below a SortPlan, the predicate is pushed down into the input load of the sort.
+ */
 class FilterPlan : public Plan {
     friend class FilterIterator;
 
   public:
-    FilterPlan(Plan *const input);
+    FilterPlan(Plan *const input, const FilterPredicate &predicate);
     ~FilterPlan();
     Iterator *init() const;
+    const FilterPredicate &getPredicate() const { return _predicate; }
 
   private:
     Plan *const _input;
+    FilterPredicate const _predicate;
 }; // class FilterPlan
 
 
@@ -23,12 +30,14 @@ class FilterIterator : public Iterator {
     ~FilterIterator();
     bool next();
     void getRecord(Record *r);
-    void getPage(Page *p);
+    bool getPage(Page *p);
 
   private:
     FilterPlan const *const _plan;
     Iterator *const _input;
     RowCount _consumed, _produced;
+    FilterKernel const _kernel;
+    Record _record; // current record of next()
 }; // class FilterIterator
 
 #endif // _FILTER_H_
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef _GROUP_BY_H_
+#define _GROUP_BY_H_
+
+
+#include "Record.h"
+#include "config.h"
+#include "defs.h"
+#include <cstring>
+#include <string>
+
+
+// =========================================================
+// ---------------------- GroupAggregate -------------------
+// =========================================================
+
+
+/**
+ * @brief Aggregates of the GROUP_BY_FIELD_OFFSET field over the records of one key.
+ * With GROUP_BY, a record stands for its group: the key, the aggregates as native 8-byte
+ * integers right after it, then the remaining bytes of one record of the group, any of them.
+ */
+struct GroupAggregate {
+    int64_t count;
+    int64_t sum; // wraps around on overflow
+    int64_t min;
+    int64_t max;
+
+    static GroupAggregate read(const char *record) {
+        GroupAggregate aggregate;
+        std::memcpy(&aggregate, record + Config::get().RECORD_KEY_SIZE, sizeof(GroupAggregate));
+        return aggregate;
+    }
+    void write(char *record) const {
+        std::memcpy(record + Config::get().RECORD_KEY_SIZE, this, sizeof(GroupAggregate));
+    }
+};
+
+
+/**
+ * @brief Throws if the aggregates or the aggregated field do not fit in a record
+ */
+void checkGroupBy();
+
+/**
+ * @brief Readable form of the GROUP_BY settings, "none" if off
+ */
+std::string getGroupByRepr();
+
+/**
+ * @brief Turn nRecords input records stored back to back into groups of one record each
+ */
+void initGroups(char *data, RowCount nRecords);
+
+/**
+ * @brief Add the aggregates of the group in record to the ones of the group in into
+ */
+void combineGroups(char *into, const char *record);
+
+/**
+ * @brief Whether a record in sorted order is folded into the previous one output: with
+ * GROUP_BY a record of the same key is combined into it, otherwise a duplicate under the
+ * DEDUP policy is dropped
+ */
+inline bool absorbRecord(char *prev, const char *record) {
+    int distinctSize = getDistinctSize();
+    if (distinctSize == 0 || std::strncmp(prev, record, distinctSize) != 0) { return false; }
+    if (Config::get().GROUP_BY) { combineGroups(prev, record); }
+    return true;
+}
+
+
+#endif // _GROUP_BY_H_
@@ -19,16 +19,32 @@ class Plan {
   private:
 }; // class Plan
 
+/**
+ * @brief Produces the records of a plan, one at a time with next() and getRecord(), or a
+ * batch at a time with getPage(). The two can be mixed, a page starts after the current record.
+ */
 class Iterator {
   public:
     Iterator();
     virtual ~Iterator();
+    /**
+     * @brief Pull all records of the plan, a page at a time
+     */
     void run();
     virtual bool next() = 0;
     virtual void getRecord(Record *r) = 0;
-    virtual void getPage(Page *p) = 0;
+    /**
+     * @brief Replace the contents of the page with the next records
+     * @return false when there are no records left, the page is empty then
+     */
+    virtual bool getPage(Page *p) = 0;
     virtual void get(char *data, ByteCount nBytes);
 
+    /**
+     * @brief Records per page between iterators, a cache worth of records
+     */
+    static RowCount getPageSizeInRecords();
+
   private:
     RowCount _count;
 }; // class Iterator
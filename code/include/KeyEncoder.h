@@ -0,0 +1,161 @@
+#ifndef _KEY_ENCODER_H_
+#define _KEY_ENCODER_H_
+
+
+#include "Record.h"
+#include "config.h"
+#include "defs.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+
+// =========================================================
+// ----------------------- KeyEncoder ----------------------
+// =========================================================
+
+
+/**
+ * @brief Symbols of the ALNUM encoding in ascending order, after the null byte: the characters
+ * of gen_a_record() and the newline that ends each generated record
+ */
+extern const char KEY_ALPHABET[];
+
+/**
+ * @brief 6-bit code of each byte, its position in KEY_ALPHABET plus one. The null byte is 0 and
+ * other bytes are INVALID_CODE.
+ */
+extern const uint8_t *const ALPHABET_CODES;
+const unsigned INVALID_CODE = 1 << 6;
+
+
+/**
+ * @brief The leading bytes of a record in the order, see getOrderSize(), as two integers.
+ * Integers compare like the bytes they encode compare with strncmp.
+ */
+struct EncodedKey {
+    uint64_t high = 0;
+    uint64_t low = 0;
+};
+
+
+/**
+ * @brief Order-preserving encoding of the keys, so the sort and the loser tree compare one or
+ * two integers instead of calling strncmp. ALNUM packs 10 symbols of KEY_ALPHABET into each
+ * integer, 6 bits each; BINARY takes 8 bytes each, byte-swapped to big endian. Both stop at a
+ * null byte, as strncmp does. Records whose encoded bytes are equal are compared with strncmp
+ * if the order covers more bytes. With KEY_ENCODING off, no bytes are encoded.
+ */
+class KeyEncoder {
+  public:
+    enum class Mode { ALNUM, BINARY, NONE };
+
+    KeyEncoder() : _orderSize(getOrderSize()) {
+        setMode(Config::get().KEY_ENCODING ? Mode::ALNUM : Mode::NONE);
+    }
+
+    Mode getMode() const { return _mode; }
+
+    /**
+     * @brief Change the encoding, keys encoded before are no longer comparable to new ones
+     */
+    void setMode(Mode mode) {
+        _mode = mode;
+        int width = mode == Mode::ALNUM ? 2 * SYMBOLS_PER_WORD : mode == Mode::BINARY ? 16 : 0;
+        _nEncoded = std::min(_orderSize, width);
+        _isExact = _nEncoded == _orderSize;
+    }
+
+    /**
+     * @brief Encode the ordered bytes of a record
+     * @return false if a byte is not in KEY_ALPHABET with ALNUM, the key is incomplete then
+     */
+    bool encode(const char *record, EncodedKey *key) const {
+        if (_mode == Mode::ALNUM) { return encodeAlphabet(record, key); }
+        if (_mode == Mode::BINARY) {
+            encodeBinary(record, key);
+        } else {
+            key->high = key->low = 0;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Whether record a comes before record b, given their keys in this encoding
+     */
+    bool isLess(const EncodedKey &ka, const char *a, const EncodedKey &kb, const char *b) const {
+        if (ka.high != kb.high) { return ka.high < kb.high; }
+        if (ka.low != kb.low) { return ka.low < kb.low; }
+        return !_isExact && std::strncmp(a, b, _orderSize) < 0;
+    }
+
+  private:
+    static const int SYMBOLS_PER_WORD = 10; // of 6 bits, in 60 of the 64 bits
+    Mode _mode;
+    int _orderSize; // see getOrderSize()
+    int _nEncoded;  // leading bytes in the keys, at most _orderSize
+    bool _isExact;  // whether the keys encode all of the ordered bytes
+
+    bool encodeAlphabet(const char *record, EncodedKey *key) const {
+        const unsigned char *symbols = reinterpret_cast<const unsigned char *>(record);
+        uint64_t words[2] = {0, 0};
+        unsigned invalid = 0; // checked once at the end, the key is dropped then anyway
+        for (int w = 0, i = 0; i < _nEncoded; w++) {
+            int end = std::min(i + SYMBOLS_PER_WORD, _nEncoded);
+            for (int shift = 6 * (SYMBOLS_PER_WORD - 1); i < end; i++, shift -= 6) {
+                if (symbols[i] == '\0') {
+                    end = _nEncoded; // strncmp stops here, the remaining symbols stay 0
+                    break;
+                }
+                unsigned code = ALPHABET_CODES[symbols[i]];
+                invalid |= code;
+                words[w] |= (uint64_t)code << shift;
+            }
+            i = end;
+        }
+        key->high = words[0];
+        key->low = words[1];
+        return (invalid & INVALID_CODE) == 0;
+    }
+
+    void encodeBinary(const char *record, EncodedKey *key) const {
+        int nHigh = std::min(_nEncoded, 8);
+        bool terminated = false;
+        key->high = loadBigEndian(record, nHigh, &terminated);
+        key->low = terminated || _nEncoded <= 8
+                       ? 0
+                       : loadBigEndian(record + 8, _nEncoded - 8, &terminated);
+    }
+
+    /**
+     * @brief Load n bytes, n at most 8, as a big-endian integer, with the bytes from the first
+     * null byte on cleared
+     */
+    static uint64_t loadBigEndian(const char *data, int n, bool *terminated) {
+        uint64_t word = 0;
+        std::memcpy(&word, data, n);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // the first byte in memory is the lowest one, a zero byte sets the high bit of its
+        // own byte first, so the lowest bit set marks the first null byte
+        uint64_t zeros = (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+        int nBytes = zeros == 0 ? 8 : __builtin_ctzll(zeros) / 8;
+        if (nBytes < n) {
+            word &= nBytes == 0 ? 0 : ~0ULL >> (64 - 8 * nBytes);
+            *terminated = true;
+        }
+        return __builtin_bswap64(word);
+#else
+        for (int i = 0; i < n; i++) {
+            if (data[i] == '\0') {
+                std::memset(reinterpret_cast<char *>(&word) + i, 0, n - i);
+                *terminated = true;
+                break;
+            }
+        }
+        return word;
+#endif
+    }
+}; // class KeyEncoder
+
+
+#endif // _KEY_ENCODER_H_
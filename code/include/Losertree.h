@@ -21,6 +21,7 @@ class LoserTree {
     std::vector<int> indices;
     RunStreamer *dummy;
     Run *dummyRun;
+    std::vector<RunStreamer *> groupStreamers; // leaves wrapping the group trees of a cascade
 
     bool isMax(RunStreamer *r) { return isRecordMax(r->getCurrRecord()); }
 
@@ -38,6 +39,10 @@ class LoserTree {
         for (RowCount i = 0; i < loserTree.size(); i++) {
             if (loserTree[i] != dummy) { delete loserTree[i]; }
         }
+        // deleting a group streamer also deletes its group tree
+        for (auto groupStreamer : groupStreamers) {
+            delete groupStreamer;
+        }
         printv("\t\t\t\tDeleted loser tree (%s)\n", name.c_str());
         // NOTE: do not delete dummyRun, it uses maxRecord which is a global
         dummyRun->setHead(nullptr);
@@ -87,6 +92,11 @@ class LoserTree {
             // Add a dummy node to make the number of leaves even
             this->loserTree[nInternalNodes * 2 - 1] = dummy;
         }
+        // Warm up the cache with the first and second record of every leaf
+        for (size_t i = 0; i < inputs.size(); i++) {
+            PREFETCH(inputs[i]->getCurrRecord()->data);
+            inputs[i]->prefetchNext();
+        }
         // printTree();
 
         // Construct the loser tree from leaves up
@@ -113,6 +123,45 @@ class LoserTree {
         // printTree();
     }
 
+    /**
+     * @brief Construct a two-level cascade for a high fan-in merge.
+     * The inputs are split into groups of at most groupSize runs, each group is merged by a
+     * small loser tree that stays cache-resident, and the group winners feed this tree.
+     * Falls back to a single tree if the inputs fit in one group.
+     * @note The caller still owns the input streamers
+     */
+    void constructCascade(std::vector<RunStreamer *> &inputs, size_t groupSize) {
+        if (groupSize < 2 || inputs.size() <= groupSize) {
+            constructTree(inputs);
+            return;
+        }
+        // Balance the groups so that every group tree has about the same height
+        size_t nGroups = divide(inputs.size(), groupSize);
+        size_t perGroup = divide(inputs.size(), nGroups);
+        for (size_t i = 0; i < inputs.size(); i += perGroup) {
+            size_t end = std::min(i + perGroup, inputs.size());
+            std::vector<RunStreamer *> group(inputs.begin() + i, inputs.begin() + end);
+            LoserTree *groupTree = new LoserTree();
+            groupTree->constructTree(group);
+            groupStreamers.push_back(new RunStreamer(StreamerType::LOSERTREE, groupTree));
+        }
+        printv("\t\t\t\tCascaded loser tree (%s): %zu runs in %zu groups\n", name.c_str(),
+               inputs.size(), groupStreamers.size());
+        constructTree(groupStreamers);
+    }
+
+    /**
+     * @brief Forget the leaves without deleting them, also in the group trees of a cascade.
+     * The destructor deletes the leaves that are not exhausted, so a merge stopped early calls
+     * this before it deletes its input streamers itself.
+     */
+    void releaseLeaves() {
+        std::fill(loserTree.begin(), loserTree.end(), dummy);
+        for (auto groupStreamer : groupStreamers) {
+            groupStreamer->getTree()->releaseLeaves();
+        }
+    }
+
     Record *getNext() {
         // printv("\t\tbefore prop: ");
         // printTree();
@@ -138,6 +187,7 @@ class LoserTree {
         // Update the tree with the next value from the list corresponding
         // to the found leaf
         // loserTree[winningIdx] = loserTree[winningIdx]->next;
+        // moveNext also prefetches the record after the new current one of this leaf
         Record *nextRecord = loserTree[winningIdx]->moveNext();
         if (nextRecord == NULL) { loserTree[winningIdx] = dummy; }
         // if (loserTree[winningIdx] == NULL) {
@@ -0,0 +1,82 @@
+#ifndef _MERGE_PLANNER_H_
+#define _MERGE_PLANNER_H_
+
+
+#include "config.h"
+#include "defs.h"
+#include <string>
+#include <vector>
+
+
+// =========================================================
+// ----------------------- MergePlanner --------------------
+// =========================================================
+
+
+/**
+ * @brief A run known to the planner, either a run file stored in a device
+ * or the output of an earlier step of the plan
+ */
+struct PlannedRun {
+    std::string filename;   // run file, or "merge<i>" for the output of step i
+    RowCount nRecords;      // number of records in the run
+    std::string deviceName; // device storing the run, empty for planned outputs
+    int depth;              // number of merges this run went through in the plan
+    std::string minKey;     // key range of the run in hex, see RunInfo; empty if unknown
+    std::string maxKey;
+};
+
+
+/**
+ * @brief One merge of the plan, merges `inputs` into a single run of `nRecords` records
+ */
+struct MergeStep {
+    std::vector<PlannedRun> inputs;
+    RowCount nRecords = 0;
+
+    /**
+     * @brief Get the inputs stored in the given device as (filename, nRecords) pairs,
+     * the same format the RunManager uses
+     */
+    std::vector<std::pair<std::string, RowCount>> getRunsIn(const std::string &deviceName) const;
+};
+
+
+/**
+ * @brief Merge trees over the runs in the catalog, in execution order.
+ * Only the first step reads existing run files only, later steps also read planned outputs.
+ */
+class MergePlan {
+  public:
+    std::vector<MergeStep> steps;
+    RowCount nRecordsWritten = 0; // records written by all steps together
+    int nPasses = 0;              // height of the merge tree
+    int nConcatenated = 0;        // runs whose key range overlaps no other run, never merged
+
+    bool isEmpty() const { return steps.empty(); }
+    std::string repr() const;
+};
+
+
+/**
+ * @brief Split the runs into groups of overlapping key ranges, in key order.
+ * The groups cover disjoint key ranges, so once every group is a single run, the runs in this
+ * order are the sorted output. Ranges sharing a boundary key overlap, their records may be
+ * duplicates. Without the key range of every run, all runs form one group.
+ */
+std::vector<std::vector<PlannedRun>> groupByKeyRange(const std::vector<PlannedRun> &runs);
+
+
+/**
+ * @brief Plan the merge trees that write the fewest records for the given runs.
+ * Only runs with overlapping key ranges are merged, one merge tree per group of
+ * groupByKeyRange(); a run overlapping no other run is concatenated as it is.
+ * Huffman-style: always merge the smallest runs first. With n runs and fan-in F,
+ * the first step merges (n - 2) % (F - 1) + 2 runs, so that every later step is full.
+ * @param runs the run catalog across devices
+ * @param fanIn maximum number of runs per merge
+ */
+MergePlan planMerges(const std::vector<PlannedRun> &runs, int fanIn);
+
+
+#endif // _MERGE_PLANNER_H_
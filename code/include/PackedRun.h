@@ -0,0 +1,171 @@
+#ifndef _PACKED_RUN_H_
+#define _PACKED_RUN_H_
+
+#include "KeyEncoder.h"
+#include "Record.h"
+#include "RunStreamer.h"
+#include "Storage.h"
+#include "config.h"
+#include "defs.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Whether the runs of this sort are handled as flat arrays of records. Small records
+ * spend most of their time on the allocations and pointers of Record lists, so records of up
+ * to PACKED_RECORD_SIZE bytes are loaded, sorted and merged in place instead.
+ */
+inline bool isPackedPath() { return Config::get().RECORD_SIZE <= Config::get().PACKED_RECORD_SIZE; }
+
+
+/**
+ * @brief Check whether nRecords flat records are in order, see getOrderSize()
+ * @return 1 in order, -1 in reverse order, 0 in neither
+ */
+int getPackedOrder(const char *data, RowCount nRecords);
+
+/**
+ * @brief Reverse the order of nRecords flat records in place
+ */
+void reversePacked(char *data, RowCount nRecords);
+
+
+// =========================================================
+// ---------------------- PackedStream ---------------------
+// =========================================================
+
+
+/**
+ * @brief The flat counterpart of RunStreamer: the records of a run in memory, or read a cluster
+ * at a time from a run file, or buffered in a file of fromDevice from another PackedStream.
+ * The current record points into one contiguous buffer, so moving to the next one is an add.
+ * Reads, buffer files and their accounting are the ones of the RunStreamer of the same type.
+ */
+class PackedStream {
+  private:
+    StreamerType type;
+    const char *current = nullptr; // nullptr once the run is exhausted
+    const char *end = nullptr;     // past the last record in memory
+    // ---- for reader and streamer ----
+    std::vector<char> cluster; // the records read last
+    RunReader *reader = nullptr;
+    Storage *fromDevice = nullptr;
+    PageCount readAhead = 0;
+    bool inputCluster = false;
+    RowCount readAheadPages();
+    // ---- for streamer ----
+    PackedStream *readStreamer = nullptr;
+    std::string writerFilename = "";
+    RowCount readStream();
+
+    /**
+     * @brief Read the next records once the ones in memory are exhausted
+     */
+    void refill();
+
+  public:
+    // ---- for run ----
+    PackedStream(const char *data, RowCount nRecords);
+    // ---- for reader ----
+    PackedStream(RunReader *reader, Storage *fromDevice, PageCount readAhead,
+                 bool inputCluster = false);
+    // ---- for streamer, takes ownership of the inner streamer ----
+    PackedStream(PackedStream *streamer, Storage *fromDevice, PageCount readAhead);
+    ~PackedStream();
+
+    /**
+     * @brief The current record, nullptr once the run is exhausted
+     */
+    const char *get() const { return current; }
+
+    void moveNext() {
+        current += Config::get().RECORD_SIZE;
+        if (current == end) { refill(); }
+    }
+
+    /**
+     * @brief Copy up to nRecords records from the current one on into data, and move past them
+     * @return the number of records copied, less than nRecords at the end of the run
+     */
+    RowCount read(char *data, RowCount nRecords);
+
+    RowCount getReadAheadInRecords() {
+        if (type == StreamerType::INMEMORY_RUN) { return -1; }
+        return readAhead * fromDevice->getPageSizeInRecords();
+    }
+
+    std::string getFilename() {
+        if (type == StreamerType::READER && reader != nullptr) { return reader->getFilename(); }
+        if (type == StreamerType::STREAMER && readStreamer != nullptr) {
+            return readStreamer->getFilename();
+        }
+        return "InMemory";
+    }
+}; // class PackedStream
+
+
+// =========================================================
+// -------------------- PackedLoserTree --------------------
+// =========================================================
+
+
+/**
+ * @brief Loser tree over PackedStreams, the flat counterpart of LoserTree. Its nodes are stream
+ * indices, an exhausted stream loses to every other one. The winner stays in its stream until
+ * pop(), so it can be copied or absorbed before its cluster is refilled. The current record of
+ * each leaf is compared by its encoded key, see KeyEncoder.
+ */
+class PackedLoserTree {
+  private:
+    std::vector<PackedStream *> leaves;
+    std::vector<EncodedKey> keys; // of the current record of each leaf
+    std::vector<int> nodes;       // nodes[0] is the winner, nodes[i] the loser at node i
+    KeyEncoder encoder;
+
+    bool isLess(int a, int b) const {
+        const char *ra = leaves[a]->get(), *rb = leaves[b]->get();
+        if (ra == nullptr) { return false; }
+        if (rb == nullptr) { return true; }
+        return encoder.isLess(keys[a], ra, keys[b], rb);
+    }
+
+    /**
+     * @brief Encode the key of the current record of a leaf. A key the encoding cannot hold
+     * switches the keys of all leaves to the BINARY encoding, which holds any key.
+     */
+    void encodeLeaf(int i);
+
+  public:
+    /**
+     * @brief Build the tree, the leaves stay owned by the caller
+     */
+    PackedLoserTree(const std::vector<PackedStream *> &leaves);
+
+    /**
+     * @brief The smallest current record of the leaves, nullptr once they are all exhausted
+     */
+    const char *peek() const { return leaves.empty() ? nullptr : leaves[nodes[0]]->get(); }
+
+    /**
+     * @brief Move the winning leaf to its next record and replay its path to the root
+     */
+    void pop();
+}; // class PackedLoserTree
+
+
+/**
+ * @brief Merge the streams into the writer's run, one output buffer of outBufSize records at a
+ * time, as the Record merges do: a record the one before it absorbs is dropped, see
+ * absorbRecord(), and a full buffer is written only once a record that is not absorbed follows
+ * @param maxRecords the records of the streams, merging more is an error
+ * @param nDups set to the records absorbed
+ * @return the number of records merged, the absorbed ones included
+ */
+RowCount mergePackedStreams(const std::vector<PackedStream *> &streams, Storage *storage,
+                            RunWriter *writer, RowCount outBufSize, RowCount maxRecords,
+                            RowCount *nDups);
+
+
+#endif // _PACKED_RUN_H_
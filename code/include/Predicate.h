@@ -0,0 +1,96 @@
+#ifndef _PREDICATE_H_
+#define _PREDICATE_H_
+
+
+#include "Record.h"
+#include "config.h"
+#include "defs.h"
+#include <string>
+
+
+// =========================================================
+// --------------------- FilterPredicate -------------------
+// =========================================================
+
+
+/**
+ * @brief Conditions a record must meet to pass a filter, all of the ones that are set.
+ * Keys are compared the way the sort compares them, over the first RECORD_KEY_SIZE bytes.
+ */
+struct FilterPredicate {
+    std::string minKey;    // lowest key kept, no lower bound if empty
+    std::string maxKey;    // highest key kept, no upper bound if empty
+    std::string pattern;   // bytes the record holds at patternOffset, any record if empty
+    int patternOffset = 0; // in bytes from the start of the record
+
+    bool isEmpty() const { return minKey.empty() && maxKey.empty() && pattern.empty(); }
+    /**
+     * @brief The filter set by the FILTER_ settings of the Config, empty by default
+     */
+    static FilterPredicate fromConfig();
+    /**
+     * @brief Readable form with the keys and the pattern in hex, "none" if empty
+     */
+    std::string repr() const;
+};
+
+
+// =========================================================
+// ---------------------- FilterKernel ---------------------
+// =========================================================
+
+
+/**
+ * @brief A FilterPredicate compiled for a loop over many records.
+ * The constructor picks the loop specialized for the conditions that are set, so testing a
+ * record costs no branch on the conditions that are not.
+ */
+class FilterKernel {
+  private:
+    FilterPredicate predicate;
+    const char *minKey;
+    const char *maxKey;
+    const char *pattern;
+    int patternOffset;
+    int patternSize;
+
+    bool (*testFn)(const FilterKernel &, const char *);
+    RowCount (*compactFn)(const FilterKernel &, char *, RowCount);
+    void (*selectFn)(const FilterKernel &, Page *);
+
+    template <bool MIN, bool MAX, bool PATTERN>
+    static bool testRecord(const FilterKernel &kernel, const char *record);
+    template <bool MIN, bool MAX, bool PATTERN>
+    static RowCount compactRecords(const FilterKernel &kernel, char *data, RowCount nRecords);
+    template <bool MIN, bool MAX, bool PATTERN>
+    static void selectRecords(const FilterKernel &kernel, Page *page);
+    template <bool MIN, bool MAX, bool PATTERN> void compile();
+
+  public:
+    /**
+     * @brief Throws if the pattern does not fit in a record or the key range is empty
+     */
+    FilterKernel(const FilterPredicate &predicate);
+    FilterKernel(const FilterKernel &) = delete;
+    FilterKernel &operator=(const FilterKernel &) = delete;
+
+    const FilterPredicate &getPredicate() const { return predicate; }
+
+    bool matches(const char *record) const { return testFn(*this, record); }
+
+    /**
+     * @brief Move the matching ones of nRecords records stored back to back to the front
+     * @return the number of matching records
+     */
+    RowCount compact(char *data, RowCount nRecords) const {
+        return compactFn(*this, data, nRecords);
+    }
+
+    /**
+     * @brief Drop the records that do not match from the selection vector of the page
+     */
+    void select(Page *page) const { selectFn(*this, page); }
+}; // class FilterKernel
+
+
+#endif // _PREDICATE_H_
@@ -17,13 +17,34 @@
 // =========================================================
 
 
+/**
+ * @brief Leading bytes that order records: the whole record with the EXACT dedup policy, so
+ * that equal records are next to each other, the key otherwise
+ */
+inline int getOrderSize() {
+    const Config &config = Config::get();
+    return config.DEDUP == DedupPolicy::EXACT && !config.GROUP_BY ? config.RECORD_SIZE
+                                                                  : config.RECORD_KEY_SIZE;
+}
+
+/**
+ * @brief Leading bytes a record shares with the one before it in sorted order when it is
+ * folded into it, see absorbRecord(); 0 if records are never folded
+ */
+inline int getDistinctSize() {
+    const Config &config = Config::get();
+    if (config.GROUP_BY || config.DEDUP == DedupPolicy::KEY) { return config.RECORD_KEY_SIZE; }
+    return config.DEDUP == DedupPolicy::EXACT ? config.RECORD_SIZE : 0;
+}
+
+
 class Record {
   private:
     Record(bool allocMemory) {
         data = nullptr;
         next = nullptr;
         if (allocMemory) {
-            data = new char[Config::RECORD_SIZE];
+            data = new char[Config::get().RECORD_SIZE];
             data[0] = '!';  // mark the record as invalid
             data[1] = '\0'; // null terminate the string
         }
@@ -38,14 +59,14 @@ class Record {
      * This constructor will allocate memory for data
      */
     Record() {
-        data = new char[Config::RECORD_SIZE];
+        data = new char[Config::get().RECORD_SIZE];
         data[0] = '!';  // mark the record as invalid
         data[1] = '\0'; // null terminate the string
         next = nullptr;
     }
     Record(char *data) {
-        this->data = new char[Config::RECORD_SIZE];
-        std::memcpy(this->data, data, Config::RECORD_SIZE);
+        this->data = new char[Config::get().RECORD_SIZE];
+        std::memcpy(this->data, data, Config::get().RECORD_SIZE);
         next = nullptr;
     }
     ~Record() {
@@ -66,16 +87,16 @@ class Record {
         return rec;
     }
 
-    // default comparison based on first 8 bytes of data
+    // default comparison based on the key, or all bytes of data, see getOrderSize()
     bool operator<(const Record &other) const {
-        return std::strncmp(data, other.data, Config::RECORD_KEY_SIZE) < 0;
+        return std::strncmp(data, other.data, getOrderSize()) < 0;
     }
     bool operator>(const Record &other) const {
-        return std::strncmp(data, other.data, Config::RECORD_KEY_SIZE) > 0;
+        return std::strncmp(data, other.data, getOrderSize()) > 0;
     }
     // equality comparison based on all bytes of data
     bool operator==(const Record &other) const {
-        return std::strncmp(data, other.data, Config::RECORD_SIZE) == 0;
+        return std::strncmp(data, other.data, Config::get().RECORD_SIZE) == 0;
     }
 
     // to string
@@ -88,7 +109,9 @@ class Record {
 }; // class Record
 
 
-extern Record *MAX_RECORD;
+/**
+ * @brief The record larger than every other one, of the sort the caller runs in
+ */
 Record *getMaxRecord();
 bool isRecordMax(Record *r);
 
@@ -138,7 +161,7 @@ class Run {
      * @note The caller is responsible for freeing the memory
      */
     char *getAllData() {
-        char *buffer = new char[size * Config::RECORD_SIZE];
+        char *buffer = new char[size * Config::get().RECORD_SIZE];
         Record *curr = runHead;
         for (RowCount i = 0; i < size; i++) {
             if (curr == nullptr) {
@@ -146,7 +169,8 @@ class Run {
                 flushv();
                 throw std::runtime_error("Error: Run size is less than expected");
             }
-            std::memcpy(buffer + i * Config::RECORD_SIZE, curr->data, Config::RECORD_SIZE);
+            std::memcpy(buffer + i * Config::get().RECORD_SIZE, curr->data,
+                        Config::get().RECORD_SIZE);
             curr = curr->next;
         }
         return buffer;
@@ -193,34 +217,73 @@ class Run {
 // ------------------------- Page --------------------------
 // =========================================================
 
+/**
+ * @brief A batch of records passed between iterators.
+ * The records are stored back to back in one buffer, in the order they were produced. The
+ * selection vector lists the positions of the records that are still in the batch, so an
+ * operator drops records by shrinking it instead of moving their bytes.
+ */
 class Page {
   private:
-    RowCount capacity; // max number of records
-    std::vector<Record *> records;
-    Page *next;
+    RowCount capacity;               // max number of records
+    RowCount size;                   // records in the buffer
+    char *data;                      // capacity * RECORD_SIZE bytes
+    std::vector<RowCount> selection; // positions of the selected records, ascending
 
   public:
     /**
      * @brief Construct a new Page object, with a given capacity
-     * The page is an vector of records pointers
-     * This constructor will NOT allocate memory for records
+     * This constructor allocates the buffer for all records at once
      */
-    Page(RowCount capacityInRecords) : capacity(capacityInRecords) {
-        if (capacity < 0) { throw std::runtime_error("Error: Page capacity cannot be negative"); }
-        this->records.reserve(capacity);
-        this->next = nullptr;
-    }
-    ~Page() {
-        for (auto rec : records) {
-            delete rec;
-        }
-        delete &records;
+    Page(RowCount capacityInRecords) : capacity(capacityInRecords), size(0) {
+        if (capacity < 1) { throw std::runtime_error("Error: Page capacity must be positive"); }
+        data = new char[capacity * Config::get().RECORD_SIZE];
+        selection.reserve(capacity);
     }
+    Page(const Page &) = delete;
+    Page &operator=(const Page &) = delete;
+    ~Page() { delete[] data; }
+
     // getters
     RowCount getCapacityInRecords() { return capacity; }
-    RowCount getSizeInRecords() { return records.size(); }
-    Record *getFirstRecord() { return records.front(); }
-    Record *getLastRecord() { return records.back(); }
+    RowCount getSizeInRecords() { return size; }
+    RowCount getSelectedCount() { return selection.size(); }
+    bool isFull() { return size >= capacity; }
+    bool isEmpty() { return selection.empty(); }
+    char *getData() { return data; }
+    /**
+     * @brief The k-th selected record
+     */
+    char *getSelected(RowCount k) { return data + selection[k] * Config::get().RECORD_SIZE; }
+    std::vector<RowCount> &getSelection() { return selection; }
+
+    /**
+     * @brief Mark the first n records of the buffer as filled and selected, after they were
+     * written to getData()
+     */
+    void setSize(RowCount n) {
+        size = n;
+        selection.resize(n);
+        for (RowCount i = 0; i < n; i++) {
+            selection[i] = i;
+        }
+    }
+
+    /**
+     * @brief Copy a record to the end of the page and select it
+     */
+    void append(const char *record) {
+        std::memcpy(data + size * Config::get().RECORD_SIZE, record, Config::get().RECORD_SIZE);
+        selection.push_back(size++);
+    }
+
+    /**
+     * @brief Drop all records, the page is empty afterwards
+     */
+    void clear() {
+        size = 0;
+        selection.clear();
+    }
 }; // class Page
 
 
@@ -237,6 +300,7 @@ class RunReader {
     std::ifstream _is;
     RowCount _nRecordsRead = 0;
     bool _isDeleted = false;
+    bool _isConsumed = false;
 
   public:
     /**
@@ -293,6 +357,16 @@ class RunReader {
      */
     bool isDeletedFile() { return _isDeleted; }
 
+    /**
+     * @brief Close the reader once its run is read to the end.
+     * The file stays, the RunManager deletes it once the step consuming the run is complete.
+     */
+    void consume() {
+        close();
+        _isConsumed = true;
+    }
+    bool isConsumed() { return _isDeleted || _isConsumed; }
+
     /**
      * @brief Read the next n records from the reader's file
      * @param nRecords Number of records to read, updated with actual number of records read
@@ -300,6 +374,13 @@ class RunReader {
      */
     Record *readNextRecords(RowCount *nRecords);
 
+    /**
+     * @brief Read the next records from the reader's file into one flat buffer
+     * @param data buffer of at least nRecords records
+     * @return the number of records read, less than nRecords at the end of the file
+     */
+    RowCount readRecords(char *data, RowCount nRecords);
+
     // Getters
     std::string getFilename() { return filename; }
     RowCount getFilesize() { return filesize; }
@@ -313,6 +394,39 @@ class RunReader {
 // =========================================================
 
 
+const RowCount FENCE_INTERVAL = 64 * 1024; // records between two fence keys of a run
+
+
+/**
+ * @brief A closed run as the manifest of its RunManager records it
+ */
+struct RunInfo {
+    std::string filename;
+    RowCount nRecords = 0;
+    std::string minKey;              // key of the first record in hex, empty for an empty run
+    std::string maxKey;              // key of the last record in hex
+    std::vector<std::string> fences; // key of record i * FENCE_INTERVAL in hex, a sparse index
+    uint64_t checksum = 0;           // see checksumRecords
+};
+
+
+/**
+ * @brief Fold nRecords records into a checksum, record by record, so the checksum of a run
+ * does not depend on how its records were written or read
+ */
+uint64_t checksumRecords(uint64_t checksum, const char *data, RowCount nRecords);
+const uint64_t EMPTY_CHECKSUM = 0xcbf29ce484222325ULL;
+const uint64_t NO_CHECKSUM = 0; // the records of the run were never read, only its size counts
+
+
+/**
+ * @brief Describe a file that is already sorted, e.g. the output of an earlier sort. The first
+ * and the last key and the fences are read with one seek each, the other records are not read,
+ * so the checksum is NO_CHECKSUM.
+ */
+RunInfo describeSortedFile(const std::string &filename);
+
+
 class RunWriter {
   private:
     std::string _filename;
@@ -320,6 +434,16 @@ class RunWriter {
     // ---- internal state ----
     RowCount currSize = 0;
     bool _isDeleted = false;
+    // ---- manifest entry ----
+    std::string _minKey;
+    std::string _maxKey;
+    std::vector<std::string> _fences;
+    uint64_t _checksum = EMPTY_CHECKSUM;
+
+    /**
+     * @brief Keep the first and last key, the fence keys and the checksum of the run up to date
+     */
+    void track(const char *data, RowCount nRecords);
 
   public:
     /**
@@ -346,6 +470,12 @@ class RunWriter {
      */
     RowCount writeNextRun(Run *run);
 
+    /**
+     * @brief Write nRecords records stored back to back
+     * @return number of records written
+     */
+    RowCount writeRecords(const char *data, RowCount nRecords);
+
     /**
      * Write the records from the given file name to this writer's file
      * @param writeFromFilename
@@ -364,6 +494,10 @@ class RunWriter {
         _os.open(_filename, std::ios::binary | std::ios::trunc);
         if (!_os) { throw std::runtime_error("Cannot open file: " + _filename); }
         currSize = 0;
+        _minKey.clear();
+        _maxKey.clear();
+        _fences.clear();
+        _checksum = EMPTY_CHECKSUM;
         printv("\t\t\t\tRunWriter RESET '%s'\n", _filename.c_str());
     }
 
@@ -402,6 +536,16 @@ class RunWriter {
     // ---- getters ----
     std::string getFilename() { return _filename; }
     RowCount getCurrSize() { return currSize; }
+    RunInfo getRunInfo() {
+        RunInfo run;
+        run.filename = _filename;
+        run.nRecords = currSize;
+        run.minKey = _minKey;
+        run.maxKey = _maxKey;
+        run.fences = _fences;
+        run.checksum = _checksum;
+        return run;
+    }
 
 }; // class RunWriter
 
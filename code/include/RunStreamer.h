@@ -21,19 +21,23 @@
 // =========================================================
 
 
-enum class StreamerType { INMEMORY_RUN, READER, STREAMER };
+enum class StreamerType { INMEMORY_RUN, READER, STREAMER, LOSERTREE };
+
+class LoserTree;
 
 /**
  * @brief RunStreamer is a class to stream records from a run
  * It can be used to stream records from a run in memory or from a file
  * If the run is in memory, it will stream records from the run
  * If the run is on disk, it will stream records from the file
+ * If the run is the output of a loser tree, it will stream the winners of that tree
  */
 class RunStreamer {
   private:
     /** NOTE: must update currentRecord in moveNext */
     Record *currentRecord;
     Record *nextRecord; // currentRecord might be deleted, so keep a copy of nextRecord
+    bool prefetch = Config::get().MERGE_PREFETCH; // see prefetchNext()
 
     // ===== internal state =====
     // ---- common ----
@@ -56,6 +60,9 @@ class RunStreamer {
     std::string writerFilename = "";
     RowCount readStream(RowCount nRecords, bool firstTime = false);
     Record *moveNextForStreamer();
+    // ---- for loser tree ----
+    LoserTree *tree = nullptr;
+    Record *moveNextForTree();
 
   public:
     // ---- for run ----
@@ -66,16 +73,31 @@ class RunStreamer {
     // ---- for streamer ----
     RunStreamer(StreamerType type, RunStreamer *streamer, Storage *fromDevice, Storage *toDevice,
                 PageCount readAhead);
+    // ---- for loser tree, takes ownership of the tree ----
+    RunStreamer(StreamerType type, LoserTree *tree);
     ~RunStreamer();
 
     // getters
     Record *getCurrRecord() { return currentRecord; }
+    LoserTree *getTree() { return tree; }
     RowCount getReadAheadInRecords() {
-        if (type == StreamerType::INMEMORY_RUN) { return -1; }
+        if (type == StreamerType::INMEMORY_RUN || type == StreamerType::LOSERTREE) { return -1; }
         return readAhead * fromDevice->getPageSizeInRecords();
     }
     Record *moveNext();
 
+    /**
+     * @brief Prefetch the key of the record after the current one, and the node of the record
+     * after that. The loser tree compares the key as soon as this streamer wins again. The
+     * node holds the pointer to the next key, it was prefetched one step earlier, so reading
+     * it here does not stall the merge.
+     */
+    void prefetchNext() {
+        if (!prefetch || nextRecord == nullptr) return;
+        PREFETCH(nextRecord->data);
+        PREFETCH(nextRecord->next);
+    }
+
 
     std::string repr() {
         std::string str = "RS:";
@@ -85,6 +107,8 @@ class RunStreamer {
             str += " Reader: ";
         } else if (type == StreamerType::STREAMER) {
             str += " Streamer: ";
+        } else if (type == StreamerType::LOSERTREE) {
+            str += " LoserTree: ";
         }
         str += this->getFilename();
         return str;
@@ -97,6 +121,8 @@ class RunStreamer {
             if (reader != nullptr) { return reader->getFilename(); }
         } else if (type == StreamerType::STREAMER) {
             if (readStreamer != nullptr) { return readStreamer->getFilename(); }
+        } else if (type == StreamerType::LOSERTREE) {
+            return "LoserTree";
         }
         return "Unknown";
     }
@@ -25,15 +25,21 @@ class ScanIterator : public Iterator {
     ~ScanIterator();
     bool next();
     void getRecord(Record *r);
-    void getPage(Page *p);
+    bool getPage(Page *p);
 
   private:
     ScanPlan const *const _plan;
-    RowCount _count;
+    RowCount _count; // records read from the input file
 
     // HDD *_hdd;
     std::ifstream _file;
-    // Page *_currpage;
+    Page *_page = nullptr;  // page of next() and getRecord()
+    RowCount _position = 0; // of the current record among the selected ones of _page
+
+    /**
+     * @brief Read the next records of the input file straight into the page's buffer
+     */
+    bool readPage(Page *p);
 }; // class ScanIterator
 
 #endif // _SCAN_H_
\ No newline at end of file
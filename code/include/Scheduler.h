@@ -0,0 +1,111 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+
+#include "ExternalSorter.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// =========================================================
+// --------------------- SortScheduler ---------------------
+// =========================================================
+
+
+/**
+ * @brief Capacity shared by the jobs of a SortScheduler
+ */
+struct SchedulerConfig {
+    ByteCount memoryBudget = 0;  // shared by the memory tiers of the running jobs
+    ByteCount stagingBudget = 0; // shared by the staging tiers of the running jobs
+    int maxJobs = 4;             // jobs running at the same time
+    ByteCount minMemory = 0;     // quota a job never drops below, budget / (2 * maxJobs) if 0
+    ByteCount minStaging = 0;    // quota a job never drops below, budget / (2 * maxJobs) if 0
+};
+
+
+/**
+ * @brief Runs many sorts side by side within a memory and a staging budget.
+ * A job is admitted when a slot and its minimum quota are free. The quotas follow the phases
+ * of the jobs: run generation sorts whole memory loads, so it weighs twice on the memory
+ * budget, while merging rereads and rewrites the runs in every pass, so it weighs twice on
+ * the staging budget. No job gets more than it can use (its input in memory, twice its input
+ * on the staging tier). A job picks up its new quota at its next step: it shrinks right away,
+ * never below its stored runs, and grows into what other jobs have released. The quotas never
+ * add up to more than the budgets; a job whose stored runs need more waits at its step.
+ */
+class SortScheduler {
+  private:
+    enum class JobState { WAITING, RUN_GENERATION, MERGING, FINISHED, COLLECTED };
+
+    struct Job {
+        int id;
+        SortConfig config;
+        SortFiles files;
+        ByteCount inputSize;
+        JobState state = JobState::WAITING;
+        ByteCount memory = 0;  // quota granted on the memory tier
+        ByteCount staging = 0; // quota granted on the staging tier
+        std::unique_ptr<ExternalSorter> sorter;
+        SortStats stats;
+        std::string error;
+    };
+
+    SchedulerConfig config;
+    std::vector<std::unique_ptr<Job>> jobs;
+    std::mutex mutex;
+    std::condition_variable changed;
+    ByteCount peakMemory = 0;  // largest sum of the memory quotas
+    ByteCount peakStaging = 0; // largest sum of the staging quotas
+
+    ByteCount getUsedMemory() const;
+    ByteCount getUsedStaging() const;
+    ByteCount getFreeMemory() const;
+    ByteCount getFreeStaging() const;
+    /**
+     * @brief Track the peak sums of the quotas, after they changed
+     */
+    void updatePeaks();
+    /**
+     * @brief Target quotas of the running jobs and of the jobs admitted next
+     */
+    void getTargets(std::vector<Job *> &candidates, std::vector<ByteCount> &memory,
+                    std::vector<ByteCount> &staging) const;
+    /**
+     * @brief Admit waiting jobs while a slot and their minimum quota are free
+     */
+    void admitJobs();
+    /**
+     * @brief Rebalance the quotas as the job enters a phase, and resize the job's tiers
+     */
+    void onStep(Job *job, SortContext &context, const std::string &phase);
+    void onDone(Job *job);
+
+  public:
+    SortScheduler(const SchedulerConfig &config);
+
+    /**
+     * @brief Queue a sort, jobs are admitted in the order submitted
+     * @return the job id, the index into the results of run()
+     */
+    int submit(const SortConfig &config, const SortFiles &files);
+
+    /**
+     * @brief Run all submitted jobs and wait for them.
+     * A failed job does not stop the others, its error is printed and its stats are empty.
+     * @return the statistics of every job
+     */
+    std::vector<SortStats> run();
+    void print() const;
+
+    /**
+     * @brief The largest sums of the quotas granted at the same time, within the budgets
+     */
+    ByteCount getPeakMemory() const { return peakMemory; }
+    ByteCount getPeakStaging() const { return peakStaging; }
+}; // class SortScheduler
+
+
+#endif // _SCHEDULER_H_
@@ -3,18 +3,37 @@
 
 
 #include "Iterator.h"
+#include "MergePlanner.h"
+#include <functional>
+
+
+class SortContext;
+
+
+/**
+ * @brief Called between the steps of a sort with its context and the current phase,
+ * "FIRST_PASS" or "MERGE". No merge holds buffers at that point, so the hook may resize the
+ * memory and staging tiers of the context.
+ */
+typedef std::function<void(SortContext &context, const std::string &phase)> StepHook;
 
 
 class SortPlan : public Plan {
     friend class SortIterator;
 
   public:
-    SortPlan(Plan *const input);
+    /**
+     * @param stream hand the sorted records to the parent through next(), getRecord() and
+     * getPage() straight from the last merge, instead of writing Config::OUTPUT_FILE
+     */
+    SortPlan(Plan *const input, StepHook onStep = nullptr, bool stream = false);
     ~SortPlan();
     Iterator *init() const;
 
   private:
     Plan *const _input;
+    StepHook const _onStep;
+    bool const _stream;
 }; // class SortPlan
 
 
@@ -22,22 +41,39 @@ class SortIterator : public Iterator {
   public:
     SortIterator(SortPlan const *const plan);
     ~SortIterator();
+    /**
+     * @brief Move to the next sorted record, false once all are produced. Without streaming
+     * the records are in Config::OUTPUT_FILE and there is none to move to.
+     */
     bool next();
+    /**
+     * @brief Copy the current record into r, which owns its data
+     */
     void getRecord(Record *r);
-    void getPage(Page *p);
+    /**
+     * @brief Fill the page with copies of the records after the current one, as many as fit.
+     * The iterator moves to the last one, so next() continues after the page.
+     */
+    bool getPage(Page *p);
 
   private:
     SortPlan const *const _plan;
     Iterator *const _input;
     RowCount _consumed, _produced;
+    SortContext *const _context; // bound when the sort was initialized, owns the tiers
+
+    // ==== streaming, see SortPlan ====
+    MergeStream *_stream = nullptr; // the last merge, until it is read to the end
+    Record *_current = nullptr;     // record next() moved to, owned by _stream
 
     // ==== external merge sort ====
 
     void externalMergeSort();
 
     // utility variables for external merge sort
-    HDD *_hdd;
-    SSD *_ssd;
+    PersistentTier *_hdd; // the final tier
+    PersistentTier *_ssd; // the staging tier
+    std::vector<PersistentTier *> _tiers; // the spill chain, see SortContext::getSpillChain()
     DRAM *_dram;
     RowCount _hddCapacity;
     RowCount _hddPageSize;
@@ -54,6 +90,51 @@ class SortIterator : public Iterator {
      */
     RowCount loadInputToDRAM();
     void firstPass();
+    /**
+     * @brief Checkpoint the completed steps, run the step hook of the plan, and pick up the
+     * capacities it may have changed
+     */
+    void atStep(const std::string &phase);
+
+    // ==== resume ====
+    int _step = 0; // steps begun, see RunManager
+
+    std::string getCheckpointFile();
+    /**
+     * @brief Record that the steps before _step are complete: the phase, the consumed input
+     * and the counters. The runs are in the MANIFEST of every tier.
+     */
+    void saveCheckpoint(const std::string &phase);
+    /**
+     * @brief Restore the sort as it was when the checkpointed step began
+     * @return the phase to continue with, empty without a checkpoint
+     */
+    std::string restoreCheckpoint();
+    /**
+     * @brief Get the runs stored in the tiers of the spill chain
+     */
+    std::vector<PlannedRun> getStoredRuns();
+    /**
+     * @brief Plan the merges of all runs on the spill chain, the first step is executed next
+     */
+    MergePlan planRemainingMerges();
+    /**
+     * @brief A single input record is copied as it is, unless there is something to merge it
+     * with, a filter that may drop it, a consumer to stream it to, or a group to turn it into
+     */
+    bool isSingleRecordCopy() {
+        return Config::get().NUM_RECORDS == 1 && Config::get().APPEND_FILE.empty() &&
+               !_plan->_stream && !_dram->hasFilter() && !Config::get().GROUP_BY;
+    }
+    /**
+     * @brief Write the output once no runs overlap: rename the last run, or copy the runs in
+     * key order
+     */
+    void concatenateRuns();
+    /**
+     * @brief Write the records of the merge stream to the output file, up to TOP_K of them
+     */
+    void writeStream();
 }; // class SortIterator
 
 
@@ -0,0 +1,139 @@
+#ifndef _SORT_CONTEXT_H_
+#define _SORT_CONTEXT_H_
+
+
+#include "Storage.h"
+#include "TierGraph.h"
+#include "config.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+class DRAM;
+class PersistentTier;
+struct PlannedRun;
+
+
+// =========================================================
+// ---------------------- SortCounters ---------------------
+// =========================================================
+
+
+/**
+ * @brief Statistics counted while a sort runs
+ */
+struct SortCounters {
+    RowCount nDuplicatesRemoved = 0; // or combined into a group, GROUP_BY
+    RowCount nRecordsFiltered = 0;   // dropped on load, by a filter or TOP_K
+    RowCount nStagingAccesses = 0;   // see Storage::chargeAccess
+    RowCount nFinalAccesses = 0;     // of the intermediate and the final tiers
+};
+
+
+// =========================================================
+// ---------------------- SortContext ----------------------
+// =========================================================
+
+
+/**
+ * @brief Everything one sort owns: its settings, its tiers, its TimeLedger, its counters and
+ * its trace. ExternalSorter creates a context per sort, so sorts running side by side share no
+ * state, and a sort may run on any thread.
+ * The tiers are created on first use and keep a pointer to their context, through which they
+ * reach each other, the ledger and the counters. The code below them, records and loser trees,
+ * reaches the settings through Config::get() and the context through get(): the context a
+ * Scope bound to the calling thread, or else the default context of the process, which the
+ * command line fills in.
+ */
+class SortContext {
+  private:
+    static thread_local SortContext *bound; // see Scope
+
+    TierGraph *tierGraph = nullptr;
+    DRAM *dram = nullptr;
+    PersistentTier *staging = nullptr;
+    std::vector<PersistentTier *> intermediates; // in spill order
+    PersistentTier *finalTier = nullptr;
+    Record *maxRecord = nullptr; // see getMaxRecord()
+    TimeLedger ledger;
+    std::ofstream trace;
+
+  public:
+    Config config;
+    SortCounters counters;
+
+    SortContext() {}
+    SortContext(const SortContext &) = delete;
+    SortContext &operator=(const SortContext &) = delete;
+    ~SortContext();
+
+    /**
+     * @brief The context of the sort the caller runs in
+     */
+    static SortContext *get();
+
+    /**
+     * @brief Run the enclosing block in a context: get() and Config::get() return it until the
+     * Scope ends, then the context bound before
+     */
+    class Scope {
+      private:
+        SortContext *previous;
+
+      public:
+        explicit Scope(SortContext *context);
+        ~Scope();
+    };
+
+    // ---- tiers, see TierGraph ----
+    TierGraph *getTierGraph();
+    DRAM *getDRAM();
+    PersistentTier *getStagingTier();
+    /**
+     * @brief Get the intermediate tiers in spill order, each one spilling to the next and the
+     * last one to the final tier
+     */
+    const std::vector<PersistentTier *> &getIntermediateTiers();
+    PersistentTier *getFinalTier();
+    /**
+     * @brief Get the persistent tiers in spill order: the staging tier, the intermediate tiers
+     * and the final tier. Each of them holds runs.
+     */
+    std::vector<PersistentTier *> getSpillChain();
+    /**
+     * @brief Get the tier of the spill chain with the given name, see PlannedRun::deviceName
+     */
+    PersistentTier *getTier(const std::string &name);
+    /**
+     * @brief Get the tier furthest down the spill chain that holds one of the runs, the staging
+     * tier if there are none, see mergeTierRuns()
+     */
+    PersistentTier *getLowestTier(const std::vector<PlannedRun> &runs);
+    /**
+     * @brief Get the tier below the staging tier with the largest pages, the final tier unless
+     * an intermediate tier has larger ones. The staging tier buffers the runs below it in
+     * clusters of these pages.
+     */
+    PersistentTier *getLargestPageTier();
+    /**
+     * @brief Delete the tiers and the records shared by them, the next use creates them anew,
+     * e.g. for another record size
+     */
+    void deleteTiers();
+
+    // ---- shared by the tiers ----
+    TimeLedger *getLedger() { return &ledger; }
+    /**
+     * @brief The record larger than every other one, of the current record size
+     */
+    Record *getMaxRecord();
+    /**
+     * @brief The trace of the sort, opened on first use as Config::TRACE_FILE
+     */
+    std::ofstream &getTrace();
+    void flushTrace();
+}; // class SortContext
+
+
+#endif // _SORT_CONTEXT_H_
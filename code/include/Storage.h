@@ -3,22 +3,22 @@
 
 
 #include "Record.h"
+#include "TierGraph.h"
 #include "config.h"
 #include "defs.h"
 #include <cstddef>
 #include <cstdio>
+#include <chrono>
 #include <cstring>
+#include <ctime>
 #include <dirent.h>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <queue>
 #include <sys/stat.h>
 #include <vector>
 
-#define DRAM_NAME "DRAM"
-#define DISK_NAME "HDD"
-#define SSD_NAME "SSD"
-
 
 // =========================================================
 // ------------------------ RunManager ---------------------
@@ -26,62 +26,100 @@
 
 
 /**
- * @brief RunManager class to manage runs in a storage device
+ * @brief A run in the manifest of a RunManager, with the steps of the sort that stored and
+ * consumed it
+ */
+struct CatalogedRun {
+    RunInfo info;
+    int storedAt;        // step of the sort
+    int consumedAt = -1; // step that consumed the run, its file is kept until the step ends
+};
+
+
+/**
+ * @brief RunManager class to manage runs in a storage device.
+ * Every stored or consumed run is written through to the MANIFEST of the run directory. The
+ * file of a consumed run stays until the next step begins, so the manifest together with the
+ * sort's CHECKPOINT always describes the runs as they were when the last completed step ended.
  */
 class RunManager {
   private:
+    std::string tierName;
     std::string baseDir;
     std::vector<std::pair<std::string, RowCount>> runFiles;
+    std::vector<CatalogedRun> manifest; // stored runs and the runs consumed in this step
     int nextRunIndex = 0; // next run id
+    int step = 0;         // current step of the sort
     RowCount totalRecords = 0;
 
     /**
-     * @brief reads the run files from the baseDir and returns the list of run files.
+     * @brief reads the run files from the baseDir and returns the list of run files,
+     * including buffer files of RunStreamers.
      */
     std::vector<std::string> getRunInfoFromDir();
 
+    /**
+     * @brief Rewrite the MANIFEST, through a temporary file so a crash leaves the old or the new
+     */
+    void writeManifest();
+    std::vector<CatalogedRun> readManifest();
+    std::string getManifestFile() { return baseDir + "/MANIFEST"; }
+
   public:
     /**
      * @brief RunManager class to manage runs in a storage device.
      * It creates a directory for the device runs.
-     * If the directory exists, it deletes all run files in the directory.
+     * If the directory exists, it deletes all run files in the directory, unless Config::RESUME
+     * keeps them for restore().
      * @param deviceName
+     * @param runDir directory of the run files
      */
-    RunManager(std::string deviceName);
+    RunManager(std::string deviceName, std::string runDir);
 
     /**
-     * @brief warns the user if all run files are not deleted
+     * @brief Once no run is left, deletes the consumed runs and the manifest, otherwise keeps
+     * them for a resume. Warns the user if run files are left.
      */
     ~RunManager();
 
     // Setters
-    void addRunFile(std::string filename, RowCount nRecords) {
-        runFiles.push_back({filename, nRecords});
-        totalRecords += nRecords;
+    void addRunFile(const RunInfo &run) {
+        runFiles.push_back({run.filename, run.nRecords});
+        totalRecords += run.nRecords;
+        CatalogedRun entry;
+        entry.info = run;
+        entry.storedAt = step;
+        manifest.push_back(entry);
+        writeManifest();
     }
 
     /**
-     * @brief removes the run file from the runFiles list.
-     * It also updates the totalRecords count.
+     * @brief removes the run file from the runFiles list, the run is consumed.
+     * It also updates the totalRecords count. The file of a run stored in an earlier step is
+     * deleted by beginStep(), the file of a run stored in this step right away.
      */
-    bool removeRunFile(std::string filename) {
-        // Find the run file
-        auto it = std::find_if(
-            runFiles.begin(), runFiles.end(),
-            [filename](const std::pair<std::string, RowCount> &p) { return p.first == filename; });
-
-        if (it != runFiles.end()) {
-            // Remove the run file and update the total records count
-            totalRecords -= it->second;
-            runFiles.erase(it);
-            return true;
-        }
-        return false;
-    }
+    bool removeRunFile(std::string filename);
+
+    /**
+     * @brief The steps before the given one are complete and checkpointed:
+     * delete the files of the runs they consumed
+     */
+    void beginStep(int step);
+
+    /**
+     * @brief Rebuild the runs from the manifest as they were when the given step began.
+     * Runs stored from that step on, and files not in the manifest, are deleted; the kept runs
+     * are checked against their size and checksum.
+     */
+    void restore(int step);
 
     // Getters
     std::string getBaseDir() { return baseDir; }
     RowCount getTotalRecords() { return totalRecords; }
+    /**
+     * @brief Manifest entry of a stored run: its key range, fence keys and checksum
+     */
+    const RunInfo &getRunInfo(const std::string &filename);
     std::string getNextRunFileName();
     std::vector<std::pair<std::string, RowCount>> &getStoredRunsSortedBySize();
 
@@ -93,31 +131,112 @@ class RunManager {
 }; // class RunManager
 
 
+// =========================================================
+// ------------------------ TimeLedger ---------------------
+// =========================================================
+
+
+/**
+ * @brief Modeled time of the accesses to one device in one phase
+ */
+struct DeviceTime {
+    RowCount nAccesses = 0;
+    ByteCount nBytes = 0;
+    double latencyInSec = 0;
+    double transferInSec = 0;
+    double backgroundInSec = 0; // part of latency and transfer that overlaps with compute
+
+    double getTotalInSec() const { return latencyInSec + transferInSec; }
+};
+
+
+/**
+ * @brief Accumulates the modeled latency and transfer time of every device access,
+ * per phase of the sort and per device.
+ * Background accesses (read-ahead of the RunStreamers) overlap with compute, so a phase takes
+ * its foreground device time plus the larger of its background device time and CPU time.
+ */
+class TimeLedger {
+  private:
+    std::vector<std::string> phases;                                // in the order started
+    std::map<std::string, std::map<std::string, DeviceTime>> times; // phase -> device -> time
+    std::map<std::string, double> computeInSec;                     // phase -> CPU time
+    std::string currentPhase = "INIT";
+    double phaseStart = -1; // thread CPU time, -1 outside of a phase
+
+  public:
+    /**
+     * @brief Charge the following accesses to the given phase, ends the current phase
+     */
+    void startPhase(const std::string &phase);
+    void endPhase();
+    /**
+     * @brief Charge nRequests accesses of nRecords in total, latencyInSec covers all of them
+     */
+    void charge(const std::string &deviceName, RowCount nRecords, RowCount nRequests,
+                double latencyInSec, double transferInSec, bool background);
+
+    /**
+     * @brief Modeled time of a phase: foreground device time + max(background device time, CPU)
+     */
+    double getModeledTimeInSec(const std::string &phase) const;
+    void print() const;
+}; // class TimeLedger
+
+
 // =========================================================
 //  -------------------------- Storage ---------------------
 // =========================================================
 
 
+class SortContext;
+
+
 class Storage {
     std::string name;
+    TierRole role;
     // ---- provided configurations ----
     ByteCount CAPACITY_IN_BYTES = 0; // in bytes
     int BANDWIDTH = 0;               // in MB/s
     double LATENCY = 0;              // in ms
     // ---- calibrable configurations ----
     RowCount PAGE_SIZE_IN_RECORDS = 0; // in records
-    int MAX_MERGE_FAN_IN = 95;         // #runs to merge at a time, or #input_clusters
+    int CLUSTER_FAN_IN = 0;            // #runs the clusters are sized for, see configureBuffers
+    int MAX_MERGE_FAN_IN = 0;          // #runs to merge at a time, raised in configureBuffers
     int MAX_MERGE_FAN_OUT = 5;         // #output_clusters
+    int MIN_CLUSTER_PAGES = 4;         // min #pages buffered per input run
     // ---- read/write buffer ----
     std::string readFilePath;
     std::ifstream readFile;
+    // ---- I/O emulation: token bucket in bytes, refilled at BANDWIDTH ----
+    double _ioTokens = 0;
+    std::chrono::steady_clock::time_point _ioRefilledAt;
+
+    /**
+     * @brief Delay the caller as long as this device would take for nRequests requests of
+     * nRecords in total: the latency once per request, plus the wait for bandwidth tokens.
+     * The bucket holds at most one page, so bursts beyond a page are throttled.
+     */
+    void throttle(RowCount nRecords, RowCount nRequests);
+
+    /**
+     * @brief Size the merge buffers and the fan-in for the current capacity
+     */
+    void configureBuffers();
+
+    /**
+     * @brief Size of the runs this tier holds: miniruns of a cache worth of records in the
+     * memory tier, memory loads in the others
+     */
+    RowCount getExpectedRunSizeInRecords() const;
 
   protected:
+    SortContext *context; // of the sort, owns the tiers, see SortContext
     PageCount CLUSTER_SIZE = 0;       // in pages
     RowCount MERGE_FANIN_IN_RECORDS;  // total #records to merge at a time per input cluster
     RowCount MERGE_FANOUT_IN_RECORDS; // total #records that can be stored in output clusters
     // run manager
-    RunManager *runManager = nullptr; // only for HDD and SSD
+    RunManager *runManager = nullptr; // only for the persistent tiers
     // ---- internal state ----
     RowCount _filled = 0; // updated by RunManager
     // used for merging
@@ -132,9 +251,10 @@ class Storage {
     RunWriter *spillWriter = nullptr;
 
     /**
-     * @brief Constructor for the Storage class
+     * @brief Constructor for the Storage class, for the tier playing the given role in the sort
+     * of the given context
      */
-    Storage(std::string name, ByteCount capacity, int bandwidth, double latency);
+    Storage(SortContext *context, const TierSpec &tier, TierRole role);
 
     /**
      * @brief Configure the storage device based on the provided configurations.
@@ -165,28 +285,79 @@ class Storage {
   public:
     // ------------------------ configurations ---------------------------------
     std::string getName() const { return name; }
-    RowCount getCapacityInRecords() const { return CAPACITY_IN_BYTES / Config::RECORD_SIZE; }
+    TierRole getRole() const { return role; }
+    SortContext *getContext() const { return context; }
+    RowCount getCapacityInRecords() const { return CAPACITY_IN_BYTES / Config::get().RECORD_SIZE; }
     RowCount getPageSizeInRecords() const { return PAGE_SIZE_IN_RECORDS; }
     RowCount getMergeFanInRecords() const { return MERGE_FANIN_IN_RECORDS; }
     RowCount getMergeFanOutRecords() const { return MERGE_FANOUT_IN_RECORDS; }
     int getMaxMergeFanIn() const { return MAX_MERGE_FAN_IN; }
     int getMaxMergeFanOut() const { return MAX_MERGE_FAN_OUT; }
+    int getClusterFanIn() const { return CLUSTER_FAN_IN; }
     PageCount getClusterSize() const { return CLUSTER_SIZE; }
 
 
     // ----------------------------- time calculations -------------------------
     double getAccessTimeInSec(RowCount nRecords) const {
-        if (this->name == SSD_NAME) {
-            Config::SSD_COUNT++;
-        } else if (this->name == DISK_NAME) {
-            Config::HDD_COUNT++;
-        }
-        return this->LATENCY + (nRecords * Config::RECORD_SIZE) / this->BANDWIDTH;
+        return this->LATENCY + ((double)nRecords * Config::get().RECORD_SIZE) / this->BANDWIDTH;
     }
     double getAccessTimeInMicro(RowCount nRecords) const {
         return (this->getAccessTimeInSec(nRecords) * 1000 * 1000);
     }
 
+    /**
+     * @brief Count an access of nRecords in the SortCounters of the context and charge its
+     * modeled time to its TimeLedger. The access is split into requests of a page each, see
+     * getRequests(), and every request pays the latency.
+     * With Config::EMULATE_IO, SSD and HDD accesses are also throttled to the modeled time.
+     * @param background the access overlaps with compute, e.g. the read-ahead of a RunStreamer
+     * @return the modeled access time in microseconds
+     */
+    double chargeAccess(RowCount nRecords, bool background = false);
+
+    /**
+     * @brief Page-sized requests an access of nRecords takes, at least one
+     */
+    RowCount getRequests(RowCount nRecords) const {
+        if (PAGE_SIZE_IN_RECORDS <= 0) { return 1; }
+        return std::max((RowCount)1, divide(nRecords, PAGE_SIZE_IN_RECORDS));
+    }
+
+    // ----------------------------- cost model --------------------------------
+    /**
+     * @brief Modeled time to transfer nRecords from or to this device in requests of
+     * requestInRecords records, paying the latency once per request.
+     * Unlike getAccessTimeInSec, this does not count as an access.
+     */
+    double getTransferTimeInSec(RowCount nRecords, RowCount requestInRecords) const;
+
+    /**
+     * @brief Modeled time to read nRecords from this device while merging nRuns runs with the
+     * given fan-in, reading clusterInRecords records per request.
+     * Every pass pays the transfer time once and the latency once per cluster.
+     */
+    double getMergeReadTimeInSec(RowCount nRecords, int nRuns, int fanIn,
+                                 RowCount clusterInRecords) const;
+
+    /**
+     * @brief Choose the fan-in with the lowest modeled time for merging nRuns runs
+     * (nRecords in total) stored in fromDevice, when bufferInRecords records of this device
+     * are shared by the input clusters.
+     * A higher fan-in saves merge passes but shrinks the clusters, so every read pays the
+     * latency of fromDevice for fewer records.
+     * @return a fan-in between 2 and min(nRuns, maxFanIn), or nRuns if nRuns < 2
+     */
+    int getCostOptimalFanIn(const Storage *fromDevice, RowCount nRecords, int nRuns, int maxFanIn,
+                            RowCount bufferInRecords) const;
+
+    /**
+     * @brief Change the capacity of the memory or staging tier, e.g. to a new quota of the
+     * SortScheduler. Only between steps of the sort, while no merge holds buffers; the capacity
+     * never drops below the stored records. The page size stays, the buffers are recomputed.
+     * @return the capacity applied, more than asked for if the stored records need it
+     */
+    ByteCount resize(ByteCount capacity);
+
     // ----------------------------- space calculations ------------------------
     // getters
     RowCount getTotalEmptySpaceInRecords() {
@@ -265,7 +436,7 @@ class Storage {
 
     // --------------------------- FILE I/O ------------------------------------
     std::string getReadFilePath() const { return readFilePath; }
-    bool readFrom(const std::string &filePath);
+    bool readFrom(const std::string &filePath, ByteCount offset = 0);
     std::streampos getReadPosition() { return readFile.tellg(); }
     RowCount readRecords(char *data, RowCount nRecords);
     // cleanup
@@ -274,16 +445,33 @@ class Storage {
     // ---------------------------- run management ----------------------------
     RunWriter *getRunWriter();
     RowCount writeNextChunk(RunWriter *writer, Run *run);
+    RowCount writeNextChunk(RunWriter *writer, const char *data, RowCount nRecords);
     void closeWriter(RunWriter *writer);
-    void addRunFile(std::string filename, RowCount nRecords) {
-        runManager->addRunFile(filename, nRecords);
-    }
+    void addRunFile(const RunInfo &run) { runManager->addRunFile(run); }
+    void removeRunFile(const std::string &filename) { runManager->removeRunFile(filename); }
+    /**
+     * @brief See RunManager::beginStep and RunManager::restore, the restored runs fill the tier
+     */
+    void beginStep(int step);
+    void restoreRuns(int step);
+    /**
+     * @brief Add a file that is already sorted as a run of this tier. The file is hard linked
+     * into the run directory, or copied if it cannot be linked, so consuming the run never
+     * removes the file itself.
+     */
+    void addSortedFile(const std::string &filename);
     std::string getBaseDir() {
         if (runManager == nullptr) { return ""; }
         return runManager->getBaseDir();
     }
     // ---- spill session ----
     void spill(RunWriter *writer);
+    /**
+     * @brief Append nRecords of a file of the tier above to a writer of this tier, the spill of
+     * that tier. If they do not fit, the writer's records move down the spill chain first, and
+     * if this tier is still too full, the records pass through to its own spill session.
+     */
+    void acceptSpill(RunWriter *writer, const std::string &filename, RowCount nRecords);
     RunWriter *startSpillSession();
     void endSpillSession(RunWriter *writer, bool deleteCurrFile = false);
     int getRunfilesCount() {
@@ -1,49 +1,83 @@
 #ifndef _STORAGE_TYPES_H_
 #define _STORAGE_TYPES_H_
 
+#include "GroupBy.h"
 #include "Losertree.h"
+#include "MergePlanner.h"
+#include "PackedRun.h"
+#include "Predicate.h"
 #include "RunStreamer.h"
 
 
 // ==================================================================
-// ------------------------------ Disk ------------------------------
+// -------------------------- PersistentTier ------------------------
 // ==================================================================
 
-class HDD : public Storage {
-  private:
-    static HDD *instance;
-
-    // ---- only needed for mergeHDDRuns ----
-    int setupMergeStateInSSDAndDRAM();
-    std::pair<std::vector<RunStreamer *>, RowCount> loadRunfilesToDRAM(size_t fanIn);
+/**
+ * @brief A tier that holds runs: the staging tier, an intermediate tier or the final tier of
+ * the spill chain, see TierRole. Every role is played by this class, configured by its
+ * TierSpec, so a chain of a single NVMe device fits as well as Optane, NVMe and HDD.
+ * The staging tier, the first one of the chain, also buffers the runs below it in a merge, see
+ * mergeTierRuns().
+ */
+class PersistentTier : public Storage {
+    friend class DryRun;      // simulates mergeTierRuns with the same limits
+    friend class MergeStream; // sets up the buffers of mergeTierRuns
+    friend void mergeTierRuns(Storage *from, Storage *to, const MergeStep *step);
 
-  protected:
-    HDD(std::string name = DISK_NAME, ByteCount capacity = Config::HDD_CAPACITY,
-        int bandwidth = Config::HDD_BANDWIDTH, double latency = Config::HDD_LATENCY);
-
-  public:
+  private:
+    // ---- merges, called on the staging tier ----
     /**
-     * @brief Get the singleton instance of HDD.
+     * @brief Get the fan-in of a merge of runs below this tier: every run needs an input
+     * cluster here and at least one page of this tier in DRAM
      */
-    static HDD *getInstance() {
-        if (instance == nullptr) { instance = new HDD(); }
-        return instance;
-    }
+    int getMaxBufferedFanIn();
+    /**
+     * @brief Set up the input clusters in this tier and in DRAM for a merge of runs below it
+     * @param from the lowest tier of the runs, see getRunsBelow()
+     * @return the fan-in, runs of this tier included
+     */
+    int setupBufferedMerge(Storage *from, const MergeStep *step = nullptr);
+    /**
+     * @brief Set up the input clusters in DRAM for a merge of runs of this tier only. If the
+     * runs leave no room for the output clusters, the largest ones spill first and the step
+     * is dropped.
+     * @param runFiles set to the runs to merge, the planned ones or the smallest
+     * @return the fan-in, 0 if there is nothing to merge
+     */
+    int setupDirectMerge(const MergeStep *step,
+                         std::vector<std::pair<std::string, RowCount>> &runFiles);
+    /**
+     * @brief Get the runs below this tier down to the tier from: the inputs of the step stored
+     * there, or all of them from the smallest to the largest
+     */
+    std::vector<PlannedRun> getRunsBelow(Storage *from, const MergeStep *step);
+    /**
+     * @brief Open a streamer per run, the runs of this tier read into DRAM, the runs below it
+     * through input clusters in this tier
+     * @return the streamers and their records
+     */
+    std::pair<std::vector<RunStreamer *>, RowCount>
+    openRunStreamers(const std::vector<std::pair<std::string, RowCount>> &runFiles,
+                     const std::vector<PlannedRun> &lowerRuns);
+    /**
+     * @brief mergeTierRuns on the packed path, see isPackedPath(), the same runs and buffers
+     */
+    void mergePackedRuns(const std::vector<std::pair<std::string, RowCount>> &runFiles,
+                         const std::vector<PlannedRun> &lowerRuns, Storage *to);
 
+  public:
     /**
-     * @brief Delete the singleton instance of HDD.
+     * @brief A tier of the context playing the given role, see SortContext::getSpillChain()
+     * @param spillTo the tier below it on the spill chain, none for the final tier
      */
-    static void deleteInstance() {
-        if (instance != nullptr) {
-            delete instance;
-            instance = nullptr;
-        }
-    }
+    PersistentTier(SortContext *context, const TierSpec &tier, TierRole role,
+                   Storage *spillTo = nullptr);
 
     /**
-     * @brief Destructor for HDD.
+     * @brief Destructor for PersistentTier.
      */
-    ~HDD() {
+    ~PersistentTier() {
         if (runManager != nullptr) {
             delete runManager;
             runManager = nullptr;
@@ -51,111 +85,153 @@ class HDD : public Storage {
     }
 
     /**
-     * @brief merge the runs in the HDD and SSD together to a single run.
+     * @brief Whether this staging tier lacks the space to buffer the runs below it for a
+     * merge, in which case mergeTierRuns first spills runs of it down the chain
+     */
+    bool isTooFullToMerge();
+
+    /**
+     * @brief Get the run files stored in this device for the merge planner.
+     */
+    std::vector<PlannedRun> getPlannedRuns();
+
+    /**
+     * @brief Get the fan-in for planning the merges of all runs on the spill chain.
+     * Runs of this staging tier are buffered in DRAM; the runs below it are buffered here and
+     * then in DRAM.
+     */
+    int getPlanningFanIn();
+
+    /**
+     * @brief Get the planning fan-in for the given run layout instead of the stored runs, with
+     * nLowerRuns runs below this staging tier. Used by the dry run, which only simulates the
+     * run files.
      */
-    void mergeHDDRuns();
+    int getPlanningFanIn(int nRuns, int nLowerRuns, RowCount nRecords, RowCount emptySpace);
+
+    /**
+     * @brief Set up the input clusters of this staging tier for fanIn runs below it, the rest
+     * of its free space holds the output clusters
+     */
+    void setupMergeState(RowCount outputDevicePageSize, int fanIn);
+
+    /**
+     * @brief Move the largest run down the spill chain, see Storage::acceptSpill
+     */
+    void freeSpaceBySpillingRunfiles();
 
     /**
      * @brief Store the run in a new runfile using a RunWriter.
      * @return Number of records stored.
      */
     RowCount storeRun(Run *run);
+    RowCount storeRun(const char *data, RowCount nRecords);
 
     // ---- helper functions ----
     void printStates(std::string where);
 };
 
+
+/**
+ * @brief Merge runs of the spill chain into a new run of the tier to, which spills down the
+ * chain once it is full. The runs come from the staging tier and the tiers below it down to
+ * the tier from: runs of the staging tier are read into input clusters in DRAM, the runs below
+ * it through input clusters in the staging tier. A staging tier too full to buffer them first
+ * spills its largest run and merges its own runs instead.
+ * @param from the staging tier for its runs only, or a tier below it
+ * @param step if given, merge exactly the runs of this planned step, stored down to from;
+ * otherwise merge as many runs of the staging tier as fit in DRAM and, from below it, as many
+ * of the smallest runs as fit in the staging tier
+ */
+void mergeTierRuns(Storage *from, Storage *to, const MergeStep *step = nullptr);
+
 // ==================================================================
-// ------------------------------ SSD ------------------------------
+// ------------------------------ DRAM ------------------------------
 // ==================================================================
 
-class SSD : public HDD {
+class DRAM : public Storage {
 
   private:
-    static SSD *instance;
-    SSD();
+    // ---- internal state for generating mini-runs ----
+    Record *_head; // linked list of Records for loading records
+    char *_packed; // the loaded records as one flat buffer instead, see isPackedPath()
+
+    // ---- natural runs, loads that are already in order ----
+    RunWriter *_naturalRun;          // open run in the final tier, extended by the next loads
+    Record *_naturalRunLast;         // copy of the last record written to it
+    RowCount _naturalRunInput;       // input records loaded into it, duplicates included
+    RowCount _naturalRunDuplicates;  // duplicates dropped from it
+    RowCount _naturalRunFiltered;    // input records of it the filter dropped
+
+    // ---- filter pushed down from a FilterPlan, see setFilter() ----
+    FilterKernel *_filter;
+    RowCount _loadedInput;    // input records read by the last load, dropped ones included
+    RowCount _loadedFiltered; // input records the filter or TOP_K dropped from the last load
+    RowCount _loadedDuplicates; // duplicates dropped from the last load by dropDuplicates()
+
+    // ---- top-k, see keepTopK() ----
+    std::string _topKCutoff; // key of the TOP_K-th distinct record kept, empty until then
+    std::vector<char> _topK; // carried records, in order and distinct, at most TOP_K
+    RowCount _topKInput;      // input records loaded while carrying them
+    RowCount _topKDuplicates; // duplicates dropped from them
+    RowCount _topKFiltered;   // input records the filter or TOP_K dropped meanwhile
 
-  public:
     /**
-     * @brief Get the singleton instance of SSD.
+     * @brief Keep the TOP_K smallest distinct records of a load. Records with a key beyond the
+     * cutoff are dropped first, TOP_K distinct records are ahead of them already.
+     * If TOP_K records fit in half of DRAM, they are carried from load to load, so the input
+     * is read once and nothing is written before its end. Otherwise the kept records, with
+     * their duplicates, are moved in order to the front of data, and become a run.
+     * @return the number of records left in data
      */
-    static SSD *getInstance() {
-        if (instance == nullptr) { instance = new SSD(); }
-        return instance;
-    }
+    RowCount keepTopK(char *data, RowCount nRecords);
 
     /**
-     * @brief Delete the singleton instance of SSD.
+     * @brief Drop the records of a load that an earlier record of the same load absorbs, see
+     * absorbRecord(), before they are sorted. Records are looked up by a hash of their key, as
+     * equal records have equal keys, in an open addressing table of at least twice as many slots.
+     * @return the number of records left, moved to the front of data in load order
      */
-    static void deleteInstance() {
-        if (instance != nullptr) {
-            delete instance;
-            instance = nullptr;
-        }
-    }
+    RowCount dropDuplicates(char *data, RowCount nRecords);
 
     /**
-     * @brief Destructor for SSD.
+     * @brief Check whether the loaded records are in order. Records in descending order are
+     * reversed in place, so they are in order afterwards.
      */
-    ~SSD() {
-        if (runManager != nullptr) {
-            delete runManager;
-            runManager = nullptr;
-        }
-    }
+    bool isNaturalRun();
 
     /**
-     * @brief Setup the merge state for SSD.
+     * @brief Append the loaded records, already in order, to the open natural run, or start a
+     * new one in the final tier when they don't continue it. No sort and no merge.
      */
-    void setupMergeState(RowCount outputDevicePageSize, int fanIn);
+    void writeNaturalRun(RowCount nRecords);
 
     /**
-     * @brief Store the run in a new runfile using a RunWriter.
+     * @brief Make the linked list of Records of _head from nRecords flat records
      */
-    void freeSpaceBySpillingRunfiles();
+    void linkRecords(char *data, RowCount nRecords);
 
     /**
-     * @brief Merge the runs in the SSD and store the final run in HDD.
+     * @brief genMiniRuns on the packed path: the cache-sized chunks of _packed are sorted in
+     * place and merged with a PackedLoserTree, with the spills and merge buffers of genMiniRuns
      */
-    void mergeSSDRuns(HDD *outputDevice);
-};
-
-// ==================================================================
-// ------------------------------ DRAM ------------------------------
-// ==================================================================
-
-class DRAM : public Storage {
-
-  private:
-    static DRAM *instance;
-
-    // ---- internal state for generating mini-runs ----
-    Record *_head; // linked list of Records for loading records
-    DRAM();
+    void genPackedMiniRuns(RowCount nRecords, PersistentTier *outputStorage);
 
   public:
     /**
-     * @brief Get the singleton instance of DRAM.
-     */
-    static DRAM *getInstance() {
-        if (instance == nullptr) { instance = new DRAM(); }
-        return instance;
-    }
-
-    /**
-     * @brief Delete the singleton instance of DRAM.
+     * @brief The memory tier of the context, see SortContext::getDRAM()
      */
-    static void deleteInstance() {
-        if (instance != nullptr) {
-            delete instance;
-            instance = nullptr;
-        }
-    }
+    explicit DRAM(SortContext *context);
 
     /**
      * @brief Destructor for DRAM.
      */
-    ~DRAM() {}
+    ~DRAM() {
+        delete _naturalRun;
+        delete _naturalRunLast;
+        delete _filter;
+        delete[] _packed;
+    }
 
     /**
      * @brief Setup the merge state for DRAM.
@@ -178,17 +254,108 @@ class DRAM : public Storage {
         this->resetAllFilledSpace();
     }
 
+    /**
+     * @brief Drop the input records that do not match the predicate as they are loaded, so
+     * they are never sorted or written. An empty predicate keeps every record.
+     */
+    void setFilter(const FilterPredicate &predicate);
+    bool hasFilter() { return _filter != nullptr; }
+    std::string getFilterRepr() {
+        return _filter == nullptr ? "none" : _filter->getPredicate().repr();
+    }
+
     /**
      * @brief Load nRecords from input file to DRAM.
+     * @param nRecordsKept set to the records in DRAM afterwards, the ones the filter kept
+     * @return the records read from the input file
      */
-    RowCount loadInput(RowCount nRecords);
+    RowCount loadInput(RowCount nRecords, RowCount *nRecordsKept);
 
     /**
      * @brief Generate mini-runs from the loaded records.
-     * Merge the mini-runs and store the final run in outputStorage.
+     * Merge the mini-runs and store the final run in outputStorage. Loads already in order, or
+     * in reverse order, skip both and extend the natural run instead, see writeNaturalRun().
      * @param nRecords Number of records to generate mini-runs.
      */
-    void genMiniRuns(RowCount nRecords, HDD *outputStorage);
+    void genMiniRuns(RowCount nRecords, PersistentTier *outputStorage);
+
+    /**
+     * @brief Close the open natural run, which adds it to the run manager of the final tier
+     */
+    void closeNaturalRun();
+
+    /**
+     * @brief Whether TOP_K records are few enough to be carried from load to load
+     */
+    bool isTopKCarried() {
+        return Config::get().TOP_K > 0 && 2 * Config::get().TOP_K <= getCapacityInRecords();
+    }
+
+    /**
+     * @brief Write the carried top-k records as a run of the final tier, once the input ends
+     */
+    void flushTopK();
+
+    /**
+     * @brief Input records of the open natural run and of the carried top-k records. They are
+     * in no run of the MANIFEST yet, so a checkpoint reads them again.
+     */
+    RowCount getUnsavedInput() { return _naturalRunInput + _topKInput; }
+
+    /**
+     * @brief Duplicates dropped from the unsaved input
+     */
+    RowCount getUnsavedDuplicates() { return _naturalRunDuplicates + _topKDuplicates; }
+
+    /**
+     * @brief Records of the unsaved input the filter or TOP_K dropped
+     */
+    RowCount getUnsavedFiltered() { return _naturalRunFiltered + _topKFiltered; }
+};
+
+
+// ==================================================================
+// --------------------------- MergeStream --------------------------
+// ==================================================================
+
+
+/**
+ * @brief The last merge of a sort, pulled record by record instead of written to a run.
+ * The runs are read group by group of groupByKeyRange(), in key order. The runs of a group are
+ * merged by a loser tree with the buffers mergeTierRuns would set up, so the merge plan must
+ * have at most one step left. Duplicates are removed as in every merge, and with GROUP_BY
+ * groups combined, so a record is returned once the next one is read.
+ * The run files are removed once their group is read, or when the stream is deleted.
+ */
+class MergeStream {
+  private:
+    SortContext *context; // of the sort, holds the runs
+    std::vector<std::vector<PlannedRun>> groups;
+    size_t nextGroup = 0;
+    std::vector<RunStreamer *> runStreamers; // of the group being read
+    LoserTree *loserTree = nullptr;
+    Record *prev = nullptr;    // the record returned last
+    Record *pending = nullptr; // read ahead, the following records may fold into it
+    RowCount nProduced = 0;
+    RowCount nDups = 0;
+
+    /**
+     * @brief Set up the buffers and the loser tree for the next group
+     * @return false if all groups were read
+     */
+    bool openNextGroup();
+    void closeGroup();
+    void removeRuns(const std::vector<PlannedRun> &runs);
+
+  public:
+    MergeStream(SortContext *context, const std::vector<PlannedRun> &runs);
+    ~MergeStream();
+
+    /**
+     * @brief The next record in sorted order, nullptr after the last one.
+     * The record belongs to the stream and stays valid until the next call.
+     */
+    Record *next();
 };
 
 
@@ -197,8 +364,10 @@ class DRAM : public Storage {
 // =============================================================================
 
 
-double getDRAMAccessTime(RowCount nRecords);
-double getSSDAccessTime(RowCount nRecords);
-double getHDDAccessTime(RowCount nRecords);
+/**
+ * @brief Check that each tier of the context can hold the merge buffers of the next one,
+ * throws std::runtime_error otherwise
+ */
+void checkTierCapacities(SortContext *context);
 
 #endif // _STORAGE_TYPES_H_
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef _TAG_SORT_H_
+#define _TAG_SORT_H_
+
+
+#include "Iterator.h"
+#include "Predicate.h"
+#include "Sort.h"
+#include <memory>
+#include <string>
+
+
+/**
+ * @brief Sort of large records by their tags, the key and the input position of each record.
+ * The tags are sorted with a SortPlan, so the runs and merges move a few bytes per record
+ * instead of the whole record. A final gather pass reads the records in batches of output
+ * positions, each batch in input order so that neighbouring records share a read, and writes
+ * them to Config::OUTPUT_FILE.
+ */
+class TagSortPlan : public Plan {
+    friend class TagSortIterator;
+
+  public:
+    TagSortPlan(Plan *const input, StepHook onStep = nullptr);
+    ~TagSortPlan();
+    Iterator *init() const;
+
+  private:
+    Plan *const _input;
+    StepHook const _onStep;
+}; // class TagSortPlan
+
+
+/**
+ * @brief Sorts in the constructor, like SortIterator without streaming: the records are in
+ * Config::OUTPUT_FILE and next() has none to move to
+ */
+class TagSortIterator : public Iterator {
+  public:
+    TagSortIterator(TagSortPlan const *const plan);
+    ~TagSortIterator();
+    bool next();
+    void getRecord(Record *r);
+    bool getPage(Page *p);
+
+  private:
+    TagSortPlan const *const _plan;
+    Iterator *const _input;
+    SortContext *const _context;           // bound when the sort was initialized
+    std::unique_ptr<FilterKernel> _filter; // of a FilterPlan right below, pushed down
+    int _recordSize;                       // of the input records, Config::RECORD_SIZE
+    RowCount _nTags = 0;
+    RowCount _nReads = 0; // of the gather pass
+
+    /**
+     * @brief Bytes of a tag: the key, then the input position as a native 8-byte integer
+     */
+    static int getTagSize() { return Config::get().RECORD_KEY_SIZE + (int)sizeof(uint64_t); }
+    std::string getTagFile() const { return Config::get().OUTPUT_FILE + ".tags"; }
+    std::string getSortedTagFile() const { return Config::get().OUTPUT_FILE + ".tags.sorted"; }
+
+    /**
+     * @brief Read the input once and write the tags of the records the filter keeps
+     */
+    void writeTags();
+
+    /**
+     * @brief Sort the tag file with a SortPlan, on tiers set up for records of a tag's size
+     */
+    void sortTags();
+
+    /**
+     * @brief Read the records in the order of the sorted tags and write them to the output.
+     * With the EXACT dedup policy, the records of one key are ordered by all of their bytes
+     * and equal ones are dropped.
+     */
+    void gather();
+
+    /**
+     * @brief Fetch the records at the given input positions into out, positions[i] to
+     * out + i * record size. Positions close enough that reading the records between them
+     * costs less than another access are read together.
+     */
+    void fetchRecords(std::ifstream &input, const std::vector<uint64_t> &positions, char *out);
+}; // class TagSortIterator
+
+
+#endif // _TAG_SORT_H_
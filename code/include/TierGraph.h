@@ -0,0 +1,65 @@
+#ifndef _TIER_GRAPH_H_
+#define _TIER_GRAPH_H_
+
+
+#include "config.h"
+#include <string>
+#include <vector>
+
+
+// =========================================================
+// ------------------------ TierGraph ----------------------
+// =========================================================
+
+
+/**
+ * @brief Role of a tier in the sort.
+ * The memory tier sorts and merges, the staging tier keeps the runs close to memory, the
+ * intermediate tiers hold the runs the tiers above them spill, and the final tier receives the
+ * rest, including the sorted output. DRAM plays the memory tier and PersistentTier the others.
+ */
+enum class TierRole { MEMORY, STAGING, INTERMEDIATE, FINAL };
+
+
+/**
+ * @brief The storage tiers configured at runtime and the roles they play.
+ * - the first tier is the memory tier, the second one the staging tier
+ * - the spill chain starts at the staging tier and follows spillTo; the tiers between its ends
+ *   are intermediate tiers, each one holds runs until it is full, and the end of the chain is
+ *   the final tier
+ * - with a single persistent tier, a second view of it with its own run directory is the final
+ *   tier, so that runs and output share the device
+ * Tiers off the spill chain are not used.
+ */
+class TierGraph {
+  private:
+    std::vector<TierSpec> tiers;
+    std::vector<TierSpec> intermediateSpecs; // in spill order
+    TierSpec finalSpec;
+    int finalIndex = -1; // index into tiers, the staging tier itself for a shared device
+
+    int findTier(const std::string &name) const;
+    void validate();
+    void resolveSpillChain();
+
+  public:
+    /**
+     * @brief Validate the given tiers and resolve their spill chain, without printing them
+     */
+    explicit TierGraph(const std::vector<TierSpec> &tiers);
+
+    /**
+     * @brief Get the specification of the tier playing the given role, the first intermediate
+     * tier for INTERMEDIATE
+     */
+    const TierSpec &getSpec(TierRole role) const;
+    /**
+     * @brief Get the intermediate tiers, from the staging tier down to the final tier
+     */
+    const std::vector<TierSpec> &getIntermediateSpecs() const { return intermediateSpecs; }
+    const std::vector<TierSpec> &getTiers() const { return tiers; }
+    void print() const;
+}; // class TierGraph
+
+
+#endif // _TIER_GRAPH_H_
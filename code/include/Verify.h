@@ -1,6 +1,7 @@
 #ifndef _VERIFY_H_
 #define _VERIFY_H_
 
+#include "Predicate.h"
 #include "Record.h"
 #include "config.h"
 #include "defs.h"
@@ -15,7 +16,18 @@
 
 bool verifyOrder(const std::string &outputFilePath, uint64_t capacityMB);
 
+/**
+ * @brief Check that every output record is an input record. In append mode the records of the
+ * sorted file the input was merged into count as input.
+ */
 bool verifyIntegrity(const std::string &inputFilePath, const std::string &outputFilePath,
-                     uint64_t capacityMB);
+                     uint64_t capacityMB, const std::string &appendFilePath = "");
+
+/**
+ * @brief Check that every output record matches the filter, and that the filter dropped
+ * nFiltered input records, the ones that do not match it
+ */
+bool verifyFilter(const std::string &inputFilePath, const std::string &outputFilePath,
+                  const FilterPredicate &predicate, RowCount nFiltered, uint64_t capacityMB);
 
 #endif // _VERIFY_H_
\ No newline at end of file
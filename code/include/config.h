@@ -33,77 +33,130 @@
 // =========================================================
 
 
+/**
+ * @brief A storage tier configured at runtime, see TierGraph for the roles of the tiers
+ */
+struct TierSpec {
+    std::string name;
+    ByteCount capacity = 0; // in bytes, INFINITE_CAPACITY for unbounded
+    int bandwidth = 0;      // in bytes/s
+    double latency = 0;     // in seconds
+    std::string dir;        // run directory, <name>_runs in Config::RUN_DIR if empty
+    std::string spillTo;    // tier to spill to when full, the next tier if empty
+
+    std::string getDir() const;
+};
+
+
+/**
+ * @brief Records folded into the one before them in sorted order: none, equal records, or
+ * records with an equal key, of which one is kept. Which one is not specified: neither the
+ * sorts nor the merges order records with equal keys, see tests/DedupKeyTest.cpp.
+ */
+enum class DedupPolicy { NONE, EXACT, KEY };
+
+
+/**
+ * @brief Settings of a sort.
+ * Every SortContext has its own copy, initialized with the defaults below, so that sorts
+ * running side by side (see ExternalSorter) do not share any settings. Config::get() is the
+ * copy of the context the caller runs in, see SortContext::Scope, and the copy of the default
+ * context of the process outside of a sort, which the command line and readConfig() fill in.
+ */
 class Config {
+  private:
+    static thread_local Config *bound; // see SortContext::Scope
+    static Config &getDefaults();
+
   public:
+    /**
+     * @brief The settings of the sort the caller runs in
+     */
+    static Config &get() { return bound != nullptr ? *bound : getDefaults(); }
+    static void bind(Config *config) { bound = config; }
+
     // variables
 
     // ---- Cache ----
-    static int CACHE_SIZE; // 1 KB
+    int CACHE_SIZE = 1 * 1024 * 1024; // 1 MB
     // ---- DRAM ----
-    static ByteCount DRAM_CAPACITY; // 100 MB
-    static double DRAM_LATENCY;     // 0.1 ms
-    static int DRAM_BANDWIDTH;      // 100 MB/s
+    ByteCount DRAM_CAPACITY = 1LL * 100 * 1024 * 1024; // 100 MB
+    double DRAM_LATENCY = 1.0 / (1000 * 1000);         // 10 microsecond
+    int DRAM_BANDWIDTH = 100 * 1024 * 1024;            // 100 GB/s
     // ---- SSD ----
-    static ByteCount SSD_CAPACITY; // 10 GB
-    static double SSD_LATENCY;     // 0.1 ms
-    static int SSD_BANDWIDTH;      // 100 MB/s
+    ByteCount SSD_CAPACITY = 10LL * 1024 * 1024 * 1024; // 10GB
+    double SSD_LATENCY = 1.0 / (10 * 1000);             // 0.1 ms
+    int SSD_BANDWIDTH = 200 * 1024 * 1024;              // 200 MB/s
     // ---- HDD ----
-    static ByteCount HDD_CAPACITY; // Infinite
-    static double HDD_LATENCY;     // 10 ms
-    static int HDD_BANDWIDTH;      // 100 MB/s
+    ByteCount HDD_CAPACITY = INFINITE_CAPACITY * 1LL; // Infinite
+    double HDD_LATENCY = 1 * 5.0 / 1000;              // 5 ms
+    int HDD_BANDWIDTH = 100 * 1024 * 1024;            // 100 MB/s
+    // ---- Tiers ----
+    std::vector<TierSpec> TIERS; // empty: DRAM, SSD and HDD configured above
     // ---- Record ----
-    static int RECORD_KEY_SIZE;  // 8 bytes
-    static int RECORD_SIZE;      // 1024 bytes
-    static RowCount NUM_RECORDS; // 20 records
+    int RECORD_KEY_SIZE = 8;          // 8 bytes
+    int RECORD_SIZE = 1024;           // 1024 bytes
+    RowCount NUM_RECORDS = 2200000LL; // 20 records
+    // ---- Merge ----
+    int MERGE_FAN_IN = 1024;    // upper bound, limited in Storage::configure
+    int MERGE_GROUP_SIZE = 32;  // leaves per loser tree in a cascaded merge
+    bool MERGE_PREFETCH = true; // off: merge leaves do not prefetch, see RunStreamer.h
+    // ---- Emulation ----
+    bool EMULATE_IO = false; // off: I/O runs at the speed of the local disk
+    // ---- Calibration ----
+    bool CALIBRATE = false;                          // measure the persistent tiers at startup
+    ByteCount CALIBRATE_SIZE = 32LL * 1024 * 1024;   // 32 MB per sequential benchmark
+    std::string PROFILE_FILE = "device_profile.txt"; // cached measurements
     // ---- Duplicate ----
-    static RowCount NUM_DUPLICATES;
-    static RowCount NUM_DUPLICATES_REMOVED;
-    // ---- Access Count ----
-    static RowCount SSD_COUNT;
-    static RowCount HDD_COUNT;
-    // ---- VERIFY ----
-    static std::string VERIFY_INPUTDIR;
-    static std::string VERIFY_OUTPUTDIR;
-    static bool VERIFY_ONLY;
-    static bool VERIFY;
-    static int VERIFY_HASH_BYTES;
+    RowCount NUM_DUPLICATES = 0;
+    DedupPolicy DEDUP = DedupPolicy::EXACT; // EXACT orders equal keys by the rest of the record
+    bool EARLY_DEDUP = false; // off: duplicates are dropped by the merges
+    // ---- Verify ----
+    std::string VERIFY_INPUTDIR = "Verify_parts/input/";
+    std::string VERIFY_OUTPUTDIR = "Verify_parts/output/";
+    bool VERIFY_ONLY = false;
+    bool VERIFY = false;
+    int VERIFY_HASH_BYTES = sizeof(uint64_t);
+    // ---- Plan-only ----
+    bool PLAN_ONLY = false;
+    // ---- Resume ----
+    bool RESUME = false; // off: a sort starts over, deleting old runs
+    // ---- Append ----
+    std::string APPEND_FILE = ""; // empty: a full sort of the input
+    // ---- Filter, see FilterPredicate ----
+    std::string FILTER_MIN_KEY = ""; // empty: no filter on the keys
+    std::string FILTER_MAX_KEY = ""; // highest key kept, no upper bound if empty
+    std::string FILTER_PATTERN = ""; // empty: no filter on the bytes
+    int FILTER_PATTERN_OFFSET = 0;   // in bytes from the start of the record
+    // ---- Top-k ----
+    RowCount TOP_K = 0; // 0: all records
+    // ---- Group by ----
+    bool GROUP_BY = false;         // off: records with equal keys are all output
+    int GROUP_BY_FIELD_OFFSET = 8; // right after the default key
+    // ---- Tag sort ----
+    bool TAG_SORT = false; // off: the runs carry whole records, see TagSort.h
+    // ---- Packed records ----
+    int PACKED_RECORD_SIZE = 100; // 0: every record size takes Record lists, see PackedRun.h
+    bool KEY_ENCODING = true;     // off: packed runs compare keys with strncmp, KeyEncoder.h
     // ---- File ----
-    static std::string OUTPUT_FILE;
-    static std::string INPUT_FILE;
-    static std::string TRACE_FILE;
+    std::string OUTPUT_FILE = "output.txt";
+    std::string INPUT_FILE = "input.txt";
+    std::string TRACE_FILE = "trace.log";
+    std::string RUN_DIR = ""; // the working directory
 }; // class Config
 
 void printConfig();
 void readConfig(const std::string &configFile);
+std::vector<TierSpec> getTierSpecs();
 ByteCount getInputSizeInBytes();
 ByteCount getInputSizeInMB();
 ByteCount getInputSizeInGB();
 std::string formatNum(uint64_t num);
-
-
-// =========================================================
-// ------------------------- Logger ------------------------
-// =========================================================
-
-
-// singleton logger class
-class Logger {
-  private:
-    std::ofstream traceFile;
-    Logger() {
-        if (!traceFile.is_open()) traceFile.open(Config::TRACE_FILE);
-    }
-
-  public:
-    static Logger *getInstance() {
-        static Logger instance;
-        return &instance;
-    }
-
-    void write(const std::string &message);
-    void writef(const char *format, ...);
-    ~Logger() { traceFile.close(); }
-};
+/**
+ * @brief `none`, `exact` or `key`, throws for any other name
+ */
+DedupPolicy parseDedupPolicy(const std::string &name);
+std::string getDedupPolicyName(DedupPolicy policy);
 
 
 // =========================================================
@@ -115,8 +168,6 @@ void Assert(bool const predicate, char const *const file, int const line,
             char const *const function);
 
 
-extern std::ofstream logFile;
-
 void printVerbose(bool vv, char const *const file, int const line, char const *const function,
                   const char *format, ...);
 void flushVerbose();
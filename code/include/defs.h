@@ -32,6 +32,13 @@ void Assert(bool const predicate, char const *const file, int const line);
 
 #define traceprintf printf("%s:%d:%s ", __FILE__, __LINE__, __FUNCTION__), printf
 
+// software prefetch of a read-only address into all cache levels
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define PREFETCH(addr) (void)(0)
+#endif
+
 // -----------------------------------------------------------------
 
 class Trace {
@@ -0,0 +1,136 @@
+#include "TestUtil.h"
+#include <memory>
+
+
+/**
+ * @brief Sorters running at the same time share no state: each sort has a SortContext of its
+ * own, with its settings, tiers, ledger, counters and trace. Three sorters with different
+ * record sizes, deduplication, tiers and sort paths run on their own threads while a fourth
+ * one sorts on the main thread, and each output and each trace must be that of its own sort.
+ */
+
+
+static std::mt19937_64 rng(11);
+
+
+static TierSpec makeTier(const std::string &name, ByteCount capacity, int bandwidth,
+                         double latency) {
+    TierSpec tier;
+    tier.name = name;
+    tier.capacity = capacity;
+    tier.bandwidth = bandwidth;
+    tier.latency = latency;
+    return tier;
+}
+
+
+/**
+ * @brief One of the sorts running side by side, with its input and expected output
+ */
+struct ConcurrentSort {
+    std::string name;
+    SortConfig config;
+    SortFiles files;
+    std::vector<std::string> expected;
+    RowCount nRecords;
+    std::unique_ptr<ExternalSorter> sorter;
+
+    /**
+     * @param nSymbols distinct characters per byte of the input, few of them make duplicates
+     */
+    ConcurrentSort(const std::string &name, int recordSize, int keySize, RowCount nRecords,
+                   int nSymbols, DedupPolicy dedup)
+        : name(name), nRecords(nRecords) {
+        const int mb = 1024 * 1024;
+        config.tiers = {makeTier("DRAM", 2 * mb, 100 * mb, 0.000001),
+                        makeTier("SSD", 20 * mb, 200 * mb, 0.0001),
+                        makeTier("HDD", INFINITE_CAPACITY, 100 * mb, 0.005)};
+        config.recordSize = recordSize;
+        config.recordKeySize = keySize;
+        config.dedup = dedup;
+        config.tagSort = false;
+        config.runDir = name + "_runs";
+        config.traceFile = name + ".log";
+        files.input = name + "_input.txt";
+        files.output = name + "_output.txt";
+
+        std::vector<char> input(nRecords * recordSize);
+        for (auto &c : input) {
+            c = 'a' + rng() % nSymbols;
+        }
+        writeRecords(files.input, input);
+        int orderSize = dedup == DedupPolicy::EXACT ? recordSize : keySize;
+        int distinctSize = dedup == DedupPolicy::KEY     ? keySize
+                           : dedup == DedupPolicy::EXACT ? recordSize
+                                                         : 0;
+        expected = expectedOutput(input, recordSize, orderSize, distinctSize);
+    }
+
+    void check(const SortStats &stats) {
+        int orderSize = config.dedup == DedupPolicy::EXACT ? config.recordSize
+                                                           : config.recordKeySize;
+        checkOutput(files.output, expected, config.recordSize, orderSize);
+        CHECK(stats.nRecords == nRecords, "%s: sorted %lld records instead of %lld",
+              name.c_str(), (long long)stats.nRecords, (long long)nRecords);
+        RowCount nDropped = nRecords - (RowCount)expected.size();
+        CHECK(stats.nDuplicatesRemoved == nDropped, "%s: %lld duplicates removed instead of %lld",
+              name.c_str(), (long long)stats.nDuplicatesRemoved, (long long)nDropped);
+        CHECK(stats.nStagingAccesses > 0 && stats.nFinalAccesses > 0,
+              "%s: %lld staging and %lld final accesses", name.c_str(),
+              (long long)stats.nStagingAccesses, (long long)stats.nFinalAccesses);
+
+        // The trace holds the configuration of this sort only
+        std::ifstream trace(config.traceFile);
+        std::string line;
+        int nInputs = 0;
+        while (getline(trace, line)) {
+            if (line.find("INPUT_FILE: ") == std::string::npos) { continue; }
+            nInputs++;
+            CHECK(line.find(files.input) != std::string::npos, "%s: foreign trace line: %s",
+                  name.c_str(), line.c_str());
+        }
+        CHECK(nInputs > 0, "%s: no configuration in %s", name.c_str(), config.traceFile.c_str());
+        std::remove(files.input.c_str());
+        std::remove(files.output.c_str());
+    }
+};
+
+
+int main() {
+    const int mb = 1024 * 1024;
+    std::vector<std::unique_ptr<ConcurrentSort>> sorts;
+    // Large records on the record lists, without deduplication
+    sorts.emplace_back(new ConcurrentSort("ConcurrentLists", 500, 8, 40000, 26, DedupPolicy::NONE));
+    // Small packed records, many of them duplicates
+    sorts.emplace_back(
+        new ConcurrentSort("ConcurrentPacked", 20, 8, 1000000, 3, DedupPolicy::EXACT));
+    // Tags sorted in place of the records, one record kept per key
+    sorts.emplace_back(new ConcurrentSort("ConcurrentTags", 100, 4, 200000, 10, DedupPolicy::KEY));
+    sorts.back()->config.tagSort = true;
+    // On the main thread, through an intermediate tier
+    sorts.emplace_back(
+        new ConcurrentSort("ConcurrentMain", 64, 8, 300000, 4, DedupPolicy::EXACT));
+    sorts.back()->config.tiers.insert(sorts.back()->config.tiers.end() - 1,
+                                      makeTier("NVME", 6 * mb, 150 * mb, 0.001));
+    sorts.back()->config.earlyDedup = true;
+
+    for (auto &sort : sorts) {
+        sort->sorter.reset(new ExternalSorter(sort->config, sort->files));
+    }
+    for (size_t i = 0; i + 1 < sorts.size(); i++) {
+        sorts[i]->sorter->start();
+    }
+    try {
+        sorts.back()->check(sorts.back()->sorter->run());
+    } catch (const std::exception &e) {
+        CHECK(false, "%s failed: %s", sorts.back()->name.c_str(), e.what());
+    }
+    for (size_t i = 0; i + 1 < sorts.size(); i++) {
+        try {
+            sorts[i]->check(sorts[i]->sorter->wait());
+        } catch (const std::exception &e) {
+            CHECK(false, "%s failed: %s", sorts[i]->name.c_str(), e.what());
+        }
+    }
+    return finishTest("ConcurrentSortTest");
+}
@@ -0,0 +1,114 @@
+#include "TestUtil.h"
+#include <map>
+#include <set>
+
+
+/**
+ * @brief With the KEY dedup policy, the output holds exactly one record per key of the input,
+ * in key order, and each one is an input record with that key. Which one is not specified:
+ * ties are not ordered by the in-memory sort, the merges or the reversal of descending natural
+ * runs, so the test accepts any record of the key and only counts how many are not the first
+ * one of the input. Inputs in random order, in descending order and through the tag sort.
+ */
+
+
+static std::mt19937_64 rng(19);
+
+static const int RECORD_SIZE = 64;
+static const int KEY_SIZE = 6;
+
+
+static TierSpec makeTier(const std::string &name, ByteCount capacity, int bandwidth,
+                         double latency) {
+    TierSpec tier;
+    tier.name = name;
+    tier.capacity = capacity;
+    tier.bandwidth = bandwidth;
+    tier.latency = latency;
+    return tier;
+}
+
+
+/**
+ * @brief Sort the input with one record kept per key and check the output
+ * @param descending the input in descending order, so that its loads are reversed natural runs
+ */
+static void checkDedupKey(const std::string &name, RowCount nRecords, bool descending,
+                          bool tagSort) {
+    const int mb = 1024 * 1024;
+    SortConfig config;
+    config.tiers = {makeTier("DRAM", 2 * mb, 100 * mb, 0.000001),
+                    makeTier("SSD", 20 * mb, 200 * mb, 0.0001),
+                    makeTier("HDD", INFINITE_CAPACITY, 100 * mb, 0.005)};
+    config.recordSize = RECORD_SIZE;
+    config.recordKeySize = KEY_SIZE;
+    config.dedup = DedupPolicy::KEY;
+    config.tagSort = tagSort;
+    config.runDir = name + "_runs";
+    config.traceFile = name + ".log";
+    SortFiles files;
+    files.input = name + "_input.txt";
+    files.output = name + "_output.txt";
+
+    // Few symbols in the key, so that every key has several records with other payloads
+    std::vector<std::string> records(nRecords);
+    for (auto &record : records) {
+        record.resize(RECORD_SIZE);
+        for (int i = 0; i < RECORD_SIZE; i++) {
+            record[i] = i < KEY_SIZE ? 'a' + rng() % 5 : 'a' + rng() % 26;
+        }
+    }
+    if (descending) { std::sort(records.rbegin(), records.rend()); }
+    std::vector<char> input;
+    std::map<std::string, std::set<std::string>> payloads; // per key
+    std::map<std::string, std::string> firsts;             // record of the key first in input
+    for (auto &record : records) {
+        input.insert(input.end(), record.begin(), record.end());
+        std::string key = record.substr(0, KEY_SIZE);
+        payloads[key].insert(record);
+        firsts.insert({key, record});
+    }
+    writeRecords(files.input, input);
+
+    SortStats stats;
+    try {
+        stats = ExternalSorter(config, files).run();
+    } catch (const std::exception &e) {
+        CHECK(false, "%s failed: %s", name.c_str(), e.what());
+        return;
+    }
+
+    std::vector<char> output = readRecords(files.output);
+    size_t nOutput = output.size() / RECORD_SIZE;
+    CHECK(nOutput == payloads.size(), "%s: %zu records for %zu keys", name.c_str(), nOutput,
+          payloads.size());
+    auto key = payloads.begin();
+    int nNotFirst = 0;
+    for (size_t i = 0; i < nOutput && key != payloads.end(); i++, key++) {
+        std::string record(&output[i * RECORD_SIZE], RECORD_SIZE);
+        if (record.compare(0, KEY_SIZE, key->first) != 0) {
+            CHECK(false, "%s: record %zu has key %s instead of %s", name.c_str(), i,
+                  record.substr(0, KEY_SIZE).c_str(), key->first.c_str());
+            break;
+        }
+        CHECK(key->second.count(record) == 1, "%s: record %zu is none of the input records of "
+                                              "its key",
+              name.c_str(), i);
+        nNotFirst += record != firsts[key->first];
+    }
+    CHECK(stats.nDuplicatesRemoved == nRecords - (RowCount)payloads.size(),
+          "%s: %lld duplicates removed instead of %lld", name.c_str(),
+          (long long)stats.nDuplicatesRemoved, (long long)(nRecords - (RowCount)payloads.size()));
+    printf("%s: %zu keys, %d of them kept another record than their first one\n", name.c_str(),
+           payloads.size(), nNotFirst);
+    std::remove(files.input.c_str());
+    std::remove(files.output.c_str());
+}
+
+
+int main() {
+    checkDedupKey("DedupKeyRandom", 200000, false, false);
+    checkDedupKey("DedupKeyDescending", 200000, true, false);
+    checkDedupKey("DedupKeyTags", 200000, false, true);
+    return finishTest("DedupKeyTest");
+}
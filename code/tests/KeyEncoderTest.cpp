@@ -0,0 +1,251 @@
+#include "KeyEncoder.h"
+#include "PackedRun.h"
+#include "TestUtil.h"
+
+
+/**
+ * @brief KeyEncoder must order records exactly like strncmp over getOrderSize() bytes, in both
+ * encodings, and the packed sort must switch from ALNUM to BINARY without reordering records
+ * when a key outside KEY_ALPHABET shows up in the middle of a load or of a merge.
+ * Records over PACKED_RECORD_SIZE are not covered, they are compared with strncmp directly.
+ */
+
+
+static std::mt19937_64 rng(42);
+
+
+/**
+ * @brief A random byte: mostly symbols of KEY_ALPHABET with a few null bytes, or any byte
+ */
+static char randomByte(bool binary) {
+    if (rng() % 16 == 0) { return '\0'; }
+    if (binary) { return (char)(rng() % 256); }
+    return KEY_ALPHABET[rng() % std::strlen(KEY_ALPHABET)];
+}
+
+static void randomRecord(char *record, int size, bool binary) {
+    for (int i = 0; i < size; i++) {
+        record[i] = randomByte(binary);
+    }
+}
+
+/**
+ * @brief A record equal to another one up to a random byte, so the keys often tie in their
+ * high or their low word, or up to a null byte
+ */
+static void nearbyRecord(char *record, const char *other, int size, bool binary) {
+    std::memcpy(record, other, size);
+    int i = rng() % size;
+    record[i] = randomByte(binary);
+}
+
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+
+// =========================================================
+// ------------------------ isLess -------------------------
+// =========================================================
+
+
+/**
+ * @brief Compare isLess against strncmp on random pairs, in both encodings
+ */
+static void testIsLess(int recordSize, int keySize, DedupPolicy dedup, bool binary) {
+    Config::get().RECORD_SIZE = recordSize;
+    Config::get().RECORD_KEY_SIZE = keySize;
+    Config::get().DEDUP = dedup;
+    Config::get().KEY_ENCODING = true;
+    const int orderSize = getOrderSize();
+
+    KeyEncoder alnum, bin;
+    bin.setMode(KeyEncoder::Mode::BINARY);
+    std::vector<char> a(recordSize), b(recordSize);
+    int nEncoded = 0;
+    for (int n = 0; n < 200000; n++) {
+        randomRecord(a.data(), recordSize, binary && rng() % 2 == 0);
+        if (n % 2 == 0) {
+            nearbyRecord(b.data(), a.data(), recordSize, binary && rng() % 2 == 0);
+        } else {
+            randomRecord(b.data(), recordSize, binary && rng() % 2 == 0);
+        }
+        int expected = sign(std::strncmp(a.data(), b.data(), orderSize));
+
+        EncodedKey ka, kb;
+        if (alnum.encode(a.data(), &ka) && alnum.encode(b.data(), &kb)) {
+            nEncoded++;
+            int actual = alnum.isLess(ka, a.data(), kb, b.data())   ? -1
+                         : alnum.isLess(kb, b.data(), ka, a.data()) ? 1
+                                                                     : 0;
+            CHECK(actual == expected, "ALNUM, order size %d: %d instead of %d", orderSize,
+                  actual, expected);
+        }
+        bin.encode(a.data(), &ka);
+        bin.encode(b.data(), &kb);
+        int actual = bin.isLess(ka, a.data(), kb, b.data())   ? -1
+                     : bin.isLess(kb, b.data(), ka, a.data()) ? 1
+                                                               : 0;
+        CHECK(actual == expected, "BINARY, order size %d: %d instead of %d", orderSize, actual,
+              expected);
+    }
+    // Alphabet keys must always encode, and outside it some must not
+    CHECK(binary || nEncoded == 200000, "only %d of the alphabet pairs encoded", nEncoded);
+    CHECK(!binary || nEncoded < 200000, "every binary pair encoded with ALNUM");
+}
+
+/**
+ * @brief Keys with a null byte inside compare equal from that byte on, as with strncmp
+ */
+static void testEmbeddedNull() {
+    Config::get().RECORD_SIZE = 20;
+    Config::get().RECORD_KEY_SIZE = 16;
+    Config::get().DEDUP = DedupPolicy::KEY;
+    const char a[20] = {'a', 'b', 'c', '\0', 'z', 'z', 'z', 'z', 'z', 'z', 'z', 'z', 'z', 'z'};
+    const char b[20] = {'a', 'b', 'c', '\0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0'};
+    const char c[20] = {'a', 'b', 'c', '\1'};
+    for (auto mode : {KeyEncoder::Mode::ALNUM, KeyEncoder::Mode::BINARY}) {
+        KeyEncoder encoder;
+        encoder.setMode(mode);
+        EncodedKey ka, kb, kc;
+        CHECK(encoder.encode(a, &ka) && encoder.encode(b, &kb), "keys up to a null byte");
+        CHECK(!encoder.isLess(ka, a, kb, b) && !encoder.isLess(kb, b, ka, a),
+              "bytes after a null byte are compared");
+        if (encoder.encode(c, &kc)) {
+            CHECK(encoder.isLess(ka, a, kc, c), "a null byte does not come first");
+        } else {
+            CHECK(mode == KeyEncoder::Mode::ALNUM, "BINARY does not encode every key");
+        }
+    }
+}
+
+
+// =========================================================
+// ----------------- Fallback in the merge -----------------
+// =========================================================
+
+
+/**
+ * @brief Merge sorted runs whose later records are outside KEY_ALPHABET, so PackedLoserTree
+ * starts with ALNUM keys and switches to BINARY in the middle of the merge
+ */
+static void testMergeFallback(int recordSize, DedupPolicy dedup) {
+    Config::get().RECORD_SIZE = recordSize;
+    Config::get().RECORD_KEY_SIZE = 8;
+    Config::get().DEDUP = dedup;
+    Config::get().KEY_ENCODING = true;
+    const int orderSize = getOrderSize();
+    auto less = [orderSize](const std::string &a, const std::string &b) {
+        return std::strncmp(a.data(), b.data(), orderSize) < 0;
+    };
+
+    const int nRuns = 7, nRecords = 3000;
+    std::vector<std::vector<char>> runs(nRuns);
+    std::vector<std::string> all;
+    for (int r = 0; r < nRuns; r++) {
+        std::vector<std::string> records(nRecords, std::string(recordSize, '\0'));
+        for (int i = 0; i < nRecords; i++) {
+            // The first half in the alphabet, the rest binary from a random position on
+            randomRecord(&records[i][0], recordSize, false);
+            if (i >= nRecords / 2) {
+                int from = rng() % orderSize;
+                randomRecord(&records[i][from], recordSize - from, true);
+            }
+        }
+        std::stable_sort(records.begin(), records.end(), less);
+        for (auto &record : records) {
+            runs[r].insert(runs[r].end(), record.begin(), record.end());
+            all.push_back(record);
+        }
+    }
+    std::stable_sort(all.begin(), all.end(), less);
+
+    std::vector<PackedStream *> streams;
+    for (auto &run : runs) {
+        streams.push_back(new PackedStream(run.data(), nRecords));
+    }
+    PackedLoserTree tree(streams);
+    size_t i = 0;
+    for (const char *record = tree.peek(); record != nullptr; record = tree.peek(), i++) {
+        if (i >= all.size() || std::strncmp(record, all[i].data(), orderSize) != 0) {
+            CHECK(false, "order size %d: record %zu of the merge is out of order", orderSize, i);
+            break;
+        }
+        tree.pop();
+    }
+    CHECK(i == all.size(), "merged %zu records instead of %zu", i, all.size());
+    for (auto stream : streams) {
+        delete stream;
+    }
+}
+
+
+// =========================================================
+// -------------------- Fallback in a sort -----------------
+// =========================================================
+
+
+/**
+ * @brief Sort an input whose loads start with alphabet records and turn binary, so
+ * genPackedMiniRuns switches to BINARY in the middle of a load, and the merges of the runs in
+ * the middle of a merge
+ */
+static void testSortFallback(int recordSize, DedupPolicy dedup) {
+    SortConfig config;
+    config.tiers[0].capacity = 2 * 1024 * 1024;
+    config.cacheSize = 64 * 1024;
+    config.recordSize = recordSize;
+    config.recordKeySize = 8;
+    config.dedup = dedup;
+    config.keyEncoding = true;
+    config.runDir = "KeyEncoderTest_runs";
+    config.traceFile = "KeyEncoderTest.log";
+
+    const RowCount nRecords = 300000, loadSize = config.tiers[0].capacity / recordSize;
+    std::vector<char> input(nRecords * recordSize);
+    for (RowCount i = 0; i < nRecords; i++) {
+        char *record = &input[i * recordSize];
+        if (i % 10 == 0 && i > 0) {
+            // An exact duplicate, or a record equal up to a null byte
+            std::memcpy(record, record - recordSize, recordSize);
+            if (i % 20 == 0) { record[rng() % recordSize] = '\0'; }
+        } else {
+            randomRecord(record, recordSize, i % loadSize > loadSize / 2);
+        }
+    }
+    SortFiles files;
+    files.input = "KeyEncoderTest_input.txt";
+    files.output = "KeyEncoderTest_output.txt";
+    writeRecords(files.input, input);
+
+    Config::get().RECORD_SIZE = recordSize;
+    Config::get().RECORD_KEY_SIZE = 8;
+    Config::get().DEDUP = dedup;
+    std::vector<std::string> expected =
+        expectedOutput(input, recordSize, getOrderSize(), getDistinctSize());
+    const int orderSize = getOrderSize();
+
+    ExternalSorter sorter(config, files);
+    SortStats stats = sorter.run();
+    CHECK(stats.nRecords == nRecords, "sorted %lld records", (long long)stats.nRecords);
+    checkOutput(files.output, expected, recordSize, orderSize);
+    std::remove(files.input.c_str());
+    std::remove(files.output.c_str());
+}
+
+
+int main() {
+    for (bool binary : {false, true}) {
+        testIsLess(20, 8, DedupPolicy::KEY, binary);    // 8 bytes, one word with ALNUM
+        testIsLess(20, 16, DedupPolicy::KEY, binary);   // two words, exact with BINARY
+        testIsLess(20, 8, DedupPolicy::EXACT, binary);  // 20 bytes, exact with ALNUM only
+        testIsLess(50, 8, DedupPolicy::EXACT, binary);  // 50 bytes, ties go to strncmp
+        testIsLess(24, 24, DedupPolicy::NONE, binary);  // 24 bytes, ties go to strncmp
+    }
+    testEmbeddedNull();
+    testMergeFallback(20, DedupPolicy::EXACT);
+    testMergeFallback(50, DedupPolicy::EXACT);
+    testMergeFallback(20, DedupPolicy::KEY);
+    testSortFallback(20, DedupPolicy::EXACT);
+    testSortFallback(50, DedupPolicy::EXACT);
+    testSortFallback(32, DedupPolicy::KEY);
+    return finishTest("KeyEncoderTest");
+}
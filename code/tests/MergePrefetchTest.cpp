@@ -0,0 +1,121 @@
+#include "Losertree.h"
+#include "RunStreamer.h"
+#include "TestUtil.h"
+#include <chrono>
+
+
+/**
+ * @brief Microbenchmark of the prefetches of the merge leaves, see RunStreamer::prefetchNext().
+ * The records of the runs are allocated in random order, so every step along a run misses the
+ * cache, as in a merge of runs that were loaded and sorted in memory. The loser tree merges
+ * the runs with and without MERGE_PREFETCH, both merges must output every record in order,
+ * and the driver prints the time per record of each.
+ */
+
+
+static const int RECORD_SIZE = 128;
+static const int N_RUNS = 64;
+static const RowCount N_RECORDS = 600000; // about 100 MB with the nodes, beyond the caches
+static const int N_ROUNDS = 3;
+
+
+/**
+ * @brief Link the records of each run in order again, a merge unlinks nothing but consumes the
+ * runs' streamers
+ */
+static std::vector<RunStreamer *> makeStreamers(std::vector<std::vector<Record *>> &runRecords,
+                                                std::vector<Run *> &runs) {
+    std::vector<RunStreamer *> streamers;
+    for (size_t i = 0; i < runRecords.size(); i++) {
+        std::vector<Record *> &records = runRecords[i];
+        for (size_t j = 0; j + 1 < records.size(); j++) {
+            records[j]->next = records[j + 1];
+        }
+        records.back()->next = nullptr;
+        runs[i]->setHead(records.front());
+        streamers.push_back(new RunStreamer(StreamerType::INMEMORY_RUN, runs[i]));
+    }
+    return streamers;
+}
+
+
+/**
+ * @brief Merge the runs, check the order and return the seconds it took
+ */
+static double merge(std::vector<std::vector<Record *>> &runRecords, std::vector<Run *> &runs,
+                    bool prefetch) {
+    Config::get().MERGE_PREFETCH = prefetch;
+    std::vector<RunStreamer *> streamers = makeStreamers(runRecords, runs);
+    auto start = std::chrono::steady_clock::now();
+    LoserTree *tree = new LoserTree();
+    tree->constructTree(streamers);
+    RowCount nMerged = 0;
+    Record *previous = nullptr;
+    bool sorted = true;
+    for (Record *record = tree->getNext(); record != nullptr; record = tree->getNext()) {
+        sorted = sorted && (previous == nullptr || !(*record < *previous));
+        previous = record;
+        nMerged++;
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(sorted, "merge with prefetch %s is out of order", prefetch ? "on" : "off");
+    CHECK(nMerged == N_RECORDS, "merged %lld of %lld records", (long long)nMerged,
+          (long long)N_RECORDS);
+    // The exhausted leaves left the tree, so it deletes none of them
+    delete tree;
+    for (RunStreamer *streamer : streamers) {
+        delete streamer;
+    }
+    return seconds;
+}
+
+
+int main() {
+    Config::get().RECORD_SIZE = RECORD_SIZE;
+    Config::get().RECORD_KEY_SIZE = 8;
+    Config::get().DEDUP = DedupPolicy::NONE;
+
+    // Allocated in one order, linked in another
+    std::mt19937_64 rng(17);
+    std::vector<Record *> records(N_RECORDS);
+    for (auto &record : records) {
+        record = new Record();
+        for (int i = 0; i < RECORD_SIZE; i++) {
+            record->data[i] = 'a' + rng() % 26;
+        }
+    }
+    std::shuffle(records.begin(), records.end(), rng);
+    std::vector<std::vector<Record *>> runRecords(N_RUNS);
+    std::vector<Run *> runs;
+    for (int i = 0; i < N_RUNS; i++) {
+        auto begin = records.begin() + i * N_RECORDS / N_RUNS;
+        auto end = records.begin() + (i + 1) * N_RECORDS / N_RUNS;
+        runRecords[i].assign(begin, end);
+        std::sort(runRecords[i].begin(), runRecords[i].end(),
+                  [](Record *a, Record *b) { return *a < *b; });
+        runs.push_back(new Run(nullptr, 0));
+    }
+
+    // Alternate the two, so that neither one runs on a warmer machine
+    double best[2] = {1e9, 1e9};
+    for (int round = 0; round < N_ROUNDS; round++) {
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            best[prefetch] = std::min(best[prefetch], merge(runRecords, runs, prefetch == 1));
+        }
+    }
+    printf("Merge of %d runs, %lld records of %d bytes, best of %d rounds\n", N_RUNS,
+           (long long)N_RECORDS, RECORD_SIZE, N_ROUNDS);
+    printf("\tprefetch off: %.1lf ns per record\n", best[0] * 1e9 / N_RECORDS);
+    printf("\tprefetch on:  %.1lf ns per record\n", best[1] * 1e9 / N_RECORDS);
+    fprintf(stderr, "MergePrefetchTest: prefetch off %.1lf ns, on %.1lf ns per record\n",
+            best[0] * 1e9 / N_RECORDS, best[1] * 1e9 / N_RECORDS);
+
+    for (Run *run : runs) {
+        delete run; // holds no records, they are deleted below
+    }
+    for (Record *record : records) {
+        delete record;
+    }
+    return finishTest("MergePrefetchTest");
+}
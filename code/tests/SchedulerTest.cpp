@@ -0,0 +1,193 @@
+#include "Scheduler.h"
+#include "TestUtil.h"
+#include <map>
+
+
+/**
+ * @brief More jobs than slots share a tight memory and staging budget: a job waits until a
+ * running one has finished, a job that enters the merge phase gives up memory to the jobs
+ * still generating runs, every output is sorted, and a job that fails does not hold up the
+ * jobs queued behind it. The quotas of the running jobs never add up to more than the budgets.
+ */
+
+
+static std::mt19937_64 rng(13);
+
+static const int MB = 1024 * 1024;
+static const int RECORD_SIZE = 100;
+static const int KEY_SIZE = 8;
+
+
+static TierSpec makeTier(const std::string &name, ByteCount capacity, int bandwidth,
+                         double latency) {
+    TierSpec tier;
+    tier.name = name;
+    tier.capacity = capacity;
+    tier.bandwidth = bandwidth;
+    tier.latency = latency;
+    return tier;
+}
+
+
+/**
+ * @brief The lines of a trace with the given text
+ */
+static std::vector<std::string> grepTrace(const std::string &traceFile,
+                                          const std::string &text) {
+    std::vector<std::string> lines;
+    std::ifstream trace(traceFile);
+    std::string line;
+    while (getline(trace, line)) {
+        if (line.find(text) != std::string::npos) { lines.push_back(line); }
+    }
+    return lines;
+}
+
+
+/**
+ * @brief Quota of a job, in MB as the scheduler traces it
+ */
+struct Quota {
+    long long memory = 0;
+    long long staging = 0;
+};
+
+
+int main() {
+    // The scheduler traces admissions to the trace of the default context
+    Config::get().TRACE_FILE = "SchedulerTest.log";
+    std::remove(Config::get().TRACE_FILE.c_str());
+
+    SchedulerConfig schedulerConfig;
+    schedulerConfig.memoryBudget = 12 * MB;
+    schedulerConfig.stagingBudget = 48 * MB;
+    schedulerConfig.maxJobs = 2;
+    SortScheduler scheduler(schedulerConfig);
+
+    // Job 1 fails on its missing input, jobs 2 to 4 wait for it and for job 0
+    const std::vector<RowCount> nRecords = {120000, 0, 90000, 150000, 120000};
+    const int failingJob = 1;
+    std::vector<SortFiles> files(nRecords.size());
+    std::vector<std::string> traces(nRecords.size());
+    std::vector<std::vector<std::string>> expected(nRecords.size());
+    for (size_t i = 0; i < nRecords.size(); i++) {
+        std::string name = "SchedulerTest_job" + std::to_string(i);
+        SortConfig config;
+        config.tiers = {makeTier("DRAM", INFINITE_CAPACITY, 100 * MB, 0.000001),
+                        makeTier("SSD", INFINITE_CAPACITY, 200 * MB, 0.0001),
+                        makeTier("HDD", INFINITE_CAPACITY, 100 * MB, 0.005)};
+        config.recordSize = RECORD_SIZE;
+        config.recordKeySize = KEY_SIZE;
+        config.dedup = DedupPolicy::NONE;
+        config.tagSort = false;
+        config.runDir = name + "_runs";
+        config.traceFile = name + ".log";
+        traces[i] = config.traceFile;
+        files[i].input = name + "_input.txt";
+        files[i].output = name + "_output.txt";
+        std::remove(files[i].input.c_str());
+
+        if ((int)i != failingJob) {
+            std::vector<char> input(nRecords[i] * RECORD_SIZE);
+            for (auto &c : input) {
+                c = 'a' + rng() % 26;
+            }
+            writeRecords(files[i].input, input);
+            expected[i] = expectedOutput(input, RECORD_SIZE, KEY_SIZE, 0);
+        }
+        CHECK(scheduler.submit(config, files[i]) == (int)i, "job %zu got another id", i);
+    }
+
+    std::vector<SortStats> stats = scheduler.run();
+    scheduler.print();
+    flushvv();
+
+    // Every job but the failing one sorted its input
+    CHECK(stats.size() == nRecords.size(), "%zu results for %zu jobs", stats.size(),
+          nRecords.size());
+    for (size_t i = 0; i < stats.size() && i < nRecords.size(); i++) {
+        if ((int)i == failingJob) {
+            CHECK(stats[i].nRecords == 0, "the failing job sorted %lld records",
+                  (long long)stats[i].nRecords);
+            continue;
+        }
+        CHECK(stats[i].nRecords == nRecords[i], "job %zu sorted %lld records instead of %lld", i,
+              (long long)stats[i].nRecords, (long long)nRecords[i]);
+        checkOutput(files[i].output, expected[i], RECORD_SIZE, KEY_SIZE);
+    }
+
+    // The quotas of the jobs running side by side never add up to more than the budgets
+    CHECK(scheduler.getPeakMemory() <= schedulerConfig.memoryBudget,
+          "memory quotas of %lld bytes beyond the budget", (long long)scheduler.getPeakMemory());
+    CHECK(scheduler.getPeakStaging() <= schedulerConfig.stagingBudget,
+          "staging quotas of %lld bytes beyond the budget", (long long)scheduler.getPeakStaging());
+    CHECK(scheduler.getPeakMemory() > 0 && scheduler.getPeakStaging() > 0, "no quotas granted");
+
+    // Admissions: never more jobs than slots or quotas beyond the budgets, and a job waits
+    // for a running one to finish
+    std::map<int, Quota> quotas; // at admission
+    int nRunning = 0;
+    int nWaited = 0;
+    int nFinished = 0;
+    bool failureReported = false;
+    for (const std::string &line : grepTrace(Config::get().TRACE_FILE, "SCHEDULER: ")) {
+        int id = 0;
+        Quota quota;
+        size_t at = line.find("SCHEDULER: ");
+        if (sscanf(line.c_str() + at, "SCHEDULER: started job %d (%*[^)]), memory %lld MB, "
+                                      "staging %lld MB",
+                   &id, &quota.memory, &quota.staging) == 3) {
+            quotas[id] = quota;
+            nRunning++;
+            nWaited += nFinished > 0;
+            CHECK(nRunning <= schedulerConfig.maxJobs, "%d jobs running: %s", nRunning,
+                  line.c_str());
+            CHECK(quota.memory <= (long long)BYTE_TO_MB(schedulerConfig.memoryBudget) &&
+                      quota.staging <= (long long)BYTE_TO_MB(schedulerConfig.stagingBudget),
+                  "quota beyond the budget: %s", line.c_str());
+        } else if (sscanf(line.c_str() + at, "SCHEDULER: finished job %d", &id) == 1) {
+            nRunning--;
+            nFinished++;
+            failureReported = failureReported ||
+                              (id == failingJob && line.find("ERROR") != std::string::npos);
+        }
+    }
+    CHECK(quotas.size() == nRecords.size(), "%zu of %zu jobs started", quotas.size(),
+          nRecords.size());
+    CHECK(nWaited >= (int)nRecords.size() - schedulerConfig.maxJobs,
+          "%d jobs started after another one finished", nWaited);
+    CHECK(failureReported, "the failure of job %d is not in %s", failingJob,
+          Config::get().TRACE_FILE.c_str());
+
+    // Quotas: a job entering the merge phase hands memory to the jobs generating runs
+    int nShrunk = 0;
+    for (size_t i = 0; i < traces.size(); i++) {
+        if ((int)i == failingJob || quotas.count(i) == 0) { continue; }
+        Quota quota = quotas[i];
+        bool merging = false;
+        for (const std::string &line : grepTrace(traces[i], "SCHEDULER: job ")) {
+            int id = 0;
+            char phase[32];
+            Quota next;
+            size_t at = line.find("SCHEDULER: ");
+            if (sscanf(line.c_str() + at,
+                       "SCHEDULER: job %d in %31s memory %lld MB, staging %lld MB", &id, phase,
+                       &next.memory, &next.staging) != 4) {
+                continue;
+            }
+            CHECK(id == (int)i, "job %d traced to %s", id, traces[i].c_str());
+            if (!merging && std::string(phase) == "MERGE,") {
+                merging = true;
+                nShrunk += next.memory < quota.memory;
+            }
+            quota = next;
+        }
+    }
+    CHECK(nShrunk > 0, "no job gave up memory when it started merging");
+
+    for (size_t i = 0; i < files.size(); i++) {
+        std::remove(files[i].input.c_str());
+        std::remove(files[i].output.c_str());
+    }
+    return finishTest("SchedulerTest");
+}
@@ -0,0 +1,122 @@
+#include "TestUtil.h"
+#include <sstream>
+
+
+/**
+ * @brief Every tier on the spill chain holds runs: with intermediate tiers between the staging
+ * and the final tier, the merged runs of the first pass fill the staging tier, then each
+ * intermediate tier in turn, and the rest goes to the final tier. A tier too full for a spill
+ * passes it through to the tier below it. The merges read the runs of every tier.
+ */
+
+
+static std::mt19937_64 rng(7);
+
+
+static TierSpec makeTier(const std::string &name, ByteCount capacity, int bandwidth,
+                         double latency) {
+    TierSpec tier;
+    tier.name = name;
+    tier.capacity = capacity;
+    tier.bandwidth = bandwidth;
+    tier.latency = latency;
+    return tier;
+}
+
+
+/**
+ * @brief The run files per tier at the start of the merge phase, from the MERGE_ITR line of
+ * the trace
+ */
+static std::string getRunLayout(const std::string &traceFile) {
+    std::ifstream trace(traceFile);
+    std::string line;
+    while (getline(trace, line)) {
+        size_t at = line.find("MERGE_ITR 0: ");
+        if (at != std::string::npos) { return line.substr(at + 13); }
+    }
+    return "";
+}
+
+static int getRunCount(const std::string &layout, const std::string &tierName) {
+    std::istringstream is(layout);
+    std::string entry;
+    while (getline(is, entry, ',')) {
+        int nRuns = 0;
+        char name[64];
+        if (sscanf(entry.c_str(), " %d runfiles in %63s", &nRuns, name) == 2 &&
+            tierName == name) {
+            return nRuns;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Sort through DRAM, SSD, the given intermediate tiers and HDD, and check the output and
+ * that each intermediate tier holds the expected runs when the merge phase starts
+ * @param minRuns per intermediate tier, the runs it holds at least, or exactly 0 if it is 0
+ */
+static void testChain(const std::vector<TierSpec> &intermediates, const std::vector<int> &minRuns,
+                      int recordSize, RowCount nRecords, DedupPolicy dedup) {
+    const int mb = 1024 * 1024;
+    SortConfig config;
+    config.tiers = {makeTier("DRAM", 2 * mb, 100 * mb, 0.000001),
+                    makeTier("SSD", 20 * mb, 200 * mb, 0.0001)};
+    config.tiers.insert(config.tiers.end(), intermediates.begin(), intermediates.end());
+    config.tiers.push_back(makeTier("HDD", INFINITE_CAPACITY, 100 * mb, 0.005));
+    config.recordSize = recordSize;
+    config.recordKeySize = 8;
+    config.dedup = dedup;
+    config.tagSort = false;
+    config.runDir = "SpillChainTest_runs";
+    config.traceFile = "SpillChainTest.log";
+
+    std::vector<char> input(nRecords * recordSize);
+    for (auto &c : input) {
+        c = 'a' + rng() % 26;
+    }
+    SortFiles files;
+    files.input = "SpillChainTest_input.txt";
+    files.output = "SpillChainTest_output.txt";
+    writeRecords(files.input, input);
+
+    Config::get().RECORD_SIZE = recordSize;
+    Config::get().RECORD_KEY_SIZE = 8;
+    Config::get().DEDUP = dedup;
+    std::vector<std::string> expected =
+        expectedOutput(input, recordSize, getOrderSize(), getDistinctSize());
+
+    ExternalSorter sorter(config, files);
+    SortStats stats = sorter.run();
+    CHECK(stats.nRecords == nRecords, "sorted %lld records", (long long)stats.nRecords);
+    checkOutput(files.output, expected, recordSize, getOrderSize());
+
+    std::string layout = getRunLayout(config.traceFile);
+    CHECK(!layout.empty(), "no merge phase in %s", config.traceFile.c_str());
+    printf("Runs at the start of the merge phase: %s\n", layout.c_str());
+    for (size_t i = 0; i < intermediates.size(); i++) {
+        int nRuns = getRunCount(layout, intermediates[i].name);
+        CHECK(minRuns[i] == 0 ? nRuns == 0 : nRuns >= minRuns[i], "%d runs in %s: %s", nRuns,
+              intermediates[i].name.c_str(), layout.c_str());
+    }
+    std::remove(files.input.c_str());
+    std::remove(files.output.c_str());
+}
+
+
+int main() {
+    const int mb = 1024 * 1024;
+    TierSpec nvme = makeTier("NVME", 30 * mb, 150 * mb, 0.001);
+    TierSpec cloud = makeTier("CLOUD", 40 * mb, 120 * mb, 0.002);
+    TierSpec tiny = makeTier("TINY", 5 * mb, 150 * mb, 0.001);
+
+    // Two intermediate tiers, both fill up before the final tier takes runs
+    testChain({nvme, cloud}, {1, 1}, 1000, 300000, DedupPolicy::NONE);
+    // The same on the packed path, with duplicates dropped by every merge
+    testChain({nvme, cloud}, {1, 1}, 20, 3000000, DedupPolicy::EXACT);
+    // An intermediate tier smaller than the merged runs passes them all through
+    testChain({tiny}, {0}, 1000, 400000, DedupPolicy::KEY);
+    return finishTest("SpillChainTest");
+}
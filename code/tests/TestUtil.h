@@ -0,0 +1,115 @@
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+
+
+#include "ExternalSorter.h"
+#include "Record.h"
+#include "config.h"
+#include "defs.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// =========================================================
+// ------------------------- Checks ------------------------
+// =========================================================
+
+
+/**
+ * @brief Failed checks of the test driver, main returns non-zero if there are any
+ */
+static int nFailedChecks = 0;
+
+#define CHECK(condition, ...)                                                                     \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            fprintf(stderr, "FAILED %s:%d: %s: ", __FILE__, __LINE__, #condition);                \
+            fprintf(stderr, __VA_ARGS__);                                                         \
+            fprintf(stderr, "\n");                                                                \
+            nFailedChecks++;                                                                      \
+        }                                                                                         \
+    } while (0)
+
+/**
+ * @brief Report the result of the driver, as its exit status. The sort traces to stdout, so
+ * the result goes to stderr.
+ */
+inline int finishTest(const char *name) {
+    if (nFailedChecks > 0) {
+        fprintf(stderr, "%s: %d checks FAILED\n", name, nFailedChecks);
+        return 1;
+    }
+    fprintf(stderr, "%s: SUCCESS\n", name);
+    return 0;
+}
+
+
+// =========================================================
+// ------------------------ Records ------------------------
+// =========================================================
+
+
+/**
+ * @brief Write records stored back to back to a file, the input of a sort
+ */
+inline void writeRecords(const std::string &fileName, const std::vector<char> &records) {
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    file.write(records.data(), records.size());
+}
+
+inline std::vector<char> readRecords(const std::string &fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file),
+                             std::istreambuf_iterator<char>());
+}
+
+/**
+ * @brief What a sort outputs for the input: the records ordered by strncmp over the order
+ * size, with the ones absorbed by the record before them dropped, see absorbRecord()
+ */
+inline std::vector<std::string> expectedOutput(const std::vector<char> &input, int recordSize,
+                                               int orderSize, int distinctSize) {
+    std::vector<std::string> records;
+    for (size_t i = 0; i + recordSize <= input.size(); i += recordSize) {
+        records.push_back(std::string(&input[i], recordSize));
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [orderSize](const std::string &a, const std::string &b) {
+                         return std::strncmp(a.data(), b.data(), orderSize) < 0;
+                     });
+    if (distinctSize == 0) { return records; }
+    std::vector<std::string> kept;
+    for (auto &record : records) {
+        if (kept.empty() ||
+            std::strncmp(kept.back().data(), record.data(), distinctSize) != 0) {
+            kept.push_back(record);
+        }
+    }
+    return kept;
+}
+
+/**
+ * @brief Check that a sort's output file holds the expected records, compared over the order
+ * size as the sort only orders by it
+ */
+inline void checkOutput(const std::string &outputFile, const std::vector<std::string> &expected,
+                        int recordSize, int orderSize) {
+    std::vector<char> output = readRecords(outputFile);
+    CHECK(output.size() == expected.size() * recordSize, "%s: %zu records instead of %zu",
+          outputFile.c_str(), output.size() / recordSize, expected.size());
+    size_t n = std::min(output.size() / recordSize, expected.size());
+    for (size_t i = 0; i < n; i++) {
+        if (std::strncmp(&output[i * recordSize], expected[i].data(), orderSize) != 0) {
+            CHECK(false, "%s: record %zu differs from the expected one", outputFile.c_str(), i);
+            return;
+        }
+    }
+}
+
+
+#endif // _TEST_UTIL_H_
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+
+# Clean and make the project
+cd /mnt/nvme/project/code
+make clean
+make
+
+# Create the test directory
+cd /mnt/nvme
+mkdir -p filtertests
+cd filtertests
+
+# Remove old files
+rm ./input*
+rm ./output*
+rm ./trace*
+rm ./ExternalSort.exe
+
+# Copy the executable to the test directory
+cp /mnt/nvme/project/code/ExternalSort.exe .
+
+# Each run verifies the order, that the output holds input records, that every output record
+# matches the filter and that NUM_RECORDS_FILTERED counts the input records that do not
+failed=0
+run() {
+    trace=$1
+    shift
+    ./ExternalSort.exe -v -o $trace "$@"
+    if ! grep -q "SUCCESS: Filter verified" $trace || ! grep -q "SUCCESS: Order verified" $trace; then
+        echo "FAILED: $trace"
+        failed=1
+    fi
+}
+
+# Filter pushed down into DRAM::loadInput, for Record lists and for flat arrays
+run trace-key-c200000-s1000 -c 200000 -s 1000 --filter B m
+run trace-pattern-c200000-s1000 -c 200000 -s 1000 --filter - - --filter-pattern 20 a
+run trace-key-c1000000-s20 -c 1000000 -s 20 --filter 5 Z
+run trace-empty-c10000-s1024 -c 10000 -s 1024 --filter - 0
+
+# Filter pushed down into TagSortIterator, applied while writing the tags
+run trace-tags-c200000-s1000 -c 200000 -s 1000 --tag-sort --filter - K --filter-pattern 20 a
+run trace-tags-c100000-s1024 -c 100000 -s 1024 --tag-sort --filter a z
+
+exit $failed